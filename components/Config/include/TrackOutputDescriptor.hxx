@@ -29,6 +29,22 @@ namespace esp32cs
   static constexpr const char *DCC_BOOLEAN_MAP =
       "<relation><property>0</property><value>Disabled</value></relation>"
       "<relation><property>1</property><value>Enabled</value></relation>";
+
+  /// <map> of possible keys and descriptive values to show to the user for
+  /// the EMC spectrum spreading field below.
+  static constexpr const char *DCC_EMC_SPREAD_MAP =
+      "<relation><property>0</property><value>Disabled</value></relation>"
+      "<relation><property>1</property><value>Sawtooth</value></relation>"
+      "<relation><property>2</property><value>Pseudo-random</value></relation>";
+
+#if CONFIG_DCC_RMT_EMC_SPREAD
+  /// Default EMC spectrum spreading pattern.
+  static constexpr uint8_t DCC_EMC_SPREAD_DEFAULT = 1;
+#else
+  /// Default EMC spectrum spreading pattern.
+  static constexpr uint8_t DCC_EMC_SPREAD_DEFAULT = 0;
+#endif // CONFIG_DCC_RMT_EMC_SPREAD
+
   /// DCC output behavior
   CDI_GROUP(AdvancedDCCConfig)
   CDI_GROUP_ENTRY(ops_preamble_bits, openlcb::Uint8ConfigEntry,
@@ -57,6 +73,15 @@ enabled).)!^!"),
                   Min(0), Max(1),
                   Default(1), /* On */
                   MapValues(DCC_BOOLEAN_MAP));
+  CDI_GROUP_ENTRY(emc_spread, openlcb::Uint8ConfigEntry,
+                  Name("EMC spectrum spreading"),
+                  Description(
+R"!^!(Adjusts the DCC bit times by a small amount, within the NMRA S-9.1 limits,
+to spread out the pulse widths and reduce the peak EMC emissions. This is
+useful on larger layouts with long track runs.)!^!"),
+                  Min(0), Max(2),
+                  Default(DCC_EMC_SPREAD_DEFAULT),
+                  MapValues(DCC_EMC_SPREAD_MAP));
   CDI_GROUP_END();
 
   /// Track output configuration
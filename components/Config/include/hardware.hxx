@@ -683,8 +683,21 @@ struct DccHwDefs
   static constexpr uint32_t DCC_SERVICE_MODE_PREAMBLE_BITS =
     CONFIG_PROG_DCC_PREAMBLE_BITS;
 
+#if CONFIG_RAILCOM_CUT_OUT_ENABLED
+  /// Number of microseconds of the RailCom cut-out before the channel 1
+  /// window starts, the cut-out overlaps the next preamble and the preamble
+  /// is extended to cover this.
+  static constexpr uint32_t RAILCOM_CUTOUT_START_USEC =
+    RailComHwDefs::RAILCOM_START_PHASE1_DELAY_USEC +
+    RailComHwDefs::RAILCOM_START_PHASE2_DELAY_USEC;
+#else
+  /// Number of microseconds of the RailCom cut-out before the channel 1
+  /// window starts, zero when the cut-out is disabled.
+  static constexpr uint32_t RAILCOM_CUTOUT_START_USEC = 0;
+#endif // CONFIG_RAILCOM_CUT_OUT_ENABLED
+
   /// Number of RMT ticks for each half of the RMT encoded ZERO bit.
-  static constexpr uint8_t DCC_ZERO_RMT_TICKS =
+  static constexpr uint16_t DCC_ZERO_RMT_TICKS =
     CONFIG_DCC_RMT_TICKS_ZERO_PULSE;
 
   /// Number of RMT ticks for each half of the RMT encoded ONE bit.
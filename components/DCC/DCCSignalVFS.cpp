@@ -12,14 +12,18 @@
 #if CONFIG_RAILCOM_CUT_OUT_ENABLED
 #include "Esp32RailComDriver.hxx"
 #endif 
-#include "PrioritizedUpdateLoop.hxx"
+#include "DCCSignalVFS.hxx"
+#include "DccDistrict.hxx"
+#include "DistrictRouter.hxx"
+#include "RailComFeedbackCache.hxx"
+#include "RailComPomEngine.hxx"
 #include "TrackOutputDescriptor.hxx"
 #include "TrackPowerHandler.hxx"
 
 #include <AccessoryDecoderDatabase.hxx>
+#include <atomic>
 #include <locomgr/LocoManager.hxx>
 #include <dcc/DccOutput.hxx>
-#include <dcc/LocalTrackIf.hxx>
 #include <dcc/ProgrammingTrackBackend.hxx>
 #include <dcc/RailCom.hxx>
 #include <dcc/RailcomHub.hxx>
@@ -29,9 +33,7 @@
 #include <driver/rmt.h>
 #include <driver/timer.h>
 #include <driver/uart.h>
-#include <esp_vfs.h>
 #include <EventBroadcastHelper.hxx>
-#include <executor/PoolToQueueFlow.hxx>
 #include <freertos_drivers/arduino/DummyGPIO.hxx>
 #include <freertos_drivers/esp32/Esp32Gpio.hxx>
 #include <map>
@@ -40,13 +42,14 @@
 #include <openlcb/Node.hxx>
 #include <openlcb/RefreshLoop.hxx>
 #include <os/Gpio.hxx>
-#include <RMTTrackDevice.hxx>
 #include <soc/rtc_cntl_reg.h>
 #include <StatusDisplay.hxx>
+#include <utils/StringPrintf.hxx>
 #include <utils/StringUtils.hxx>
 #include <UlpAdc.hxx>
 #include <utils/GpioInitializer.hxx>
 #include <utils/logging.h>
+#include <vector>
 
 namespace esp32cs
 {
@@ -59,6 +62,7 @@ static void enable_programming_track()
     DccOutput::DisableReason::PGM_TRACK_LOCKOUT);
   DccHwDefs::OpenLCBBoosterOutput::set_disable_reason(
     DccOutput::DisableReason::PGM_TRACK_LOCKOUT);
+  track_state_changed();
 
   PROG_ENABLE_Pin::set(true);
 }
@@ -72,9 +76,12 @@ static void disable_programming_track()
     DccOutput::DisableReason::PGM_TRACK_LOCKOUT);
   DccHwDefs::OpenLCBBoosterOutput::clear_disable_reason(
     DccOutput::DisableReason::PGM_TRACK_LOCKOUT);
+  track_state_changed();
 }
 #endif // CONFIG_PROG_TRACK_ENABLED
 
+static void set_district_estop(bool active);
+
 class EStopPacketSource : public dcc::NonTrainPacketSource,
                           public openlcb::BitEventInterface
 {
@@ -118,15 +125,22 @@ public:
     if (new_value)
     {
       LOG(INFO, "[eStop] Received eStop request, sending eStop to all trains.");
-      Singleton<locomgr::LocoManager>::instance()->estop_all_trains();
+      // take over the update loops first so that no further locomotive
+      // packets are generated, then flush the pending packets from the
+      // signal generators in favor of broadcast e-stop packets. The train
+      // state is updated last as it requires visiting every train.
       packet_processor_add_refresh_source(this, dcc::UpdateLoopBase::ESTOP_PRIORITY);
+      set_district_estop(true);
+      Singleton<locomgr::LocoManager>::instance()->estop_all_trains();
     }
     else
     {
       LOG(INFO, "[eStop] Received eStop clear request.");
       packet_processor_remove_refresh_source(this);
+      set_district_estop(false);
     }
     enabled_ = new_value;
+    track_state_changed();
   }
 
   openlcb::Node *node()
@@ -149,14 +163,39 @@ static uninitialized<dcc::RailcomHubFlow> railcom_hub;
 #if CONFIG_RAILCOM_DUMP_PACKETS
 static uninitialized<dcc::RailcomPrintfFlow> railcom_dumper;
 #endif // CONFIG_RAILCOM_DUMP_PACKETS
+#if CONFIG_RAILCOM_DATA_ENABLED
+static uninitialized<esp32cs::RailComFeedbackCache> railcom_cache;
+static uninitialized<esp32cs::RailComPomEngine> railcom_pom;
+#endif // CONFIG_RAILCOM_DATA_ENABLED
 static esp32cs::Esp32RailComDriver<RailComHwDefs, DccHwDefs::InternalBoosterOutput, DccHwDefs::OpenLCBBoosterOutput> railComDriver;
 #else
 static NoRailcomDriver railComDriver;
 #endif // CONFIG_RAILCOM_CUT_OUT_ENABLED
-static esp32cs::RMTTrackDevice<DccHwDefs, DccHwDefs::InternalBoosterOutput, DccHwDefs::OpenLCBBoosterOutput> track(&railComDriver);
-static uninitialized<dcc::LocalTrackIf> track_interface;
-static uninitialized<esp32cs::PrioritizedUpdateLoop> track_update_loop;
-static uninitialized<PoolToQueueFlow<Buffer<dcc::Packet>>> track_flow;
+static esp32cs::DccDistrict<DccHwDefs, DccHwDefs::InternalBoosterOutput, DccHwDefs::OpenLCBBoosterOutput> ops_district(0, &railComDriver);
+static esp32cs::DccDistrictBase * const districts[] =
+{
+  &ops_district,
+};
+static uninitialized<esp32cs::DistrictRouter> district_router;
+
+/// Sets or clears the emergency stop state of all districts.
+///
+/// @param active is true to send a broadcast e-stop ahead of all pending
+/// packets, false to clear the e-stop state.
+static void set_district_estop(bool active)
+{
+  for (auto district : districts)
+  {
+    if (active)
+    {
+      district->emergency_stop();
+    }
+    else
+    {
+      district->clear_emergency_stop();
+    }
+  }
+}
 static uninitialized<TrackPowerBit<DccHwDefs::InternalBoosterOutput, DccHwDefs::OpenLCBBoosterOutput>> track_power;
 static uninitialized<openlcb::BitEventConsumer> track_power_consumer;
 static uninitialized<EStopPacketSource> estop_packet_source;
@@ -167,6 +206,101 @@ static uninitialized<ProgrammingTrackBackend> prog_backend;
 static uninitialized<esp32cs::AccessoryDecoderDB> accessory_db;
 
 #if CONFIG_OPS_TRACK_ENABLED
+DECLARE_CONST(ops_trip_retry_min_ms);
+DECLARE_CONST(ops_trip_retry_max_ms);
+DECLARE_CONST(ops_trip_stable_ms);
+
+/// Re-enables the OPS track output after it has been tripped by the ULP.
+///
+/// The first retry happens after ops_trip_retry_min_ms, if the track trips
+/// again within ops_trip_stable_ms of a retry the delay is doubled for the
+/// next retry (up to ops_trip_retry_max_ms).
+class OpsTripRecoveryFlow : public StateFlowBase
+{
+public:
+  /// Constructor.
+  ///
+  /// @param service is the @ref Service to execute this flow on.
+  OpsTripRecoveryFlow(Service *service) : StateFlowBase(service)
+  {
+    start_flow(STATE(wait_for_trip));
+  }
+
+  /// Wakes up the flow when the OPS track has been tripped.
+  ///
+  /// NOTE: this is called from the ULP wake-up ISR context.
+  void trip_from_isr()
+  {
+    if (waiting_.exchange(false))
+    {
+      notify_from_isr();
+    }
+  }
+
+private:
+  /// Timer used for the retry delay.
+  StateFlowTimer timer_{this};
+
+  /// True while the flow is waiting for a trip.
+  std::atomic<bool> waiting_{false};
+
+  /// Time of the most recent retry, zero if the track has not been retried.
+  long long lastRetry_{0};
+
+  /// Delay before the next retry.
+  uint32_t retryDelayMs_{0};
+
+  /// Waits for the ULP to trip the OPS track.
+  Action wait_for_trip()
+  {
+    waiting_.store(true);
+    return wait_and_call(STATE(tripped));
+  }
+
+  /// Calculates the retry delay and waits for it to expire.
+  Action tripped()
+  {
+    if (lastRetry_ && (os_get_time_monotonic() - lastRetry_) <
+          MSEC_TO_NSEC(config_ops_trip_stable_ms()))
+    {
+      retryDelayMs_ =
+        std::min<uint32_t>(retryDelayMs_ << 1,
+                           config_ops_trip_retry_max_ms());
+    }
+    else
+    {
+      retryDelayMs_ = config_ops_trip_retry_min_ms();
+    }
+    LOG(WARNING, "[Track] OPS %s trip, retrying in %d ms",
+        esp32cs::get_ops_trip_reason() == esp32cs::UlpTripReason::INSTANT ?
+          "instant" : "sustained",
+        retryDelayMs_);
+    return sleep_and_call(&timer_, MSEC_TO_NSEC(retryDelayMs_),
+                          STATE(retry));
+  }
+
+  /// Re-enables the OPS track output.
+  Action retry()
+  {
+    lastRetry_ = os_get_time_monotonic();
+    // the flow must be waiting before the ULP is re-armed, the track may
+    // trip again as soon as the output is re-enabled.
+    waiting_.store(true);
+    esp32cs::clear_ops_trip();
+    DccHwDefs::InternalBoosterOutput::clear_disable_reason(
+      DccOutput::DisableReason::SHORTED);
+    track_state_changed();
+    return wait_and_call(STATE(tripped));
+  }
+};
+
+static uninitialized<OpsTripRecoveryFlow> ops_trip_recovery;
+
+/// Monitors the state of the OPS track output and reports changes via the
+/// status display, OpenLCB events and the track status listener.
+///
+/// The flow only runs when it is notified of a possible state change (see
+/// @ref trigger and @ref trigger_from_isr), there is no periodic polling.
 class TrackMonitorFlow : public StateFlowBase, public DefaultConfigUpdateListener
 {
 public:
@@ -175,7 +309,7 @@ public:
   {
     auto status = Singleton<StatusDisplay>::instance();
     status->track_power("Track: Off");
-    start_flow(STATE(sleep));
+    start_flow(STATE(update));
   }
 
   UpdateAction apply_configuration(int fd, bool initial_load,
@@ -184,6 +318,11 @@ public:
     AutoNotify n(done);
     shortEvent_ = cfg_.event_short().read(fd);
     shutdownEvent_ = cfg_.event_shutdown().read(fd);
+    uint8_t spread = CDI_READ_TRIM_DEFAULT(cfg_.advanced().emc_spread, fd);
+    for (auto district : districts)
+    {
+      district->set_emc_spread(static_cast<esp32cs::DccEmcSpread>(spread));
+    }
     return UPDATED;
   }
 
@@ -195,122 +334,228 @@ public:
     CDI_FACTORY_RESET(cfg_.advanced().enable_railcom_receiver);
     CDI_FACTORY_RESET(cfg_.advanced().ops_preamble_bits);
     CDI_FACTORY_RESET(cfg_.advanced().prog_preamble_bits);
+    CDI_FACTORY_RESET(cfg_.advanced().emc_spread);
+  }
+
+  /// Requests the OPS track state to be re-evaluated.
+  void trigger()
+  {
+    if (waiting_.exchange(false))
+    {
+      notify();
+    }
+  }
+
+  /// Requests the OPS track state to be re-evaluated.
+  ///
+  /// NOTE: this is called from the ULP wake-up ISR context.
+  void trigger_from_isr()
+  {
+    if (waiting_.exchange(false))
+    {
+      notify_from_isr();
+    }
+  }
+
+  /// @return JSON object describing the OPS track state.
+  std::string status_json()
+  {
+    return StringPrintf(R"!^!({"track":"%s","usage":%d,"warning":%s})!^!",
+                        state_name(state_.load()), esp32cs::get_ops_load(),
+                        state_.load() == TrackState::OVERLOAD ? "true" : "false");
+  }
+
+  /// Registers the listener for state changes.
+  ///
+  /// @param listener is invoked on the executor with the JSON status (see
+  /// @ref status_json) after each state change.
+  void set_listener(std::function<void(const std::string &)> listener)
+  {
+    listener_ = std::move(listener);
   }
 
 private:
-  StateFlowTimer timer_{this};
+  /// States of the OPS track output.
+  enum class TrackState : uint8_t
+  {
+    /// Track output is disabled.
+    OFF,
+
+    /// Track output is enabled and the current is within limits.
+    ON,
+
+    /// Track output is enabled and the current is above the warning
+    /// threshold.
+    OVERLOAD,
+
+    /// Track output has been disabled by a short circuit (or overload).
+    SHORTED,
+
+    /// Emergency stop is active.
+    ESTOP,
+  };
+
   TrackOutputConfig cfg_;
   openlcb::EventId shortEvent_;
   openlcb::EventId shutdownEvent_;
-  static constexpr uint64_t INTERVAL = SEC_TO_NSEC(15);
 
-  Action check()
-  {
-    auto status = Singleton<StatusDisplay>::instance();
-    uint16_t last_reading = esp32cs::get_last_ops_reading();
-    uint16_t short_limit = esp32cs::get_ops_short_threshold();
-    uint16_t shutdown_limit = esp32cs::get_ops_shutdown_threshold();
-    uint16_t warn_limit = esp32cs::get_ops_warning_threshold();
-    uint8_t disable_reason =
-      DccHwDefs::InternalBoosterOutput::outputDisableReasons_;
-    bool was_shorted =
-      (disable_reason & (uint8_t)DccOutput::DisableReason::SHORTED);
+  /// True while the flow is waiting for a trigger.
+  std::atomic<bool> waiting_{false};
+
+  /// Most recently reported state.
+  std::atomic<TrackState> state_{TrackState::OFF};
 
-    // If the last reading is under the short limit and the output is diabled
-    // due to the short condition, clear it.
-    if (was_shorted && last_reading < short_limit)
+  /// Listener for state changes.
+  std::function<void(const std::string &)> listener_;
+
+  /// @return the name of a state as reported to the web interface.
+  ///
+  /// @param state is the state to convert.
+  static const char *state_name(TrackState state)
+  {
+    switch (state)
     {
-      DccHwDefs::InternalBoosterOutput::clear_disable_reason(
-        DccOutput::DisableReason::SHORTED);
+      case TrackState::ON:
+        return "On";
+      case TrackState::OVERLOAD:
+        return "Overload";
+      case TrackState::SHORTED:
+        return "Fault";
+      case TrackState::ESTOP:
+        return "e-stop";
+      case TrackState::OFF:
+      default:
+        return "Off";
     }
+  }
 
-    if (last_reading > short_limit)
+  /// @return the current state of the OPS track output.
+  TrackState current_state()
+  {
+    uint8_t disable_reason =
+      DccHwDefs::InternalBoosterOutput::outputDisableReasons_;
+    if (disable_reason & (uint8_t)DccOutput::DisableReason::SHORTED)
     {
-      status->track_power("Track: Short!");
-      if (last_reading < shutdown_limit)
-      {
-        Singleton<esp32cs::EventBroadcastHelper>::instance()->send_event(shortEvent_);
-      }
-      else
-      {
-        Singleton<esp32cs::EventBroadcastHelper>::instance()->send_event(shutdownEvent_);
-      }
+      return TrackState::SHORTED;
     }
     else if (estop_packet_source->is_enabled())
     {
-      status->track_power("Track: e-stop");
+      return TrackState::ESTOP;
     }
     else if (DccHwDefs::InternalBoosterOutput::should_be_enabled())
     {
-      LOG(INFO, "[Track] Usage: %d/%d, %d mA", last_reading, short_limit,
-          esp32cs::get_ops_load());
-      status->track_power("Track: %d mA%c", esp32cs::get_ops_load(),
-                          last_reading > warn_limit ? '!' : ' ');
+      return esp32cs::is_ops_warning_active() ? TrackState::OVERLOAD :
+                                                TrackState::ON;
     }
-    else
+    return TrackState::OFF;
+  }
+
+  /// Reports the OPS track state if it has changed and waits for the next
+  /// trigger.
+  Action update()
+  {
+    TrackState state = current_state();
+    if (state != state_.load())
+    {
+      report(state);
+    }
+    waiting_.store(true);
+    // the state may have changed before the waiting flag was set, if so
+    // reclaim the flag and report it. If a trigger already took the flag it
+    // will notify this flow.
+    if (current_state() != state_.load() && waiting_.exchange(false))
     {
-      status->track_power("Track: Off");
+      return yield();
     }
-    return call_immediately(STATE(sleep));
+    return wait();
   }
 
-  Action sleep()
+  /// Reports a change of the OPS track state.
+  ///
+  /// @param state is the new state.
+  void report(TrackState state)
   {
-      return sleep_and_call(&timer_, INTERVAL, STATE(check));
+    auto status = Singleton<StatusDisplay>::instance();
+    // usage is reported based on all readings since the previous state
+    // change so that brief load spikes are not missed.
+    esp32cs::UlpAdcStats usage;
+    if (esp32cs::get_ops_window_stats(&usage))
+    {
+      LOG(INFO,
+          "[Track] %s -> %s, usage: %d/%d (min:%d, max:%d), %d mA "
+          "(peak %d mA)", state_name(state_.load()), state_name(state),
+          usage.avg, esp32cs::get_ops_short_threshold(), usage.min,
+          usage.max, esp32cs::get_ops_load(usage.avg),
+          esp32cs::get_ops_load(usage.max));
+    }
+    else
+    {
+      LOG(INFO, "[Track] %s -> %s", state_name(state_.load()),
+          state_name(state));
+    }
+    state_.store(state);
+
+    switch (state)
+    {
+      case TrackState::SHORTED:
+        // NOTE: the output is re-enabled after a short by ops_trip_recovery.
+        status->track_power("Track: Short!");
+        if (esp32cs::get_ops_trip_reason() != esp32cs::UlpTripReason::INSTANT)
+        {
+          Singleton<esp32cs::EventBroadcastHelper>::instance()->send_event(shortEvent_);
+        }
+        else
+        {
+          Singleton<esp32cs::EventBroadcastHelper>::instance()->send_event(shutdownEvent_);
+        }
+        break;
+      case TrackState::ESTOP:
+        status->track_power("Track: e-stop");
+        break;
+      case TrackState::OVERLOAD:
+        status->track_power("Track: Overload!");
+        break;
+      case TrackState::ON:
+        status->track_power("Track: On");
+        break;
+      case TrackState::OFF:
+      default:
+        status->track_power("Track: Off");
+    }
+
+    if (listener_)
+    {
+      listener_(status_json());
+    }
   }
 };
 
 static uninitialized<TrackMonitorFlow> track_monitor;
-#endif // CONFIG_OPS_TRACK_ENABLED
 
-/// ESP32 VFS ::write() impl for the RMTTrackDevice.
+/// Forwards OPS track trips from the ULP to @ref ops_trip_recovery and
+/// @ref track_monitor.
 ///
-/// @param fd is the file descriptor being written to.
-/// @param data is the data to write.
-/// @param size is the size of data.
-/// @returns number of bytes written.
-static ssize_t dcc_vfs_write(int fd, const void *data, size_t size)
-{
-  return track.write(fd, data, size);
-}
-
-/// ESP32 VFS ::open() impl for the RMTTrackDevice
-///
-/// @param path is the file location to be opened.
-/// @param flags is not used.
-/// @param mode is not used.
+/// @param reason is the reason the OPS track was tripped.
 ///
-/// @returns file descriptor for the opened file location.
-static int dcc_vfs_open(const char *path, int flags, int mode)
+/// NOTE: this is called from the ULP wake-up ISR context.
+static void ops_trip_isr(esp32cs::UlpTripReason reason)
 {
-  int fd = DccHwDefs::RMT_CHANNEL;
-  LOG(INFO, "[Track:%d] Connecting track interface", fd);
-  return fd;
+  ops_trip_recovery->trip_from_isr();
+  track_monitor->trigger_from_isr();
 }
 
-/// ESP32 VFS ::close() impl for the RMTTrackDevice.
+/// Forwards OPS track warning state changes from the ULP to
+/// @ref track_monitor.
 ///
-/// @param fd is the file descriptor to close.
+/// @param active is true if the OPS track current is above the warning
+/// threshold.
 ///
-/// @returns the status of the close() operation, only returns zero.
-static int dcc_vfs_close(int fd)
+/// NOTE: this is called from the ULP wake-up ISR context.
+static void ops_warning_isr(bool active)
 {
-  LOG(INFO, "[Track:%d] Disconnecting track interface", fd);
-  return 0;
-}
-
-/// ESP32 VFS ::ioctl() impl for the RMTTrackDevice.
-///
-/// @param fd is the file descriptor to operate on.
-/// @param cmd is the ioctl command to execute.
-/// @param args are the arguments to ioctl.
-///
-/// @returns the result of the ioctl command, zero on success, non-zero will
-/// set errno.
-static int dcc_vfs_ioctl(int fd, int cmd, va_list args)
-{
-  return track.ioctl(fd, cmd, args);
+  track_monitor->trigger_from_isr();
 }
+#endif // CONFIG_OPS_TRACK_ENABLED
 
 /// RMT transmit complete callback.
 ///
@@ -321,39 +566,27 @@ static int dcc_vfs_ioctl(int fd, int cmd, va_list args)
 /// of TX data.
 static void rmt_tx_callback(rmt_channel_t channel, void *ctx)
 {
-  if (channel == DccHwDefs::RMT_CHANNEL)
+  for (auto district : districts)
   {
-    track.rmt_transmit_complete();
+    district->rmt_transmit_complete(channel);
   }
 }
 
-/// Initializes the ESP32 VFS adapter for the DCC track interface and the short
-/// detection devices.
+/// Initializes the DCC districts, the ESP32 VFS adapter for each district and
+/// the short detection devices.
 ///
 /// @param node is the OpenLCB node to bind to.
 /// @param service is the OpenLCB @ref Service to use for recurring tasks.
 /// @param cfg is the CDI element for the track output.
 void init_dcc(openlcb::Node *node, Service *svc, const TrackOutputConfig &cfg)
 {
-  // register the VFS handler as the LocalTrackIf uses this to route DCC
-  // packets to the track.
-  esp_vfs_t vfs;
-  memset(&vfs, 0, sizeof(vfs));
-  vfs.flags = ESP_VFS_FLAG_DEFAULT;
-  vfs.ioctl = dcc_vfs_ioctl;
-  vfs.open = dcc_vfs_open;
-  vfs.close = dcc_vfs_close;
-  vfs.write = dcc_vfs_write;
-
-  LOG(INFO, "[Track] Registering %s VFS interface", CONFIG_DCC_VFS_MOUNT_POINT);
-  ESP_ERROR_CHECK(esp_vfs_register(CONFIG_DCC_VFS_MOUNT_POINT, &vfs, nullptr));
-
   // Connect our callback into the RMT so we can queue up the next packet for
   // transmission when needed.
   rmt_register_tx_end_callback(rmt_tx_callback, nullptr);
 
-  // Initialize the RMT signal generator.
-  track.hw_init();
+  // Initialize the VFS, RMT signal generator and packet flows for each
+  // district.
+  ops_district.hw_init(svc);
 
 #if CONFIG_OPS_TRACK_ENABLED
   LOG(INFO, "[OPS] EN/PWM: %d,"
@@ -399,13 +632,10 @@ void init_dcc(openlcb::Node *node, Service *svc, const TrackOutputConfig &cfg)
 );
 #endif // CONFIG_OPS_TRACK_ENABLED
 
-  track_interface.emplace(svc, CONFIG_DCC_PACKET_POOL_SIZE);
-  track_interface->set_fd(open(CONFIG_DCC_VFS_MOUNT_POINT, O_WRONLY));
-  track_update_loop.emplace(svc, track_interface.operator->());
-
-  // Attach the DCC update loop to the track interface
-  track_flow.emplace(svc, track_interface->pool(),
-                     track_update_loop.operator->());
+  // Route packet sources and packets to the district owning the address.
+  district_router.emplace(
+    std::vector<esp32cs::DccDistrictBase *>(std::begin(districts),
+                                            std::end(districts)));
 
 #if CONFIG_RAILCOM_CUT_OUT_ENABLED
   railcom_hub.emplace(svc);
@@ -413,6 +643,11 @@ void init_dcc(openlcb::Node *node, Service *svc, const TrackOutputConfig &cfg)
 #if CONFIG_RAILCOM_DUMP_PACKETS
   railcom_dumper.emplace(railcom_hub.operator->());
 #endif
+#if CONFIG_RAILCOM_DATA_ENABLED
+  railcom_cache.emplace(railcom_hub.operator->());
+  railcom_pom.emplace(svc, district_router.operator->());
+  railcom_cache->set_pom_engine(railcom_pom.operator->());
+#endif // CONFIG_RAILCOM_DATA_ENABLED
 #else // cut-out disabled
   get_dcc_output(DccOutput::Type::TRACK)->set_railcom_cutout_enabled(
     DccOutput::RailcomCutout::DISABLED);
@@ -427,9 +662,12 @@ void init_dcc(openlcb::Node *node, Service *svc, const TrackOutputConfig &cfg)
   prog_backend.emplace(svc, enable_programming_track,
                        disable_programming_track);
 #endif
-  accessory_db.emplace(node, svc, track_interface.operator->());
+  accessory_db.emplace(node, svc, district_router.operator->());
 #if CONFIG_OPS_TRACK_ENABLED
+  ops_trip_recovery.emplace(svc);
   track_monitor.emplace(svc, cfg);
+  esp32cs::set_ops_trip_callback(ops_trip_isr);
+  esp32cs::set_ops_warning_callback(ops_warning_isr);
 #endif // CONFIG_OPS_TRACK_ENABLED
 
 #if CONFIG_ENERGIZE_TRACK_ON_STARTUP
@@ -449,7 +687,171 @@ void init_dcc(openlcb::Node *node, Service *svc, const TrackOutputConfig &cfg)
     DccOutput::DisableReason::INITIALIZATION_PENDING);
   get_dcc_output(DccOutput::Type::LCC)->clear_disable_output_for_reason(
     DccOutput::DisableReason::INITIALIZATION_PENDING);
+  track_state_changed();
+}
+
+void track_state_changed()
+{
+#if CONFIG_OPS_TRACK_ENABLED
+  track_monitor->trigger();
+#endif // CONFIG_OPS_TRACK_ENABLED
+}
+
+std::string get_track_status_json()
+{
+#if CONFIG_OPS_TRACK_ENABLED
+  return track_monitor->status_json();
+#else
+  return R"!^!({"track":"Off","usage":0,"warning":false})!^!";
+#endif // CONFIG_OPS_TRACK_ENABLED
+}
+
+void set_track_status_listener(
+  std::function<void(const std::string &)> listener)
+{
+#if CONFIG_OPS_TRACK_ENABLED
+  track_monitor->set_listener(std::move(listener));
+#endif // CONFIG_OPS_TRACK_ENABLED
+}
+
+/// Names of the @ref PrioritizedUpdateLoop::RepeatMode values.
+static constexpr const char * const REPEAT_MODE_NAMES[] =
+{
+  "reduced",
+  "normal",
+  "boosted"
+};
+
+std::string get_dcc_stats_json()
+{
+  using TrafficClass = esp32cs::PrioritizedUpdateLoop::TrafficClass;
+  std::string result = "[";
+  for (auto district : districts)
+  {
+    esp32cs::PrioritizedUpdateLoop::Stats stats;
+    district->update_loop()->get_stats(&stats);
+    const auto &device = district->device_stats();
+    uint32_t total = stats.idle_per_sec;
+    for (auto count : stats.packets_per_sec)
+    {
+      total += count;
+    }
+    if (result.length() > 1)
+    {
+      result.append(",");
+    }
+    result.append(StringPrintf(
+      R"!^!({"district":%d,"sources":%u,)!^!"
+      R"!^!("pps":{"estop":%u,"speed":%u,"function":%u,"refresh":%u,)!^!"
+      R"!^!("accessory":%u,"pom":%u,"idle":%u},"idle_pct":%u,)!^!"
+      R"!^!("refresh_ms":{"p50":%u,"p99":%u,"max":%u},)!^!"
+      R"!^!("hwm":{"estop":%u,"speed":%u,"function":%u,"packets":%u,)!^!"
+      R"!^!("rmt":%u},"rmt":{"packets":%u,"superseded":%u,"enospc":%u},)!^!"
+      R"!^!("estop":{"count":%u,"latency_us":%u,"latency_max_us":%u},)!^!"
+      R"!^!("repeats":{"mode":"%s","added":%u,"removed":%u}})!^!",
+      district->index(), stats.sources,
+      stats.packets_per_sec[(size_t)TrafficClass::ESTOP],
+      stats.packets_per_sec[(size_t)TrafficClass::SPEED],
+      stats.packets_per_sec[(size_t)TrafficClass::FUNCTION],
+      stats.packets_per_sec[(size_t)TrafficClass::REFRESH],
+      stats.packets_per_sec[(size_t)TrafficClass::ACCESSORY],
+      stats.packets_per_sec[(size_t)TrafficClass::POM],
+      stats.idle_per_sec, total ? (stats.idle_per_sec * 100) / total : 0,
+      stats.refresh_p50_ms, stats.refresh_p99_ms, stats.refresh_max_ms,
+      stats.update_queue_high_water[(size_t)TrafficClass::ESTOP],
+      stats.update_queue_high_water[(size_t)TrafficClass::SPEED],
+      stats.update_queue_high_water[(size_t)TrafficClass::FUNCTION],
+      stats.packet_queue_high_water, device.ring_high_water, device.packets,
+      device.superseded, device.enospc_drops, device.estops,
+      device.estop_latency_usec, device.estop_latency_max_usec,
+      REPEAT_MODE_NAMES[(size_t)stats.repeat_mode], stats.repeats_added_per_sec,
+      stats.repeats_removed_per_sec));
+  }
+  result.append("]");
+  return result;
+}
+
+#if CONFIG_DCC_RMT_TRACE
+/// Version of the DCC packet trace export format.
+static constexpr uint8_t DCC_TRACE_FORMAT_VERSION = 1;
+
+std::string get_dcc_trace(uint8_t district)
+{
+  for (auto entry : districts)
+  {
+    if (entry->index() != district)
+    {
+      continue;
+    }
+    std::vector<esp32cs::DccTraceRecord> records(CONFIG_DCC_RMT_TRACE_RECORDS);
+    uint32_t count = entry->trace_snapshot(records.data(), records.size());
+    std::string result("DCCT", 4);
+    result.push_back(DCC_TRACE_FORMAT_VERSION);
+    result.push_back(sizeof(esp32cs::DccTraceRecord));
+    result.push_back(district);
+    result.push_back(0);
+    result.append(reinterpret_cast<const char *>(&count), sizeof(count));
+    result.append(reinterpret_cast<const char *>(records.data()),
+                  count * sizeof(esp32cs::DccTraceRecord));
+    return result;
+  }
+  return std::string();
+}
+#endif // CONFIG_DCC_RMT_TRACE
+
+#if CONFIG_RAILCOM_CUT_OUT_ENABLED && CONFIG_RAILCOM_DATA_ENABLED
+bool get_railcom_feedback(uint16_t address, bool is_long,
+                          RailComFeedback *feedback)
+{
+  return railcom_cache->get(address, is_long, feedback);
+}
+
+std::string get_railcom_feedback_json(uint16_t address)
+{
+  return railcom_cache->to_json(address);
+}
+
+bool read_pom_cv(uint16_t address, bool is_long, uint16_t cv,
+                 uint8_t *value)
+{
+  auto b = invoke_flow(railcom_pom.operator->(),
+                       esp32cs::RailComPomRequest::READ, address, is_long, cv);
+  *value = b->data()->value;
+  return b->data()->resultCode == 0;
+}
+
+bool verify_pom_cv(uint16_t address, bool is_long, uint16_t cv,
+                   uint8_t value)
+{
+  auto b = invoke_flow(railcom_pom.operator->(),
+                       esp32cs::RailComPomRequest::VERIFY, address, is_long,
+                       cv, value);
+  return b->data()->resultCode == 0;
+}
+#else
+bool get_railcom_feedback(uint16_t address, bool is_long,
+                          RailComFeedback *feedback)
+{
+  return false;
+}
+
+std::string get_railcom_feedback_json(uint16_t address)
+{
+  return "[]";
+}
+
+bool read_pom_cv(uint16_t address, bool is_long, uint16_t cv,
+                 uint8_t *value)
+{
+  return false;
+}
+
+bool verify_pom_cv(uint16_t address, bool is_long, uint16_t cv,
+                   uint8_t value)
+{
+  return false;
 }
+#endif // CONFIG_RAILCOM_CUT_OUT_ENABLED && CONFIG_RAILCOM_DATA_ENABLED
 
 void shutdown_dcc()
 {
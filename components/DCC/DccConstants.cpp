@@ -21,5 +21,19 @@ namespace esp32cs
 {
 
 DEFAULT_CONST(min_refresh_delay_ms, 10);
+DEFAULT_CONST(refresh_period_ms, 100);
+DEFAULT_CONST(high_priority_refresh_period_ms, 50);
+DEFAULT_CONST(speed_bandwidth_weight, 40);
+DEFAULT_CONST(function_bandwidth_weight, 20);
+DEFAULT_CONST(refresh_bandwidth_weight, 20);
+DEFAULT_CONST(accessory_bandwidth_weight, 15);
+DEFAULT_CONST(pom_bandwidth_weight, 5);
+DEFAULT_CONST(repeat_boost_idle_percent, 50);
+DEFAULT_CONST(repeat_reduce_idle_percent, 10);
+DEFAULT_CONST(railcom_pom_timeout_ms, 100);
+DEFAULT_CONST(railcom_pom_attempts, 3);
+DEFAULT_CONST(ops_trip_retry_min_ms, 250);
+DEFAULT_CONST(ops_trip_retry_max_ms, 8000);
+DEFAULT_CONST(ops_trip_stable_ms, 2000);
 
 } // namespace esp32cs
\ No newline at end of file
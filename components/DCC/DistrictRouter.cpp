@@ -0,0 +1,218 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+#include "DistrictRouter.hxx"
+
+#include <dcc/Defs.hxx>
+#include <dcc/PacketSource.hxx>
+
+namespace esp32cs
+{
+
+using dcc::PacketSource;
+using dcc::UpdateLoopBase;
+
+DistrictRouter::DistrictRouter(std::vector<DccDistrictBase *> districts)
+  : districts_(std::move(districts))
+{
+  HASSERT(!districts_.empty());
+}
+
+bool DistrictRouter::add_refresh_source(PacketSource *source,
+                                        unsigned priority)
+{
+  // with a single district all packet sources are owned by it.
+  if (districts_.size() == 1)
+  {
+    return districts_[0]->update_loop()->add_refresh_source(source, priority);
+  }
+
+  // Exclusive packet sources (e-stop) need to reach all districts so there is
+  // no need to determine the address of the source.
+  uint16_t address = DCC_BROADCAST_ADDRESS;
+  if (priority <= UpdateLoopBase::EXCLUSIVE_MIN_PRIORITY)
+  {
+    address = source_address(source);
+  }
+
+  uint8_t district = ALL_DISTRICTS;
+  {
+    SpinlockHolder lock(&lock_);
+    if (address != DCC_BROADCAST_ADDRESS)
+    {
+      district = district_for_address_locked(address);
+    }
+    sources_[source] = {address, district, priority};
+  }
+
+  if (district != ALL_DISTRICTS)
+  {
+    return districts_[district]->update_loop()->add_refresh_source(source,
+                                                                    priority);
+  }
+
+  bool added = true;
+  for (auto district : districts_)
+  {
+    added &= district->update_loop()->add_refresh_source(source, priority);
+  }
+  return added;
+}
+
+void DistrictRouter::remove_refresh_source(PacketSource *source)
+{
+  if (districts_.size() == 1)
+  {
+    districts_[0]->update_loop()->remove_refresh_source(source);
+    return;
+  }
+
+  uint8_t district;
+  {
+    SpinlockHolder lock(&lock_);
+    auto entry = sources_.find(source);
+    if (entry == sources_.end())
+    {
+      return;
+    }
+    district = entry->second.district;
+    sources_.erase(entry);
+  }
+
+  if (district != ALL_DISTRICTS)
+  {
+    districts_[district]->update_loop()->remove_refresh_source(source);
+    return;
+  }
+  for (auto district : districts_)
+  {
+    district->update_loop()->remove_refresh_source(source);
+  }
+}
+
+void DistrictRouter::notify_update(PacketSource *source, unsigned code)
+{
+  if (districts_.size() == 1)
+  {
+    districts_[0]->update_loop()->notify_update(source, code);
+    return;
+  }
+
+  uint8_t district;
+  {
+    SpinlockHolder lock(&lock_);
+    auto entry = sources_.find(source);
+    if (entry == sources_.end())
+    {
+      return;
+    }
+    district = entry->second.district;
+  }
+
+  if (district != ALL_DISTRICTS)
+  {
+    districts_[district]->update_loop()->notify_update(source, code);
+    return;
+  }
+  for (auto district : districts_)
+  {
+    district->update_loop()->notify_update(source, code);
+  }
+}
+
+void DistrictRouter::send(Buffer<dcc::Packet> *packet, unsigned priority)
+{
+  if (districts_.size() == 1)
+  {
+    districts_[0]->update_loop()->send_packet(packet);
+    return;
+  }
+
+  uint16_t address = dcc_packet_address(*packet->data());
+  if (address != DCC_BROADCAST_ADDRESS)
+  {
+    uint8_t district;
+    {
+      SpinlockHolder lock(&lock_);
+      district = district_for_address_locked(address);
+    }
+    districts_[district]->update_loop()->send_packet(packet);
+    return;
+  }
+
+  // send a copy of the packet to all but the first district, the original
+  // packet is sent to the first district.
+  for (size_t index = 1; index < districts_.size(); index++)
+  {
+    Buffer<dcc::Packet> *copy;
+    mainBufferPool->alloc(&copy);
+    HASSERT(copy);
+    *copy->data() = *packet->data();
+    districts_[index]->update_loop()->send_packet(copy);
+  }
+  districts_[0]->update_loop()->send_packet(packet);
+}
+
+void DistrictRouter::set_address_district(uint16_t address, uint8_t district)
+{
+  HASSERT(district < districts_.size());
+  std::vector<std::pair<PacketSource *, SourceOwner>> moved;
+  {
+    SpinlockHolder lock(&lock_);
+    addressDistrict_[address] = district;
+    for (auto &entry : sources_)
+    {
+      if (entry.second.address == address &&
+          entry.second.district != ALL_DISTRICTS &&
+          entry.second.district != district)
+      {
+        moved.emplace_back(entry.first, entry.second);
+        entry.second.district = district;
+      }
+    }
+  }
+
+  for (auto &entry : moved)
+  {
+    LOG(INFO, "[Track] Moving address %d from district %d to district %d",
+        address, entry.second.district, district);
+    districts_[entry.second.district]->update_loop()->remove_refresh_source(
+      entry.first);
+    districts_[district]->update_loop()->add_refresh_source(
+      entry.first, entry.second.priority);
+  }
+}
+
+uint16_t DistrictRouter::source_address(PacketSource *source)
+{
+  // the packet source of a locomotive is also its TrainImpl, the address can
+  // be read from it without generating a packet (which would advance the
+  // refresh state of the source).
+  switch (source->legacy_address_type())
+  {
+    case dcc::TrainAddressType::DCC_SHORT_ADDRESS:
+      return dcc_address_key(source->legacy_address(), false);
+    case dcc::TrainAddressType::DCC_LONG_ADDRESS:
+      return dcc_address_key(source->legacy_address(), true);
+    default:
+      // Marklin and other packets are not routed by address.
+      return DCC_BROADCAST_ADDRESS;
+  }
+}
+
+uint8_t DistrictRouter::district_for_address_locked(uint16_t address)
+{
+  auto entry = addressDistrict_.find(address);
+  if (entry != addressDistrict_.end())
+  {
+    return entry->second;
+  }
+  return 0;
+}
+
+} // namespace esp32cs
@@ -16,12 +16,16 @@ COPYRIGHT (c) 2020-2021 Mike Dunston
 **********************************************************************/
 
 #include "PrioritizedUpdateLoop.hxx"
+#include "DccPacketClass.hxx"
 
 #include <algorithm>
 #include <dcc/PacketSource.hxx>
 #include <esp_timer.h>
 #include <inttypes.h>
+#include <string.h>
 #include <utils/constants.hxx>
+#include <utils/logging.h>
+#include <utility>
 
 namespace esp32cs
 {
@@ -31,28 +35,71 @@ using dcc::TrackIf;
 using dcc::UpdateLoopBase;
 
 DECLARE_CONST(min_refresh_delay_ms);
+DECLARE_CONST(refresh_period_ms);
+DECLARE_CONST(high_priority_refresh_period_ms);
+DECLARE_CONST(speed_bandwidth_weight);
+DECLARE_CONST(function_bandwidth_weight);
+DECLARE_CONST(refresh_bandwidth_weight);
+DECLARE_CONST(accessory_bandwidth_weight);
+DECLARE_CONST(pom_bandwidth_weight);
+DECLARE_CONST(repeat_boost_idle_percent);
+DECLARE_CONST(repeat_reduce_idle_percent);
 
-struct UpdateRequest
-{
-  void reset(PacketSource *source, unsigned code)
-  {
-    this->source = source;
-    this->code = code;
-  }
-  PacketSource *source;
-  unsigned code;
-};
+static_assert((size_t)PrioritizedUpdateLoop::TrafficClass::ESTOP == 0 &&
+              (size_t)PrioritizedUpdateLoop::TrafficClass::SPEED == 1 &&
+              (size_t)PrioritizedUpdateLoop::TrafficClass::FUNCTION == 2,
+              "Update queues must be the first traffic classes");
 
 PrioritizedUpdateLoop::PrioritizedUpdateLoop(Service *service, TrackIf *track)
   : StateFlow<Buffer<dcc::Packet>, QList<1>>(service),
     track_(track)
 {
+  // the e-stop class has strict priority and does not use a weight.
+  weight_[(size_t)TrafficClass::ESTOP] = 0;
+  weight_[(size_t)TrafficClass::SPEED] = config_speed_bandwidth_weight();
+  weight_[(size_t)TrafficClass::FUNCTION] = config_function_bandwidth_weight();
+  weight_[(size_t)TrafficClass::REFRESH] = config_refresh_bandwidth_weight();
+  weight_[(size_t)TrafficClass::ACCESSORY] =
+    config_accessory_bandwidth_weight();
+  weight_[(size_t)TrafficClass::POM] = config_pom_bandwidth_weight();
+  for (size_t index = 0; index < (size_t)TrafficClass::COUNT; index++)
+  {
+    // ensure all classes get some bandwidth.
+    if (index != (size_t)TrafficClass::ESTOP && weight_[index] < 1)
+    {
+      weight_[index] = 1;
+    }
+    credit_[index] = 0;
+  }
+  for (size_t queue = 0; queue < UPDATE_QUEUE_COUNT; queue++)
+  {
+    updateHead_[queue] = NO_SLOT;
+    updateTail_[queue] = NO_SLOT;
+    updateDepth_[queue] = 0;
+    updateHighWater_[queue] = 0;
+  }
+  memset(windowPackets_, 0, sizeof(windowPackets_));
+  memset(lastWindowPackets_, 0, sizeof(lastWindowPackets_));
+  memset(refreshHistogram_, 0, sizeof(refreshHistogram_));
 }
 
 PrioritizedUpdateLoop::~PrioritizedUpdateLoop()
 {
   sources_.clear();
-  metrics_.clear();
+  lastPacket_.clear();
+  priority_.clear();
+  pendingCodes_.clear();
+  queued_.clear();
+  for (size_t queue = 0; queue < UPDATE_QUEUE_COUNT; queue++)
+  {
+    updateNext_[queue].clear();
+  }
+  nextDue_.clear();
+  refreshPeriod_.clear();
+  heapIndex_.clear();
+  refreshHeap_.clear();
+  freeSlots_.clear();
+  slots_.clear();
 }
 
 bool PrioritizedUpdateLoop::add_refresh_source(PacketSource *source,
@@ -60,24 +107,76 @@ bool PrioritizedUpdateLoop::add_refresh_source(PacketSource *source,
 {
   SpinlockHolder lock(&lock_);
 
-  // record the new packet source
-  sources_.push_back(source);
+  // record the new packet source in a free slot or grow the source table.
+  uint16_t slot = find_slot_locked(source);
+  if (slot != NO_SLOT)
+  {
+    // source is already registered, reuse the existing slot.
+    sourceCount_--;
+  }
+  else if (!freeSlots_.empty())
+  {
+    slot = freeSlots_.back();
+    freeSlots_.pop_back();
+  }
+  else if (sources_.size() < NO_EXCLUSIVE_SOURCE)
+  {
+    slot = sources_.size();
+    sources_.push_back(nullptr);
+    lastPacket_.push_back(0);
+    priority_.push_back(0);
+    pendingCodes_.push_back(0);
+    queued_.push_back(0);
+    for (size_t queue = 0; queue < UPDATE_QUEUE_COUNT; queue++)
+    {
+      updateNext_[queue].push_back(NO_SLOT);
+    }
+    nextDue_.push_back(0);
+    refreshPeriod_.push_back(0);
+    heapIndex_.push_back(NO_SLOT);
+  }
+  else
+  {
+    // source table is full.
+    return false;
+  }
+  sources_[slot] = source;
+  lastPacket_[slot] = 0;
+  priority_[slot] = priority;
+  pendingCodes_[slot] = 0;
+  if (priority >= HIGH_PRIORITY_MIN)
+  {
+    refreshPeriod_[slot] =
+      MSEC_TO_USEC(config_high_priority_refresh_period_ms());
+  }
+  else
+  {
+    refreshPeriod_[slot] = MSEC_TO_USEC(config_refresh_period_ms());
+  }
+  slots_[source] = slot;
+  sourceCount_++;
 
-  // seed the tracking metrics
-  auto &metrics = metrics_[source];
-  metrics.priority = priority;
-  metrics.last_packet = 0;
+  // new sources are due for refresh immediately.
+  if (heapIndex_[slot] == NO_SLOT)
+  {
+    nextDue_[slot] = 0;
+    heap_push_locked(slot);
+  }
+  else
+  {
+    heap_reschedule_locked(slot, 0);
+  }
 
   if (priority > UpdateLoopBase::EXCLUSIVE_MIN_PRIORITY)
   {
     unsigned highest_priority = 0;
     if (exclusiveIndex_ != NO_EXCLUSIVE_SOURCE)
     {
-      highest_priority = metrics_[sources_[exclusiveIndex_]].priority;
+      highest_priority = priority_[exclusiveIndex_];
     }
     if (priority > highest_priority)
     {
-      exclusiveIndex_ = sources_.size() - 1;
+      exclusiveIndex_ = slot;
     }
     else
     {
@@ -94,26 +193,39 @@ bool PrioritizedUpdateLoop::add_refresh_source(PacketSource *source,
 void PrioritizedUpdateLoop::remove_refresh_source(PacketSource *source)
 {
   SpinlockHolder lock(&lock_);
-  sources_.erase(
-    std::remove(sources_.begin(), sources_.end(), source), sources_.end());
-  metrics_.erase(source);
+  uint16_t slot = find_slot_locked(source);
+  if (slot == NO_SLOT)
+  {
+    return;
+  }
+  slots_.erase(source);
+  heap_remove_locked(slot);
+  sources_[slot] = nullptr;
+  pendingCodes_[slot] = 0;
+  freeSlots_.push_back(slot);
+  sourceCount_--;
 
   // if there are no packet sources there can't be an exclusive so exit early.
-  if (sources_.empty())
+  if (!sourceCount_)
   {
     exclusiveIndex_ = NO_EXCLUSIVE_SOURCE;
     return;
   }
 
+  // the exclusive source (if any) is unchanged unless it was removed.
+  if (slot != exclusiveIndex_)
+  {
+    return;
+  }
+
   // recalculate for packet priority based on exclusive sources
   unsigned highest_priority = UpdateLoopBase::EXCLUSIVE_MIN_PRIORITY;
   unsigned highest_priority_index = NO_EXCLUSIVE_SOURCE;
   for (size_t index = 0; index < sources_.size(); index++)
   {
-    const auto &packet_source = sources_[index];
-    if (metrics_[packet_source].priority > highest_priority)
+    if (sources_[index] && priority_[index] > highest_priority)
     {
-      highest_priority = metrics_[packet_source].priority;
+      highest_priority = priority_[index];
       highest_priority_index = index;
     }
   }
@@ -122,15 +234,128 @@ void PrioritizedUpdateLoop::remove_refresh_source(PacketSource *source)
 
 void PrioritizedUpdateLoop::notify_update(PacketSource* source, unsigned code)
 {
-  // prepare the high priority update before we lock the queue
-  Buffer<UpdateRequest> *buf;
-  mainBufferPool->alloc(&buf, nullptr);
-  HASSERT(buf);
-  buf->data()->reset(source, code);
+  if (code >= MAX_UPDATE_CODE)
+  {
+    LOG_ERROR("[UpdateLoop] Discarding unsupported update code: %u", code);
+    return;
+  }
+  size_t queue = update_queue(code);
 
-  // lock the queue and insert the new update packet for processing
   SpinlockHolder lock(&lock_);
-  updateSources_.insert(buf, 0);
+  uint16_t slot = find_slot_locked(source);
+  if (slot == NO_SLOT)
+  {
+    // unknown packet source, discard the update.
+    return;
+  }
+  // record the pending update code, if there is already an update pending
+  // for this source and code it will be coalesced since the packet will be
+  // generated from the latest state when it is sent.
+  pendingCodes_[slot] |= (1U << code);
+  enqueue_update_locked(queue, slot);
+}
+
+void PrioritizedUpdateLoop::send_packet(Buffer<dcc::Packet> *packet)
+{
+  TrafficClass traffic_class = packet_class(*packet->data());
+  SpinlockHolder lock(&lock_);
+  packets_[(size_t)traffic_class].insert(packet, 0);
+  if (++packetDepth_ > packetHighWater_)
+  {
+    packetHighWater_ = packetDepth_;
+  }
+}
+
+uint16_t PrioritizedUpdateLoop::find_slot_locked(PacketSource *source)
+{
+  auto entry = slots_.find(source);
+  if (entry == slots_.end())
+  {
+    return NO_SLOT;
+  }
+  return entry->second;
+}
+
+void PrioritizedUpdateLoop::heap_push_locked(uint16_t slot)
+{
+  heapIndex_[slot] = refreshHeap_.size();
+  refreshHeap_.push_back(slot);
+  heap_sift_up_locked(refreshHeap_.size() - 1);
+}
+
+void PrioritizedUpdateLoop::heap_remove_locked(uint16_t slot)
+{
+  size_t index = heapIndex_[slot];
+  if (index == NO_SLOT)
+  {
+    return;
+  }
+  heapIndex_[slot] = NO_SLOT;
+  uint16_t last = refreshHeap_.back();
+  refreshHeap_.pop_back();
+  if (index < refreshHeap_.size())
+  {
+    // move the last entry into the vacated position and restore the order.
+    refreshHeap_[index] = last;
+    heapIndex_[last] = index;
+    heap_sift_up_locked(index);
+    heap_sift_down_locked(heapIndex_[last]);
+  }
+}
+
+void PrioritizedUpdateLoop::heap_reschedule_locked(uint16_t slot, uint64_t due)
+{
+  nextDue_[slot] = due;
+  heap_sift_up_locked(heapIndex_[slot]);
+  heap_sift_down_locked(heapIndex_[slot]);
+}
+
+void PrioritizedUpdateLoop::heap_sift_up_locked(size_t index)
+{
+  while (index > 0)
+  {
+    size_t parent = (index - 1) / 2;
+    if (nextDue_[refreshHeap_[parent]] <= nextDue_[refreshHeap_[index]])
+    {
+      break;
+    }
+    heap_swap_locked(parent, index);
+    index = parent;
+  }
+}
+
+void PrioritizedUpdateLoop::heap_sift_down_locked(size_t index)
+{
+  const size_t count = refreshHeap_.size();
+  while (true)
+  {
+    size_t earliest = index;
+    size_t left = (index * 2) + 1;
+    size_t right = left + 1;
+    if (left < count &&
+        nextDue_[refreshHeap_[left]] < nextDue_[refreshHeap_[earliest]])
+    {
+      earliest = left;
+    }
+    if (right < count &&
+        nextDue_[refreshHeap_[right]] < nextDue_[refreshHeap_[earliest]])
+    {
+      earliest = right;
+    }
+    if (earliest == index)
+    {
+      break;
+    }
+    heap_swap_locked(index, earliest);
+    index = earliest;
+  }
+}
+
+void PrioritizedUpdateLoop::heap_swap_locked(size_t first, size_t second)
+{
+  std::swap(refreshHeap_[first], refreshHeap_[second]);
+  heapIndex_[refreshHeap_[first]] = first;
+  heapIndex_[refreshHeap_[second]] = second;
 }
 
 #if CONFIG_ESP_TIMER_IMPL_TG0_LAC
@@ -168,71 +393,92 @@ uint64_t get_current_time() __attribute__((alias("esp_timer_get_time")));
 StateFlowBase::Action PrioritizedUpdateLoop::entry()
 {
   dcc::PacketSource *source = nullptr;
+  Buffer<dcc::Packet> *packet = nullptr;
+  TrafficClass sent_class = TrafficClass::ESTOP;
+  uint16_t slot = NO_SLOT;
   uint64_t now = get_current_time();
   uint64_t min_refresh_time =
     now - MSEC_TO_USEC(config_min_refresh_delay_ms());
   unsigned code = 0;
+  RepeatMode repeat_mode;
 
   {
     SpinlockHolder lock(&lock_);
+    repeat_mode = repeatMode_;
     // if we have an exclusive source use it as the source otherwise check if
-    // there is a priority update to send out.
+    // there is any e-stop traffic to send out.
     if (exclusiveIndex_ != NO_EXCLUSIVE_SOURCE)
     {
-      source = sources_[exclusiveIndex_];
+      slot = exclusiveIndex_;
+    }
+    else if (packets_[(size_t)TrafficClass::ESTOP].pending())
+    {
+      packet = static_cast<Buffer<dcc::Packet> *>(
+        packets_[(size_t)TrafficClass::ESTOP].next().item);
     }
-    else if (updateSources_.pending())
+    else
     {
-      Buffer<UpdateRequest> *update =
-        static_cast<Buffer<UpdateRequest>*>(updateSources_.next().item);
-      code = update->data()->code;
-      const auto &update_source = update->data()->source;
+      slot = next_update_locked((size_t)TrafficClass::ESTOP, min_refresh_time,
+                                &code);
+    }
 
-      auto metrics = metrics_.find(update_source);
-      if (metrics == metrics_.end())
-      {
-        // priority update source has disappeared, discard and find another
-        // packet source.
-        update->unref();
-      }
-      else if (metrics->second.last_packet > min_refresh_time)
-      {
-        // we sent a packet to this source within the minimum refresh window
-        // send this source back to the queue.
-        updateSources_.insert(update, 0);
-      }
-      else
+    // select one of the weighted traffic classes, if the selected class does
+    // not produce a packet try the remaining classes.
+    uint32_t ready = 0;
+    if (slot == NO_SLOT && !packet)
+    {
+      ready = ready_classes_locked(min_refresh_time);
+    }
+    while (ready && slot == NO_SLOT && !packet)
+    {
+      TrafficClass traffic_class = select_class_locked(ready);
+      ready &= ~(1U << (size_t)traffic_class);
+      sent_class = traffic_class;
+      switch (traffic_class)
       {
-        // all checks have been validated, we can use this high priority source
-        // for the next packet.
-        source = update_source;
+        case TrafficClass::SPEED:
+        case TrafficClass::FUNCTION:
+          // pre-built packets (from the district router or the track
+          // interface) are sent ahead of the packet source updates.
+          if (packets_[(size_t)traffic_class].pending())
+          {
+            packet = static_cast<Buffer<dcc::Packet> *>(
+              packets_[(size_t)traffic_class].next().item);
+          }
+          else
+          {
+            slot = next_update_locked((size_t)traffic_class,
+                                      min_refresh_time, &code);
+          }
+          break;
+        case TrafficClass::REFRESH:
+          // use the packet source with the earliest refresh deadline.
+          code = 0;
+          slot = refreshHeap_.front();
+          break;
+        case TrafficClass::ACCESSORY:
+        case TrafficClass::POM:
+          packet = static_cast<Buffer<dcc::Packet> *>(
+            packets_[(size_t)traffic_class].next().item);
+          break;
+        default:
+          break;
       }
     }
-  }
 
-  if (!source && !sources_.empty())
-  {
-    // default to general refresh.
-    code = 0;
+    if (packet)
+    {
+      packetDepth_--;
+    }
+    record_packet_locked(now, slot == NO_SLOT && !packet, sent_class, slot);
 
-    // no priority updates or exclusive sources available, scan all registered
-    // sources to find the one that has not been updated recently.
-    size_t index = 0;
-    while (index++ < sources_.size() && !source)
+    if (slot != NO_SLOT)
     {
-      {
-        SpinlockHolder lock(&lock_);
-        if (nextIndex_ >= sources_.size())
-        {
-          nextIndex_ = 0;
-        }
-        source = sources_[nextIndex_++];
-      }
-      if (metrics_[source].last_packet > min_refresh_time)
-      {
-        // source is not yet ready for refresh.
-        source = nullptr;
-      }
+      source = sources_[slot];
+      // track that we have sent a packet to this source recently and
+      // schedule the next refresh.
+      lastPacket_[slot] = now;
+      heap_reschedule_locked(slot, now + refreshPeriod_[slot]);
     }
   }
 
@@ -241,9 +487,14 @@ StateFlowBase::Action PrioritizedUpdateLoop::entry()
     //ets_printf("%" PRIu64 ": source:%p, code:%d\n", now, source, code);
     // we have a new source, get the next packet from the source
     source->get_next_packet(code, message()->data());
-
-    // track that we have sent a packet to this source recently
-    metrics_[source].last_packet = now;
+    apply_repeat_mode(repeat_mode, sent_class, message()->data());
+  }
+  else if (packet)
+  {
+    // copy the pre-built packet and release it.
+    *message()->data() = *packet->data();
+    packet->unref();
+    apply_repeat_mode(repeat_mode, sent_class, message()->data());
   }
   else
   {
@@ -259,4 +510,349 @@ StateFlowBase::Action PrioritizedUpdateLoop::entry()
   return exit();
 }
 
+void PrioritizedUpdateLoop::get_stats(Stats *stats)
+{
+  SpinlockHolder lock(&lock_);
+  memcpy(stats->packets_per_sec, lastWindowPackets_,
+         sizeof(stats->packets_per_sec));
+  stats->idle_per_sec = lastWindowIdle_;
+  stats->refresh_p50_ms = refresh_percentile_locked(500);
+  stats->refresh_p99_ms = refresh_percentile_locked(990);
+  stats->refresh_max_ms = refreshMax_ / 1000;
+  for (size_t queue = 0; queue < UPDATE_QUEUE_COUNT; queue++)
+  {
+    stats->update_queue_high_water[queue] = updateHighWater_[queue];
+  }
+  stats->packet_queue_high_water = packetHighWater_;
+  stats->sources = sourceCount_;
+  stats->repeat_mode = repeatMode_;
+  stats->repeats_added_per_sec = lastWindowRepeatsAdded_;
+  stats->repeats_removed_per_sec = lastWindowRepeatsRemoved_;
+}
+
+void PrioritizedUpdateLoop::apply_repeat_mode(RepeatMode mode,
+                                              TrafficClass traffic_class,
+                                              dcc::Packet *packet)
+{
+  if (mode == RepeatMode::NORMAL || packet->packet_header.send_long_preamble)
+  {
+    // service mode packets are always sent as requested.
+    return;
+  }
+  uint8_t requested = packet->packet_header.rept_count;
+  uint8_t repeats = requested;
+  switch (traffic_class)
+  {
+    case TrafficClass::ESTOP:
+      // e-stop packets are never reduced.
+      if (mode == RepeatMode::BOOSTED)
+      {
+        repeats = MAX_REPEAT_COUNT;
+      }
+      break;
+    case TrafficClass::ACCESSORY:
+      repeats = mode == RepeatMode::BOOSTED ? MAX_REPEAT_COUNT :
+        std::min(requested, MIN_ACCESSORY_REPEAT_COUNT);
+      break;
+    case TrafficClass::POM:
+      repeats = mode == RepeatMode::BOOSTED ? MAX_REPEAT_COUNT :
+        std::min(requested, MIN_POM_REPEAT_COUNT);
+      break;
+    default:
+      // locomotive speed and function packets are refreshed periodically so
+      // repeats are only dropped when the track is busy.
+      if (mode == RepeatMode::REDUCED)
+      {
+        repeats = 0;
+      }
+      break;
+  }
+  if (repeats > requested)
+  {
+    windowRepeatsAdded_ += repeats - requested;
+  }
+  else
+  {
+    windowRepeatsRemoved_ += requested - repeats;
+  }
+  packet->packet_header.rept_count = repeats;
+}
+
+void PrioritizedUpdateLoop::record_packet_locked(uint64_t now, bool idle,
+                                                 TrafficClass traffic_class,
+                                                 uint16_t slot)
+{
+  if (now - windowStart_ >= STATS_WINDOW_USEC)
+  {
+    // the window has elapsed, publish the counters and start a new window.
+    memcpy(lastWindowPackets_, windowPackets_, sizeof(lastWindowPackets_));
+    memset(windowPackets_, 0, sizeof(windowPackets_));
+    lastWindowIdle_ = windowIdle_;
+    windowIdle_ = 0;
+    windowStart_ = now;
+    lastWindowRepeatsAdded_ = windowRepeatsAdded_;
+    lastWindowRepeatsRemoved_ = windowRepeatsRemoved_;
+    windowRepeatsAdded_ = 0;
+    windowRepeatsRemoved_ = 0;
+
+    // select the repeat mode for the next window based on the share of idle
+    // packets in the completed window.
+    uint32_t total = lastWindowIdle_;
+    for (auto count : lastWindowPackets_)
+    {
+      total += count;
+    }
+    uint32_t idle_percent = total ? (lastWindowIdle_ * 100) / total : 100;
+    if (idle_percent >= config_repeat_boost_idle_percent())
+    {
+      repeatMode_ = RepeatMode::BOOSTED;
+    }
+    else if (idle_percent < config_repeat_reduce_idle_percent())
+    {
+      repeatMode_ = RepeatMode::REDUCED;
+    }
+    else
+    {
+      repeatMode_ = RepeatMode::NORMAL;
+    }
+  }
+  if (idle)
+  {
+    windowIdle_++;
+    return;
+  }
+  windowPackets_[(size_t)traffic_class]++;
+
+  // record the interval since the previous packet for this source, sources
+  // that have not been sent a packet yet are skipped.
+  if (slot != NO_SLOT && lastPacket_[slot])
+  {
+    uint64_t interval = now - lastPacket_[slot];
+    size_t bucket = (interval / 1000) / REFRESH_HISTOGRAM_BUCKET_MS;
+    if (bucket >= REFRESH_HISTOGRAM_BUCKETS)
+    {
+      bucket = REFRESH_HISTOGRAM_BUCKETS - 1;
+    }
+    refreshHistogram_[bucket]++;
+    if (interval > refreshMax_)
+    {
+      refreshMax_ = interval;
+    }
+  }
+}
+
+uint32_t PrioritizedUpdateLoop::refresh_percentile_locked(uint32_t permille)
+{
+  uint64_t total = 0;
+  for (size_t bucket = 0; bucket < REFRESH_HISTOGRAM_BUCKETS; bucket++)
+  {
+    total += refreshHistogram_[bucket];
+  }
+  if (!total)
+  {
+    return 0;
+  }
+  uint64_t target = ((total * permille) + 999) / 1000;
+  uint64_t count = 0;
+  for (size_t bucket = 0; bucket < REFRESH_HISTOGRAM_BUCKETS - 1; bucket++)
+  {
+    count += refreshHistogram_[bucket];
+    if (count >= target)
+    {
+      // report the upper edge of the bucket.
+      return (bucket + 1) * REFRESH_HISTOGRAM_BUCKET_MS;
+    }
+  }
+  // the percentile is in the overflow bucket, report the maximum.
+  return refreshMax_ / 1000;
+}
+
+uint32_t PrioritizedUpdateLoop::ready_classes_locked(uint64_t min_refresh_time)
+{
+  uint32_t ready = 0;
+  if (updateHead_[(size_t)TrafficClass::SPEED] != NO_SLOT ||
+      packets_[(size_t)TrafficClass::SPEED].pending())
+  {
+    ready |= 1U << (size_t)TrafficClass::SPEED;
+  }
+  if (updateHead_[(size_t)TrafficClass::FUNCTION] != NO_SLOT ||
+      packets_[(size_t)TrafficClass::FUNCTION].pending())
+  {
+    ready |= 1U << (size_t)TrafficClass::FUNCTION;
+  }
+  if (!refreshHeap_.empty() &&
+      lastPacket_[refreshHeap_.front()] <= min_refresh_time)
+  {
+    ready |= 1U << (size_t)TrafficClass::REFRESH;
+  }
+  if (packets_[(size_t)TrafficClass::ACCESSORY].pending())
+  {
+    ready |= 1U << (size_t)TrafficClass::ACCESSORY;
+  }
+  if (packets_[(size_t)TrafficClass::POM].pending())
+  {
+    ready |= 1U << (size_t)TrafficClass::POM;
+  }
+  return ready;
+}
+
+PrioritizedUpdateLoop::TrafficClass
+PrioritizedUpdateLoop::select_class_locked(uint32_t ready)
+{
+  // smooth weighted round-robin, each ready class earns its weight in credit
+  // and the class with the most credit is selected and pays back the total
+  // weight of all ready classes.
+  int32_t total = 0;
+  size_t selected = (size_t)TrafficClass::COUNT;
+  for (size_t index = 0; index < (size_t)TrafficClass::COUNT; index++)
+  {
+    if (ready & (1U << index))
+    {
+      credit_[index] += weight_[index];
+      total += weight_[index];
+      if (selected == (size_t)TrafficClass::COUNT ||
+          credit_[index] > credit_[selected])
+      {
+        selected = index;
+      }
+    }
+  }
+  HASSERT(selected != (size_t)TrafficClass::COUNT);
+  credit_[selected] -= total;
+  return (TrafficClass)selected;
+}
+
+uint16_t PrioritizedUpdateLoop::next_update_locked(size_t queue,
+                                                   uint64_t min_refresh_time,
+                                                   unsigned *code)
+{
+  uint16_t slot = updateHead_[queue];
+  if (slot == NO_SLOT)
+  {
+    return NO_SLOT;
+  }
+  uint32_t codes = pendingCodes_[slot] & update_queue_codes(queue);
+  if (!sources_[slot] || !codes)
+  {
+    // priority update source has disappeared, discard and find another
+    // packet source.
+    dequeue_update_locked(queue);
+    return NO_SLOT;
+  }
+  else if (lastPacket_[slot] > min_refresh_time)
+  {
+    // we sent a packet to this source within the minimum refresh window
+    // send this source back to the end of the queue.
+    dequeue_update_locked(queue);
+    enqueue_update_locked(queue, slot);
+    return NO_SLOT;
+  }
+
+  // all checks have been validated, we can use this high priority source for
+  // the next packet.
+  dequeue_update_locked(queue);
+  *code = __builtin_ctz(codes);
+  pendingCodes_[slot] &= ~(1U << *code);
+  if (codes & ~(1U << *code))
+  {
+    // additional updates are pending for this queue, send them after other
+    // queued sources.
+    enqueue_update_locked(queue, slot);
+  }
+  return slot;
+}
+
+void PrioritizedUpdateLoop::enqueue_update_locked(size_t queue, uint16_t slot)
+{
+  if (queued_[slot] & (1U << queue))
+  {
+    return;
+  }
+  queued_[slot] |= (1U << queue);
+  if (++updateDepth_[queue] > updateHighWater_[queue])
+  {
+    updateHighWater_[queue] = updateDepth_[queue];
+  }
+  updateNext_[queue][slot] = NO_SLOT;
+  if (updateTail_[queue] == NO_SLOT)
+  {
+    updateHead_[queue] = slot;
+  }
+  else
+  {
+    updateNext_[queue][updateTail_[queue]] = slot;
+  }
+  updateTail_[queue] = slot;
+}
+
+void PrioritizedUpdateLoop::dequeue_update_locked(size_t queue)
+{
+  uint16_t slot = updateHead_[queue];
+  updateHead_[queue] = updateNext_[queue][slot];
+  if (updateHead_[queue] == NO_SLOT)
+  {
+    updateTail_[queue] = NO_SLOT;
+  }
+  updateNext_[queue][slot] = NO_SLOT;
+  queued_[slot] &= ~(1U << queue);
+  updateDepth_[queue]--;
+}
+
+size_t PrioritizedUpdateLoop::update_queue(unsigned code)
+{
+  if (code == dcc::DccTrainUpdateCode::ESTOP)
+  {
+    return (size_t)TrafficClass::ESTOP;
+  }
+  else if (code == dcc::DccTrainUpdateCode::SPEED)
+  {
+    return (size_t)TrafficClass::SPEED;
+  }
+  return (size_t)TrafficClass::FUNCTION;
+}
+
+uint32_t PrioritizedUpdateLoop::update_queue_codes(size_t queue)
+{
+  const uint32_t estop = 1U << dcc::DccTrainUpdateCode::ESTOP;
+  const uint32_t speed = 1U << dcc::DccTrainUpdateCode::SPEED;
+  if (queue == (size_t)TrafficClass::ESTOP)
+  {
+    return estop;
+  }
+  else if (queue == (size_t)TrafficClass::SPEED)
+  {
+    return speed;
+  }
+  return ~(estop | speed);
+}
+
+PrioritizedUpdateLoop::TrafficClass
+PrioritizedUpdateLoop::packet_class(const dcc::Packet &packet)
+{
+  if (packet.dlc && packet.payload[0] == 0)
+  {
+    // broadcast packets (e-stop, reset).
+    return TrafficClass::ESTOP;
+  }
+  else if (dcc_packet_address(packet) == DCC_BROADCAST_ADDRESS)
+  {
+    // accessory decoder packets.
+    return TrafficClass::ACCESSORY;
+  }
+  switch (dcc_packet_class(packet))
+  {
+    case DccPacketClass::SPEED:
+      return TrafficClass::SPEED;
+    case DccPacketClass::FUNCTION_F0_F4:
+    case DccPacketClass::FUNCTION_F5_F8:
+    case DccPacketClass::FUNCTION_F9_F12:
+    case DccPacketClass::FUNCTION_F13_F20:
+    case DccPacketClass::FUNCTION_F21_F28:
+      return TrafficClass::FUNCTION;
+    default:
+      // POM, consist and other configuration packets.
+      return TrafficClass::POM;
+  }
+}
+
 } // namespace esp32cs
@@ -0,0 +1,382 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+#include "RailComFeedbackCache.hxx"
+#include "DccPacketClass.hxx"
+#include "RailComPomEngine.hxx"
+
+#include <dcc/RailCom.hxx>
+#include <esp_timer.h>
+#include <locodb/LocoPresence.hxx>
+#include <string.h>
+#include <utils/StringPrintf.hxx>
+
+namespace esp32cs
+{
+
+/// RailCom datagram identifiers (RCN-217).
+enum RailComDatagramId : uint8_t
+{
+  /// POM read response.
+  RAILCOM_ID_POM = 0,
+
+  /// Upper bits of the decoder address (channel 1 broadcast).
+  RAILCOM_ID_ADR_HIGH = 1,
+
+  /// Lower bits of the decoder address (channel 1 broadcast).
+  RAILCOM_ID_ADR_LOW = 2,
+
+  /// Location information.
+  RAILCOM_ID_EXT = 3,
+
+  /// Dynamic variable.
+  RAILCOM_ID_DYN = 7,
+
+  /// First of the four extended POM read responses.
+  RAILCOM_ID_XPOM_FIRST = 8,
+
+  /// Last of the four extended POM read responses.
+  RAILCOM_ID_XPOM_LAST = 11,
+};
+
+/// Dynamic variable holding the speed (0-255 km/h).
+static constexpr uint8_t RAILCOM_DYN_SPEED_LOW = 0;
+
+/// Dynamic variable holding the speed (256-511 km/h).
+static constexpr uint8_t RAILCOM_DYN_SPEED_HIGH = 1;
+
+/// Dynamic variable holding the receive statistics (QoS).
+static constexpr uint8_t RAILCOM_DYN_QOS = 7;
+
+/// Largest value of a decoded 4-of-8 data symbol, values above this are
+/// either special symbols (ACK, NACK, BUSY) or invalid.
+static constexpr uint8_t RAILCOM_MAX_DATA_SYMBOL = 0x3F;
+
+/// @return the number of 4-of-8 symbols in a datagram (including the one
+/// holding the identifier) or zero if the identifier is not known.
+///
+/// @param id is the datagram identifier.
+static uint8_t datagram_length(uint8_t id)
+{
+  if (id == RAILCOM_ID_POM || id == RAILCOM_ID_ADR_HIGH ||
+      id == RAILCOM_ID_ADR_LOW)
+  {
+    return 2;
+  }
+  else if (id == RAILCOM_ID_EXT || id == RAILCOM_ID_DYN)
+  {
+    return 3;
+  }
+  else if (id >= RAILCOM_ID_XPOM_FIRST && id <= RAILCOM_ID_XPOM_LAST)
+  {
+    return 6;
+  }
+  return 0;
+}
+
+/// @return the cache key of an entry, see dcc_address_key.
+///
+/// @param feedback is the cached feedback of the entry.
+static uint16_t slot_key(const RailComFeedback &feedback)
+{
+  return dcc_address_key(feedback.address, feedback.long_address);
+}
+
+/// @return the current time in milliseconds, never zero.
+static uint32_t now_ms()
+{
+  uint32_t now = esp_timer_get_time() / 1000ULL;
+  return now ? now : 1;
+}
+
+RailComFeedbackCache::RailComFeedbackCache(dcc::RailcomHubFlow *hub)
+  : hub_(hub)
+{
+  memset(slots_, 0, sizeof(slots_));
+  hub_->register_port(this);
+}
+
+RailComFeedbackCache::~RailComFeedbackCache()
+{
+  hub_->unregister_port(this);
+}
+
+void RailComFeedbackCache::send(Buffer<dcc::RailcomHubData> *entry,
+                                unsigned priority)
+{
+  AutoReleaseBuffer<dcc::RailcomHubData> rb(entry);
+  const dcc::Feedback &fb = *entry->data();
+  uint16_t ch1_address = 0;
+  bool valid = decode_ch1(fb, &ch1_address);
+  if (ch1_address && Singleton<locodb::LocoPresence>::exists())
+  {
+    // channel 1 broadcasts are sent after any packet, including idle and
+    // broadcast packets, so they are used for presence detection even when
+    // the feedback can not be attributed to a single decoder.
+    Singleton<locodb::LocoPresence>::instance()->seen(
+      dcc_address_number(ch1_address),
+      (ch1_address & DCC_LONG_ADDRESS_FLAG) ?
+        dcc::TrainAddressType::DCC_LONG_ADDRESS :
+        dcc::TrainAddressType::DCC_SHORT_ADDRESS);
+  }
+
+  uint16_t address = dcc_feedback_key_address(fb.feedbackKey);
+  if (address == DCC_BROADCAST_ADDRESS || dcc_address_number(address) == 0 ||
+      (!fb.ch1Size && !fb.ch2Size))
+  {
+    // only feedback that can be attributed to a single decoder is cached.
+    return;
+  }
+
+  uint32_t now = now_ms();
+  bool pom = false;
+  uint8_t cv_value = 0;
+  {
+    SpinlockHolder lock(&lock_);
+    Slot *slot = claim_locked(address);
+    if (ch1_address)
+    {
+      slot->feedback.ch1_address = dcc_address_number(ch1_address);
+      slot->feedback.ch1_long_address = ch1_address & DCC_LONG_ADDRESS_FLAG;
+      slot->feedback.ch1_ms = now;
+    }
+    valid &= decode_ch2(fb, slot, now, &pom);
+    slot->feedback.responses++;
+    slot->feedback.last_ms = now;
+    if (!valid)
+    {
+      slot->feedback.errors++;
+    }
+    cv_value = slot->feedback.cv_value;
+  }
+  if (pom && pomEngine_)
+  {
+    pomEngine_->pom_response(fb.feedbackKey, cv_value);
+  }
+}
+
+bool RailComFeedbackCache::get(uint16_t address, bool is_long,
+                               RailComFeedback *feedback)
+{
+  SpinlockHolder lock(&lock_);
+  Slot *slot = find_locked(dcc_address_key(address, is_long));
+  if (slot)
+  {
+    *feedback = slot->feedback;
+    return true;
+  }
+  return false;
+}
+
+std::string RailComFeedbackCache::to_json(uint16_t address)
+{
+  std::string res = "[";
+  for (size_t idx = 0; idx < CACHE_SIZE; idx++)
+  {
+    RailComFeedback fb;
+    {
+      SpinlockHolder lock(&lock_);
+      fb = slots_[idx].feedback;
+    }
+    if (!fb.address || (address && fb.address != address))
+    {
+      continue;
+    }
+    if (res.length() > 1)
+    {
+      res += ",";
+    }
+    uint32_t error_pct = fb.responses ? (fb.errors * 100) / fb.responses : 0;
+    res += StringPrintf(
+      R"!^!({"addr":%u,"long":%s,"ch1":{"addr":%u,"long":%s,"ms":%u},)!^!"
+      R"!^!("speed":{"kmh":%u,"ms":%u},"qos":{"pct":%u,"ms":%u},)!^!"
+      R"!^!("cv":{"value":%u,"ms":%u},"ack_ms":%u,"last_ms":%u,)!^!"
+      R"!^!("responses":%u,"errors":%u,"error_pct":%u})!^!",
+      fb.address, fb.long_address ? "true" : "false", fb.ch1_address,
+      fb.ch1_long_address ? "true" : "false", fb.ch1_ms, fb.speed, fb.speed_ms, fb.qos,
+      fb.qos_ms, fb.cv_value, fb.cv_ms, fb.ack_ms, fb.last_ms, fb.responses,
+      fb.errors, error_pct);
+  }
+  res += "]";
+  return res;
+}
+
+RailComFeedbackCache::Slot *RailComFeedbackCache::find_locked(uint16_t key)
+{
+  size_t index = (key ^ (key >> 7)) & (CACHE_SIZE - 1);
+  for (size_t probe = 0; probe < MAX_PROBE; probe++)
+  {
+    Slot *slot = &slots_[(index + probe) & (CACHE_SIZE - 1)];
+    if (slot_key(slot->feedback) == key)
+    {
+      return slot;
+    }
+    else if (!slot->feedback.address)
+    {
+      // slots are never released so an unused slot ends the probe sequence.
+      break;
+    }
+  }
+  return nullptr;
+}
+
+RailComFeedbackCache::Slot *RailComFeedbackCache::claim_locked(uint16_t key)
+{
+  size_t index = (key ^ (key >> 7)) & (CACHE_SIZE - 1);
+  Slot *oldest = nullptr;
+  for (size_t probe = 0; probe < MAX_PROBE; probe++)
+  {
+    Slot *slot = &slots_[(index + probe) & (CACHE_SIZE - 1)];
+    if (slot_key(slot->feedback) == key)
+    {
+      return slot;
+    }
+    else if (!slot->feedback.address)
+    {
+      oldest = slot;
+      break;
+    }
+    else if (!oldest || slot->feedback.last_ms < oldest->feedback.last_ms)
+    {
+      oldest = slot;
+    }
+  }
+  memset(oldest, 0, sizeof(Slot));
+  oldest->feedback.address = dcc_address_number(key);
+  oldest->feedback.long_address = key & DCC_LONG_ADDRESS_FLAG;
+  return oldest;
+}
+
+bool RailComFeedbackCache::decode_ch1(const dcc::Feedback &fb,
+                                      uint16_t *address)
+{
+  // ADR_HIGH is only combined with the ADR_LOW of the next cut-out, any other
+  // channel 1 data (or none) in between discards it. Channel 1 is shared by
+  // all decoders on the track so pairing values from cut-outs further apart
+  // could combine the address halves of two different decoders.
+  bool adr_high_valid = adrHighValid_;
+  adrHighValid_ = false;
+  if (!fb.ch1Size)
+  {
+    return true;
+  }
+  else if (fb.ch1Size != 2)
+  {
+    return false;
+  }
+  uint8_t high = dcc::railcom_decode[fb.ch1Data[0]];
+  uint8_t low = dcc::railcom_decode[fb.ch1Data[1]];
+  if (high > RAILCOM_MAX_DATA_SYMBOL || low > RAILCOM_MAX_DATA_SYMBOL)
+  {
+    return false;
+  }
+  uint8_t id = high >> 2;
+  uint8_t value = ((high & 0x03) << 6) | low;
+  if (id == RAILCOM_ID_ADR_HIGH)
+  {
+    adrHigh_ = value;
+    adrHighValid_ = true;
+  }
+  else if (id == RAILCOM_ID_ADR_LOW && adr_high_valid)
+  {
+    uint16_t number = ((adrHigh_ & 0x3F) << 8) | value;
+    if ((adrHigh_ & 0xC0) == 0x80 && number)
+    {
+      // long address, the upper two bits of ADR_HIGH are a marker.
+      *address = dcc_address_key(number, true);
+    }
+    else if (adrHigh_ == 0 && value)
+    {
+      *address = value;
+    }
+    // other ADR_HIGH values are consist addresses, which do not identify a
+    // single decoder.
+  }
+  return true;
+}
+
+bool RailComFeedbackCache::decode_ch2(const dcc::Feedback &fb, Slot *slot,
+                                      uint32_t now, bool *pom)
+{
+  uint8_t pos = 0;
+  while (pos < fb.ch2Size)
+  {
+    uint8_t symbol = dcc::railcom_decode[fb.ch2Data[pos]];
+    if (symbol == dcc::RailcomDefs::ACK)
+    {
+      slot->feedback.ack_ms = now;
+      pos++;
+      continue;
+    }
+    else if (symbol == dcc::RailcomDefs::NACK ||
+             symbol == dcc::RailcomDefs::BUSY)
+    {
+      pos++;
+      continue;
+    }
+    else if (symbol > RAILCOM_MAX_DATA_SYMBOL)
+    {
+      return false;
+    }
+    uint8_t id = symbol >> 2;
+    uint8_t length = datagram_length(id);
+    if (!length || pos + length > fb.ch2Size)
+    {
+      return false;
+    }
+    // assemble the datagram payload, excluding the identifier bits.
+    uint32_t payload = symbol & 0x03;
+    for (uint8_t idx = 1; idx < length; idx++)
+    {
+      symbol = dcc::railcom_decode[fb.ch2Data[pos + idx]];
+      if (symbol > RAILCOM_MAX_DATA_SYMBOL)
+      {
+        return false;
+      }
+      payload = (payload << 6) | symbol;
+    }
+    pos += length;
+
+    if (id == RAILCOM_ID_POM)
+    {
+      slot->feedback.cv_value = payload & 0xFF;
+      slot->feedback.cv_ms = now;
+      *pom = true;
+    }
+    else if (id == RAILCOM_ID_DYN)
+    {
+      uint8_t value = (payload >> 6) & 0xFF;
+      uint8_t subindex = payload & 0x3F;
+      if (subindex == RAILCOM_DYN_SPEED_LOW)
+      {
+        slot->feedback.speed = value;
+        slot->feedback.speed_ms = now;
+      }
+      else if (subindex == RAILCOM_DYN_SPEED_HIGH)
+      {
+        slot->feedback.speed = value + 256;
+        slot->feedback.speed_ms = now;
+      }
+      else if (subindex == RAILCOM_DYN_QOS)
+      {
+        slot->feedback.qos = value;
+        slot->feedback.qos_ms = now;
+      }
+    }
+    else if (id >= RAILCOM_ID_XPOM_FIRST && id <= RAILCOM_ID_XPOM_LAST)
+    {
+      // XPOM returns four consecutive CVs, only the first is cached.
+      slot->feedback.cv_value = (payload >> 24) & 0xFF;
+      slot->feedback.cv_ms = now;
+      *pom = true;
+    }
+  }
+  return true;
+}
+
+} // namespace esp32cs
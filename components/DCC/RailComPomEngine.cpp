@@ -0,0 +1,109 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+#include "RailComPomEngine.hxx"
+#include "DccPacketClass.hxx"
+
+#include <dcc/Packet.hxx>
+#include <openlcb/Defs.hxx>
+#include <utils/logging.h>
+
+namespace esp32cs
+{
+
+RailComPomEngine::RailComPomEngine(Service *service, dcc::TrackIf *track)
+  : CallableFlow<RailComPomRequest>(service), track_(track)
+{
+}
+
+void RailComPomEngine::pom_response(uint32_t feedback_key, uint8_t value)
+{
+  // the tag is only present once a packet of the current request has been
+  // sent to the track, responses to any other packet are ignored.
+  if (pending_ && !responded_ &&
+      dcc_feedback_key_class(feedback_key) == DccPacketClass::POM &&
+      dcc_feedback_key_tag(feedback_key) == tag_ &&
+      dcc_feedback_key_address(feedback_key) ==
+        dcc_address_key(request()->address, request()->is_long))
+  {
+    responded_ = true;
+    response_ = value;
+    // wake up the flow rather than waiting for the full timeout.
+    timer_.trigger();
+  }
+}
+
+StateFlowBase::Action RailComPomEngine::entry()
+{
+  uint16_t max_address = request()->is_long ?
+    dcc::DccLongAddress::ADDRESS_MAX : dcc::DccShortAddress::ADDRESS_MAX;
+  if (!request()->address || request()->address > max_address ||
+      request()->cv < 1 || request()->cv > 1024)
+  {
+    return return_with_error(openlcb::Defs::ERROR_INVALID_ARGS);
+  }
+  // tag zero is used by packets without a tag.
+  tag_ = (tag_ % DCC_FEEDBACK_KEY_TAG_MAX) + 1;
+  return call_immediately(STATE(send_read));
+}
+
+StateFlowBase::Action RailComPomEngine::send_read()
+{
+  if (request()->attempts >= config_railcom_pom_attempts())
+  {
+    LOG(VERBOSE, "[RailCom] No POM response from %d for CV %d after %d "
+                 "attempts",
+        request()->address, request()->cv, request()->attempts);
+    return return_with_error(RailComPomRequest::ERROR_NO_RESPONSE);
+  }
+  request()->attempts++;
+
+  dcc::TrackIf::message_type *pkt;
+  mainBufferPool->alloc(&pkt);
+  dcc::Packet *packet = pkt->data();
+  if (request()->is_long)
+  {
+    packet->add_dcc_address(dcc::DccLongAddress(request()->address));
+  }
+  else
+  {
+    packet->add_dcc_address(dcc::DccShortAddress(request()->address));
+  }
+  // the CV number in the packet is zero based.
+  packet->add_dcc_pom_read1(request()->cv - 1);
+  // S-9.2.1 requires two identical POM packets before the decoder acts on
+  // them.
+  packet->packet_header.rept_count = 1;
+  packet->feedback_key = dcc_packet_feedback_key(*packet, tag_);
+
+  LOG(VERBOSE, "[RailCom] Reading CV %d from %d (attempt %d)",
+      request()->cv, request()->address, request()->attempts);
+  pending_ = true;
+  responded_ = false;
+  track_->send(pkt);
+  return sleep_and_call(&timer_, MSEC_TO_NSEC(config_railcom_pom_timeout_ms()),
+                        STATE(response_timeout));
+}
+
+StateFlowBase::Action RailComPomEngine::response_timeout()
+{
+  pending_ = false;
+  if (!responded_)
+  {
+    return call_immediately(STATE(send_read));
+  }
+  if (request()->verify && request()->value != response_)
+  {
+    request()->value = response_;
+    return return_with_error(RailComPomRequest::ERROR_VERIFY_FAILED);
+  }
+  request()->value = response_;
+  return return_ok();
+}
+
+} // namespace esp32cs
@@ -15,9 +15,12 @@ COPYRIGHT (c) 2021 Mike Dunston
   along with this program.  If not, see http://www.gnu.org/licenses
 **********************************************************************/
 
+#include "RailComFeedback.hxx"
 #include "TrackOutputDescriptor.hxx"
 
 #include <executor/Service.hxx>
+#include <functional>
+#include <string>
 
 namespace openlcb
 {
@@ -32,4 +35,79 @@ void init_dcc(openlcb::Node *node, Service *service,
 
 void shutdown_dcc();
 
+/// Requests the track monitor to re-evaluate the state of the OPS track
+/// output, this must be called after changing the disable reasons of the
+/// OPS track output.
+void track_state_changed();
+
+/// @return JSON object describing the state of the OPS track output.
+std::string get_track_status_json();
+
+/// Registers a listener for OPS track output state changes.
+///
+/// @param listener is invoked on the OpenMRN executor with the JSON object
+/// from @ref get_track_status_json after each state change.
+void set_track_status_listener(
+  std::function<void(const std::string &)> listener);
+
+/// @return JSON document containing the DCC signal generation telemetry for
+/// all districts.
+std::string get_dcc_stats_json();
+
+#if CONFIG_DCC_RMT_TRACE
+/// @return the DCC packet trace for a district in binary form or an empty
+/// string if the district does not exist.
+///
+/// @param district is the index of the district.
+///
+/// The trace starts with a 12 byte header: "DCCT", format version, record
+/// size, district index, reserved and the number of records (uint32_t). The
+/// records follow the header oldest first, see DccTraceRecord for the
+/// layout. All values are little endian.
+std::string get_dcc_trace(uint8_t district);
+#endif // CONFIG_DCC_RMT_TRACE
+
+/// Retrieves the decoded RailCom feedback for a DCC address.
+///
+/// @param address is the DCC address to retrieve.
+/// @param is_long is true if @param address is a 14-bit (long) address.
+/// @param feedback will receive the feedback for the address.
+///
+/// @return true if RailCom feedback has been received for the address.
+bool get_railcom_feedback(uint16_t address, bool is_long,
+                          RailComFeedback *feedback);
+
+/// @return JSON array containing the decoded RailCom feedback for a DCC
+/// address or for all addresses when @param address is zero. The short and
+/// long address with the same number are both included.
+std::string get_railcom_feedback_json(uint16_t address = 0);
+
+/// Reads a CV from a decoder on the main track using a RailCom POM read.
+///
+/// @param address is the DCC address of the decoder.
+/// @param is_long is true if @param address is a 14-bit (long) address.
+/// @param cv is the CV number to read (1-1024).
+/// @param value will receive the CV value reported by the decoder.
+///
+/// @return true if the decoder responded, false if no response was received
+/// or RailCom is not enabled.
+///
+/// NOTE: This blocks the calling thread until the decoder responds or all
+/// attempts time out, it must not be called on the OpenMRN executor.
+bool read_pom_cv(uint16_t address, bool is_long, uint16_t cv,
+                 uint8_t *value);
+
+/// Verifies a CV of a decoder on the main track using a RailCom POM read.
+///
+/// @param address is the DCC address of the decoder.
+/// @param is_long is true if @param address is a 14-bit (long) address.
+/// @param cv is the CV number to verify (1-1024).
+/// @param value is the expected value of the CV.
+///
+/// @return true if the decoder reported the expected value.
+///
+/// NOTE: This blocks the calling thread, see @ref read_pom_cv.
+bool verify_pom_cv(uint16_t address, bool is_long, uint16_t cv,
+                   uint8_t value);
+
 } // namespace esp32cs
\ No newline at end of file
@@ -0,0 +1,75 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+#ifndef RAILCOM_FEEDBACK_HXX_
+#define RAILCOM_FEEDBACK_HXX_
+
+#include <stdint.h>
+
+namespace esp32cs
+{
+
+/// Decoded RailCom feedback for a single DCC decoder address.
+///
+/// All timestamps are in milliseconds since boot (truncated to 32 bits), a
+/// timestamp of zero indicates the value has not been received.
+struct RailComFeedback
+{
+  /// DCC address of the decoder the feedback was received for.
+  uint16_t address;
+
+  /// True if @ref address is a 14-bit (long) address, short address N and
+  /// long address N are different decoders.
+  bool long_address;
+
+  /// Last address broadcast received on channel 1 after a packet for
+  /// @ref address.
+  uint16_t ch1_address;
+
+  /// True if @ref ch1_address is a 14-bit (long) address.
+  bool ch1_long_address;
+
+  /// Last speed reported by the decoder, in km/h.
+  uint16_t speed;
+
+  /// Last quality of service (receive statistics) reported by the decoder,
+  /// in percent.
+  uint8_t qos;
+
+  /// Last CV value reported by the decoder in response to a POM read.
+  uint8_t cv_value;
+
+  /// Time when @ref ch1_address was received.
+  uint32_t ch1_ms;
+
+  /// Time when @ref speed was received.
+  uint32_t speed_ms;
+
+  /// Time when @ref qos was received.
+  uint32_t qos_ms;
+
+  /// Time when @ref cv_value was received.
+  uint32_t cv_ms;
+
+  /// Time when an ACK was last received.
+  uint32_t ack_ms;
+
+  /// Time when any feedback was last received.
+  uint32_t last_ms;
+
+  /// Number of cut-outs where data was received for this address.
+  uint32_t responses;
+
+  /// Number of cut-outs where the data received for this address could not
+  /// be decoded.
+  uint32_t errors;
+};
+
+} // namespace esp32cs
+
+#endif // RAILCOM_FEEDBACK_HXX_
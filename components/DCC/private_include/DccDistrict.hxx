@@ -0,0 +1,272 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+#ifndef DCC_DISTRICT_HXX_
+#define DCC_DISTRICT_HXX_
+
+#include "sdkconfig.h"
+#include "PrioritizedUpdateLoop.hxx"
+#include "RMTTrackDevice.hxx"
+#include "RMTTrackIf.hxx"
+
+#include <esp_vfs.h>
+#include <executor/PoolToQueueFlow.hxx>
+#include <utils/StringPrintf.hxx>
+#include <utils/Uninitialized.hxx>
+#include <utils/logging.h>
+
+namespace esp32cs
+{
+
+/// Hardware agnostic interface of a DCC power district.
+class DccDistrictBase
+{
+public:
+  /// @return the index of this district.
+  uint8_t index()
+  {
+    return index_;
+  }
+
+  /// @return the @ref PrioritizedUpdateLoop which generates the packets for
+  /// this district.
+  virtual PrioritizedUpdateLoop *update_loop() = 0;
+
+  /// @return the track interface for this district.
+  virtual dcc::TrackIf *track() = 0;
+
+  /// @return the telemetry counters of the RMT signal generator.
+  virtual const RMTTrackDeviceStats &device_stats() = 0;
+
+  /// Selects the EMC spectrum spreading pattern for the DCC signal.
+  ///
+  /// @param spread is the @ref DccEmcSpread pattern to use.
+  virtual void set_emc_spread(DccEmcSpread spread) = 0;
+
+  /// Sends a broadcast emergency stop to the track ahead of all pending
+  /// packets.
+  virtual void emergency_stop() = 0;
+
+  /// Clears the emergency stop state.
+  virtual void clear_emergency_stop() = 0;
+
+#if CONFIG_DCC_RMT_TRACE
+  /// Copies the most recently transmitted packets from the packet trace.
+  ///
+  /// @param records is the buffer to receive the records, oldest first.
+  /// @param count is the maximum number of records to copy.
+  ///
+  /// @return the number of records copied.
+  virtual size_t trace_snapshot(DccTraceRecord *records, size_t count) = 0;
+#endif // CONFIG_DCC_RMT_TRACE
+
+  /// RMT transmit complete callback.
+  ///
+  /// @param channel is the RMT channel that has completed transmission.
+  ///
+  /// NOTE: this is called from the ISR context.
+  virtual void rmt_transmit_complete(rmt_channel_t channel) = 0;
+
+protected:
+  /// Constructor.
+  ///
+  /// @param index is the index of this district.
+  DccDistrictBase(uint8_t index) : index_(index)
+  {
+  }
+
+  /// Index of this district.
+  const uint8_t index_;
+};
+
+/// A DCC power district is a single DCC signal generated by one RMT channel
+/// along with the VFS node, track interface, update loop and packet queue that
+/// feed it. Each district generates its packet stream independently of other
+/// districts.
+///
+/// Packets generated by the update loop are handed directly to the RMT signal
+/// generator via @ref RMTTrackIf, the VFS node is only used by external
+/// writers.
+template <class HW, class DCC_BOOSTER, class OLCB_DCC_BOOSTER>
+class DccDistrict : public DccDistrictBase
+{
+public:
+  /// Constructor.
+  ///
+  /// @param index is the index of this district, index zero will use
+  /// CONFIG_DCC_VFS_MOUNT_POINT as the VFS mount point and other districts
+  /// will have their index appended to it.
+  /// @param railcomDriver @ref RailcomDriver instance to use for cut-out
+  /// generation.
+  DccDistrict(uint8_t index, RailcomDriver *railcomDriver)
+    : DccDistrictBase(index), device_(railcomDriver)
+  {
+  }
+
+  /// Initializes the VFS node, RMT signal generator and packet flow for this
+  /// district.
+  ///
+  /// @param service is the @ref Service to use for the packet flows.
+  void hw_init(Service *service)
+  {
+    if (index_)
+    {
+      mountPoint_ = StringPrintf("%s%d", CONFIG_DCC_VFS_MOUNT_POINT, index_);
+    }
+    else
+    {
+      mountPoint_ = CONFIG_DCC_VFS_MOUNT_POINT;
+    }
+
+    // register the VFS handler for external writers, packets from the update
+    // loop bypass the VFS.
+    esp_vfs_t vfs;
+    memset(&vfs, 0, sizeof(vfs));
+    vfs.flags = ESP_VFS_FLAG_CONTEXT_PTR;
+    vfs.ioctl_p = vfs_ioctl;
+    vfs.open_p = vfs_open;
+    vfs.close_p = vfs_close;
+    vfs.write_p = vfs_write;
+
+    LOG(INFO, "[Track:%d] Registering %s VFS interface", index_,
+        mountPoint_.c_str());
+    ESP_ERROR_CHECK(esp_vfs_register(mountPoint_.c_str(), &vfs, this));
+
+    // Initialize the RMT signal generator.
+    device_.hw_init();
+
+    trackIf_.emplace(service, &device_, CONFIG_DCC_PACKET_POOL_SIZE);
+    updateLoop_.emplace(service, trackIf_.operator->());
+
+    // Attach the DCC update loop to the track interface
+    flow_.emplace(service, trackIf_->pool(), updateLoop_.operator->());
+  }
+
+  PrioritizedUpdateLoop *update_loop() override
+  {
+    return updateLoop_.operator->();
+  }
+
+  dcc::TrackIf *track() override
+  {
+    return trackIf_.operator->();
+  }
+
+  const RMTTrackDeviceStats &device_stats() override
+  {
+    return device_.stats();
+  }
+
+  void set_emc_spread(DccEmcSpread spread) override
+  {
+    device_.set_emc_spread(spread);
+  }
+
+  void emergency_stop() override
+  {
+    device_.emergency_stop();
+  }
+
+  void clear_emergency_stop() override
+  {
+    device_.clear_emergency_stop();
+  }
+
+#if CONFIG_DCC_RMT_TRACE
+  size_t trace_snapshot(DccTraceRecord *records, size_t count) override
+  {
+    return device_.trace_snapshot(records, count);
+  }
+#endif // CONFIG_DCC_RMT_TRACE
+
+  void rmt_transmit_complete(rmt_channel_t channel) override
+  {
+    if (channel == HW::RMT_CHANNEL)
+    {
+      device_.rmt_transmit_complete();
+    }
+  }
+
+private:
+  /// RMT signal generator for this district.
+  RMTTrackDevice<HW, DCC_BOOSTER, OLCB_DCC_BOOSTER> device_;
+
+  /// VFS mount point for this district.
+  std::string mountPoint_;
+
+  /// Track interface which hands packets to @ref device_.
+  uninitialized<RMTTrackIf<RMTTrackDevice<HW, DCC_BOOSTER, OLCB_DCC_BOOSTER>>>
+    trackIf_;
+
+  /// Update loop which generates the packets for this district.
+  uninitialized<PrioritizedUpdateLoop> updateLoop_;
+
+  /// Flow which feeds empty packets from @ref trackIf_ to @ref updateLoop_.
+  uninitialized<PoolToQueueFlow<Buffer<dcc::Packet>>> flow_;
+
+  /// ESP32 VFS ::write() impl for the district.
+  ///
+  /// @param ctx is the @ref DccDistrict instance.
+  /// @param fd is the file descriptor being written to.
+  /// @param data is the data to write.
+  /// @param size is the size of data.
+  /// @returns number of bytes written.
+  static ssize_t vfs_write(void *ctx, int fd, const void *data, size_t size)
+  {
+    return reinterpret_cast<DccDistrict *>(ctx)->device_.write(fd, data, size);
+  }
+
+  /// ESP32 VFS ::open() impl for the district.
+  ///
+  /// @param ctx is the @ref DccDistrict instance.
+  /// @param path is the file location to be opened.
+  /// @param flags is not used.
+  /// @param mode is not used.
+  ///
+  /// @returns file descriptor for the opened file location.
+  static int vfs_open(void *ctx, const char *path, int flags, int mode)
+  {
+    int fd = HW::RMT_CHANNEL;
+    LOG(INFO, "[Track:%d] Connecting track interface (fd:%d)",
+        reinterpret_cast<DccDistrict *>(ctx)->index_, fd);
+    return fd;
+  }
+
+  /// ESP32 VFS ::close() impl for the district.
+  ///
+  /// @param ctx is the @ref DccDistrict instance.
+  /// @param fd is the file descriptor to close.
+  ///
+  /// @returns the status of the close() operation, only returns zero.
+  static int vfs_close(void *ctx, int fd)
+  {
+    LOG(INFO, "[Track:%d] Disconnecting track interface (fd:%d)",
+        reinterpret_cast<DccDistrict *>(ctx)->index_, fd);
+    return 0;
+  }
+
+  /// ESP32 VFS ::ioctl() impl for the district.
+  ///
+  /// @param ctx is the @ref DccDistrict instance.
+  /// @param fd is the file descriptor to operate on.
+  /// @param cmd is the ioctl command to execute.
+  /// @param args are the arguments to ioctl.
+  ///
+  /// @returns the result of the ioctl command, zero on success, non-zero will
+  /// set errno.
+  static int vfs_ioctl(void *ctx, int fd, int cmd, va_list args)
+  {
+    return reinterpret_cast<DccDistrict *>(ctx)->device_.ioctl(fd, cmd, args);
+  }
+
+  DISALLOW_COPY_AND_ASSIGN(DccDistrict);
+};
+
+} // namespace esp32cs
+
+#endif // DCC_DISTRICT_HXX_
@@ -0,0 +1,266 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+#ifndef DCC_PACKET_CLASS_HXX_
+#define DCC_PACKET_CLASS_HXX_
+
+#include <dcc/Packet.hxx>
+#include <stdint.h>
+
+namespace esp32cs
+{
+
+/// Value used for packets which are not directed at a single multi-function
+/// decoder address.
+static constexpr uint16_t DCC_BROADCAST_ADDRESS = 0xFFFF;
+
+/// Flag set in the addresses returned by @ref dcc_packet_address for 14-bit
+/// (long) multi-function decoder addresses. Short address N and long address
+/// N are different decoders, the flag keeps them apart in the supersede and
+/// feedback keys.
+static constexpr uint16_t DCC_LONG_ADDRESS_FLAG = 0x8000;
+
+/// @return the address value to use for a multi-function decoder in the
+/// supersede and feedback keys.
+///
+/// @param address is the DCC address (1-127 for short addresses, 1-10239 for
+/// long addresses).
+/// @param is_long is true if @param address is a 14-bit (long) address.
+static inline uint16_t dcc_address_key(uint16_t address, bool is_long)
+{
+  return is_long ? (address | DCC_LONG_ADDRESS_FLAG) : address;
+}
+
+/// @return the DCC address number without @ref DCC_LONG_ADDRESS_FLAG.
+///
+/// @param address is the address from @ref dcc_packet_address.
+static inline uint16_t dcc_address_number(uint16_t address)
+{
+  return address & ~DCC_LONG_ADDRESS_FLAG;
+}
+
+/// Classification of a multi-function decoder packet based on the instruction
+/// byte. Two packets with the same address and class (other than
+/// @ref DccPacketClass::OTHER and @ref DccPacketClass::POM) carry the same
+/// decoder state and a newer packet fully replaces the older one.
+enum class DccPacketClass : uint8_t
+{
+  /// Packet that can not be superseded (consist, broadcast, etc).
+  OTHER,
+
+  /// 14, 28 or 128 speed step packet.
+  SPEED,
+
+  /// Function group one (F0-F4).
+  FUNCTION_F0_F4,
+
+  /// Function group two (F5-F8).
+  FUNCTION_F5_F8,
+
+  /// Function group two (F9-F12).
+  FUNCTION_F9_F12,
+
+  /// Feature expansion (F13-F20).
+  FUNCTION_F13_F20,
+
+  /// Feature expansion (F21-F28).
+  FUNCTION_F21_F28,
+
+  /// Configuration variable access on the main track (POM, XPOM), these
+  /// can not be superseded.
+  POM,
+};
+
+/// @return the DCC address of a packet or @ref DCC_BROADCAST_ADDRESS if the
+/// packet is not directed at a single multi-function decoder. Long addresses
+/// have @ref DCC_LONG_ADDRESS_FLAG set.
+///
+/// @param packet is the packet to decode.
+static inline uint16_t dcc_packet_address(const dcc::Packet &packet)
+{
+  if (packet.dlc < 2 || packet.packet_header.is_marklin)
+  {
+    return DCC_BROADCAST_ADDRESS;
+  }
+  const uint8_t first = packet.payload[0];
+  if (first >= 1 && first <= 127)
+  {
+    // Multi-function decoder with 7-bit address.
+    return first;
+  }
+  else if (first >= 192 && first <= 231)
+  {
+    // Multi-function decoder with 14-bit address.
+    return dcc_address_key(((first & 0x3F) << 8) | packet.payload[1], true);
+  }
+  // Broadcast, accessory, reserved and idle packets.
+  return DCC_BROADCAST_ADDRESS;
+}
+
+/// @return the @ref DccPacketClass of a packet.
+///
+/// @param packet is the packet to decode.
+static inline DccPacketClass dcc_packet_class(const dcc::Packet &packet)
+{
+  if (packet.packet_header.send_long_preamble)
+  {
+    // service mode packets must always be sent as-is.
+    return DccPacketClass::OTHER;
+  }
+  uint16_t address = dcc_packet_address(packet);
+  if (address == DCC_BROADCAST_ADDRESS)
+  {
+    return DccPacketClass::OTHER;
+  }
+  // instruction byte follows the one or two address bytes, the last byte of
+  // the packet is the checksum.
+  uint8_t index = packet.payload[0] >= 192 ? 2 : 1;
+  if (index + 1 >= packet.dlc)
+  {
+    return DccPacketClass::OTHER;
+  }
+  const uint8_t instruction = packet.payload[index];
+  if ((instruction & 0xC0) == 0x40 || instruction == 0x3F)
+  {
+    return DccPacketClass::SPEED;
+  }
+  else if ((instruction & 0xE0) == 0x80)
+  {
+    return DccPacketClass::FUNCTION_F0_F4;
+  }
+  else if ((instruction & 0xF0) == 0xB0)
+  {
+    return DccPacketClass::FUNCTION_F5_F8;
+  }
+  else if ((instruction & 0xF0) == 0xA0)
+  {
+    return DccPacketClass::FUNCTION_F9_F12;
+  }
+  else if (instruction == 0xDE)
+  {
+    return DccPacketClass::FUNCTION_F13_F20;
+  }
+  else if (instruction == 0xDF)
+  {
+    return DccPacketClass::FUNCTION_F21_F28;
+  }
+  else if ((instruction & 0xF0) == 0xE0)
+  {
+    return DccPacketClass::POM;
+  }
+  return DccPacketClass::OTHER;
+}
+
+/// @return key which identifies packets that supersede each other, zero if
+/// the packet can not be superseded by a newer packet.
+///
+/// @param packet is the packet to decode.
+static inline uint32_t dcc_packet_supersede_key(const dcc::Packet &packet)
+{
+  DccPacketClass pkt_class = dcc_packet_class(packet);
+  if (pkt_class == DccPacketClass::OTHER || pkt_class == DccPacketClass::POM)
+  {
+    return 0;
+  }
+  return ((uint32_t)dcc_packet_address(packet) << 8) | (uint8_t)pkt_class;
+}
+
+/// Marker in the upper byte of the feedback keys generated by
+/// @ref dcc_packet_feedback_key. Packet sources may set their own feedback
+/// key to match the RailCom response to a packet (OpenMRN uses the address of
+/// the waiting flow), the marker keeps the generated keys apart from those.
+static constexpr uint32_t DCC_FEEDBACK_KEY_MARKER = 0xDC000000;
+
+/// Bits of a generated feedback key holding the @ref DccPacketClass.
+static constexpr uint32_t DCC_FEEDBACK_KEY_CLASS_MASK = 0x0F;
+
+static_assert((uint8_t)DccPacketClass::POM <= DCC_FEEDBACK_KEY_CLASS_MASK,
+              "DccPacketClass does not fit in the feedback key");
+
+/// Position of the tag in a generated feedback key, see
+/// @ref dcc_packet_feedback_key.
+static constexpr uint8_t DCC_FEEDBACK_KEY_TAG_SHIFT = 4;
+
+/// Largest tag that can be carried by a generated feedback key.
+static constexpr uint8_t DCC_FEEDBACK_KEY_TAG_MAX = 0x0F;
+
+/// @return the RailCom feedback key for a packet.
+///
+/// The feedback key carries the DCC address and @ref DccPacketClass of the
+/// packet so that the RailCom data received in the cut-out which follows the
+/// packet can be attributed to a decoder without a lookup, see
+/// @ref dcc_feedback_key_address. This is used for packets where the source
+/// did not set a feedback key.
+///
+/// @param packet is the packet to decode.
+/// @param tag is an optional value (up to @ref DCC_FEEDBACK_KEY_TAG_MAX)
+/// which a packet source can include to recognise the cut-out following its
+/// own packet, zero for packets without a tag.
+static inline uint32_t dcc_packet_feedback_key(const dcc::Packet &packet,
+                                               uint8_t tag = 0)
+{
+  return DCC_FEEDBACK_KEY_MARKER |
+         ((uint32_t)dcc_packet_address(packet) << 8) |
+         ((uint32_t)(tag & DCC_FEEDBACK_KEY_TAG_MAX) <<
+            DCC_FEEDBACK_KEY_TAG_SHIFT) |
+         (uint8_t)dcc_packet_class(packet);
+}
+
+/// @return true if a feedback key was generated by
+/// @ref dcc_packet_feedback_key, false if it was set by the packet source.
+///
+/// @param key is the feedback key of the packet.
+static inline bool dcc_feedback_key_is_generated(uint32_t key)
+{
+  return (key & 0xFF000000) == DCC_FEEDBACK_KEY_MARKER;
+}
+
+/// @return the DCC address encoded in a RailCom feedback key or
+/// @ref DCC_BROADCAST_ADDRESS if the packet which preceded the cut-out was
+/// not directed at a single multi-function decoder or the key was set by the
+/// packet source. Long addresses have @ref DCC_LONG_ADDRESS_FLAG set.
+///
+/// @param key is the feedback key of the packet.
+static inline uint16_t dcc_feedback_key_address(uint32_t key)
+{
+  if (!dcc_feedback_key_is_generated(key))
+  {
+    return DCC_BROADCAST_ADDRESS;
+  }
+  return (key >> 8) & 0xFFFF;
+}
+
+/// @return the @ref DccPacketClass encoded in a RailCom feedback key or
+/// @ref DccPacketClass::OTHER if the key was set by the packet source.
+///
+/// @param key is the feedback key of the packet.
+static inline DccPacketClass dcc_feedback_key_class(uint32_t key)
+{
+  if (!dcc_feedback_key_is_generated(key))
+  {
+    return DccPacketClass::OTHER;
+  }
+  return (DccPacketClass)(key & DCC_FEEDBACK_KEY_CLASS_MASK);
+}
+
+/// @return the tag encoded in a RailCom feedback key, zero if the key has no
+/// tag or was set by the packet source.
+///
+/// @param key is the feedback key of the packet.
+static inline uint8_t dcc_feedback_key_tag(uint32_t key)
+{
+  if (!dcc_feedback_key_is_generated(key))
+  {
+    return 0;
+  }
+  return (key >> DCC_FEEDBACK_KEY_TAG_SHIFT) & DCC_FEEDBACK_KEY_TAG_MAX;
+}
+
+} // namespace esp32cs
+
+#endif // DCC_PACKET_CLASS_HXX_
@@ -0,0 +1,133 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+#ifndef DISTRICT_ROUTER_HXX_
+#define DISTRICT_ROUTER_HXX_
+
+#include "DccDistrict.hxx"
+#include "DccPacketClass.hxx"
+
+#include <dcc/Packet.hxx>
+#include <dcc/TrackIf.hxx>
+#include <dcc/UpdateLoop.hxx>
+#include <map>
+#include <Spinlock.hxx>
+#include <vector>
+
+namespace esp32cs
+{
+
+/// Routes packet sources and outbound packets to the @ref DccDistrict which
+/// owns the DCC address of the packet source. This is the single
+/// @ref dcc::UpdateLoopBase instance for the command station, all calls to
+/// packet_processor_add_refresh_source() and related functions will be routed
+/// through this class to the per-district @ref PrioritizedUpdateLoop.
+///
+/// Packet sources for an address that has not been explicitly assigned to a
+/// district will be owned by the first district. Exclusive packet sources
+/// (e-stop) and broadcast packets are sent to all districts. When there is only
+/// a single district everything is routed to it without any lookups.
+class DistrictRouter : public dcc::UpdateLoopBase, public dcc::TrackIf
+{
+public:
+  /// Constructor.
+  ///
+  /// @param districts are the districts to route packets to.
+  DistrictRouter(std::vector<DccDistrictBase *> districts);
+
+  /// Adds a new refresh source to the district that owns the address of the
+  /// source.
+  ///
+  /// @param source is the packet source to add.
+  /// @param priority is the priority to send the packet(s) out with.
+  /// @return true if the packet source was added, false otherwise.
+  bool add_refresh_source(dcc::PacketSource *source, unsigned priority) override;
+
+  /// Deletes a packet refresh source from the district(s) it was added to.
+  ///
+  /// @param source is the packet source to be removed.
+  void remove_refresh_source(dcc::PacketSource *source) override;
+
+  /// Forwards the update notification to the district that owns the source.
+  ///
+  /// @param source is the packet source being updated.
+  /// @param code is the type of update, see @ref dcc::DccTrainUpdateCode for
+  /// supported values.
+  void notify_update(dcc::PacketSource *source, unsigned code) override;
+
+  /// Sends a single packet to the district that owns the address of the
+  /// packet, broadcast and accessory packets are sent to all districts. The
+  /// packet is queued in the update loop of the district so that it shares
+  /// the track bandwidth with other traffic based on its traffic class.
+  ///
+  /// @param packet is the packet to send.
+  /// @param priority is not used.
+  void send(Buffer<dcc::Packet> *packet, unsigned priority = UINT_MAX) override;
+
+  /// Assigns a DCC address to a district, any packet sources for the address
+  /// will be moved to the new district.
+  ///
+  /// @param address is the DCC address to assign, long addresses must have
+  /// @ref DCC_LONG_ADDRESS_FLAG set (see @ref dcc_address_key).
+  /// @param district is the index of the district which owns the address.
+  void set_address_district(uint16_t address, uint8_t district);
+
+  /// @return the number of districts.
+  size_t size()
+  {
+    return districts_.size();
+  }
+
+private:
+  /// Value used for sources that are sent to all districts.
+  static constexpr uint8_t ALL_DISTRICTS = 0xFF;
+
+  /// Tracking data for a registered packet source.
+  struct SourceOwner
+  {
+    /// DCC address of the packet source.
+    uint16_t address;
+
+    /// Index of the district that owns the packet source or
+    /// @ref ALL_DISTRICTS.
+    uint8_t district;
+
+    /// Priority of the packet source.
+    unsigned priority;
+  };
+
+  /// Districts to route packets to.
+  std::vector<DccDistrictBase *> districts_;
+
+  /// Registered packet sources and their owning district.
+  std::map<dcc::PacketSource *, SourceOwner> sources_;
+
+  /// Explicit address to district assignments.
+  std::map<uint16_t, uint8_t> addressDistrict_;
+
+  /// Lock protecting @ref sources_ and @ref addressDistrict_.
+  Spinlock lock_;
+
+  /// @return the DCC address of a packet source or
+  /// @ref DCC_BROADCAST_ADDRESS if the source does not generate packets for a
+  /// single DCC address.
+  ///
+  /// @param source is the packet source to look up.
+  static uint16_t source_address(dcc::PacketSource *source);
+
+  /// @return the district index for the provided address.
+  ///
+  /// @param address is the address to look up.
+  ///
+  /// NOTE: @ref lock_ must be held by the caller.
+  uint8_t district_for_address_locked(uint16_t address);
+};
+
+} // namespace esp32cs
+
+#endif // DISTRICT_ROUTER_HXX_
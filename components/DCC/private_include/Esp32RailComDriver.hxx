@@ -18,6 +18,7 @@ COPYRIGHT (c) 2020 Mike Dunston
 #ifndef ESP32_RAILCOM_DRIVER_HXX_
 #define ESP32_RAILCOM_DRIVER_HXX_
 
+#include <atomic>
 #include <dcc/RailCom.hxx>
 #include <dcc/RailcomHub.hxx>
 #include <esp_intr_alloc.h>
@@ -30,7 +31,7 @@ COPYRIGHT (c) 2020 Mike Dunston
 #elif CONFIG_IDF_TARGET_ESP32S3
 #include <esp32s3/clk.h>
 #endif // IDF v5+
-#include <freertos_drivers/arduino/DeviceBuffer.hxx>
+#include <executor/StateFlow.hxx>
 #include <freertos_drivers/arduino/RailcomDriver.hxx>
 #include <hal/uart_types.h>
 #include <os/Gpio.hxx>
@@ -39,8 +40,12 @@ COPYRIGHT (c) 2020 Mike Dunston
 #include <soc/timer_periph.h>
 #include <soc/uart_periph.h>
 #include <stdint.h>
+#include <utils/Uninitialized.hxx>
 #include <utils/logging.h>
 
+#include "RailComCutout.hxx"
+#include "SpscRing.hxx"
+
 namespace esp32cs
 {
 
@@ -58,13 +63,58 @@ static constexpr uint32_t ESP32_UART_DISABLE_ALL_INTERRUPTS = 0x00000000;
 static constexpr uint32_t ESP32_UART_RX_INTERRUPT_BITS =
   UART_RXFIFO_FULL_INT_ENA | UART_RXFIFO_TOUT_INT_ENA;
 
+/// Raw bytes received during a single RailCom cut-out.
+struct RailComCapture
+{
+  /// Feedback key of the DCC packet which preceded the cut-out.
+  uint32_t feedback_key;
+
+  /// Number of bytes received in the channel 1 window.
+  uint8_t ch1_count;
+
+  /// Number of bytes received in the channel 2 window.
+  uint8_t ch2_count;
+
+  /// Number of bytes which did not fit in @ref ch1 or @ref ch2.
+  uint8_t discarded;
+
+  /// True if the cut-out before this one could not be captured.
+  bool after_overrun;
+
+  /// Bytes received in the channel 1 window.
+  uint8_t ch1[2];
+
+  /// Bytes received in the channel 2 window.
+  uint8_t ch2[6];
+};
+
+/// Telemetry counters of the RailCom receiver.
+struct RailComCaptureStats
+{
+  /// Number of cut-outs captured.
+  uint32_t captures{0};
+
+  /// Number of cut-outs where no data was received.
+  uint32_t no_response{0};
+
+  /// Number of cut-outs which could not be captured due to the capture ring
+  /// being full.
+  uint32_t overruns{0};
+
+  /// Number of received bytes which are not valid 4-of-8 codes.
+  uint32_t invalid_bytes{0};
+
+  /// Number of received bytes which exceeded the channel length.
+  uint32_t discarded_bytes{0};
+};
+
 template <class HW, class DCC_BOOSTER, class OLCB_DCC_BOOSTER>
 class Esp32RailComDriver : public RailcomDriver
 {
 public:
   Esp32RailComDriver()
-    : railComFeedbackBuffer_(DeviceBuffer<dcc::RailcomHubData>::create(HW::PACKET_Q_SIZE))
   {
+    captureRing_.init(captures_);
   }
 
   void hw_init(dcc::RailcomHubFlow *hubFlow)
@@ -72,6 +122,7 @@ public:
     railComHubFlow_ = hubFlow;
 
 #if CONFIG_RAILCOM_DATA_ENABLED
+    decodeFlow_.emplace(this);
     HW::hw_init();
     LOG(INFO, "[RailCom] Initializing detector using UART %d", HW::UART);
     portENTER_CRITICAL_SAFE(&esp32_uart_mux);
@@ -118,30 +169,22 @@ public:
     // NOOP
   }
 
+  /// Starts the RailCom cut-out.
+  ///
+  /// This disables the track outputs and arms the hardware timer, the rest of
+  /// the cut-out (detector enable, channel 1 and 2 windows and detector
+  /// disable) is driven by the timer alarm chain in @ref timer_tick so that
+  /// the RMT ISR does not need to busy-wait for the booster delays.
+  ///
+  /// The RMT transmission of the next packet starts as soon as this returns
+  /// so the whole cut-out, including the booster start delays, overlaps the
+  /// next preamble. RMTTrackDevice extends the preamble to compensate.
+  ///
+  /// NOTE: this is called from the RMT ISR context.
   void start_cutout() override
   {
-    ets_delay_us(DCC_BOOSTER::start_railcom_cutout_phase1() +
-                 OLCB_DCC_BOOSTER::start_railcom_cutout_phase1());
-
-#if CONFIG_RAILCOM_DATA_ENABLED
-    portENTER_CRITICAL_SAFE(&esp32_uart_mux);
-    // flush the uart queue of any pending data
-    rx_to_buf(nullptr, 0);
-
-    // clear all pending interrupts and enable default RX interrupts.
-    SET_PERI_REG_MASK(UART_INT_CLR_REG(HW::UART), ESP32_UART_RX_INTERRUPT_BITS);
-    SET_PERI_REG_MASK(UART_INT_ENA_REG(HW::UART), ESP32_UART_RX_INTERRUPT_BITS);
-    portEXIT_CRITICAL_SAFE(&esp32_uart_mux);
-#endif // CONFIG_RAILCOM_DATA_ENABLED
-
-    // enable the RailCom detector
-    ets_delay_us(DCC_BOOSTER::start_railcom_cutout_phase2() + 
-                 OLCB_DCC_BOOSTER::start_railcom_cutout_phase2());
-
     portENTER_CRITICAL_SAFE(&esp32_timer_mux);
-    // set our phase and start the timer
-    railcomPhase_ = RailComPhase::CUTOUT_PHASE1;
-    start_timer(HW::RAILCOM_MAX_READ_DELAY_CH_1);
+    start_timer(cutout_.start());
     portEXIT_CRITICAL_SAFE(&esp32_timer_mux);
   }
 
@@ -157,26 +200,11 @@ public:
 
   void end_cutout() override
   {
-#if CONFIG_RAILCOM_DATA_ENABLED
-    portENTER_CRITICAL_SAFE(&esp32_uart_mux);
-    // disable the UART RX interrupts
-    HW::UART_BASE->int_clr.val = ESP32_UART_CLEAR_ALL_INTERRUPTS;
-    HW::UART_BASE->int_ena.val = ESP32_UART_DISABLE_ALL_INTERRUPTS;
-    portEXIT_CRITICAL_SAFE(&esp32_uart_mux);
-#endif // CONFIG_RAILCOM_DATA_ENABLED
-    // disable the RailCom detector
-    ets_delay_us(DCC_BOOSTER::stop_railcom_cutout_phase1() +
-                 OLCB_DCC_BOOSTER::stop_railcom_cutout_phase1());
-    DCC_BOOSTER::stop_railcom_cutout_phase2();
-    OLCB_DCC_BOOSTER::stop_railcom_cutout_phase2();
-    if (DCC_BOOSTER::should_be_enabled())
-    {
-      DCC_BOOSTER::enable_output();
-    }
-    if (OLCB_DCC_BOOSTER::should_be_enabled())
-    {
-      OLCB_DCC_BOOSTER::enable_output();
-    }
+    // the cut-out is ended by the timer alarm chain, this is only used when
+    // the cut-out needs to be ended immediately.
+    end_capture();
+    ets_delay_us(cutout_.stop_detector());
+    cutout_.stop();
   }
 
   void set_feedback_key(uint32_t key) override
@@ -184,53 +212,107 @@ public:
     railcomFeedbackKey_ = key;
   }
 
+  /// Advances the RailCom cut-out state machine, this is called when the
+  /// hardware timer alarm fires.
+  ///
+  /// The phases and the booster calls are handled by
+  /// @ref RailComCutoutSequencer, this only handles the RailCom receiver at
+  /// the end of the phases:
+  /// START_PHASE1:  UART enabled before the detector is enabled.
+  /// CUTOUT_PHASE1: channel 1 data collected.
+  /// CUTOUT_PHASE2: channel 2 data collected and UART disabled.
   void timer_tick()
   {
     portENTER_CRITICAL_SAFE(&esp32_timer_mux);
     // clear the interrupt status register for our timer
     HW::TIMER_BASE->int_clr_timers.val = BIT(HW::TIMER_IDX);
 
-    if (railcomPhase_ == RailComPhase::CUTOUT_PHASE1)
+    switch (cutout_.phase())
     {
-      middle_cutout();
-
-      railcomPhase_ = RailComPhase::CUTOUT_PHASE2;
-      start_timer(HW::RAILCOM_MAX_READ_DELAY_CH_2);
+      case RailComPhase::START_PHASE1:
+#if CONFIG_RAILCOM_DATA_ENABLED
+        portENTER_CRITICAL_SAFE(&esp32_uart_mux);
+        // flush the uart queue of any pending data
+        rx_to_buf(nullptr, 0);
+        open_capture();
+
+        // clear all pending interrupts and enable default RX interrupts.
+        SET_PERI_REG_MASK(UART_INT_CLR_REG(HW::UART), ESP32_UART_RX_INTERRUPT_BITS);
+        SET_PERI_REG_MASK(UART_INT_ENA_REG(HW::UART), ESP32_UART_RX_INTERRUPT_BITS);
+        portEXIT_CRITICAL_SAFE(&esp32_uart_mux);
+#endif // CONFIG_RAILCOM_DATA_ENABLED
+        break;
+      case RailComPhase::CUTOUT_PHASE1:
+#if CONFIG_RAILCOM_DATA_ENABLED
+        // any data in the FIFO at this point belongs to channel 1.
+        portENTER_CRITICAL_SAFE(&esp32_uart_mux);
+        capture_rx();
+        portEXIT_CRITICAL_SAFE(&esp32_uart_mux);
+#endif // CONFIG_RAILCOM_DATA_ENABLED
+        middle_cutout();
+        break;
+      case RailComPhase::CUTOUT_PHASE2:
+        end_capture();
+        break;
+      default:
+        break;
     }
-    else if (railcomPhase_ == RailComPhase::CUTOUT_PHASE2)
+    uint32_t delay = cutout_.advance();
+    if (delay)
     {
-      end_cutout();
-      railcomPhase_ = RailComPhase::PRE_CUTOUT;
+      start_timer(delay);
     }
     portEXIT_CRITICAL_SAFE(&esp32_timer_mux);
   }
 
-  typedef enum : uint8_t
-  {
-    PRE_CUTOUT,
-    CUTOUT_PHASE1,
-    CUTOUT_PHASE2
-  } RailComPhase;
+  typedef typename RailComCutoutSequencer<
+    HW, DCC_BOOSTER, OLCB_DCC_BOOSTER>::RailComPhase RailComPhase;
 
   RailComPhase railcom_phase()
   {
-    return railcomPhase_;
+    return cutout_.phase();
   }
 
-  dcc::RailcomHubData *railcom_buffer()
+  /// @return the telemetry counters of the RailCom receiver.
+  const RailComCaptureStats &stats()
   {
-    dcc::RailcomHubData *data = nullptr;
-    if (railComFeedbackBuffer_->data_write_pointer(&data) > 0)
-    {
-      data->reset(railcomFeedbackKey_);
-    }
-    return data;
+    return stats_;
   }
 
-  void advance_railcom_buffer()
+  /// Drains the UART RX FIFO into the capture of the current cut-out, the
+  /// bytes are assigned to channel 1 or 2 based on the current phase.
+  ///
+  /// NOTE: this is called from the UART or timer ISR context with
+  /// esp32_uart_mux held.
+  void capture_rx()
   {
-    railComFeedbackBuffer_->advance(1);
-    railComFeedbackBuffer_->signal_condition_from_isr();
+    RailComCapture *capture = capture_;
+    bool ch1 = cutout_.phase() < RailComPhase::CUTOUT_PHASE2;
+    // NOTE: Due to a hardware issue when flushing the RX FIFO it is necessary
+    // to read the FIFO until the RX count is zero *AND* read/write addresses
+    // in the RX buffer are the same.
+    while(HW::UART_BASE->status.rxfifo_cnt ||
+          (HW::UART_BASE->mem_rx_status.wr_addr !=
+           HW::UART_BASE->mem_rx_status.rd_addr))
+    {
+      uint8_t ch = HW::UART_BASE->fifo.rw_byte;
+      if (capture == nullptr)
+      {
+        continue;
+      }
+      if (ch1 && capture->ch1_count < sizeof(capture->ch1))
+      {
+        capture->ch1[capture->ch1_count++] = ch;
+      }
+      else if (!ch1 && capture->ch2_count < sizeof(capture->ch2))
+      {
+        capture->ch2[capture->ch2_count++] = ch;
+      }
+      else
+      {
+        capture->discarded++;
+      }
+    }
   }
 
   size_t rx_to_buf(uint8_t *buf, size_t max_len)
@@ -348,11 +430,190 @@ private:
 #endif
   }
 
+  /// Flow which decodes the captured cut-outs and forwards the data to the
+  /// RailCom hub, this keeps the decoding and hub buffer allocation out of
+  /// the ISR context.
+  class DecodeFlow : public StateFlowBase
+  {
+  public:
+    /// Constructor.
+    ///
+    /// @param driver is the @ref Esp32RailComDriver to drain captures from.
+    DecodeFlow(Esp32RailComDriver *driver)
+      : StateFlowBase(driver->railComHubFlow_->service()), driver_(driver)
+    {
+      start_flow(STATE(drain));
+    }
+
+  private:
+    /// Owning driver.
+    Esp32RailComDriver *driver_;
+
+    /// Forwards all pending captures to the hub and waits for the next
+    /// capture to be committed.
+    Action drain()
+    {
+      while (driver_->dispatch_capture())
+      {
+      }
+      driver_->decoderWaiting_.store(true);
+      // a capture may have been committed before the waiting flag was set,
+      // if so reclaim the flag and drain again. If the ISR already took the
+      // flag it will notify this flow.
+      if (driver_->captureRing_.pending() &&
+          driver_->decoderWaiting_.exchange(false))
+      {
+        return yield();
+      }
+      return wait();
+    }
+  };
+
+  /// Number of cut-outs that can be captured before the decoder flow must
+  /// drain them.
+  static constexpr size_t CAPTURE_RING_SIZE = HW::PACKET_Q_SIZE;
+
+  /// Claims the capture slot for the cut-out that is starting.
+  ///
+  /// NOTE: this is called from the timer ISR context.
+  void open_capture()
+  {
+    capture_ = captureRing_.write_slot();
+    if (capture_ == nullptr)
+    {
+      stats_.overruns++;
+      overrun_ = true;
+      return;
+    }
+    capture_->feedback_key = railcomFeedbackKey_;
+    capture_->ch1_count = 0;
+    capture_->ch2_count = 0;
+    capture_->discarded = 0;
+    capture_->after_overrun = overrun_;
+    overrun_ = false;
+  }
+
+  /// Collects the remaining channel 2 data, disables the UART and publishes
+  /// the capture of the cut-out that has ended.
+  ///
+  /// NOTE: this is called from the timer ISR context.
+  void end_capture()
+  {
+#if CONFIG_RAILCOM_DATA_ENABLED
+    portENTER_CRITICAL_SAFE(&esp32_uart_mux);
+    // collect any data still in the FIFO that has not reached the threshold
+    // or timeout and disable the UART RX interrupts.
+    capture_rx();
+    HW::UART_BASE->int_clr.val = ESP32_UART_CLEAR_ALL_INTERRUPTS;
+    HW::UART_BASE->int_ena.val = ESP32_UART_DISABLE_ALL_INTERRUPTS;
+    portEXIT_CRITICAL_SAFE(&esp32_uart_mux);
+    commit_capture();
+#endif // CONFIG_RAILCOM_DATA_ENABLED
+  }
+
+  /// Publishes the capture of the cut-out that has ended to the decoder
+  /// flow.
+  ///
+  /// NOTE: this is called from the timer ISR context.
+  void commit_capture()
+  {
+    if (capture_ == nullptr)
+    {
+      return;
+    }
+    capture_ = nullptr;
+    captureRing_.commit();
+    if (decoderWaiting_.exchange(false))
+    {
+      decodeFlow_->notify_from_isr();
+    }
+  }
+
+  /// Decodes the oldest capture and forwards it to the RailCom hub.
+  ///
+  /// Every cut-out is forwarded, including those where no data was received,
+  /// so that the hub listeners can follow the cut-out sequence (channel 1
+  /// broadcasts alternate between cut-outs). Cut-outs which could not be
+  /// captured are forwarded as a single empty feedback.
+  ///
+  /// @return false if there are no captures pending.
+  ///
+  /// NOTE: this is called from the decoder flow.
+  bool dispatch_capture()
+  {
+    RailComCapture *capture = captureRing_.peek();
+    if (capture == nullptr)
+    {
+      return false;
+    }
+    stats_.captures++;
+    stats_.discarded_bytes += capture->discarded;
+    if (capture->after_overrun)
+    {
+      Buffer<dcc::RailcomHubData> *buf = railComHubFlow_->alloc();
+      buf->data()->reset(0);
+      railComHubFlow_->send(buf);
+    }
+    if (!capture->ch1_count && !capture->ch2_count)
+    {
+      stats_.no_response++;
+    }
+    Buffer<dcc::RailcomHubData> *buf = railComHubFlow_->alloc();
+    buf->data()->reset(capture->feedback_key);
+    for (uint8_t idx = 0; idx < capture->ch1_count; idx++)
+    {
+      validate(capture->ch1[idx]);
+      buf->data()->add_ch1_data(capture->ch1[idx]);
+    }
+    for (uint8_t idx = 0; idx < capture->ch2_count; idx++)
+    {
+      validate(capture->ch2[idx]);
+      buf->data()->add_ch2_data(capture->ch2[idx]);
+    }
+    railComHubFlow_->send(buf);
+    captureRing_.release();
+    return true;
+  }
+
+  /// Counts received bytes which are not valid 4-of-8 codes.
+  ///
+  /// @param data is the received byte.
+  void validate(uint8_t data)
+  {
+    if (dcc::railcom_decode[data] == dcc::RailcomDefs::INV)
+    {
+      stats_.invalid_bytes++;
+    }
+  }
+
   uintptr_t railcomFeedbackKey_{0}; 
   dcc::RailcomHubFlow *railComHubFlow_;
-  DeviceBuffer<dcc::RailcomHubData> *railComFeedbackBuffer_;
-  RailComPhase railcomPhase_{RailComPhase::PRE_CUTOUT};
+  /// Phase sequencing of the cut-out.
+  RailComCutoutSequencer<HW, DCC_BOOSTER, OLCB_DCC_BOOSTER> cutout_;
   bool enabled_{false};
+
+  /// Storage for @ref captureRing_.
+  RailComCapture captures_[CAPTURE_RING_SIZE];
+
+  /// Captured cut-outs, produced by the timer ISR and consumed by
+  /// @ref decodeFlow_.
+  SpscRing<RailComCapture, CAPTURE_RING_SIZE> captureRing_;
+
+  /// Capture of the cut-out in progress, nullptr when no cut-out is in
+  /// progress or the capture ring was full.
+  RailComCapture *capture_{nullptr};
+
+  /// Set when a cut-out could not be captured, cleared by the next capture.
+  bool overrun_{false};
+
+  /// Set when @ref decodeFlow_ is waiting for a capture to be committed.
+  std::atomic<bool> decoderWaiting_{false};
+
+  /// Decoder flow for the captured cut-outs.
+  uninitialized<DecodeFlow> decodeFlow_;
+
+  /// Telemetry counters.
+  RailComCaptureStats stats_;
 };
 
 template <class HW, class DCC_BOOSTER, class OLCB_DCC_BOOSTER>
@@ -366,28 +627,13 @@ static void esp32_railcom_timer_tick(void *param)
 template <class HW, class DCC_BOOSTER, class OLCB_DCC_BOOSTER>
 static void esp32_railcom_uart_isr(void *param)
 {
+  // the FIFO threshold and RX timeout interrupts fire at most a few times per
+  // cut-out, the raw bytes are only copied into the capture slot here and
+  // decoded later by the decoder flow.
   portENTER_CRITICAL_SAFE(&esp32_uart_mux);
   Esp32RailComDriver<HW, DCC_BOOSTER, OLCB_DCC_BOOSTER> *driver =
     reinterpret_cast<Esp32RailComDriver<HW, DCC_BOOSTER, OLCB_DCC_BOOSTER> *>(param);
-  dcc::RailcomHubData *fb = driver->railcom_buffer();
-  uint8_t rx_buf[6] = {0, 0, 0, 0, 0, 0};
-  size_t rx_bytes = driver->rx_to_buf(rx_buf, 6);
-  if (fb)
-  {
-    for (size_t idx = 0; idx < rx_bytes; idx++)
-    {
-      if (driver->railcom_phase() ==
-          Esp32RailComDriver<HW, DCC_BOOSTER, OLCB_DCC_BOOSTER>::RailComPhase::CUTOUT_PHASE1)
-      {
-        fb->add_ch1_data(rx_buf[idx]);
-      }
-      else
-      {
-        fb->add_ch2_data(rx_buf[idx]);
-      }
-    }
-    driver->advance_railcom_buffer();
-  }
+  driver->capture_rx();
   // clear interrupt status
   HW::UART_BASE->int_clr.val = ESP32_UART_CLEAR_ALL_INTERRUPTS;
   portEXIT_CRITICAL_SAFE(&esp32_uart_mux);
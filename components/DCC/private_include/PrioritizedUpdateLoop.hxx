@@ -22,6 +22,9 @@ COPYRIGHT (c) 2020-2021 Mike Dunston
 #include <dcc/UpdateLoop.hxx>
 #include <executor/StateFlow.hxx>
 #include <Spinlock.hxx>
+#include <dcc/Packet.hxx>
+#include <unordered_map>
+#include <vector>
 
 namespace esp32cs
 {
@@ -29,14 +32,117 @@ namespace esp32cs
 /// This state flow is responsible for creating DCC packets for the track
 /// interface based on active locomotives or other packet sources. All active
 /// locomotives will have a periodic refresh of speed and function packets sent
-/// to the track. If/When a higher priority update (such as toggling a function
-/// or updating speed step) it will be sent ahead of other background refresh
-/// packets. Similarly an e-stop packet source will be given highest priority
-/// and suppress any other packets being sent.
-class PrioritizedUpdateLoop : public StateFlow<Buffer<dcc::Packet>, QList<1>>,
-                              private dcc::UpdateLoopBase
+/// to the track, the refresh packets are scheduled earliest-deadline-first
+/// based on the configured refresh period for the priority of the source.
+/// If/When a higher priority update (such as toggling a function or updating
+/// speed step) it will be sent ahead of other background refresh packets.
+/// Similarly an e-stop packet source will be given highest priority and
+/// suppress any other packets being sent.
+///
+/// Packets are grouped into a @ref TrafficClass, e-stop traffic is always sent
+/// first and the remaining classes share the track bandwidth based on their
+/// configured weights using a smooth weighted round-robin. This prevents a
+/// burst of accessory packets from starving locomotive speed updates and the
+/// background refresh from delaying accessory packets.
+///
+/// The repeat count of each packet is adjusted based on the share of idle
+/// packets during the last second, see @ref RepeatMode. Spare bandwidth is
+/// used to repeat critical packets more often and when the track is busy the
+/// repeats are reduced so more distinct packets can be sent.
+///
+/// NOTE: This is not registered as the @ref dcc::UpdateLoopBase, packet sources
+/// are routed to the update loop of the owning district by
+/// @ref DistrictRouter.
+class PrioritizedUpdateLoop : public StateFlow<Buffer<dcc::Packet>, QList<1>>
 {
 public:
+  /// Bandwidth classes of DCC traffic.
+  enum class TrafficClass : uint8_t
+  {
+    /// Exclusive packet sources, e-stop updates and broadcast packets. This
+    /// class has strict priority over all other classes.
+    ESTOP,
+
+    /// Locomotive speed updates.
+    SPEED,
+
+    /// Locomotive function updates.
+    FUNCTION,
+
+    /// Background refresh of locomotive state.
+    REFRESH,
+
+    /// Accessory decoder packets.
+    ACCESSORY,
+
+    /// Operations mode programming (POM) and other configuration packets.
+    POM,
+
+    /// Number of traffic classes.
+    COUNT
+  };
+
+  /// Number of @ref TrafficClass values which have an update queue, these
+  /// are @ref TrafficClass::ESTOP, @ref TrafficClass::SPEED and
+  /// @ref TrafficClass::FUNCTION.
+  static constexpr size_t UPDATE_QUEUE_COUNT = 3;
+
+  /// Repeat count policy based on the track load.
+  enum class RepeatMode : uint8_t
+  {
+    /// The track is busy, repeats are reduced to the minimum required for
+    /// each @ref TrafficClass.
+    REDUCED,
+
+    /// Packets are sent with the repeat count set by the packet source.
+    NORMAL,
+
+    /// The track has idle capacity, critical packets (e-stop, accessory and
+    /// POM) are sent with the maximum repeat count.
+    BOOSTED
+  };
+
+  /// Snapshot of the update loop telemetry.
+  struct Stats
+  {
+    /// Packets sent during the last second for each @ref TrafficClass.
+    uint32_t packets_per_sec[(size_t)TrafficClass::COUNT];
+
+    /// Idle packets sent during the last second.
+    uint32_t idle_per_sec;
+
+    /// 50th percentile of the interval between packets for a packet source,
+    /// in milliseconds.
+    uint32_t refresh_p50_ms;
+
+    /// 99th percentile of the interval between packets for a packet source,
+    /// in milliseconds.
+    uint32_t refresh_p99_ms;
+
+    /// Maximum interval between packets for a packet source, in milliseconds.
+    uint32_t refresh_max_ms;
+
+    /// Maximum number of packet sources waiting in each update queue.
+    uint32_t update_queue_high_water[UPDATE_QUEUE_COUNT];
+
+    /// Maximum number of pre-built packets waiting to be sent.
+    uint32_t packet_queue_high_water;
+
+    /// Number of registered packet sources.
+    uint32_t sources;
+
+    /// Current @ref RepeatMode.
+    RepeatMode repeat_mode;
+
+    /// Number of packet repeats added by the @ref RepeatMode during the last
+    /// second.
+    uint32_t repeats_added_per_sec;
+
+    /// Number of packet repeats removed by the @ref RepeatMode during the
+    /// last second.
+    uint32_t repeats_removed_per_sec;
+  };
+
   /// Constructor.
   ///
   /// @param service is the service to attach this stateflow to.
@@ -51,65 +157,348 @@ public:
   /// @param source is the packet source to add.
   /// @param priority is the priority to send the packet(s) out with.
   /// @return true if the packet source was added, false otherwise.
-  bool add_refresh_source(dcc::PacketSource *source, unsigned priority) override;
+  bool add_refresh_source(dcc::PacketSource *source, unsigned priority);
 
   /// Deletes a packet refresh source.
   ///
   /// @param source is the packet source to be removed.
-  void remove_refresh_source(dcc::PacketSource *source) override;
+  void remove_refresh_source(dcc::PacketSource *source);
 
   /// Notification hook for a packet source to inform the update loop that
   /// something has been updated and needs to be sent out at higher priority.
+  /// If there is already a pending update for the same source and code the
+  /// notification will be coalesced into the pending update since the packet
+  /// is generated from the latest state of the source when it is sent.
   ///
   /// @param source is the packet source being updated.
   /// @param code is the type of update, see @ref dcc::DccTrainUpdateCode for
   /// supported values.
-  void notify_update(dcc::PacketSource *source, unsigned code) override;
+  void notify_update(dcc::PacketSource *source, unsigned code);
+
+  /// Queues a pre-built packet for transmission, the packet will be sent
+  /// based on the @ref TrafficClass it belongs to.
+  ///
+  /// @param packet is the packet to send, ownership is transferred to the
+  /// update loop.
+  void send_packet(Buffer<dcc::Packet> *packet);
 
   /// Entry point of the @ref StateFlow which will generate the next packet
   /// to be sent to the track.
   Action entry() override;
 
+  /// Retrieves a snapshot of the update loop telemetry.
+  ///
+  /// @param stats will receive the telemetry snapshot.
+  void get_stats(Stats *stats);
+
 private:
   /// Flag to indicate that we have no high priority packet source.
   static constexpr uint16_t NO_EXCLUSIVE_SOURCE = 0x7FF;
 
-  /// Tracking metrics for the update source.
-  struct Metrics
-  {
-    /// OS timestamp of when the last packet was sent to this source. This is
-    /// used to suppress sending a packet from this packet source too quickly.
-    uint64_t last_packet;
+  /// Update codes must be below this value to be tracked in
+  /// @ref pendingCodes_.
+  static constexpr unsigned MAX_UPDATE_CODE = 32;
 
-    /// Priority of this packet source.
-    unsigned priority;
-  };
+  /// Marker for a slot in the source table that is not in use.
+  static constexpr uint16_t NO_SLOT = 0xFFFF;
+
+  /// Width of each bucket in @ref refreshHistogram_, in milliseconds.
+  static constexpr uint32_t REFRESH_HISTOGRAM_BUCKET_MS = 8;
+
+  /// Number of buckets in @ref refreshHistogram_, the last bucket holds all
+  /// intervals that are longer than the other buckets.
+  static constexpr size_t REFRESH_HISTOGRAM_BUCKETS = 65;
+
+  /// Maximum repeat count that can be stored in a DCC packet header.
+  static constexpr uint8_t MAX_REPEAT_COUNT = 3;
+
+  /// Minimum repeat count for POM packets, S-9.2.1 requires the decoder to
+  /// receive two identical POM packets before acting on them.
+  static constexpr uint8_t MIN_POM_REPEAT_COUNT = 1;
+
+  /// Minimum repeat count for accessory packets.
+  static constexpr uint8_t MIN_ACCESSORY_REPEAT_COUNT = 1;
+
+  /// Length of the window used for the packets per second counters.
+  static constexpr uint64_t STATS_WINDOW_USEC = MSEC_TO_USEC(1000);
+
+  /// Packet sources with a priority at or above this value (but below
+  /// @ref dcc::UpdateLoopBase::EXCLUSIVE_MIN_PRIORITY) will be refreshed using
+  /// the high priority refresh period.
+  static constexpr unsigned HIGH_PRIORITY_MIN =
+    dcc::UpdateLoopBase::EXCLUSIVE_MIN_PRIORITY / 2;
 
   /// Track interface to send packets to.
   dcc::TrackIf *track_;
 
-  /// Packet sources to ask about refreshing data periodically.
+  /// Packet source registered in each slot of the source table, nullptr if
+  /// the slot is not in use.
+  ///
+  /// NOTE: The source table is stored as parallel arrays indexed by the slot
+  /// of the source, the slot of a source does not change while it is
+  /// registered.
   std::vector<dcc::PacketSource *> sources_;
 
-  /// Tracking metrics for each registered @ref dcc::PacketSource.
-  std::map<dcc::PacketSource *, Metrics> metrics_;
+  /// OS timestamp of when the last packet was sent for each slot. This is
+  /// used to suppress sending a packet from the packet source too quickly.
+  std::vector<uint64_t> lastPacket_;
+
+  /// Priority of the packet source in each slot.
+  std::vector<unsigned> priority_;
+
+  /// Bitmask of update codes that are pending for each slot.
+  std::vector<uint32_t> pendingCodes_;
+
+  /// Bitmask of the update queues that each slot is linked into.
+  std::vector<uint8_t> queued_;
+
+  /// Intrusive links for the update queues, for each queue this holds the
+  /// next slot in the queue or @ref NO_SLOT.
+  std::vector<uint16_t> updateNext_[UPDATE_QUEUE_COUNT];
+
+  /// OS timestamp of when the next refresh packet is due for each slot.
+  std::vector<uint64_t> nextDue_;
+
+  /// Target refresh period (in microseconds) for each slot.
+  std::vector<uint32_t> refreshPeriod_;
 
-  /// Queue of packet sources that have reported an update that needs to be
-  /// sent out to the track interface. This will have higher priority than all
-  /// background update packet sources but lower priority than exclusive packet
-  /// sources.
-  QList<1> updateSources_;
+  /// Position of each slot in @ref refreshHeap_ or @ref NO_SLOT.
+  std::vector<uint16_t> heapIndex_;
 
-  /// Offset in the @ref sources_ vector for the next loco to send.
-  uint16_t nextIndex_{0};
+  /// Binary min-heap of slots ordered by @ref nextDue_, the first entry is
+  /// the most overdue packet source.
+  std::vector<uint16_t> refreshHeap_;
 
-  /// Index into @ref sources_ for the highest priority packet source
-  /// that is generating packets.
+  /// Slots in the source table that are not in use.
+  std::vector<uint16_t> freeSlots_;
+
+  /// Slot assigned to each registered packet source.
+  std::unordered_map<dcc::PacketSource *, uint16_t> slots_;
+
+  /// First slot in each update queue, these queues hold the slots that have
+  /// reported an update that needs to be sent out to the track interface.
+  /// The queue index is the @ref TrafficClass of the update.
+  uint16_t updateHead_[UPDATE_QUEUE_COUNT];
+
+  /// Last slot in each update queue.
+  uint16_t updateTail_[UPDATE_QUEUE_COUNT];
+
+  /// Queues of pre-built packets that are waiting to be sent to the track
+  /// interface, indexed by @ref TrafficClass. The @ref TrafficClass::REFRESH
+  /// queue is not used.
+  QList<1> packets_[(size_t)TrafficClass::COUNT];
+
+  /// Bandwidth weight of each @ref TrafficClass.
+  int32_t weight_[(size_t)TrafficClass::COUNT];
+
+  /// Current credit of each @ref TrafficClass for the weighted round-robin.
+  int32_t credit_[(size_t)TrafficClass::COUNT];
+
+  /// Slot in the source table for the highest priority packet source that is
+  /// generating packets.
   uint16_t exclusiveIndex_{NO_EXCLUSIVE_SOURCE};
 
-  /// Lock used to protect @ref sources_, @ref metrics_ and
-  /// @ref updateSources_.
+  /// Number of registered packet sources.
+  uint16_t sourceCount_{0};
+
+  /// Number of slots in each update queue.
+  uint16_t updateDepth_[UPDATE_QUEUE_COUNT];
+
+  /// Maximum value of @ref updateDepth_ for each update queue.
+  uint16_t updateHighWater_[UPDATE_QUEUE_COUNT];
+
+  /// Number of pre-built packets in @ref packets_.
+  uint16_t packetDepth_{0};
+
+  /// Maximum value of @ref packetDepth_.
+  uint16_t packetHighWater_{0};
+
+  /// OS timestamp of the start of the current packets per second window.
+  uint64_t windowStart_{0};
+
+  /// Packets sent for each @ref TrafficClass in the current window.
+  uint32_t windowPackets_[(size_t)TrafficClass::COUNT];
+
+  /// Idle packets sent in the current window.
+  uint32_t windowIdle_{0};
+
+  /// Packets sent for each @ref TrafficClass in the last complete window.
+  uint32_t lastWindowPackets_[(size_t)TrafficClass::COUNT];
+
+  /// Idle packets sent in the last complete window.
+  uint32_t lastWindowIdle_{0};
+
+  /// Current @ref RepeatMode, updated at the end of each window.
+  RepeatMode repeatMode_{RepeatMode::NORMAL};
+
+  /// Repeats added by @ref repeatMode_ in the current window.
+  ///
+  /// NOTE: this is only updated from @ref entry.
+  uint32_t windowRepeatsAdded_{0};
+
+  /// Repeats removed by @ref repeatMode_ in the current window.
+  ///
+  /// NOTE: this is only updated from @ref entry.
+  uint32_t windowRepeatsRemoved_{0};
+
+  /// Repeats added by @ref repeatMode_ in the last complete window.
+  uint32_t lastWindowRepeatsAdded_{0};
+
+  /// Repeats removed by @ref repeatMode_ in the last complete window.
+  uint32_t lastWindowRepeatsRemoved_{0};
+
+  /// Histogram of the interval between packets for a packet source.
+  uint32_t refreshHistogram_[REFRESH_HISTOGRAM_BUCKETS];
+
+  /// Maximum interval between packets for a packet source, in microseconds.
+  uint64_t refreshMax_{0};
+
+  /// Lock used to protect the source table, update queues, @ref packets_,
+  /// @ref credit_ and the telemetry counters.
   Spinlock lock_;
+
+  /// Records a packet in the telemetry counters.
+  ///
+  /// @param now is the current OS timestamp.
+  /// @param idle is true if the packet is an idle packet.
+  /// @param traffic_class is the @ref TrafficClass of the packet, ignored for
+  /// idle packets.
+  /// @param slot is the slot of the packet source or @ref NO_SLOT.
+  ///
+  /// NOTE: @ref lock_ must be held by the caller.
+  void record_packet_locked(uint64_t now, bool idle,
+                            TrafficClass traffic_class, uint16_t slot);
+
+  /// Adjusts the repeat count of a packet based on the @ref RepeatMode.
+  ///
+  /// @param mode is the @ref RepeatMode to apply.
+  /// @param traffic_class is the @ref TrafficClass of the packet.
+  /// @param packet is the packet to adjust.
+  void apply_repeat_mode(RepeatMode mode, TrafficClass traffic_class,
+                         dcc::Packet *packet);
+
+  /// @return the interval (in milliseconds) at or below which the requested
+  /// fraction of the recorded packet source intervals fall.
+  ///
+  /// @param permille is the requested percentile in 1/1000 units.
+  ///
+  /// NOTE: @ref lock_ must be held by the caller.
+  uint32_t refresh_percentile_locked(uint32_t permille);
+
+  /// @return bitmask of @ref TrafficClass values that have a packet ready to
+  /// be sent.
+  ///
+  /// @param min_refresh_time is the OS timestamp before which a packet source
+  /// must have last been sent a packet to be eligible.
+  ///
+  /// NOTE: @ref lock_ must be held by the caller.
+  uint32_t ready_classes_locked(uint64_t min_refresh_time);
+
+  /// @return the @ref TrafficClass to send the next packet for.
+  ///
+  /// @param ready is the bitmask of @ref TrafficClass values to select from,
+  /// it must not be zero.
+  ///
+  /// NOTE: @ref lock_ must be held by the caller.
+  TrafficClass select_class_locked(uint32_t ready);
+
+  /// Retrieves the next usable update from one of the update queues.
+  ///
+  /// @param queue is the update queue to retrieve the update from.
+  /// @param min_refresh_time is the OS timestamp before which a packet source
+  /// must have last been sent a packet to be eligible.
+  /// @param code will be set to the update code.
+  ///
+  /// @return the slot of the packet source to send a packet for or
+  /// @ref NO_SLOT if there is no usable update.
+  ///
+  /// NOTE: @ref lock_ must be held by the caller.
+  uint16_t next_update_locked(size_t queue, uint64_t min_refresh_time,
+                              unsigned *code);
+
+  /// Adds a slot to the end of an update queue if it is not already queued.
+  ///
+  /// @param queue is the update queue to add the slot to.
+  /// @param slot is the slot to add.
+  ///
+  /// NOTE: @ref lock_ must be held by the caller.
+  void enqueue_update_locked(size_t queue, uint16_t slot);
+
+  /// Removes the first slot from an update queue.
+  ///
+  /// @param queue is the update queue to remove the first slot from.
+  ///
+  /// NOTE: @ref lock_ must be held by the caller.
+  void dequeue_update_locked(size_t queue);
+
+  /// @return the update queue for an update code.
+  ///
+  /// @param code is the update code.
+  static size_t update_queue(unsigned code);
+
+  /// @return the bitmask of update codes that are sent via an update queue.
+  ///
+  /// @param queue is the update queue.
+  static uint32_t update_queue_codes(size_t queue);
+
+  /// @return the @ref TrafficClass for a pre-built packet.
+  ///
+  /// @param packet is the packet to classify.
+  static TrafficClass packet_class(const dcc::Packet &packet);
+
+  /// @return the slot for a packet source or @ref NO_SLOT if the source is not
+  /// registered.
+  ///
+  /// @param source is the packet source to find.
+  ///
+  /// NOTE: @ref lock_ must be held by the caller.
+  uint16_t find_slot_locked(dcc::PacketSource *source);
+
+  /// Adds a slot to the refresh heap.
+  ///
+  /// @param slot is the slot to add.
+  ///
+  /// NOTE: @ref lock_ must be held by the caller.
+  void heap_push_locked(uint16_t slot);
+
+  /// Removes a slot from the refresh heap.
+  ///
+  /// @param slot is the slot to remove.
+  ///
+  /// NOTE: @ref lock_ must be held by the caller.
+  void heap_remove_locked(uint16_t slot);
+
+  /// Updates the next refresh time of a slot and restores the heap order.
+  ///
+  /// @param slot is the slot to update.
+  /// @param due is the OS timestamp of when the next refresh is due.
+  ///
+  /// NOTE: @ref lock_ must be held by the caller.
+  void heap_reschedule_locked(uint16_t slot, uint64_t due);
+
+  /// Moves an entry of the refresh heap towards the root until the heap
+  /// order is restored.
+  ///
+  /// @param index is the position in @ref refreshHeap_ to move.
+  ///
+  /// NOTE: @ref lock_ must be held by the caller.
+  void heap_sift_up_locked(size_t index);
+
+  /// Moves an entry of the refresh heap towards the leaves until the heap
+  /// order is restored.
+  ///
+  /// @param index is the position in @ref refreshHeap_ to move.
+  ///
+  /// NOTE: @ref lock_ must be held by the caller.
+  void heap_sift_down_locked(size_t index);
+
+  /// Swaps two entries in the refresh heap.
+  ///
+  /// @param first is the position of the first entry.
+  /// @param second is the position of the second entry.
+  ///
+  /// NOTE: @ref lock_ must be held by the caller.
+  void heap_swap_locked(size_t first, size_t second);
 };
 
 } // namespace esp32cs
@@ -19,14 +19,24 @@ COPYRIGHT (c) 2019-2021 Mike Dunston
 #define _RMT_TRACK_DEVICE_H_
 
 #include "sdkconfig.h"
+#include "DccPacketClass.hxx"
+#include "SpscRing.hxx"
+
+#include <atomic>
 #include <can_ioctl.h>
 #include <dcc/DccDebug.hxx>
 #include <dcc/Packet.hxx>
 #include <driver/rmt.h>
+#include <esp_timer.h>
 #include <executor/Notifiable.hxx>
 #include <freertos/FreeRTOS.h>
-#include <freertos/queue.h>
 #include <freertos_drivers/arduino/RailcomDriver.hxx>
+#include <os/OS.hxx>
+#if CONFIG_DCC_RMT_STREAMING
+#include <esp_intr_alloc.h>
+#include <hal/rmt_ll.h>
+#include <soc/rmt_struct.h>
+#endif // CONFIG_DCC_RMT_STREAMING
 #include <soc/soc_caps.h>
 #include <utils/logging.h>
 #include <utils/macros.h>
@@ -34,6 +44,102 @@ COPYRIGHT (c) 2019-2021 Mike Dunston
 namespace esp32cs
 {
 
+/// Telemetry counters for the @ref RMTTrackDevice.
+struct RMTTrackDeviceStats
+{
+  /// Number of packets accepted for transmission.
+  uint32_t packets{0};
+
+  /// Number of packets that replaced a queued packet in-place.
+  uint32_t superseded{0};
+
+  /// Number of packets rejected because the packet ring was full.
+  uint32_t enospc_drops{0};
+
+  /// Maximum number of packets pending in the packet ring.
+  uint32_t ring_high_water{0};
+
+  /// Number of emergency stop requests.
+  uint32_t estops{0};
+
+  /// Time from the most recent emergency stop request until the first
+  /// broadcast e-stop packet started transmission, in microseconds.
+  uint32_t estop_latency_usec{0};
+
+  /// Maximum value of @ref estop_latency_usec.
+  uint32_t estop_latency_max_usec{0};
+};
+
+#if CONFIG_DCC_RMT_TRACE
+/// Maximum number of DCC packet payload bytes recorded in a
+/// @ref DccTraceRecord, longer packets are truncated.
+static constexpr uint8_t DCC_TRACE_MAX_PAYLOAD = 6;
+
+/// @ref DccTraceRecord flag: the packet replaced a queued packet for the
+/// same address and packet class before it was transmitted.
+static constexpr uint8_t DCC_TRACE_FLAG_SUPERSEDED = 0x01;
+
+/// Single DCC packet recorded by the @ref RMTTrackDevice packet trace.
+///
+/// NOTE: this is exported as-is (little endian) via the web server, any
+/// changes to the layout must be reflected in tools/dcc_trace.py.
+struct DccTraceRecord
+{
+  /// Time when the packet transmission started, in microseconds since boot
+  /// (truncated to 32 bits).
+  uint32_t timestamp;
+
+  /// RailCom feedback key of the packet.
+  uint32_t feedback_key;
+
+  /// DCC packet payload, including the checksum byte.
+  uint8_t payload[DCC_TRACE_MAX_PAYLOAD];
+
+  /// Number of bytes in the DCC packet (may exceed
+  /// @ref DCC_TRACE_MAX_PAYLOAD).
+  uint8_t dlc;
+
+  /// Number of times the packet will be repeated after the first
+  /// transmission.
+  uint8_t repeat_count;
+
+  /// Number of preamble bits sent before the packet.
+  uint8_t preamble_bits;
+
+  /// @ref DccPacketClass of the packet.
+  uint8_t packet_class;
+
+  /// Combination of DCC_TRACE_FLAG_* values.
+  uint8_t flags;
+
+  /// Reserved for future use, always zero.
+  uint8_t reserved;
+};
+
+static_assert(sizeof(DccTraceRecord) == 20,
+              "DccTraceRecord layout is part of the trace export format");
+static_assert(sizeof(dcc::Packet::payload) >= DCC_TRACE_MAX_PAYLOAD,
+              "DccTraceRecord payload exceeds dcc::Packet payload");
+#endif // CONFIG_DCC_RMT_TRACE
+
+/// EMC spectrum spreading patterns that can be applied to the DCC signal.
+enum class DccEmcSpread : uint8_t
+{
+  /// All bits use the nominal ONE and ZERO durations.
+  DISABLED,
+
+  /// Bit durations step up by one RMT tick per bit position and wrap around
+  /// at the S-9.1 maximum.
+  SAWTOOTH,
+
+  /// Bit durations follow a fixed pseudo-random sequence within the S-9.1
+  /// limits.
+  PSEUDO_RANDOM,
+
+  /// Number of spreading patterns, this must be last.
+  COUNT
+};
+
 /// The NMRA DCC Signal is sent as a square wave with each half having
 /// identical timing (or nearly identical). Packet Bytes have a minimum of 11
 /// preamble ONE bits in order to be considered valid by the decoder. For
@@ -79,35 +185,40 @@ public:
   /// RMT peripheral and to start generating the DCC signal.
   void hw_init()
   {
-    // allocate buffer space for the packet queue items.
-    packetQueueBuf_ =
-      heap_caps_calloc(HW::PACKET_Q_SIZE, sizeof(dcc::Packet),
-                       RMT_MALLOC_CAPS);
-    HASSERT(packetQueueBuf_ != nullptr);
-
-    // create the packet queue using the pre-allocated memory.
-    packetQueueHandle_ =
-      xQueueCreateStatic(HW::PACKET_Q_SIZE, sizeof(dcc::Packet)
-                      , (uint8_t*)packetQueueBuf_, &packetQueue_);
-    HASSERT(packetQueueHandle_ != NULL);
-
-    // calculate the maximum number of bits that can be transmitted in a single
-    // dcc packet, with the current configuration the maximum number of bits
-    // for a single dcc packet is 192 while using up to 50 preamble bits.
-    uint16_t maxBitCount =
-      std::max(HW::DCC_SERVICE_MODE_PREAMBLE_BITS, HW::DCC_PREAMBLE_BITS) +
-      1 + /* payload start bit */
-      (MAX_DCC_DLC_LEN * 8) + /* payload bytes */
-      MAX_DCC_DLC_LEN + /* end of byte markers */
-      3; /* end of packet marker, sacrificial bit, RMT EOF marker */
-    HASSERT(maxBitCount <= MAX_RMT_ENCODED_BITS);
+    // allocate buffer space for the pre-encoded packet ring.
+    packetRingBuf_ = reinterpret_cast<EncodedPacket *>(
+      heap_caps_calloc(PACKET_RING_SIZE, sizeof(EncodedPacket),
+                       RMT_MALLOC_CAPS));
+    HASSERT(packetRingBuf_ != nullptr);
+    packetRing_.init(packetRingBuf_);
+
+    // pre-encode the idle packet for each of the EMC spreading patterns, the
+    // idle packet is sent when there are no other packets pending
+    // transmission. Keeping one copy per pattern allows the pattern to be
+    // switched while the ISR is transmitting the idle packet.
+    for (size_t idx = 0; idx < ARRAYSIZE(idlePackets_); idx++)
+    {
+      encode_packet(dcc::Packet::DCC_IDLE(), &idlePackets_[idx],
+                    DCC_RMT_SYMBOL_TABLES[idx]);
+      idlePackets_[idx].estop = false;
+    }
+    activePacket_ = idle_packet();
+
+    uint16_t maxBitCount = MAX_ENCODED_PACKET_ITEMS;
+#if CONFIG_DCC_RMT_STREAMING
+    // when streaming the packet is refilled into the RMT memory in half block
+    // chunks so only a single memory block is required regardless of the
+    // packet length.
+    uint8_t memoryBlocks = RMT_STREAM_MEMORY_BLOCKS;
+#else
     uint8_t memoryBlocks = (maxBitCount / RMT_MEM_ITEM_NUM) + 1;
+#endif // CONFIG_DCC_RMT_STREAMING
     HASSERT(memoryBlocks <= MAX_RMT_MEMORY_BLOCKS);
     LOG(INFO,
         "[DCC-RMT-%d] DCC config: zero:%duS, one:%duS, preamble-bits:%d/%d, "
         "wave:%s, signal pin:%d, RMT-mem:%d (blocks:%d), RMT-CLK:%s (%d)",
         HW::RMT_CHANNEL, HW::DCC_ZERO_RMT_TICKS, HW::DCC_ONE_RMT_TICKS,
-        HW::DCC_PREAMBLE_BITS, HW::DCC_SERVICE_MODE_PREAMBLE_BITS,
+        OPS_PREAMBLE_BITS, HW::DCC_SERVICE_MODE_PREAMBLE_BITS,
         HW::RMT_WAVE_FMT, HW::DCC_SIGNAL_PIN_NUM, maxBitCount,
         memoryBlocks, RMT_CLOCK_SOURCE[HW::RMT_CLOCK_SOURCE],
         HW::RMT_CLOCK_SOURCE);
@@ -125,6 +236,20 @@ public:
       rmt_driver_install(HW::RMT_CHANNEL, 0 /* rx count */, RMT_ISR_FLAGS));
     ESP_ERROR_CHECK(rmt_set_source_clk(HW::RMT_CHANNEL, HW::RMT_CLOCK_SOURCE));
 
+#if CONFIG_DCC_RMT_STREAMING
+    // The RMT driver does not expose the TX threshold event to applications
+    // so a shared handler is registered for it. This must be registered after
+    // the RMT driver ISR so that it is invoked first, the driver ISR will then
+    // see the threshold event as already cleared for this channel.
+    LOG(INFO, "[DCC-RMT-%d] Streaming mode enabled, refill size: %d",
+        HW::RMT_CHANNEL, RMT_STREAM_CHUNK_ITEMS);
+    ESP_ERROR_CHECK(
+      esp_intr_alloc(ETS_RMT_INTR_SOURCE, RMT_ISR_FLAGS, rmt_threshold_isr,
+                     this, &thresholdIsrHandle_));
+    ESP_ERROR_CHECK(
+      rmt_set_tx_thr_intr_en(HW::RMT_CHANNEL, true, RMT_STREAM_CHUNK_ITEMS));
+#endif // CONFIG_DCC_RMT_STREAMING
+
     LOG(INFO, "[DCC-RMT-%d] Starting signal generator", HW::RMT_CHANNEL);
     // send one bit to kickstart the signal, remaining data will come from the
     // packet queue. We intentionally do not wait for the RMT TX complete here.
@@ -135,14 +260,17 @@ public:
   ~RMTTrackDevice()
   {
     LOG(INFO, "[DCC-RMT-%d] Shutting down signal generator", HW::RMT_CHANNEL);
-    rmt_driver_uninstall(HW::RMT_CHANNEL);
-    if (packetQueueHandle_)
+#if CONFIG_DCC_RMT_STREAMING
+    rmt_set_tx_thr_intr_en(HW::RMT_CHANNEL, false, 0);
+    if (thresholdIsrHandle_)
     {
-      vQueueDelete(packetQueueHandle_);
+      esp_intr_free(thresholdIsrHandle_);
     }
-    if (packetQueueBuf_)
+#endif // CONFIG_DCC_RMT_STREAMING
+    rmt_driver_uninstall(HW::RMT_CHANNEL);
+    if (packetRingBuf_)
     {
-      free(packetQueueBuf_);
+      free(packetRingBuf_);
     }
   }
 
@@ -154,62 +282,192 @@ public:
       errno = EINVAL;
       return -1;
     }
-    const dcc::Packet *sourcePacket{(dcc::Packet *)data};
+    if (!send(*(const dcc::Packet *)data))
+    {
+      errno = ENOSPC;
+      return -1;
+    }
+    return 1;
+  }
 
-    if (sourcePacket->packet_header.is_marklin)
+  /// Encodes a DCC packet into the packet ring for transmission.
+  ///
+  /// @param packet is the DCC packet to send, it is not referenced after this
+  /// method returns.
+  ///
+  /// @return true if the packet was consumed (queued, superseded a queued
+  /// packet or dropped as unsupported), false if the packet ring is full in
+  /// which case @ref wait_for_space can be used to wait for space.
+  ///
+  /// NOTE: this can be called from the track interface and the VFS, the
+  /// packet ring producer side is serialized via @ref producerLock_.
+  bool send(const dcc::Packet &packet)
+  {
+    if (packet.packet_header.is_marklin)
     {
       // drop Marklin packets.
-      return 1;
+      return true;
     }
-    if (sourcePacket->dlc > MAX_DCC_DLC_LEN)
+    if (packet.dlc > MAX_DCC_DLC_LEN)
     {
       // drop over-length packets.
       LOG_ERROR("[DCC-RMT-%d] Dropping DCC packet that is too long: %s\n",
-                HW::RMT_CHANNEL,
-                dcc::packet_to_string(*sourcePacket, true).c_str());
-      return 1;
+                HW::RMT_CHANNEL, dcc::packet_to_string(packet, true).c_str());
+      return true;
     }
 #if !CONFIG_PROG_TRACK_ENABLED
-    if (sourcePacket->packet_header.send_long_preamble)
+    if (packet.packet_header.send_long_preamble)
     {
       // If the packet looks like a programming track packet, drop it since as
       // only short preamble packets will be accepted for TX.
-      return 1;
+      return true;
     }
-#elif !CONFIG_OPS_TRACK_ENABLED
-    // force long preamble for all packets.
-    sourcePacket->packet_header.send_long_preamble = 1;
 #endif // !CONFIG_PROG_TRACK_ENABLED
-    if (xQueueSendToBack(packetQueueHandle_, sourcePacket
-                      , MAX_PACKET_QUEUE_WAIT_TIME) == pdTRUE)
+    OSMutexLock l(&producerLock_);
+    if (estopLatched_ && dcc_packet_class(packet) == DccPacketClass::SPEED)
     {
-      return 1;
+      // drop locomotive speed packets while the e-stop is active, the
+      // broadcast e-stop packets will keep all locomotives stopped.
+      return true;
+    }
+    // if there is a queued packet for the same address and packet class it
+    // will be replaced in-place rather than queueing the newer packet behind
+    // the stale packet.
+    uint32_t supersedeKey = dcc_packet_supersede_key(packet);
+    if (supersedeKey && supersede_packet(packet, supersedeKey))
+    {
+      stats_.packets++;
+      stats_.superseded++;
+      return true;
     }
 
-    // packet queue is full!
-    errno = ENOSPC;
-    return -1;
+    EncodedPacket *slot = packetRing_.write_slot();
+    if (slot == nullptr)
+    {
+      // packet ring is full!
+      stats_.enospc_drops++;
+      return false;
+    }
+
+    // encode the packet directly into the next free slot of the ring, the ISR
+    // will not read the slot until it has been committed.
+    encode_packet(packet, slot);
+    slot->supersede_key = supersedeKey;
+    slot->estop = false;
+    slot->state.store(SLOT_PENDING, std::memory_order_relaxed);
+    packetRing_.commit();
+    stats_.packets++;
+    size_t pending = packetRing_.pending();
+    if (pending > stats_.ring_high_water)
+    {
+      stats_.ring_high_water = pending;
+    }
+    return true;
   }
 
-  /// VFS interface helper
-  int ioctl(int fd, int cmd, va_list args)
+  /// Sends a broadcast emergency stop to the track ahead of all pending
+  /// packets.
+  ///
+  /// All packets that are pending in the packet ring are replaced in-place
+  /// by broadcast e-stop packets and the packet that is currently being
+  /// transmitted will not be repeated. Until @ref clear_emergency_stop is
+  /// called any locomotive speed packets will be discarded so that a packet
+  /// generated before the e-stop request can not restart a locomotive.
+  ///
+  /// NOTE: this is called from the task context.
+  void emergency_stop()
   {
-    // Attempt to write a Packet to the queue
-    if (IOC_TYPE(cmd) == CAN_IOC_MAGIC && IOC_SIZE(cmd) == NOTIFIABLE_TYPE &&
-        cmd == CAN_IOC_WRITE_ACTIVE)
+    dcc::Packet estop;
+    estop.set_dcc_speed14(dcc::DccShortAddress(0), true, false,
+                          dcc::Packet::EMERGENCY_STOP);
+
+    OSMutexLock l(&producerLock_);
+    estopLatched_ = true;
+    stats_.estops++;
+    // the timestamp is forced to be non-zero as zero indicates there is no
+    // pending request.
+    estopRequested_.store(static_cast<uint32_t>(esp_timer_get_time()) | 1,
+                          std::memory_order_release);
+    bool injected = false;
+    for (size_t offset = 0;; offset++)
     {
-      Notifiable* n = reinterpret_cast<Notifiable*>(va_arg(args, uintptr_t));
-      HASSERT(n);
-      // if there is no space available in the queue, stash the notifiable
-      // handle so we can wake it up later.
-      if (!uxQueueSpacesAvailable(packetQueueHandle_))
+      EncodedPacket *slot = packetRing_.published_slot(offset);
+      if (slot == nullptr)
       {
-        std::swap(n, notifiable_);
+        break;
       }
+      // slots that have been claimed by the ISR can not be replaced, this
+      // will only be the oldest slot.
+      uint8_t expected = SLOT_PENDING;
+      if (slot->state.compare_exchange_strong(
+            expected, SLOT_REWRITING, std::memory_order_acquire))
+      {
+        encode_packet(estop, slot);
+        slot->supersede_key = 0;
+        slot->estop = true;
+        slot->state.store(SLOT_PENDING, std::memory_order_release);
+        injected = true;
+      }
+    }
+    EncodedPacket *slot = injected ? nullptr : packetRing_.write_slot();
+    if (slot != nullptr)
+    {
+      encode_packet(estop, slot);
+      slot->supersede_key = 0;
+      slot->estop = true;
+      slot->state.store(SLOT_PENDING, std::memory_order_relaxed);
+      packetRing_.commit();
+    }
+  }
+
+  /// Clears the emergency stop state set by @ref emergency_stop, locomotive
+  /// speed packets will be accepted again.
+  void clear_emergency_stop()
+  {
+    OSMutexLock l(&producerLock_);
+    estopLatched_ = false;
+  }
+
+  /// Requests a notification when there is space available in the packet
+  /// ring.
+  ///
+  /// @param n is the @ref Notifiable to invoke, if there is space available
+  /// already it will be invoked immediately.
+  void wait_for_space(Notifiable *n)
+  {
+    HASSERT(n);
+    // if there is no space available in the ring, stash the notifiable
+    // handle so the ISR can wake it up once the ring has drained to the low
+    // watermark.
+    if (!packetRing_.available())
+    {
+      n = notifiable_.exchange(n);
       if (n)
       {
         n->notify();
       }
+      // the ISR may have drained the ring before the notifiable was stashed
+      // in which case it would not see it, check again and reclaim it.
+      if (packetRing_.pending() > PACKET_RING_LOW_WATERMARK)
+      {
+        return;
+      }
+      n = notifiable_.exchange(nullptr);
+    }
+    if (n)
+    {
+      n->notify();
+    }
+  }
+
+  /// VFS interface helper
+  int ioctl(int fd, int cmd, va_list args)
+  {
+    // Attempt to write a Packet to the queue
+    if (IOC_TYPE(cmd) == CAN_IOC_MAGIC && IOC_SIZE(cmd) == NOTIFIABLE_TYPE &&
+        cmd == CAN_IOC_WRITE_ACTIVE)
+    {
+      wait_for_space(reinterpret_cast<Notifiable*>(va_arg(args, uintptr_t)));
       return 0;
     }
 
@@ -218,12 +476,75 @@ public:
     return -1;
   }
 
+  /// Selects the EMC spectrum spreading pattern for the DCC signal.
+  ///
+  /// @param spread is the @ref DccEmcSpread pattern to use.
+  ///
+  /// NOTE: packets which have already been encoded will be sent with the
+  /// previous pattern.
+  void set_emc_spread(DccEmcSpread spread)
+  {
+    if (spread >= DccEmcSpread::COUNT)
+    {
+      spread = DccEmcSpread::DISABLED;
+    }
+    if (spread_.exchange(static_cast<uint8_t>(spread)) !=
+        static_cast<uint8_t>(spread))
+    {
+      LOG(INFO, "[DCC-RMT-%d] EMC spread pattern: %s", HW::RMT_CHANNEL,
+          EMC_SPREAD_NAMES[static_cast<uint8_t>(spread)]);
+    }
+  }
+
+  /// @return the telemetry counters for this device.
+  ///
+  /// NOTE: the packet counters are only updated from @ref send, the e-stop
+  /// latency is updated from the ISR.
+  const RMTTrackDeviceStats &stats()
+  {
+    return stats_;
+  }
+
+#if CONFIG_DCC_RMT_TRACE
+  /// Copies the most recently transmitted packets from the packet trace.
+  ///
+  /// @param records is the buffer to receive the records, oldest first.
+  /// @param count is the maximum number of records to copy.
+  ///
+  /// @return the number of records copied.
+  ///
+  /// NOTE: the ISR continues to record packets while the trace is being
+  /// copied, any records that may have been overwritten during the copy are
+  /// discarded.
+  size_t trace_snapshot(DccTraceRecord *records, size_t count)
+  {
+    // the slot at the head index may be in the process of being written by
+    // the ISR so it is never copied.
+    uint32_t head = traceHead_.load(std::memory_order_acquire);
+    count = std::min(count, std::min<size_t>(head, TRACE_RECORDS - 1));
+    uint32_t start = head - count;
+    for (size_t idx = 0; idx < count; idx++)
+    {
+      records[idx] = traceRecords_[(start + idx) % TRACE_RECORDS];
+    }
+    uint32_t end = traceHead_.load(std::memory_order_acquire);
+    if (end + 1 > TRACE_RECORDS + start)
+    {
+      // drop the oldest records as they were overwritten during the copy.
+      size_t stale = std::min<size_t>(end + 1 - TRACE_RECORDS - start, count);
+      memmove(records, records + stale,
+              (count - stale) * sizeof(DccTraceRecord));
+      count -= stale;
+    }
+    return count;
+  }
+#endif // CONFIG_DCC_RMT_TRACE
+
   /// RMT callback for transmit completion. This will be called via the ISR
   /// context but not from an IRAM restricted context.
   void rmt_transmit_complete()
   {
-    BaseType_t woken = pdFALSE;
-    encode_next_packet(&woken);
+    select_next_packet();
     if (DCC_BOOSTER::need_railcom_cutout())
     {
       railcomDriver_->start_cutout();
@@ -243,20 +564,57 @@ public:
 
     // NOTE: This is not using rmt_write_items as it is not safe within an ISR
     // context which this callback is invoked from.
-    rmt_fill_tx_items(HW::RMT_CHANNEL, packet_, pktLength_, 0);
+#if CONFIG_DCC_RMT_STREAMING
+    // fill the RMT memory with as much of the packet as will fit, the
+    // remainder will be refilled from the TX threshold ISR.
+    uint16_t count = activePacket_->length > RMT_STREAM_MEM_ITEMS ?
+      RMT_STREAM_MEM_ITEMS : activePacket_->length;
+    rmt_fill_tx_items(HW::RMT_CHANNEL, activePacket_->items, count, 0);
+    streamNext_ = activePacket_->items + count;
+    streamRemaining_ = activePacket_->length - count;
+    streamOffset_ = 0;
+#else
+    rmt_fill_tx_items(HW::RMT_CHANNEL, activePacket_->items,
+                      activePacket_->length, 0);
+#endif // CONFIG_DCC_RMT_STREAMING
 
     // start the transmit using the rmt_tx_start method which is ISR safe as of
     // IDF v4.1.
     rmt_tx_start(HW::RMT_CHANNEL, true);
+  }
+
+#if CONFIG_DCC_RMT_STREAMING
+  /// RMT TX threshold callback. This will be called via the ISR context when
+  /// half of the RMT memory block has been transmitted and will refill that
+  /// half with the next chunk of the active packet.
+  void rmt_tx_threshold()
+  {
+    if (!(rmt_ll_get_tx_thres_interrupt_status(&RMT) & BIT(HW::RMT_CHANNEL)))
+    {
+      return;
+    }
+    rmt_ll_clear_tx_thres_interrupt(&RMT, HW::RMT_CHANNEL);
 
-    // if we need to wake up another task we can safely do it after sending the
-    // packet off to be transmitted.
-    portYIELD_FROM_ISR(woken);
+    // nothing to do if the remainder of the packet, including the RMT EOF
+    // marker, is already in the RMT memory.
+    if (streamRemaining_ == 0)
+    {
+      return;
+    }
+    uint16_t count = streamRemaining_ > RMT_STREAM_CHUNK_ITEMS ?
+      RMT_STREAM_CHUNK_ITEMS : streamRemaining_;
+    rmt_fill_tx_items(HW::RMT_CHANNEL, streamNext_, count, streamOffset_);
+    streamNext_ += count;
+    streamRemaining_ -= count;
+    streamOffset_ = streamOffset_ ? 0 : RMT_STREAM_CHUNK_ITEMS;
   }
+#endif // CONFIG_DCC_RMT_STREAMING
 
 private:
-  /// Maximum number of bytes to support for DCC packets.
-  static constexpr uint8_t MAX_DCC_DLC_LEN = 6;
+  /// Maximum number of bytes to support for DCC packets, this is the maximum
+  /// payload that can be held by a @ref dcc::Packet (6 bytes) with or without
+  /// CONFIG_DCC_RMT_STREAMING.
+  static constexpr uint8_t MAX_DCC_DLC_LEN = sizeof(dcc::Packet::payload);
 
 
 #if CONFIG_IDF_TARGET_ESP32
@@ -303,95 +661,547 @@ private:
     "APB"  // APB clock, 80Mhz.
   };
 
+  /// Visual names for the @ref DccEmcSpread patterns.
+  static constexpr const char * const EMC_SPREAD_NAMES[] =
+  {
+    "Disabled",
+    "Sawtooth",
+    "Pseudo-random"
+  };
+  static_assert(ARRAYSIZE(EMC_SPREAD_NAMES) ==
+                static_cast<size_t>(DccEmcSpread::COUNT),
+                "EMC_SPREAD_NAMES must have an entry for each DccEmcSpread");
+
   /// Maximum number of microseconds that can be added to each bit pulse time.
   ///
   /// S-9.1 provides a maximum length of 105 and 61 microseconds for each half
   /// wave
   /// 
   /// NOTE: the values below are one higher than maximum to allow for modulo
-  /// operation.
+  /// operation, when the configured bit time is already at (or beyond) the
+  /// maximum no spreading will be applied.
   static constexpr uint8_t DCC_RMT_MAX_ZERO_BIT_SPREAD =
-    105 - HW::DCC_ZERO_RMT_TICKS + 1;
+    HW::DCC_ZERO_RMT_TICKS < 105 ? 105 - HW::DCC_ZERO_RMT_TICKS + 1 : 1;
   static constexpr uint8_t DCC_RMT_MAX_ONE_BIT_SPREAD =
-    61 - HW::DCC_ONE_RMT_TICKS + 1;
+    HW::DCC_ONE_RMT_TICKS < 61 ? 61 - HW::DCC_ONE_RMT_TICKS + 1 : 1;
 
-  /// DCC ZERO bit pre-encoded in RMT format.
-  static rmt_item32_t DCC_RMT_ZERO_BIT;
+  /// Duration of one RMT tick in units of 0.5 nanoseconds, the APB clock is
+  /// 80MHz (12.5nsec) and the REF clock is 1MHz (1usec).
+  static constexpr uint32_t RMT_TICK_HALF_NSEC = CONFIG_DCC_RMT_CLOCK_DIVIDER *
+    (HW::RMT_CLOCK_SOURCE == RMT_BASECLK_APB ? 25 : 2000);
+
+  /// Converts a number of RMT ticks to nanoseconds.
+  ///
+  /// @param ticks is the number of RMT ticks.
+  ///
+  /// @return the number of nanoseconds for the provided ticks.
+  static constexpr uint64_t rmt_ticks_to_nsec(uint64_t ticks)
+  {
+    return (ticks * RMT_TICK_HALF_NSEC) / 2;
+  }
+
+  // Verify the generated signal against the NMRA S-9.1 timing limits for the
+  // command station output, each half of a ONE bit must be 55-61 usec and each
+  // half of a ZERO bit must be 95-9900 usec. The RMT encoding requires the
+  // durations to fit within 15 bits.
+  static_assert(HW::DCC_ONE_RMT_TICKS <= 0x7FFF &&
+                HW::DCC_ZERO_RMT_TICKS <= 0x7FFF,
+                "DCC bit duration exceeds the RMT item duration limit");
+  static_assert(rmt_ticks_to_nsec(HW::DCC_ONE_RMT_TICKS) >= 55000 &&
+                rmt_ticks_to_nsec(HW::DCC_ONE_RMT_TICKS) <= 61000,
+                "DCC ONE half-wave must be 55-61 usec (S-9.1), check the RMT "
+                "clock source and divider");
+  static_assert(rmt_ticks_to_nsec(HW::DCC_ZERO_RMT_TICKS) >= 95000 &&
+                rmt_ticks_to_nsec(HW::DCC_ZERO_RMT_TICKS) <= 9900000,
+                "DCC ZERO half-wave must be 95-9900 usec (S-9.1), check the "
+                "RMT clock source and divider");
+  static_assert(rmt_ticks_to_nsec(HW::DCC_ONE_RMT_TICKS +
+                                  DCC_RMT_MAX_ONE_BIT_SPREAD - 1) <= 61000,
+                "EMC spread pushes the DCC ONE half-wave beyond 61 usec");
 
   /// DCC ONE bit pre-encoded in RMT format.
   static rmt_item32_t DCC_RMT_ONE_BIT;
 
-  /// Maximum amount of time to wait for the packet queue to have space
-  /// available for another packet before giving up. Currently configured to
-  /// not wait.
-  static constexpr BaseType_t MAX_PACKET_QUEUE_WAIT_TIME = 0;
+  /// Number of RMT items generated for each byte of the DCC packet payload,
+  /// eight data bits followed by the end of byte marker.
+  static constexpr uint8_t RMT_ITEMS_PER_BYTE = 9;
+
+  /// Generates the raw value of an RMT item that represents a single DCC bit.
+  ///
+  /// @param ticks is the number of RMT ticks for each half of the DCC bit.
+  ///
+  /// @return the value that can be used for @ref rmt_item32_t::val.
+  static constexpr uint32_t rmt_item_value(uint32_t ticks)
+  {
+    return (ticks & 0x7FFF) |
+           ((uint32_t)HW::RMT_DCC_FIRST_HALF << 15) |
+           ((ticks & 0x7FFF) << 16) |
+           ((uint32_t)HW::RMT_DCC_SECOND_HALF << 31);
+  }
+
+  /// Duration of a DCC ONE bit in nanoseconds, EMC spreading only lengthens
+  /// the bits so this is the shortest ONE bit the encoder will generate.
+  static constexpr uint64_t DCC_ONE_BIT_NSEC =
+    rmt_ticks_to_nsec(2 * HW::DCC_ONE_RMT_TICKS);
+
+  /// Number of preamble bits added to OPS packets for the RailCom cut-out.
+  ///
+  /// The next packet is transmitted as soon as the cut-out starts, the
+  /// booster start delays (HW::RAILCOM_CUTOUT_START_USEC) therefore hide part
+  /// of the preamble in addition to the 454 usec cut-out. The preamble is
+  /// extended by enough ONE bits to cover the start delays so the decoder
+  /// sees the same number of preamble bits after the cut-out as with a
+  /// 454 usec cut-out.
+  static constexpr uint32_t RAILCOM_PREAMBLE_BITS =
+    (HW::RAILCOM_CUTOUT_START_USEC * 1000ULL + DCC_ONE_BIT_NSEC - 1) /
+    DCC_ONE_BIT_NSEC;
+
+  /// Number of preamble bits to send for OPS packets.
+  static constexpr uint32_t OPS_PREAMBLE_BITS =
+    HW::DCC_PREAMBLE_BITS + RAILCOM_PREAMBLE_BITS;
+
+  /// Number of RMT items in the pre-encoded preamble, this covers the
+  /// longest preamble that the encoder will generate.
+  static constexpr uint8_t MAX_PREAMBLE_ITEMS =
+    std::max(HW::DCC_SERVICE_MODE_PREAMBLE_BITS, OPS_PREAMBLE_BITS);
+
+  /// Calculates the number of RMT ticks to add to a DCC bit.
+  ///
+  /// @param spread is the @ref DccEmcSpread pattern.
+  /// @param position is the position of the bit within the pattern.
+  /// @param range is one higher than the maximum number of ticks to add.
+  ///
+  /// @return the number of RMT ticks to add to each half of the DCC bit.
+  static constexpr uint8_t spread_ticks(DccEmcSpread spread, uint8_t position,
+                                        uint8_t range)
+  {
+    if (spread == DccEmcSpread::SAWTOOTH)
+    {
+      return position % range;
+    }
+    else if (spread == DccEmcSpread::PSEUDO_RANDOM)
+    {
+      // advance a 16-bit Galois LFSR (x^16 + x^14 + x^13 + x^11 + 1) once per
+      // bit position, adjacent positions are forced to differ so that no two
+      // sequential bits of the same type have identical timing.
+      uint16_t lfsr = 0xACE1;
+      uint8_t previous = 0;
+      uint8_t ticks = 0;
+      for (uint8_t idx = 0; idx <= position; idx++)
+      {
+        lfsr = (lfsr >> 1) ^ (-(lfsr & 1u) & 0xB400u);
+        previous = ticks;
+        ticks = lfsr % range;
+        if (idx && ticks == previous)
+        {
+          ticks = (ticks + 1) % range;
+        }
+      }
+      return ticks;
+    }
+    return 0;
+  }
+
+  /// Pre-encoded RMT items for a single @ref DccEmcSpread pattern.
+  ///
+  /// The payload bytes are translated via a lookup table into the RMT items
+  /// for the eight data bits (MSB first) followed by a DCC ZERO as the end of
+  /// byte marker. The tables are generated at compile time for each HW
+  /// configuration and spreading pattern so that the encoder only needs to
+  /// copy blocks of items rather than testing or adjusting each bit
+  /// individually.
+  ///
+  /// The spreading offset of each bit is based on its position within the
+  /// preamble or payload byte, the start of payload marker uses the same
+  /// timing as the end of byte marker.
+  struct RmtSymbolTable
+  {
+    /// Constructor.
+    ///
+    /// @param spread is the @ref DccEmcSpread pattern to generate.
+    constexpr RmtSymbolTable(DccEmcSpread spread)
+      : preamble(), start(0), bytes(), end(0), trailer(0)
+    {
+      uint8_t one[RMT_ITEMS_PER_BYTE + 1] = {0};
+      uint8_t zero[RMT_ITEMS_PER_BYTE + 1] = {0};
+      for (uint8_t pos = 0; pos <= RMT_ITEMS_PER_BYTE; pos++)
+      {
+        one[pos] = spread_ticks(spread, pos, DCC_RMT_MAX_ONE_BIT_SPREAD);
+        zero[pos] = spread_ticks(spread, pos, DCC_RMT_MAX_ZERO_BIT_SPREAD);
+      }
+      for (uint8_t pos = 0; pos < MAX_PREAMBLE_ITEMS; pos++)
+      {
+        preamble[pos] = rmt_item_value(HW::DCC_ONE_RMT_TICKS +
+          spread_ticks(spread, pos, DCC_RMT_MAX_ONE_BIT_SPREAD));
+      }
+      start = rmt_item_value(HW::DCC_ZERO_RMT_TICKS + zero[8]);
+      for (uint16_t value = 0; value < 256; value++)
+      {
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+          bytes[value][bit] = (value & (0x80 >> bit)) ?
+            rmt_item_value(HW::DCC_ONE_RMT_TICKS + one[bit]) :
+            rmt_item_value(HW::DCC_ZERO_RMT_TICKS + zero[bit]);
+        }
+        bytes[value][8] = rmt_item_value(HW::DCC_ZERO_RMT_TICKS + zero[8]);
+      }
+      end = rmt_item_value(HW::DCC_ONE_RMT_TICKS + one[8]);
+      trailer = rmt_item_value(HW::DCC_ONE_RMT_TICKS + one[9]);
+    }
+
+    /// Pre-encoded RMT items for the preamble bits.
+    uint32_t preamble[MAX_PREAMBLE_ITEMS];
+
+    /// Pre-encoded RMT item for the start of payload marker.
+    uint32_t start;
+
+    /// Pre-encoded RMT items indexed by the payload byte value.
+    uint32_t bytes[256][RMT_ITEMS_PER_BYTE];
+
+    /// Pre-encoded RMT item for the end of packet marker, this replaces the
+    /// end of byte marker of the last payload byte.
+    uint32_t end;
+
+    /// Pre-encoded RMT item for the extra ONE bit which follows the end of
+    /// packet marker.
+    uint32_t trailer;
+  };
+
+  /// Pre-encoded RMT items for each @ref DccEmcSpread pattern.
+  static const RmtSymbolTable
+    DCC_RMT_SYMBOL_TABLES[static_cast<size_t>(DccEmcSpread::COUNT)];
+
+  /// Maximum number of RMT items that a single encoded DCC packet can use,
+  /// with the default configuration this is 107 items while using up to 50
+  /// preamble bits.
+  static constexpr uint16_t MAX_ENCODED_PACKET_ITEMS =
+    MAX_PREAMBLE_ITEMS +
+    1 + /* payload start bit */
+    (MAX_DCC_DLC_LEN * 8) + /* payload bytes */
+    MAX_DCC_DLC_LEN + /* end of byte markers */
+    3; /* end of packet marker, sacrificial bit, RMT EOF marker */
+
+#if CONFIG_DCC_RMT_STREAMING
+  /// Number of RMT memory blocks to use when streaming packets.
+  static constexpr uint8_t RMT_STREAM_MEMORY_BLOCKS = 1;
+
+  /// Number of RMT items available in the RMT memory when streaming packets.
+  static constexpr uint16_t RMT_STREAM_MEM_ITEMS =
+    RMT_STREAM_MEMORY_BLOCKS * RMT_MEM_ITEM_NUM;
+
+  /// Number of RMT items to refill from the TX threshold ISR, this is half
+  /// of the RMT memory so that one half can be refilled while the other half
+  /// is being transmitted.
+  static constexpr uint16_t RMT_STREAM_CHUNK_ITEMS = RMT_STREAM_MEM_ITEMS / 2;
+
+  /// Handle for the RMT TX threshold ISR.
+  intr_handle_t thresholdIsrHandle_{nullptr};
+
+  /// Next RMT item of the active packet to be copied into RMT memory.
+  const rmt_item32_t *streamNext_{nullptr};
+
+  /// Number of RMT items of the active packet that have not yet been copied
+  /// into RMT memory.
+  uint16_t streamRemaining_{0};
+
+  /// Offset in RMT memory for the next refill, alternates between the first
+  /// and second half of the memory block.
+  uint16_t streamOffset_{0};
+
+  /// Trampoline for @ref rmt_tx_threshold.
+  ///
+  /// @param arg is the @ref RMTTrackDevice instance.
+  static void rmt_threshold_isr(void *arg)
+  {
+    reinterpret_cast<RMTTrackDevice *>(arg)->rmt_tx_threshold();
+  }
+#else
+  static_assert(MAX_ENCODED_PACKET_ITEMS <= MAX_RMT_ENCODED_BITS,
+                "Encoded DCC packet exceeds available RMT memory");
+#endif // CONFIG_DCC_RMT_STREAMING
+
+  /// Number of pre-encoded packets in the ring, one additional slot is used
+  /// for the packet that is actively being transmitted.
+  static constexpr size_t PACKET_RING_SIZE = HW::PACKET_Q_SIZE + 1;
+
+  /// Number of pending packets in the ring at or below which a writer that
+  /// found the ring full will be woken up. This allows the writer to refill
+  /// several slots at once rather than being woken for every packet sent.
+  static constexpr size_t PACKET_RING_LOW_WATERMARK = PACKET_RING_SIZE / 2;
+
+  /// @ref EncodedPacket state: published and waiting for transmission.
+  static constexpr uint8_t SLOT_PENDING = 0;
+
+  /// @ref EncodedPacket state: being replaced by a newer packet.
+  static constexpr uint8_t SLOT_REWRITING = 1;
+
+  /// @ref EncodedPacket state: selected for transmission by the ISR.
+  static constexpr uint8_t SLOT_ACTIVE = 2;
+
+  /// DCC packet that has been pre-encoded in RMT format and is ready to be
+  /// transmitted.
+  struct EncodedPacket
+  {
+    /// Encoded bits of the packet, including the RMT EOF marker.
+    rmt_item32_t items[MAX_ENCODED_PACKET_ITEMS];
+
+    /// Number of encoded bits in @ref items.
+    uint16_t length;
+
+    /// Number of repeats of the packet to send.
+    int8_t repeat_count;
+
+    /// RailCom feedback key for the packet, this is the key set by the packet
+    /// source or dcc_packet_feedback_key when the source did not set one.
+    uintptr_t feedback_key;
+
+    /// Key used to identify packets which supersede this packet, zero if the
+    /// packet can not be superseded.
+    uint32_t supersede_key;
+
+    /// Ownership state of the packet, one of @ref SLOT_PENDING,
+    /// @ref SLOT_REWRITING or @ref SLOT_ACTIVE.
+    std::atomic<uint8_t> state;
+
+    /// True if the packet was injected by @ref emergency_stop.
+    bool estop;
+
+#if CONFIG_DCC_RMT_TRACE
+    /// Trace record for the packet, the timestamp is filled in by the ISR
+    /// when the packet is selected for transmission.
+    DccTraceRecord trace;
+#endif // CONFIG_DCC_RMT_TRACE
+  };
 
   /// @ref RailcomDriver instance to use for possibly generating the RailCom
   /// cut-out period.
   RailcomDriver *railcomDriver_;
 
-  /// Queue to use for DCC packets that are pending encoding for delivery.
-  StaticQueue_t packetQueue_;
-  
-  /// Handle to @ref packetQueue_.
-  QueueHandle_t packetQueueHandle_{nullptr};
+  /// Ring of pre-encoded packets that are pending delivery, @ref send is the
+  /// only producer and the RMT ISR is the only consumer.
+  SpscRing<EncodedPacket, PACKET_RING_SIZE> packetRing_;
 
-  /// Memory block used for @ref packetQueue_.
-  void *packetQueueBuf_{nullptr};
+  /// Serializes @ref send between the track interface and VFS writers.
+  OSMutex producerLock_;
 
-  /// Notifiable to use when there is space available in @ref packetQueue_.
-  Notifiable* notifiable_{nullptr};
+  /// Memory block used for @ref packetRing_.
+  EncodedPacket *packetRingBuf_{nullptr};
+
+  /// Pre-encoded idle packet for each @ref DccEmcSpread pattern.
+  EncodedPacket idlePackets_[static_cast<size_t>(DccEmcSpread::COUNT)];
+
+  /// Packet currently being transmitted, this will either be a slot in
+  /// @ref packetRing_ or one of @ref idlePackets_.
+  EncodedPacket *activePacket_{nullptr};
+
+  /// Notifiable to use when there is space available in @ref packetRing_.
+  std::atomic<Notifiable *> notifiable_{nullptr};
 
   /// Number of repeats of the current packet to send.
   int8_t pktRepeatCount_{0};
-  
-  /// Number of encoded bits in the current packet.
-  uint32_t pktLength_{0};
 
-  /// Encoded bits of the current packet.
-  rmt_item32_t packet_[MAX_RMT_ENCODED_BITS];
+  /// Telemetry counters.
+  RMTTrackDeviceStats stats_;
+
+#if CONFIG_DCC_RMT_TRACE
+  /// Number of records held in the packet trace.
+  static constexpr uint32_t TRACE_RECORDS = CONFIG_DCC_RMT_TRACE_RECORDS;
+
+  /// Packet trace, written only by the ISR.
+  DccTraceRecord traceRecords_[TRACE_RECORDS];
 
-  /// Encodes the next DCC packet for transmission by the RMT peripheral.
+  /// Free-running index of the next record to be written in
+  /// @ref traceRecords_.
+  std::atomic<uint32_t> traceHead_{0};
+#endif // CONFIG_DCC_RMT_TRACE
+
+  /// True while @ref emergency_stop is in effect, locomotive speed packets
+  /// will be discarded by @ref send.
   ///
-  /// @param woken will be set to pdTRUE if the ISR should transfer control to
-  /// another task.
+  /// NOTE: this is protected by @ref producerLock_.
+  bool estopLatched_{false};
+
+  /// Timestamp (in microseconds, truncated to 32 bits) of the pending
+  /// emergency stop request, zero when the ISR has already sent the first
+  /// e-stop packet.
+  std::atomic<uint32_t> estopRequested_{0};
+
+  /// Active @ref DccEmcSpread pattern.
+  std::atomic<uint8_t> spread_{
+#if CONFIG_DCC_RMT_EMC_SPREAD
+    static_cast<uint8_t>(DccEmcSpread::SAWTOOTH)
+#else
+    static_cast<uint8_t>(DccEmcSpread::DISABLED)
+#endif // CONFIG_DCC_RMT_EMC_SPREAD
+  };
+
+  /// @return the pre-encoded idle packet for the active EMC spreading
+  /// pattern.
+  EncodedPacket *idle_packet()
+  {
+    return &idlePackets_[spread_.load(std::memory_order_relaxed)];
+  }
+
+  /// @return true if the packet is one of the pre-encoded idle packets.
   ///
-  /// NOTE: this will only encode the next packet if the current packet has
-  /// reached the required number of repeats.
-  void encode_next_packet(BaseType_t *woken)
+  /// @param packet is the packet to check.
+  bool is_idle_packet(const EncodedPacket *packet)
   {
-    // Bit mask constants used as part of the packet translation layer.
-    const uint8_t PACKET_BIT_MASK[] =
-    {
-      0x80, 0x40, 0x20, 0x10, //
-      0x08, 0x04, 0x02, 0x01  //
-    };
+    return packet >= idlePackets_ &&
+           packet < idlePackets_ + ARRAYSIZE(idlePackets_);
+  }
 
-    // Check if we need to encode the next packet or if we still have at least
-    // one repeat left of the current packet.
-    if (--pktRepeatCount_ >= 0)
+  /// Selects the next pre-encoded DCC packet for transmission by the RMT
+  /// peripheral, this is called from the ISR context.
+  ///
+  /// NOTE: this will only select the next packet if the current packet has
+  /// reached the required number of repeats.
+  void select_next_packet()
+  {
+    // Check if we need to select the next packet or if we still have at least
+    // one repeat left of the current packet. Pending emergency stop requests
+    // cut the repeats short so the e-stop packets are sent immediately.
+    if (--pktRepeatCount_ >= 0 &&
+        !estopRequested_.load(std::memory_order_relaxed))
     {
       return;
     }
-    // attempt to fetch a packet from the queue or use an idle packet.
-    Notifiable* n = nullptr;
-    dcc::Packet packet{dcc::Packet::DCC_IDLE()};
-    
-    if (xQueueReceiveFromISR(packetQueueHandle_, &packet, woken))
+    if (!is_idle_packet(activePacket_))
     {
-      // since we removed a packet from the queue, swap the notifiable handle
-      // so it can be woken up if needed.
-      std::swap(n, notifiable_);
+      // the active packet has been fully sent, release the slot back to the
+      // writer and wake it up if the ring has drained to the low watermark.
+      packetRing_.release();
+      if (packetRing_.pending() <= PACKET_RING_LOW_WATERMARK &&
+          notifiable_.load(std::memory_order_relaxed))
+      {
+        Notifiable *n = notifiable_.exchange(nullptr);
+        if (n)
+        {
+          n->notify_from_isr();
+        }
+      }
     }
-    if (n)
+    // use the oldest packet in the ring or an idle packet.
+    activePacket_ = packetRing_.peek();
+    if (activePacket_ != nullptr)
+    {
+      // claim the packet so that the writer will no longer attempt to
+      // supersede it. If the writer is currently replacing the packet send an
+      // idle packet instead and claim the packet on the next pass.
+      uint8_t expected = SLOT_PENDING;
+      if (!activePacket_->state.compare_exchange_strong(
+            expected, SLOT_ACTIVE, std::memory_order_acquire))
+      {
+        activePacket_ = nullptr;
+      }
+    }
+    if (activePacket_ == nullptr)
+    {
+      activePacket_ = idle_packet();
+    }
+    else if (activePacket_->estop)
+    {
+      // record the latency of the emergency stop request.
+      uint32_t requested = estopRequested_.exchange(0);
+      if (requested)
+      {
+        uint32_t latency =
+          static_cast<uint32_t>(esp_timer_get_time()) - requested;
+        stats_.estop_latency_usec = latency;
+        if (latency > stats_.estop_latency_max_usec)
+        {
+          stats_.estop_latency_max_usec = latency;
+        }
+      }
+    }
+
+    // record the repeat count.
+    pktRepeatCount_ = activePacket_->repeat_count;
+
+#if CONFIG_DCC_RMT_TRACE
+    if (!is_idle_packet(activePacket_))
     {
-      n->notify_from_isr();
+      uint32_t head = traceHead_.load(std::memory_order_relaxed);
+      DccTraceRecord &record = traceRecords_[head % TRACE_RECORDS];
+      record = activePacket_->trace;
+      record.timestamp = static_cast<uint32_t>(esp_timer_get_time());
+      traceHead_.store(head + 1, std::memory_order_release);
     }
+#endif // CONFIG_DCC_RMT_TRACE
 
+    // Send the feedback key to the RailCom driver instance.
+    railcomDriver_->set_feedback_key(activePacket_->feedback_key);
+  }
+
+  /// Replaces a queued packet for the same address and packet class with a
+  /// newer packet.
+  ///
+  /// @param packet is the newer DCC packet.
+  /// @param key is the supersede key of the packet.
+  ///
+  /// @return true if a queued packet was replaced, false if the packet needs
+  /// to be added to the ring.
+  ///
+  /// NOTE: this is called from the task context.
+  bool supersede_packet(const dcc::Packet &packet, uint32_t key)
+  {
+    for (size_t offset = 0;; offset++)
+    {
+      EncodedPacket *slot = packetRing_.published_slot(offset);
+      if (slot == nullptr)
+      {
+        return false;
+      }
+      if (slot->supersede_key != key)
+      {
+        continue;
+      }
+      // the ISR may have claimed the slot already in which case it can not be
+      // modified, there will be at most one other pending slot for the key.
+      uint8_t expected = SLOT_PENDING;
+      if (slot->state.compare_exchange_strong(
+            expected, SLOT_REWRITING, std::memory_order_acquire))
+      {
+        encode_packet(packet, slot);
+#if CONFIG_DCC_RMT_TRACE
+        slot->trace.flags |= DCC_TRACE_FLAG_SUPERSEDED;
+#endif // CONFIG_DCC_RMT_TRACE
+        slot->state.store(SLOT_PENDING, std::memory_order_release);
+        return true;
+      }
+    }
+  }
+
+  /// Encodes a DCC packet for transmission by the RMT peripheral using the
+  /// active EMC spreading pattern.
+  ///
+  /// @param packet is the DCC packet to encode.
+  /// @param target is the @ref EncodedPacket to encode into.
+  ///
+  /// NOTE: this is called from the task context.
+  void encode_packet(const dcc::Packet &packet, EncodedPacket *target)
+  {
+    encode_packet(packet, target,
+                  DCC_RMT_SYMBOL_TABLES[spread_.load(std::memory_order_relaxed)]);
+  }
+
+  /// Encodes a DCC packet for transmission by the RMT peripheral.
+  ///
+  /// @param packet is the DCC packet to encode.
+  /// @param target is the @ref EncodedPacket to encode into.
+  /// @param symbols is the @ref RmtSymbolTable to encode with.
+  ///
+  /// NOTE: this is called from the task context for all packets except the
+  /// idle packets which are encoded during @ref hw_init.
+  void encode_packet(const dcc::Packet &packet, EncodedPacket *target,
+                     const RmtSymbolTable &symbols)
+  {
+    rmt_item32_t *items = target->items;
+    uint16_t pktLength = 0;
 #if !CONFIG_OPS_TRACK_ENABLED
     uint32_t preableBitCount = HW::DCC_SERVICE_MODE_PREAMBLE_BITS;
 #else
-    uint32_t preableBitCount = HW::DCC_PREAMBLE_BITS;
+    uint32_t preableBitCount = OPS_PREAMBLE_BITS;
 #if CONFIG_PROG_TRACK_ENABLED
     if (packet.packet_header.send_long_preamble)
     {
@@ -399,81 +1209,54 @@ private:
     }
 #endif // CONFIG_PROG_TRACK_ENABLED
 #endif // !CONFIG_OPS_TRACK_ENABLED
-    // encode the preamble bits
-    for (pktLength_ = 0; pktLength_ < preableBitCount; pktLength_++)
-    {
-      packet_[pktLength_].val = DCC_RMT_ONE_BIT.val;
-    }
+    // encode the preamble bits, when EMC spreading is enabled the bit times
+    // have already been adjusted in the symbol table so no two sequential
+    // bits are identical.
+    memcpy(items, symbols.preamble, preableBitCount * sizeof(uint32_t));
+    pktLength = preableBitCount;
     // start of payload marker
-    packet_[pktLength_++].val = DCC_RMT_ZERO_BIT.val;
-    // encode the packet bits
+    items[pktLength++].val = symbols.start;
+    // encode the packet bytes, each byte is copied as a block of pre-encoded
+    // RMT items which includes the end of byte marker.
     for (uint8_t dlc = 0; dlc < packet.dlc; dlc++)
     {
-      for(uint8_t bit = 0; bit < 8; bit++)
-      {
-        packet_[pktLength_++].val =
-          packet.payload[dlc] & PACKET_BIT_MASK[bit] ?
-            DCC_RMT_ONE_BIT.val : DCC_RMT_ZERO_BIT.val;
-      }
-      // end of byte marker
-      packet_[pktLength_++].val = DCC_RMT_ZERO_BIT.val;
+      memcpy(&items[pktLength], symbols.bytes[packet.payload[dlc]],
+             sizeof(symbols.bytes[0]));
+      pktLength += RMT_ITEMS_PER_BYTE;
     }
     // set the last bit of the encoded payload to be an end of packet marker
-    packet_[pktLength_ - 1].val = DCC_RMT_ONE_BIT.val;
+    items[pktLength - 1].val = symbols.end;
     // add an extra ONE bit to the end to prevent mangling of the last bit by
     // the RMT
-    packet_[pktLength_++].val = DCC_RMT_ONE_BIT.val;
+    items[pktLength++].val = symbols.trailer;
     // Add marker to the end of the DCC packet data to allow the RMT to know it
     // can stop transmitting at this point.
-    packet_[pktLength_++].val = 0;
+    items[pktLength++].val = 0;
 
-#if CONFIG_DCC_RMT_EMC_SPREAD
-    // If the EMC spectrum spreading option is enabled, modify the DCC bit time
-    // to ensure no two sequential bits are identical. The modification of the
-    // bits is done in the simplest manner possible by adding a few
-    // microseconds to the two parts of the signal based on the packet bit
-    // index modulo the maximum bit spread (5usec for zero, 3usec for one).
-    // The first bit of the preamble is skipped as is the last entry in the
-    // packet which is an end-of-packet marker for the RMT peripheral and is
-    // not transmitted to the rails.
-    for (uint8_t idx = 1 idx < pktLength_; idx++)
-    {
-      if (packet_[idx].val == packet_[idx - 1].val)
-      {
-        if (packet_[idx - 1].val == DCC_RMT_ZERO_BIT.val)
-        {
-          packet_[idx - 1].duration0 += (idx % DCC_RMT_MAX_ZERO_BIT_SPREAD);
-          packet_[idx - 1].duration1 += (idx % DCC_RMT_MAX_ZERO_BIT_SPREAD);
-        }
-        else
-        {
-          packet_[idx - 1].duration0 += (idx % DCC_RMT_MAX_ONE_BIT_SPREAD);
-          packet_[idx - 1].duration1 += (idx % DCC_RMT_MAX_ONE_BIT_SPREAD);
-        }
-      }
-    }
-#endif // CONFIG_DCC_RMT_EMC_SPREAD
+    target->length = pktLength;
+    target->repeat_count = packet.packet_header.rept_count;
+    // the feedback key set by the packet source is used to match the RailCom
+    // response to the packet, it is only derived from the packet when the
+    // source did not set one.
+    target->feedback_key = packet.feedback_key ? packet.feedback_key :
+                           dcc_packet_feedback_key(packet);
 
-    // record the repeat count.
-    pktRepeatCount_ = packet.packet_header.rept_count;
-
-    // Send the feedback key to the RailCom driver instance.
-    railcomDriver_->set_feedback_key(packet.feedback_key);
+#if CONFIG_DCC_RMT_TRACE
+    DccTraceRecord &trace = target->trace;
+    trace.feedback_key = target->feedback_key;
+    memcpy(trace.payload, packet.payload, DCC_TRACE_MAX_PAYLOAD);
+    trace.dlc = packet.dlc;
+    trace.repeat_count = packet.packet_header.rept_count;
+    trace.preamble_bits = preableBitCount;
+    trace.packet_class = static_cast<uint8_t>(dcc_packet_class(packet));
+    trace.flags = 0;
+    trace.reserved = 0;
+#endif // CONFIG_DCC_RMT_TRACE
   }
 
   DISALLOW_COPY_AND_ASSIGN(RMTTrackDevice);
 };
 
-/// DCC ZERO bit pre-encoded in RMT format.
-template<class HW, class DCC_BOOSTER, class OLCB_DCC_BOOSTER>
-rmt_item32_t RMTTrackDevice<HW, DCC_BOOSTER, OLCB_DCC_BOOSTER>::DCC_RMT_ZERO_BIT =
-{{{
-    HW::DCC_ZERO_RMT_TICKS, // number of microseconds for the first half of the
-    HW::RMT_DCC_FIRST_HALF, // DCC signal wave format.
-    HW::DCC_ZERO_RMT_TICKS, // number of microseconds for the second half of
-    HW::RMT_DCC_SECOND_HALF // the DCC signal wave format.
-}}};
-
 /// DCC ONE bit pre-encoded in RMT format.
 template<class HW, class DCC_BOOSTER, class OLCB_DCC_BOOSTER>
 rmt_item32_t RMTTrackDevice<HW, DCC_BOOSTER, OLCB_DCC_BOOSTER>::DCC_RMT_ONE_BIT =
@@ -484,6 +1267,16 @@ rmt_item32_t RMTTrackDevice<HW, DCC_BOOSTER, OLCB_DCC_BOOSTER>::DCC_RMT_ONE_BIT
     HW::RMT_DCC_SECOND_HALF // the DCC signal wave format.
 }}};
 
+/// Pre-encoded RMT items for each EMC spreading pattern.
+template<class HW, class DCC_BOOSTER, class OLCB_DCC_BOOSTER>
+const typename RMTTrackDevice<HW, DCC_BOOSTER, OLCB_DCC_BOOSTER>::RmtSymbolTable
+  RMTTrackDevice<HW, DCC_BOOSTER, OLCB_DCC_BOOSTER>::DCC_RMT_SYMBOL_TABLES[] =
+{
+  RmtSymbolTable(DccEmcSpread::DISABLED),
+  RmtSymbolTable(DccEmcSpread::SAWTOOTH),
+  RmtSymbolTable(DccEmcSpread::PSEUDO_RANDOM),
+};
+
 } // namespace esp32cs
 
 #endif // _RMT_TRACK_DEVICE_H_
@@ -0,0 +1,73 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+#ifndef RMT_TRACK_IF_HXX_
+#define RMT_TRACK_IF_HXX_
+
+#include <dcc/Packet.hxx>
+#include <executor/StateFlow.hxx>
+#include <utils/Buffer.hxx>
+
+namespace esp32cs
+{
+
+/// Track interface which hands DCC packets directly to an RMT signal
+/// generator.
+///
+/// This replaces dcc::LocalTrackIf for in-process packet sources, rather than
+/// writing each packet to the VFS node (and from there into the device) the
+/// packet is encoded by the device directly from the pool buffer which is
+/// released as soon as the packet has been encoded.
+///
+/// @param DEVICE is the RMT signal generator type, it must provide
+/// `bool send(const dcc::Packet &)` and `void wait_for_space(Notifiable *)`.
+template <class DEVICE>
+class RMTTrackIf : public StateFlow<Buffer<dcc::Packet>, QList<1>>
+{
+public:
+  /// Constructor.
+  ///
+  /// @param service is the @ref Service to execute this flow on.
+  /// @param device is the RMT signal generator to send packets to.
+  /// @param pool_size is the number of packets to allocate in @ref pool.
+  RMTTrackIf(Service *service, DEVICE *device, int pool_size)
+    : StateFlow<Buffer<dcc::Packet>, QList<1>>(service), device_(device),
+      pool_(sizeof(Buffer<dcc::Packet>), pool_size)
+  {
+  }
+
+  /// @return the pool of packets that should be used for sending packets to
+  /// this track interface.
+  FixedPool *pool() override
+  {
+    return &pool_;
+  }
+
+private:
+  /// RMT signal generator to send packets to.
+  DEVICE *device_;
+
+  /// Pool of packets for this track interface.
+  FixedPool pool_;
+
+  /// Hands the packet to the RMT signal generator, if the packet ring is full
+  /// the flow will wait until the ISR has drained it.
+  Action entry() override
+  {
+    if (device_->send(*message()->data()))
+    {
+      return release_and_exit();
+    }
+    device_->wait_for_space(this);
+    return wait();
+  }
+};
+
+} // namespace esp32cs
+
+#endif // RMT_TRACK_IF_HXX_
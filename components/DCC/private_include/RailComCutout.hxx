@@ -0,0 +1,158 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+#ifndef RAILCOM_CUTOUT_HXX_
+#define RAILCOM_CUTOUT_HXX_
+
+#include <stdint.h>
+
+namespace esp32cs
+{
+
+/// Sequences the phases of the RailCom cut-out.
+///
+/// The cut-out starts when the RMT transmission of a packet completes, the
+/// transmission of the next packet starts immediately afterwards so the
+/// cut-out overlaps the start of the next preamble. The phases are:
+/// START_PHASE1:  outputs disabled, waiting for the booster phase 1 delay.
+/// START_PHASE2:  detector enabled, waiting for the booster phase 2 delay.
+/// CUTOUT_PHASE1: channel 1 window.
+/// CUTOUT_PHASE2: channel 2 window.
+/// STOP_PHASE:    detector disabled, waiting for the booster stop delay.
+///
+/// This only calls the booster hooks and calculates the delay between the
+/// phases, the caller is responsible for the timer and the RailCom receiver.
+/// This allows the sequencing to be verified without the hardware.
+///
+/// @param HW is the RailCom hardware definition which provides the timing of
+/// the cut-out.
+/// @param DCC_BOOSTER is the track booster output.
+/// @param OLCB_DCC_BOOSTER is the OpenLCB booster output.
+template <class HW, class DCC_BOOSTER, class OLCB_DCC_BOOSTER>
+class RailComCutoutSequencer
+{
+public:
+  typedef enum : uint8_t
+  {
+    PRE_CUTOUT,
+    START_PHASE1,
+    START_PHASE2,
+    CUTOUT_PHASE1,
+    CUTOUT_PHASE2,
+    STOP_PHASE
+  } RailComPhase;
+
+  /// Number of microseconds from the end of the RMT transmission until the
+  /// channel 1 window starts.
+  static constexpr uint32_t START_USEC =
+    HW::RAILCOM_START_PHASE1_DELAY_USEC + HW::RAILCOM_START_PHASE2_DELAY_USEC;
+
+  /// Total length of the RailCom cut-out as configured by HW, in
+  /// microseconds.
+  static constexpr uint32_t CUTOUT_USEC =
+    START_USEC + HW::RAILCOM_MAX_READ_DELAY_CH_1 +
+    HW::RAILCOM_MAX_READ_DELAY_CH_2 + HW::RAILCOM_STOP_DELAY_USEC;
+
+  // NMRA S-9.3.2 requires the cut-out to end 454-488 usec after the end of
+  // the packet end bit, the cut-out is timed from the end of the RMT
+  // transmission. The START_USEC part of the cut-out hides the start of the
+  // next preamble, see RMTTrackDevice::RAILCOM_PREAMBLE_BITS.
+  static_assert(CUTOUT_USEC >= 454 && CUTOUT_USEC <= 488,
+                "RailCom cut-out must be 454-488 usec (S-9.3.2)");
+
+  /// @return the current phase of the cut-out.
+  RailComPhase phase() const
+  {
+    return phase_;
+  }
+
+  /// Starts the RailCom cut-out by disabling the track outputs.
+  ///
+  /// @return the number of microseconds until @ref advance should be called.
+  uint32_t start()
+  {
+    phase_ = RailComPhase::START_PHASE1;
+    return alarm_delay(DCC_BOOSTER::start_railcom_cutout_phase1() +
+                       OLCB_DCC_BOOSTER::start_railcom_cutout_phase1());
+  }
+
+  /// Advances the cut-out to the next phase, this is called when the delay
+  /// returned by @ref start or the previous call has elapsed.
+  ///
+  /// @return the number of microseconds until the next call, zero when the
+  /// cut-out has completed.
+  uint32_t advance()
+  {
+    switch (phase_)
+    {
+      case RailComPhase::START_PHASE1:
+        phase_ = RailComPhase::START_PHASE2;
+        // enable the RailCom detector
+        return alarm_delay(DCC_BOOSTER::start_railcom_cutout_phase2() +
+                           OLCB_DCC_BOOSTER::start_railcom_cutout_phase2());
+      case RailComPhase::START_PHASE2:
+        phase_ = RailComPhase::CUTOUT_PHASE1;
+        return alarm_delay(HW::RAILCOM_MAX_READ_DELAY_CH_1);
+      case RailComPhase::CUTOUT_PHASE1:
+        phase_ = RailComPhase::CUTOUT_PHASE2;
+        return alarm_delay(HW::RAILCOM_MAX_READ_DELAY_CH_2);
+      case RailComPhase::CUTOUT_PHASE2:
+        phase_ = RailComPhase::STOP_PHASE;
+        return alarm_delay(stop_detector());
+      case RailComPhase::STOP_PHASE:
+        stop();
+        return 0;
+      default:
+        return 0;
+    }
+  }
+
+  /// Disables the RailCom detector.
+  ///
+  /// @return the number of microseconds to wait before calling @ref stop.
+  uint32_t stop_detector()
+  {
+    return DCC_BOOSTER::stop_railcom_cutout_phase1() +
+           OLCB_DCC_BOOSTER::stop_railcom_cutout_phase1();
+  }
+
+  /// Completes the RailCom cut-out and re-enables the track outputs.
+  void stop()
+  {
+    phase_ = RailComPhase::PRE_CUTOUT;
+    DCC_BOOSTER::stop_railcom_cutout_phase2();
+    OLCB_DCC_BOOSTER::stop_railcom_cutout_phase2();
+    if (DCC_BOOSTER::should_be_enabled())
+    {
+      DCC_BOOSTER::enable_output();
+    }
+    if (OLCB_DCC_BOOSTER::should_be_enabled())
+    {
+      OLCB_DCC_BOOSTER::enable_output();
+    }
+  }
+
+  /// @return the timer alarm value to use for a delay.
+  ///
+  /// @param usec is the requested delay in microseconds.
+  ///
+  /// NOTE: the timer is reloaded with zero before the alarm is set, an alarm
+  /// of zero would not fire so the delay is rounded up to one microsecond.
+  static constexpr uint32_t alarm_delay(uint32_t usec)
+  {
+    return usec ? usec : 1;
+  }
+
+private:
+  /// Current phase of the cut-out.
+  RailComPhase phase_{RailComPhase::PRE_CUTOUT};
+};
+
+} // namespace esp32cs
+
+#endif // RAILCOM_CUTOUT_HXX_
@@ -0,0 +1,165 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+#ifndef RAILCOM_FEEDBACK_CACHE_HXX_
+#define RAILCOM_FEEDBACK_CACHE_HXX_
+
+#include "RailComFeedback.hxx"
+#include "sdkconfig.h"
+
+#include <dcc/RailcomHub.hxx>
+#include <Spinlock.hxx>
+#include <string>
+
+#ifndef CONFIG_RAILCOM_FEEDBACK_CACHE_SIZE
+#define CONFIG_RAILCOM_FEEDBACK_CACHE_SIZE 64
+#endif
+
+namespace esp32cs
+{
+
+class RailComPomEngine;
+
+/// Cache of the decoded RailCom feedback for each DCC decoder address.
+///
+/// This listens to the RailCom hub and attributes the data received in each
+/// cut-out to the decoder address carried in the feedback key (see
+/// dcc_packet_feedback_key), feedback for packets where the source set its
+/// own feedback key is not attributed. Short and long addresses with the same
+/// number are cached separately. Channel 1 address broadcasts and channel 2
+/// datagrams (POM, dynamic variables) are decoded and stored along with the
+/// time they were received. Channel 1 address broadcasts are also reported
+/// to the locodb::LocoPresence table when it exists and POM responses are
+/// forwarded to the @ref RailComPomEngine when one has been attached.
+///
+/// Entries are stored in a fixed size open addressing table with a bounded
+/// probe length so that lookups are O(1), when all slots in the probe
+/// sequence are in use the entry with the oldest feedback is replaced.
+class RailComFeedbackCache : public dcc::RailcomHubPortInterface
+{
+public:
+  /// Constructor.
+  ///
+  /// @param hub is the @ref dcc::RailcomHubFlow to receive feedback from.
+  RailComFeedbackCache(dcc::RailcomHubFlow *hub);
+
+  /// Destructor.
+  ~RailComFeedbackCache();
+
+  /// Decodes the feedback from a single cut-out and updates the cache entry
+  /// for the address it was received for.
+  ///
+  /// @param entry is the RailCom feedback to process.
+  /// @param priority is not used.
+  void send(Buffer<dcc::RailcomHubData> *entry, unsigned priority) override;
+
+  /// Retrieves the feedback received for a DCC address.
+  ///
+  /// @param address is the DCC address to retrieve.
+  /// @param is_long is true if @param address is a 14-bit (long) address.
+  /// @param feedback will receive the feedback for the address.
+  ///
+  /// @return true if feedback has been received for the address.
+  bool get(uint16_t address, bool is_long, RailComFeedback *feedback);
+
+  /// @return JSON document containing the feedback for a DCC address or for
+  /// all addresses when @param address is zero. The short and long address
+  /// with the same number are both included.
+  std::string to_json(uint16_t address = 0);
+
+  /// Attaches the engine that POM read responses are forwarded to.
+  ///
+  /// @param engine is the @ref RailComPomEngine to forward responses to, it
+  /// must execute on the same executor as the RailCom hub.
+  void set_pom_engine(RailComPomEngine *engine)
+  {
+    pomEngine_ = engine;
+  }
+
+private:
+  /// Number of slots in the cache, must be a power of two.
+  static constexpr size_t CACHE_SIZE = CONFIG_RAILCOM_FEEDBACK_CACHE_SIZE;
+
+  /// Maximum number of slots to inspect for a given address.
+  static constexpr size_t MAX_PROBE = 8;
+
+  static_assert((CACHE_SIZE & (CACHE_SIZE - 1)) == 0,
+                "RailCom feedback cache size must be a power of two");
+  static_assert(CACHE_SIZE >= MAX_PROBE,
+                "RailCom feedback cache size is too small");
+
+  /// Slot in the cache.
+  struct Slot
+  {
+    /// Decoded feedback, address is zero when the slot is unused.
+    RailComFeedback feedback;
+  };
+
+  /// Hub the cache is registered with.
+  dcc::RailcomHubFlow *hub_;
+
+  /// Engine to forward POM read responses to.
+  RailComPomEngine *pomEngine_{nullptr};
+
+  /// Lock protecting @ref slots_.
+  Spinlock lock_;
+
+  /// Cache slots.
+  Slot slots_[CACHE_SIZE];
+
+  /// Last ADR_HIGH value received on channel 1, decoders alternate between
+  /// ADR_HIGH and ADR_LOW in consecutive cut-outs and this is combined with
+  /// the ADR_LOW value of the next cut-out to form the address.
+  uint8_t adrHigh_{0};
+
+  /// True if @ref adrHigh_ was received in the previous cut-out.
+  bool adrHighValid_{false};
+
+  /// @return the slot for an address or nullptr if the address is not in the
+  /// cache.
+  ///
+  /// @param key is the DCC address to find, see dcc_address_key.
+  ///
+  /// NOTE: @ref lock_ must be held by the caller.
+  Slot *find_locked(uint16_t key);
+
+  /// @return the slot for an address, the slot will be claimed (or the
+  /// oldest slot in the probe sequence replaced) if the address is not in the
+  /// cache.
+  ///
+  /// @param key is the DCC address to find, see dcc_address_key.
+  ///
+  /// NOTE: @ref lock_ must be held by the caller.
+  Slot *claim_locked(uint16_t key);
+
+  /// Decodes the channel 1 address broadcast of a cut-out, this must be
+  /// called for every cut-out in the order they were received.
+  ///
+  /// @param fb is the feedback received.
+  /// @param address will receive the decoder address (see dcc_address_key)
+  /// when the broadcast completes an address, otherwise it is not modified.
+  ///
+  /// @return false if the data could not be decoded.
+  bool decode_ch1(const dcc::Feedback &fb, uint16_t *address);
+
+  /// Decodes the channel 2 datagrams of a cut-out.
+  ///
+  /// @param fb is the feedback received.
+  /// @param slot is the slot to update.
+  /// @param now is the current time in milliseconds.
+  /// @param pom will be set to true if a POM read response was decoded,
+  /// otherwise it is not modified.
+  ///
+  /// @return false if the data could not be decoded.
+  bool decode_ch2(const dcc::Feedback &fb, Slot *slot, uint32_t now,
+                  bool *pom);
+};
+
+} // namespace esp32cs
+
+#endif // RAILCOM_FEEDBACK_CACHE_HXX_
@@ -0,0 +1,162 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+#ifndef RAILCOM_POM_ENGINE_HXX_
+#define RAILCOM_POM_ENGINE_HXX_
+
+#include <dcc/TrackIf.hxx>
+#include <executor/CallableFlow.hxx>
+#include <executor/StateFlow.hxx>
+#include <utils/constants.hxx>
+
+namespace esp32cs
+{
+
+DECLARE_CONST(railcom_pom_timeout_ms);
+DECLARE_CONST(railcom_pom_attempts);
+
+/// Request to read or verify a CV of a decoder on the main track.
+struct RailComPomRequest : public CallableFlowRequestBase
+{
+  /// Command tag for reading a CV.
+  enum ReadCmd
+  {
+    READ
+  };
+
+  /// Command tag for verifying a CV.
+  enum VerifyCmd
+  {
+    VERIFY
+  };
+
+  /// No RailCom response was received for the request.
+  static constexpr int ERROR_NO_RESPONSE = 0x1001;
+
+  /// The CV value reported by the decoder does not match the expected value.
+  static constexpr int ERROR_VERIFY_FAILED = 0x1002;
+
+  /// Requests the value of a CV.
+  ///
+  /// @param address is the DCC address of the decoder.
+  /// @param is_long is true if @param address is a 14-bit (long) address.
+  /// @param cv is the CV number to read (1-1024).
+  void reset(ReadCmd, uint16_t address, bool is_long, uint16_t cv)
+  {
+    reset_base();
+    this->verify = false;
+    this->address = address;
+    this->is_long = is_long;
+    this->cv = cv;
+    this->value = 0;
+    this->attempts = 0;
+  }
+
+  /// Requests that a CV holds an expected value.
+  ///
+  /// @param address is the DCC address of the decoder.
+  /// @param is_long is true if @param address is a 14-bit (long) address.
+  /// @param cv is the CV number to verify (1-1024).
+  /// @param value is the expected value of the CV.
+  void reset(VerifyCmd, uint16_t address, bool is_long, uint16_t cv,
+             uint8_t value)
+  {
+    reset_base();
+    this->verify = true;
+    this->address = address;
+    this->is_long = is_long;
+    this->cv = cv;
+    this->value = value;
+    this->attempts = 0;
+  }
+
+  /// True if the CV is to be compared with @ref value.
+  bool verify;
+
+  /// DCC address of the decoder.
+  uint16_t address;
+
+  /// True if @ref address is a 14-bit (long) address, short address N and
+  /// long address N are different decoders.
+  bool is_long;
+
+  /// CV number (1-1024).
+  uint16_t cv;
+
+  /// Expected CV value for verify requests, on completion the CV value
+  /// reported by the decoder.
+  uint8_t value;
+
+  /// Number of POM read packets sent for the request.
+  uint8_t attempts;
+};
+
+/// Reads CVs of decoders on the main track using RailCom.
+///
+/// Requests are queued and processed in order. For each request a POM read
+/// packet is sent to the decoder and the channel 2 POM response is matched
+/// back to the request by the RailCom feedback key of the cut-out following
+/// the packet. The packets of each request carry a feedback key with a tag
+/// that differs from the previous request (see dcc_packet_feedback_key), a
+/// response is only accepted when the key has the decoder address, the POM
+/// packet class and the tag of the current request. This ignores responses
+/// to POM packets from other sources and to earlier requests that were
+/// still queued for the track. If no response is received within
+/// railcom_pom_timeout_ms the packet is resent, up to railcom_pom_attempts
+/// times.
+///
+/// NOTE: @ref pom_response must be called on the same executor as this flow.
+class RailComPomEngine : public CallableFlow<RailComPomRequest>
+{
+public:
+  /// Constructor.
+  ///
+  /// @param service is the @ref Service to execute this flow on.
+  /// @param track is the @ref dcc::TrackIf to send the POM packets to.
+  RailComPomEngine(Service *service, dcc::TrackIf *track);
+
+  /// Delivers a decoded channel 2 POM response.
+  ///
+  /// @param feedback_key is the RailCom feedback key of the cut-out the
+  /// response was received in, it identifies the packet which preceded the
+  /// cut-out.
+  /// @param value is the CV value reported by the decoder.
+  void pom_response(uint32_t feedback_key, uint8_t value);
+
+private:
+  /// Track interface to send the POM packets to.
+  dcc::TrackIf *track_;
+
+  /// Timer used for the response timeout.
+  StateFlowTimer timer_{this};
+
+  /// True while waiting for a response to the current request.
+  bool pending_{false};
+
+  /// True if a response has been received for the current request.
+  bool responded_{false};
+
+  /// CV value received for the current request.
+  uint8_t response_{0};
+
+  /// Feedback key tag of the current request, see dcc_packet_feedback_key.
+  uint8_t tag_{0};
+
+  /// Starts processing a request.
+  Action entry() override;
+
+  /// Sends the POM read packet and waits for the response.
+  Action send_read();
+
+  /// Completes the request if a response was received, otherwise retries.
+  Action response_timeout();
+};
+
+} // namespace esp32cs
+
+#endif // RAILCOM_POM_ENGINE_HXX_
@@ -0,0 +1,147 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+#ifndef SPSC_RING_HXX_
+#define SPSC_RING_HXX_
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <utils/macros.h>
+
+namespace esp32cs
+{
+
+/// Wait-free single-producer / single-consumer ring of fixed size slots.
+///
+/// The producer claims a slot via @ref write_slot, fills it in-place and then
+/// publishes it via @ref commit. The consumer inspects the oldest published
+/// slot via @ref peek and returns it to the producer via @ref release once it
+/// no longer needs the slot contents. This allows the consumer to keep using
+/// the slot (for example while repeating a DCC packet) without copying it.
+///
+/// The head and tail indices are free-running and are placed on separate
+/// cache lines so that the producer and consumer (which may be on different
+/// cores) do not contend on the same line.
+///
+/// @param T is the type of slot held in the ring.
+/// @param SIZE is the number of slots in the ring.
+template <class T, size_t SIZE>
+class SpscRing
+{
+public:
+  /// Size of a cache line used for separating the producer and consumer
+  /// indices.
+  static constexpr size_t CACHE_LINE_SIZE = 32;
+
+  /// Attaches the storage for the ring slots.
+  ///
+  /// @param storage is the memory to use for the slots, it must hold at least
+  /// SIZE entries and is not owned by the ring.
+  void init(T *storage)
+  {
+    slots_ = storage;
+  }
+
+  /// @return the slot that the producer can write to or nullptr if the ring
+  /// is full.
+  ///
+  /// NOTE: this must only be called from the producer.
+  T *write_slot()
+  {
+    uint32_t head = head_.value.load(std::memory_order_relaxed);
+    if ((head - tail_.value.load(std::memory_order_acquire)) >= SIZE)
+    {
+      return nullptr;
+    }
+    return &slots_[head % SIZE];
+  }
+
+  /// Publishes the slot returned by @ref write_slot to the consumer.
+  ///
+  /// NOTE: this must only be called from the producer.
+  void commit()
+  {
+    head_.value.fetch_add(1, std::memory_order_release);
+  }
+
+  /// @return the oldest published slot or nullptr if the ring is empty.
+  ///
+  /// NOTE: this must only be called from the consumer.
+  T *peek()
+  {
+    uint32_t tail = tail_.value.load(std::memory_order_relaxed);
+    if (tail == head_.value.load(std::memory_order_acquire))
+    {
+      return nullptr;
+    }
+    return &slots_[tail % SIZE];
+  }
+
+  /// Returns the slot returned by @ref peek to the producer.
+  ///
+  /// NOTE: this must only be called from the consumer.
+  void release()
+  {
+    tail_.value.fetch_add(1, std::memory_order_release);
+  }
+
+  /// @return a published slot or nullptr if there are not enough published
+  /// slots.
+  ///
+  /// @param offset is the offset from the oldest published slot.
+  ///
+  /// NOTE: this must only be called from the producer. The consumer may
+  /// release the returned slot at any time, callers must arbitrate access to
+  /// the slot contents with the consumer.
+  T *published_slot(size_t offset)
+  {
+    uint32_t head = head_.value.load(std::memory_order_relaxed);
+    uint32_t tail = tail_.value.load(std::memory_order_acquire);
+    if (offset >= (head - tail))
+    {
+      return nullptr;
+    }
+    return &slots_[(tail + offset) % SIZE];
+  }
+
+  /// @return the number of slots that are published or in use by the
+  /// consumer. This can be called from either side.
+  size_t pending()
+  {
+    return head_.value.load(std::memory_order_acquire) -
+           tail_.value.load(std::memory_order_acquire);
+  }
+
+  /// @return the number of slots that can be written by the producer. This
+  /// can be called from either side.
+  size_t available()
+  {
+    return SIZE - pending();
+  }
+
+private:
+  /// Index padded out to a full cache line.
+  struct alignas(CACHE_LINE_SIZE) PaddedIndex
+  {
+    std::atomic<uint32_t> value{0};
+  };
+
+  /// Free-running index of the next slot to be written by the producer.
+  PaddedIndex head_;
+
+  /// Free-running index of the oldest slot still owned by the consumer.
+  PaddedIndex tail_;
+
+  /// Storage for the slots.
+  T *slots_{nullptr};
+};
+
+} // namespace esp32cs
+
+#endif // SPSC_RING_HXX_
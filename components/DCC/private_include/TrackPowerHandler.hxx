@@ -17,6 +17,8 @@ COPYRIGHT (c) 2020-2021 Mike Dunston
 #ifndef TRACK_POWER_HANDLER_HXX_
 #define TRACK_POWER_HANDLER_HXX_
 
+#include "DCCSignalVFS.hxx"
+
 #include <dcc/DccOutput.hxx>
 #include <openlcb/EventHandlerTemplates.hxx>
 #include <utils/StringUtils.hxx>
@@ -68,6 +70,7 @@ public:
       DCC_BOOSTER::set_disable_reason(DccOutput::DisableReason::GLOBAL_EOFF);
       OLCB_DCC_BOOSTER::set_disable_reason(DccOutput::DisableReason::GLOBAL_EOFF);
     }
+    track_state_changed();
   }
 
   openlcb::Node *node()
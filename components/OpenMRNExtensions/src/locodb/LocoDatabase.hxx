@@ -10,6 +10,7 @@
 
 #include "locodb/Defs.hxx"
 #include "locodb/LocoDatabaseEntry.hxx"
+#include "locodb/LocoPresence.hxx"
 
 #include <executor/Service.hxx>
 #include <memory>
@@ -80,6 +81,24 @@ class LocoDatabase : public Singleton<LocoDatabase>
   /// @param address the locomotive address to remove.
   /// @param mode the operating mode for the locomotive to be removed.
   virtual void remove_entry(uint16_t address, DriveMode mode) = 0;
+
+  /// Returns true if the locomotive has been detected on the track by a
+  /// presence detector (RailCom) recently.
+  /// @param address the locomotive address to check.
+  /// @param mode the operating mode for the locomotive, DEFAULT matches both
+  /// the short and long DCC address.
+  virtual bool is_present(uint16_t address, DriveMode mode)
+  {
+    DriveMode protocol = drive_mode_to_protocol(mode);
+    if (protocol != DriveMode::DEFAULT && protocol != DriveMode::DCC_ANY)
+    {
+      // only DCC decoders are detected on the track.
+      return false;
+    }
+    return Singleton<LocoPresence>::exists() &&
+           Singleton<LocoPresence>::instance()->is_present(
+             address, drive_mode_to_address_type(mode, address));
+  }
 };
 
 }  // namespace locodb
@@ -0,0 +1,132 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "locodb/LocoPresence.hxx"
+
+#include <algorithm>
+#include <os/os.h>
+#include <string.h>
+
+/// Number of milliseconds after the last detection before a locomotive is no
+/// longer considered present on the track.
+DEFAULT_CONST(loco_presence_timeout_ms, 5000);
+
+namespace locodb
+{
+
+/// @return the current time in milliseconds, never zero.
+static uint32_t now_ms()
+{
+  uint32_t now = NSEC_TO_MSEC(os_get_time_monotonic());
+  return now ? now : 1;
+}
+
+LocoPresence::LocoPresence()
+{
+  memset(slots_, 0, sizeof(slots_));
+}
+
+void LocoPresence::seen(uint16_t address, dcc::TrainAddressType type)
+{
+  uint32_t now = now_ms();
+  size_t index = slot_index(address, type);
+  esp32cs::SpinlockHolder lock(&lock_);
+  Slot *oldest = nullptr;
+  for (size_t probe = 0; probe < MAX_PROBE; probe++)
+  {
+    Slot *slot = &slots_[(index + probe) & (TABLE_SIZE - 1)];
+    if (slot->last_seen_ms && slot->address == address && slot->type == type)
+    {
+      slot->last_seen_ms = now;
+      return;
+    }
+    else if (!oldest || slot->last_seen_ms < oldest->last_seen_ms)
+    {
+      // unused slots have a zero timestamp and will always be preferred.
+      oldest = slot;
+    }
+  }
+  oldest->address = address;
+  oldest->type = type;
+  oldest->last_seen_ms = now;
+}
+
+bool LocoPresence::is_present(uint16_t address, dcc::TrainAddressType type)
+{
+  if (type == dcc::TrainAddressType::UNSPECIFIED)
+  {
+    return is_present(address, dcc::TrainAddressType::DCC_SHORT_ADDRESS) ||
+           is_present(address, dcc::TrainAddressType::DCC_LONG_ADDRESS);
+  }
+  uint32_t now = now_ms();
+  esp32cs::SpinlockHolder lock(&lock_);
+  Slot *slot = find_locked(address, type);
+  return slot && is_active(*slot, now);
+}
+
+uint32_t LocoPresence::last_seen(uint16_t address, dcc::TrainAddressType type)
+{
+  if (type == dcc::TrainAddressType::UNSPECIFIED)
+  {
+    return std::max(
+      last_seen(address, dcc::TrainAddressType::DCC_SHORT_ADDRESS),
+      last_seen(address, dcc::TrainAddressType::DCC_LONG_ADDRESS));
+  }
+  esp32cs::SpinlockHolder lock(&lock_);
+  Slot *slot = find_locked(address, type);
+  return slot ? slot->last_seen_ms : 0;
+}
+
+std::vector<std::pair<uint16_t, dcc::TrainAddressType>> LocoPresence::present()
+{
+  std::vector<std::pair<uint16_t, dcc::TrainAddressType>> addresses;
+  // reserve space up front so that no allocation happens with the lock held.
+  addresses.reserve(TABLE_SIZE);
+  uint32_t now = now_ms();
+  esp32cs::SpinlockHolder lock(&lock_);
+  for (const Slot &slot : slots_)
+  {
+    if (is_active(slot, now))
+    {
+      addresses.emplace_back(slot.address, slot.type);
+    }
+  }
+  return addresses;
+}
+
+size_t LocoPresence::slot_index(uint16_t address, dcc::TrainAddressType type)
+{
+  // long addresses are offset so that short address N and long address N
+  // do not share a probe sequence.
+  if (type == dcc::TrainAddressType::DCC_LONG_ADDRESS)
+  {
+    address += TABLE_SIZE / 2;
+  }
+  return (address ^ (address >> 7)) & (TABLE_SIZE - 1);
+}
+
+LocoPresence::Slot *LocoPresence::find_locked(uint16_t address,
+                                              dcc::TrainAddressType type)
+{
+  size_t index = slot_index(address, type);
+  for (size_t probe = 0; probe < MAX_PROBE; probe++)
+  {
+    Slot *slot = &slots_[(index + probe) & (TABLE_SIZE - 1)];
+    if (slot->last_seen_ms && slot->address == address && slot->type == type)
+    {
+      return slot;
+    }
+  }
+  return nullptr;
+}
+
+bool LocoPresence::is_active(const Slot &slot, uint32_t now)
+{
+  return slot.last_seen_ms &&
+         (now - slot.last_seen_ms) <= config_loco_presence_timeout_ms();
+}
+
+} // namespace locodb
@@ -0,0 +1,120 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _LOCODB_LOCOPRESENCE_HXX_
+#define _LOCODB_LOCOPRESENCE_HXX_
+
+#include <dcc/Defs.hxx>
+#include <Spinlock.hxx>
+#include <stdint.h>
+#include <utility>
+#include <utils/constants.hxx>
+#include <utils/Singleton.hxx>
+#include <vector>
+
+namespace locodb
+{
+
+DECLARE_CONST(loco_presence_timeout_ms);
+
+/// Tracks which locomotive addresses have recently been detected on the
+/// track, for example via RailCom channel 1 address broadcasts.
+///
+/// Addresses are tracked by address and address type, short address N and
+/// long address N are different decoders and are tracked separately.
+///
+/// The detector calls @ref seen each time an address is detected, an address
+/// is considered present until no detection has been reported for
+/// loco_presence_timeout_ms. Entries are stored in a fixed size open
+/// addressing table with a bounded probe length so that all queries are O(1),
+/// expired entries are reused and when all slots in the probe sequence are
+/// in use the least recently seen address is replaced.
+class LocoPresence : public Singleton<LocoPresence>
+{
+public:
+  /// Constructor.
+  LocoPresence();
+
+  /// Records that a locomotive address has been detected on the track.
+  ///
+  /// @param address is the DCC address that was detected.
+  /// @param type is the type of @param address.
+  void seen(uint16_t address, dcc::TrainAddressType type);
+
+  /// @return true if the locomotive address has been detected on the track
+  /// within the presence timeout.
+  ///
+  /// @param address is the DCC address to check.
+  /// @param type is the type of @param address, UNSPECIFIED matches both
+  /// the short and long address.
+  bool is_present(uint16_t address, dcc::TrainAddressType type);
+
+  /// @return the time the locomotive address was last detected (in
+  /// milliseconds since boot) or zero if it has not been detected.
+  ///
+  /// @param address is the DCC address to check.
+  /// @param type is the type of @param address, UNSPECIFIED matches both
+  /// the short and long address.
+  uint32_t last_seen(uint16_t address, dcc::TrainAddressType type);
+
+  /// @return all locomotive addresses (and their type) which are currently
+  /// present.
+  std::vector<std::pair<uint16_t, dcc::TrainAddressType>> present();
+
+private:
+  /// Number of slots in the presence table, must be a power of two.
+  static constexpr size_t TABLE_SIZE = 64;
+
+  /// Maximum number of slots to inspect for a given address.
+  static constexpr size_t MAX_PROBE = 8;
+
+  static_assert((TABLE_SIZE & (TABLE_SIZE - 1)) == 0,
+                "Presence table size must be a power of two");
+
+  /// Slot in the presence table.
+  struct Slot
+  {
+    /// Time the address was last detected, zero when the slot is unused.
+    uint32_t last_seen_ms;
+
+    /// DCC address held in this slot.
+    uint16_t address;
+
+    /// Type of @ref address.
+    dcc::TrainAddressType type;
+  };
+
+  /// Lock protecting @ref slots_.
+  esp32cs::Spinlock lock_;
+
+  /// Presence table slots.
+  Slot slots_[TABLE_SIZE];
+
+  /// @return the first slot in the probe sequence of an address.
+  ///
+  /// @param address is the DCC address.
+  /// @param type is the type of @param address.
+  static size_t slot_index(uint16_t address, dcc::TrainAddressType type);
+
+  /// @return the slot for an address or nullptr if the address has not been
+  /// detected.
+  ///
+  /// @param address is the DCC address to find.
+  /// @param type is the type of @param address.
+  ///
+  /// NOTE: @ref lock_ must be held by the caller.
+  Slot *find_locked(uint16_t address, dcc::TrainAddressType type);
+
+  /// @return true if the slot holds an address that is currently present.
+  ///
+  /// @param slot is the slot to check.
+  /// @param now is the current time in milliseconds.
+  static bool is_active(const Slot &slot, uint32_t now);
+};
+
+} // namespace locodb
+
+#endif // _LOCODB_LOCOPRESENCE_HXX_
@@ -266,6 +266,13 @@ public:
       if (!Singleton<locodb::LocoDatabase>::instance()->is_valid_train(iterateId_))
       {
         LOG(TSP_LOG_LEVEL, "iterate: finished");
+        if (!hasMatches_ && !isGlobal_ && message()->data()->allocate_ &&
+            is_present_on_track())
+        {
+          LOG(TSP_LOG_LEVEL,
+              "iterate: locomotive detected on track, allocating now");
+          return call_immediately(STATE(maybe_allocate_node));
+        }
         return sleep_and_call(
           &timer_, MSEC_TO_NSEC(config_trainsearch_allocate_delay_ms()),
           STATE(maybe_allocate_node));
@@ -354,6 +361,19 @@ public:
       return wait_and_call(STATE(iterate_next));
     }
 
+    /// @return true if the address in the search query has been detected on
+    /// the track, in which case there is no need to wait for other nodes to
+    /// respond before allocating a node for it.
+    bool is_present_on_track()
+    {
+      locodb::DriveMode mode;
+      unsigned address =
+        TrainSearchDefs::query_to_address(message()->data()->event_, &mode);
+      return address &&
+             Singleton<locodb::LocoDatabase>::instance()->is_present(address,
+                                                                     mode);
+    }
+
     /// Moves to the next train identifier.
     Action iterate_next()
     {
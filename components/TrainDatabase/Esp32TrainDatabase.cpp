@@ -437,6 +437,27 @@ string Esp32TrainDatabase::to_json()
   return res;
 }
 
+string Esp32TrainDatabase::present_to_json()
+{
+  OSMutexLock lock(&mux_);
+  string res = "[";
+  for (auto entry : trains_)
+  {
+    if (!is_present(entry->get_legacy_address(),
+                    entry->get_legacy_drive_mode()))
+    {
+      continue;
+    }
+    if (res.length() > 1)
+    {
+      res += ",";
+    }
+    res += entry->to_json();
+  }
+  res += "]";
+  return res;
+}
+
 string Esp32TrainDatabase::to_json(uint16_t address, bool readable)
 {
   OSMutexLock lock(&mux_);
@@ -109,7 +109,14 @@ std::string Esp32TrainDbEntry::to_json(bool readable)
       json += R"!^!(,"name":"DCC (default)")!^!";
     }
   }
-  json += R"!^!(},"fn":[)!^!";
+  json += R"!^!(})!^!";
+  if (readable)
+  {
+    // presence is runtime state and is not persisted.
+    json += R"!^!(,"present":)!^!";
+    json += db_->is_present(address_, mode_) ? "true" : "false";
+  }
+  json += R"!^!(,"fn":[)!^!";
   size_t fn_id = 0;
   for (Function fn : functions_)
   {
@@ -161,6 +161,10 @@ namespace esp32cs
     std::string to_json();
     std::string to_json(uint16_t address, bool readable = true);
 
+    /// @return JSON array of the roster entries which have been detected on
+    /// the track.
+    std::string present_to_json();
+
     void persist();
 
   private:
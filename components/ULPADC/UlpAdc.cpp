@@ -18,10 +18,12 @@ COPYRIGHT (c) 2021 Mike Dunston
 #include "UlpAdc.hxx"
 #include "sdkconfig.h"
 #include "ulp_adc_ops.h"
+#include <algorithm>
 #include <dcc/ProgrammingTrackBackend.hxx>
 #include <driver/rtc_cntl.h>
 #include <esp32/rom/ets_sys.h>
 #include <esp32/ulp.h>
+#include <freertos/FreeRTOS.h>
 #include <hardware.hxx>
 #include <soc/rtc_cntl_reg.h>
 #include <utils/Fixed16.hxx>
@@ -35,6 +37,34 @@ namespace esp32cs
 /// the values on the ESP32 side we need to limit to only the lower 16 bits.
 #define ULP_VAR(var) (var & UINT16_MAX)
 
+/// Number of readings retained in each of the ULP sample rings.
+static constexpr size_t SAMPLE_RING_SIZE = ULP_ADC_SAMPLE_RING_SIZE;
+
+static_assert((SAMPLE_RING_SIZE & (SAMPLE_RING_SIZE - 1)) == 0,
+              "ULP ADC sample ring size must be a power of two");
+
+#if CONFIG_OPS_TRACK_ENABLED
+/// Number of bits the ULP shifts the OPS excess over the short limit by
+/// before adding it to the trip accumulator, this must match
+/// ops_trip_excess_shift in adc_ops.S.
+static constexpr uint8_t OPS_TRIP_EXCESS_SHIFT = 4;
+
+/// Number of OPS readings over the short limit needed to trip the OPS track
+/// with a reading just over the limit, relative to a reading just under the
+/// instant trip limit (which takes CONFIG_OPS_INRUSH_TOLERANCE_MS).
+static constexpr uint8_t OPS_TRIP_MAX_TOLERANCE_FACTOR = 4;
+#endif // CONFIG_OPS_TRACK_ENABLED
+
+/// Reads a ULP variable which may be updated concurrently by the ULP.
+///
+/// @param var is the ULP variable to read.
+///
+/// @return the lower 16 bits of the variable.
+static inline uint16_t ulp_read(const uint32_t &var)
+{
+  return ULP_VAR(*(const volatile uint32_t *)&var);
+}
+
 /// Current sense ULP program starting point.
 extern const uint8_t ulp_code_start[] asm("_binary_ulp_adc_ops_bin_start");
 
@@ -43,6 +73,29 @@ extern const uint8_t ulp_code_end[]   asm("_binary_ulp_adc_ops_bin_end");
 
 static bool ulp_running = false;
 
+#if CONFIG_OPS_TRACK_ENABLED
+/// Callback to invoke when the OPS track is tripped.
+static ops_trip_callback_t ops_trip_callback = nullptr;
+
+/// Reason for the most recent OPS track trip.
+static volatile UlpTripReason ops_last_trip_reason = UlpTripReason::NONE;
+
+/// True when the current OPS track trip has been handled by
+/// @ref ulp_adc_wakeup, this prevents handling the same trip more than once
+/// when the ULP wakes the SoC for PROG track events.
+static volatile bool ops_trip_handled = false;
+
+/// Lock protecting @ref ops_trip_handled and the ULP trip state against
+/// concurrent access by @ref ulp_adc_wakeup and @ref clear_ops_trip.
+static portMUX_TYPE ops_trip_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/// Callback to invoke when the OPS track warning state changes.
+static ops_warning_callback_t ops_warning_callback = nullptr;
+
+/// OPS track warning state most recently reported by the ULP.
+static volatile bool ops_warning_reported = false;
+#endif // CONFIG_OPS_TRACK_ENABLED
+
 /// ULP wake-up callback
 ///
 /// @param param unused.
@@ -55,12 +108,35 @@ static void ulp_adc_wakeup(void *param)
     return;
   }
 #if CONFIG_OPS_TRACK_ENABLED
-  if (ULP_VAR(ulp_ops_last_reading) > ULP_VAR(ulp_ops_short_threshold))
+  portENTER_CRITICAL_ISR(&ops_trip_lock);
+  UlpTripReason reason = (UlpTripReason)ULP_VAR(ulp_ops_trip_reason);
+  bool new_trip = reason != UlpTripReason::NONE && !ops_trip_handled;
+  if (new_trip)
+  {
+    ops_trip_handled = true;
+  }
+  portEXIT_CRITICAL_ISR(&ops_trip_lock);
+  if (new_trip)
   {
-    ets_printf("[ULP-ADC] OPS short detected (%d vs %d)!\n",
+    ops_last_trip_reason = reason;
+    ets_printf("[ULP-ADC] OPS %s trip detected (%d vs %d)!\n",
+               reason == UlpTripReason::INSTANT ? "instant" : "sustained",
                ULP_VAR(ulp_ops_last_reading),
                ULP_VAR(ulp_ops_short_threshold));
     DccHwDefs::InternalBoosterOutput::set_disable_reason(DccOutput::DisableReason::SHORTED);
+    if (ops_trip_callback)
+    {
+      ops_trip_callback(reason);
+    }
+  }
+  bool warning = ULP_VAR(ulp_ops_warning_active);
+  if (warning != ops_warning_reported)
+  {
+    ops_warning_reported = warning;
+    if (ops_warning_callback)
+    {
+      ops_warning_callback(warning);
+    }
   }
 #endif
 #if CONFIG_PROG_TRACK_ENABLED
@@ -82,6 +158,65 @@ static void ulp_adc_wakeup(void *param)
 #endif
 }
 
+#if CONFIG_OPS_TRACK_ENABLED || CONFIG_PROG_TRACK_ENABLED
+/// Copies the most recent readings from a ULP sample ring.
+///
+/// @param ring is the first entry of the ULP sample ring.
+/// @param samples will receive the readings, oldest first.
+/// @param count is the maximum number of readings to copy.
+///
+/// @return the number of readings copied.
+static size_t read_sample_ring(const uint32_t *ring, uint16_t *samples,
+                               size_t count)
+{
+  count = std::min(count, SAMPLE_RING_SIZE);
+  // until the ring has been filled once only part of it holds readings.
+  uint16_t exec_count = ulp_read(ulp_exec_count);
+  if (exec_count < SAMPLE_RING_SIZE)
+  {
+    count = std::min(count, (size_t)exec_count);
+  }
+  // sample_index is the next slot to be written by the ULP which is the
+  // oldest reading.
+  size_t start = (ulp_read(ulp_sample_index) - count) & (SAMPLE_RING_SIZE - 1);
+  for (size_t idx = 0; idx < count; idx++)
+  {
+    samples[idx] = ulp_read(ring[(start + idx) & (SAMPLE_RING_SIZE - 1)]);
+  }
+  return count;
+}
+
+/// Calculates statistics for the most recent readings in a ULP sample ring.
+///
+/// @param ring is the first entry of the ULP sample ring.
+/// @param stats will receive the statistics.
+/// @param samples is the maximum number of readings to include.
+///
+/// @return false if no readings are available.
+static bool calculate_ring_stats(const uint32_t *ring, UlpAdcStats *stats,
+                                 size_t samples)
+{
+  uint16_t readings[SAMPLE_RING_SIZE];
+  size_t count = read_sample_ring(ring, readings, samples);
+  if (!count)
+  {
+    return false;
+  }
+  uint32_t sum = 0;
+  stats->min = UINT16_MAX;
+  stats->max = 0;
+  for (size_t idx = 0; idx < count; idx++)
+  {
+    stats->min = std::min(stats->min, readings[idx]);
+    stats->max = std::max(stats->max, readings[idx]);
+    sum += readings[idx];
+  }
+  stats->avg = sum / count;
+  stats->count = count;
+  return true;
+}
+#endif // CONFIG_OPS_TRACK_ENABLED || CONFIG_PROG_TRACK_ENABLED
+
 static TaskHandle_t watchdog_handle;
 
 void ulp_watchdog(void *param)
@@ -146,11 +281,15 @@ void initialize_ulp_adc()
     ulp_load_binary(0, ulp_code_start,
                     (ulp_code_end - ulp_code_start) / sizeof(uint32_t)));
 
-  // Initialize the execution count
+  // Initialize the execution count and sample rings
   ulp_exec_count = 0;
+  ulp_sample_index = 0;
+  ulp_window_seq = 0;
 
 #if CONFIG_OPS_TRACK_ENABLED
   ulp_ops_last_reading = 0;
+  // start the running window with the first reading.
+  ulp_ops_window_reset = 1;
 #if CONFIG_CURRENTSENSE_USE_SHUNT
   Fixed16 ops_threshold =
     (float)CONFIG_OPS_HBRIDGE_LIMIT_MILLIAMPS / mAPerADCStep;
@@ -167,8 +306,40 @@ void initialize_ulp_adc()
   ulp_ops_warning_threshold =
     ((ULP_VAR(ulp_ops_short_threshold) << 1) +
       ULP_VAR(ulp_ops_short_threshold)) >> 2;
+  // Configure the warning clear limit to around 87.5% of the warning limit.
+  ulp_ops_warning_clear_threshold =
+    ULP_VAR(ulp_ops_warning_threshold) -
+    (ULP_VAR(ulp_ops_warning_threshold) >> 3);
+  ulp_ops_warning_active = 0;
+  ops_warning_reported = false;
   // Configure the shutdown limit to near maximum value of the ADC.
   ulp_ops_shutdown_threshold = 4090;
+  // Configure the instant trip limit to around 150% of the short limit.
+  ulp_ops_instant_threshold =
+    std::min<uint32_t>(ULP_VAR(ulp_ops_short_threshold) +
+             (ULP_VAR(ulp_ops_short_threshold) >> 1),
+             ULP_VAR(ulp_ops_shutdown_threshold));
+  // Configure the sustained trip budget. For every reading (taken every
+  // ~2.5ms) over the short limit the ULP adds the scaled excess plus a base
+  // step to the accumulator. The budget is sized so that a reading just under
+  // the instant trip limit trips after CONFIG_OPS_INRUSH_TOLERANCE_MS and the
+  // base step so that a reading just over the short limit trips after
+  // OPS_TRIP_MAX_TOLERANCE_FACTOR times that, anything in between trips
+  // proportionally to the excess.
+  uint32_t max_excess =
+    (ULP_VAR(ulp_ops_instant_threshold) -
+     ULP_VAR(ulp_ops_short_threshold)) >> OPS_TRIP_EXCESS_SHIFT;
+  ulp_ops_trip_base_step =
+    std::max<uint32_t>(max_excess / (OPS_TRIP_MAX_TOLERANCE_FACTOR - 1), 1);
+  uint32_t inrush_budget =
+    (ULP_VAR(ulp_ops_trip_base_step) + max_excess) *
+    ((CONFIG_OPS_INRUSH_TOLERANCE_MS * 2) / 5);
+  ulp_ops_trip_budget = std::min<uint32_t>(inrush_budget, UINT16_MAX - 1);
+  // Drain the accumulator after ~32 readings under the short limit.
+  ulp_ops_trip_decay_step = std::max<uint32_t>(ULP_VAR(ulp_ops_trip_budget) >> 5, 1);
+  ulp_ops_trip_accumulator = 0;
+  ulp_ops_trip_reason = 0;
+  ops_trip_handled = false;
 #if CONFIG_CURRENTSENSE_USE_SHUNT
   LOG(INFO,
       "[ULP-ADC] OPS Short threshold: %d/4095 (%6.2f mA), "
@@ -194,6 +365,13 @@ void initialize_ulp_adc()
       ((ULP_VAR(ulp_ops_shutdown_threshold) * CONFIG_OPS_HBRIDGE_LIMIT_MILLIAMPS) / 4096.0f),
       OPS_CURRENT_SENSE_Pin::pin(), OPS_CURRENT_SENSE_Pin::channel());
 #endif // CONFIG_CURRENTSENSE_USE_SHUNT
+  LOG(INFO,
+      "[ULP-ADC] OPS Instant trip threshold: %d/4095, "
+      "Inrush tolerance: %d-%d ms (budget: %d, step: %d, decay: %d)",
+      ULP_VAR(ulp_ops_instant_threshold), CONFIG_OPS_INRUSH_TOLERANCE_MS,
+      CONFIG_OPS_INRUSH_TOLERANCE_MS * OPS_TRIP_MAX_TOLERANCE_FACTOR,
+      ULP_VAR(ulp_ops_trip_budget), ULP_VAR(ulp_ops_trip_base_step),
+      ULP_VAR(ulp_ops_trip_decay_step));
 #endif // CONFIG_OPS_TRACK_ENABLED
 #if CONFIG_PROG_TRACK_ENABLED
   ulp_prog_last_reading = 0;
@@ -272,16 +450,81 @@ uint16_t get_last_ops_reading()
 
 uint32_t get_ops_load()
 {
+#if CONFIG_OPS_TRACK_ENABLED
+  UlpAdcStats stats;
+  if (get_ops_recent_stats(&stats))
+  {
+    return get_ops_load(stats.avg);
+  }
+  return get_ops_load(get_last_ops_reading());
+#endif // CONFIG_OPS_TRACK_ENABLED
+  return -1;
+}
+
+uint32_t get_ops_load(uint16_t reading)
+{
 #if CONFIG_OPS_TRACK_ENABLED
 #if CONFIG_CURRENTSENSE_USE_SHUNT
-  return get_last_ops_reading() * mAPerADCStep;
+  return reading * mAPerADCStep;
 #else // no shunt
-  return (get_last_ops_reading() * CONFIG_OPS_HBRIDGE_MAX_MILLIAMPS) / 4096;
+  return (reading * CONFIG_OPS_HBRIDGE_MAX_MILLIAMPS) / 4096;
 #endif // CONFIG_CURRENTSENSE_USE_SHUNT
 #endif // CONFIG_OPS_TRACK_ENABLED
   return -1;
 }
 
+bool get_ops_recent_stats(UlpAdcStats *stats, size_t samples)
+{
+#if CONFIG_OPS_TRACK_ENABLED
+  if (ulp_running)
+  {
+    return calculate_ring_stats(&ulp_ops_samples, stats, samples);
+  }
+#endif // CONFIG_OPS_TRACK_ENABLED
+  return false;
+}
+
+bool get_ops_window_stats(UlpAdcStats *stats)
+{
+#if CONFIG_OPS_TRACK_ENABLED
+  if (ulp_running)
+  {
+    uint16_t seq;
+    uint32_t sum;
+    // the ULP may update the window while it is being read, retry until a
+    // consistent copy has been read.
+    do
+    {
+      seq = ulp_read(ulp_window_seq);
+      stats->min = ulp_read(ulp_ops_window_min);
+      stats->max = ulp_read(ulp_ops_window_max);
+      stats->count = ulp_read(ulp_ops_window_count);
+      sum = ((uint32_t)ulp_read(ulp_ops_window_sum_high) << 16) |
+            ulp_read(ulp_ops_window_sum_low);
+    } while ((seq & 1) || seq != ulp_read(ulp_window_seq));
+    // restart the window with the next reading.
+    ulp_ops_window_reset = 1;
+    if (stats->count)
+    {
+      stats->avg = sum / stats->count;
+      return true;
+    }
+  }
+#endif // CONFIG_OPS_TRACK_ENABLED
+  return false;
+}
+
+size_t get_ops_samples(uint16_t *samples, size_t count)
+{
+#if CONFIG_OPS_TRACK_ENABLED
+  if (ulp_running)
+  {
+    return read_sample_ring(&ulp_ops_samples, samples, count);
+  }
+#endif // CONFIG_OPS_TRACK_ENABLED
+  return 0;
+}
+
 uint16_t get_ops_short_threshold()
 {
 #if CONFIG_OPS_TRACK_ENABLED
@@ -306,6 +549,51 @@ uint16_t get_ops_warning_threshold()
   return 4095;
 }
 
+void set_ops_trip_callback(ops_trip_callback_t callback)
+{
+#if CONFIG_OPS_TRACK_ENABLED
+  ops_trip_callback = callback;
+#endif // CONFIG_OPS_TRACK_ENABLED
+}
+
+UlpTripReason get_ops_trip_reason()
+{
+#if CONFIG_OPS_TRACK_ENABLED
+  return ops_last_trip_reason;
+#endif // CONFIG_OPS_TRACK_ENABLED
+  return UlpTripReason::NONE;
+}
+
+void clear_ops_trip()
+{
+#if CONFIG_OPS_TRACK_ENABLED
+  // The ULP is re-armed by clearing the trip reason, the handled flag is
+  // reset in the same critical section so that ulp_adc_wakeup can neither
+  // see the stale reason with the flag cleared nor ignore a new trip raised
+  // right after the reason is cleared (it runs once the lock is released).
+  portENTER_CRITICAL(&ops_trip_lock);
+  ulp_ops_trip_accumulator = 0;
+  ulp_ops_trip_reason = 0;
+  ops_trip_handled = false;
+  portEXIT_CRITICAL(&ops_trip_lock);
+#endif // CONFIG_OPS_TRACK_ENABLED
+}
+
+void set_ops_warning_callback(ops_warning_callback_t callback)
+{
+#if CONFIG_OPS_TRACK_ENABLED
+  ops_warning_callback = callback;
+#endif // CONFIG_OPS_TRACK_ENABLED
+}
+
+bool is_ops_warning_active()
+{
+#if CONFIG_OPS_TRACK_ENABLED
+  return ulp_running && ops_warning_reported;
+#endif // CONFIG_OPS_TRACK_ENABLED
+  return false;
+}
+
 uint16_t get_last_prog_reading()
 {
 #if CONFIG_PROG_TRACK_ENABLED
@@ -317,6 +605,28 @@ uint16_t get_last_prog_reading()
   return 4095;
 }
 
+bool get_prog_recent_stats(UlpAdcStats *stats, size_t samples)
+{
+#if CONFIG_PROG_TRACK_ENABLED
+  if (ulp_running)
+  {
+    return calculate_ring_stats(&ulp_prog_samples, stats, samples);
+  }
+#endif // CONFIG_PROG_TRACK_ENABLED
+  return false;
+}
+
+size_t get_prog_samples(uint16_t *samples, size_t count)
+{
+#if CONFIG_PROG_TRACK_ENABLED
+  if (ulp_running)
+  {
+    return read_sample_ring(&ulp_prog_samples, samples, count);
+  }
+#endif // CONFIG_PROG_TRACK_ENABLED
+  return 0;
+}
+
 uint16_t get_last_tempsensor_reading()
 {
 #if !CONFIG_TEMPSENSOR_DISABLED
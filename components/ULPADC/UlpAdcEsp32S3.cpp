@@ -44,6 +44,26 @@ uint32_t get_ops_load()
   return -1;
 }
 
+uint32_t get_ops_load(uint16_t reading)
+{
+  return -1;
+}
+
+bool get_ops_recent_stats(UlpAdcStats *stats, size_t samples)
+{
+  return false;
+}
+
+bool get_ops_window_stats(UlpAdcStats *stats)
+{
+  return false;
+}
+
+size_t get_ops_samples(uint16_t *samples, size_t count)
+{
+  return 0;
+}
+
 uint16_t get_ops_short_threshold()
 {
   return 4095;
@@ -59,11 +79,43 @@ uint16_t get_ops_warning_threshold()
   return 4095;
 }
 
+void set_ops_trip_callback(ops_trip_callback_t callback)
+{
+}
+
+UlpTripReason get_ops_trip_reason()
+{
+  return UlpTripReason::NONE;
+}
+
+void clear_ops_trip()
+{
+}
+
+void set_ops_warning_callback(ops_warning_callback_t callback)
+{
+}
+
+bool is_ops_warning_active()
+{
+  return false;
+}
+
 uint16_t get_last_prog_reading()
 {
   return 4095;
 }
 
+bool get_prog_recent_stats(UlpAdcStats *stats, size_t samples)
+{
+  return false;
+}
+
+size_t get_prog_samples(uint16_t *samples, size_t count)
+{
+  return 0;
+}
+
 uint16_t get_last_tempsensor_reading()
 {
   return 4095;
@@ -15,11 +15,69 @@ COPYRIGHT (c) 2021 Mike Dunston
   along with this program.  If not, see http://www.gnu.org/licenses
 **********************************************************************/
 
+#include "sdkconfig.h"
+
+#include <stddef.h>
 #include <stdint.h>
 
+#ifndef CONFIG_ULP_ADC_SAMPLE_RING_SIZE
+#define CONFIG_ULP_ADC_SAMPLE_RING_SIZE 32
+#endif
+
 namespace esp32cs
 {
 
+/// Number of readings retained by the ULP for each of the track ADC pins,
+/// this must match adc_ring_size in adc_ops.S.
+static constexpr size_t ULP_ADC_SAMPLE_RING_SIZE =
+  CONFIG_ULP_ADC_SAMPLE_RING_SIZE;
+
+/// Statistics for a window of ADC readings.
+struct UlpAdcStats
+{
+  /// Lowest reading in the window.
+  uint16_t min;
+
+  /// Highest reading in the window.
+  uint16_t max;
+
+  /// Average of all readings in the window.
+  uint16_t avg;
+
+  /// Number of readings in the window.
+  uint16_t count;
+};
+
+/// Reasons for the ULP to trip (disable) the OPS track output.
+enum class UlpTripReason : uint8_t
+{
+  /// The OPS track has not been tripped.
+  NONE = 0,
+
+  /// The OPS track current exceeded the instant trip threshold.
+  INSTANT = 1,
+
+  /// The OPS track current exceeded the short threshold for longer than the
+  /// inrush tolerance.
+  SUSTAINED = 2,
+};
+
+/// Callback for OPS track trips.
+///
+/// @param reason is the reason the OPS track was tripped.
+///
+/// NOTE: This is called from an ISR context!
+typedef void (*ops_trip_callback_t)(UlpTripReason reason);
+
+/// Callback for OPS track warning state changes.
+///
+/// @param active is true when the OPS track current has exceeded the warning
+/// threshold, false when it has dropped back below the warning clear
+/// threshold.
+///
+/// NOTE: This is called from an ISR context!
+typedef void (*ops_warning_callback_t)(bool active);
+
 /// Initializes and starts the ULP ADC operations in the background.
 ///
 /// When the ULP-ADC is running a watchdog task will be created to ensure the
@@ -35,9 +93,43 @@ void deinitialize_ulp_adc();
 /// reading is available.
 uint16_t get_last_ops_reading();
 
-/// @return the estimated load (in mA) for the OPS track.
+/// @return the estimated load (in mA) for the OPS track, averaged over the
+/// readings in the OPS sample ring.
 uint32_t get_ops_load();
 
+/// @return the estimated load (in mA) for an OPS track ADC reading.
+///
+/// @param reading is the ADC reading to convert.
+uint32_t get_ops_load(uint16_t reading);
+
+/// Calculates statistics for the most recent OPS track ADC readings.
+///
+/// @param stats will receive the statistics.
+/// @param samples is the number of readings to include, this is limited to
+/// @ref ULP_ADC_SAMPLE_RING_SIZE (one reading is taken every ~2.5ms).
+///
+/// @return false if no readings are available.
+bool get_ops_recent_stats(UlpAdcStats *stats, size_t samples = SIZE_MAX);
+
+/// Retrieves the statistics of the OPS track ADC readings taken since the
+/// previous call.
+///
+/// @param stats will receive the statistics.
+///
+/// @return false if no readings are available.
+///
+/// NOTE: The window is maintained by the ULP and is restarted on each call,
+/// only one consumer should use this method.
+bool get_ops_window_stats(UlpAdcStats *stats);
+
+/// Retrieves the most recent OPS track ADC readings.
+///
+/// @param samples will receive the readings, oldest first.
+/// @param count is the maximum number of readings to retrieve.
+///
+/// @return the number of readings retrieved.
+size_t get_ops_samples(uint16_t *samples, size_t count);
+
 /// @return the OPS track short threshold. Will return 4095 if OPS track is
 /// disabled.
 uint16_t get_ops_short_threshold();
@@ -50,10 +142,53 @@ uint16_t get_ops_shutdown_threshold();
 /// disabled.
 uint16_t get_ops_warning_threshold();
 
+/// Registers a callback to be invoked when the ULP trips the OPS track.
+///
+/// @param callback is the callback to invoke, nullptr to remove.
+///
+/// When the OPS track is tripped it is disabled with
+/// DccOutput::DisableReason::SHORTED before the callback is invoked. No
+/// further trips will be reported until @ref clear_ops_trip is called.
+void set_ops_trip_callback(ops_trip_callback_t callback);
+
+/// @return the reason for the most recent OPS track trip, this is retained
+/// after @ref clear_ops_trip.
+UlpTripReason get_ops_trip_reason();
+
+/// Resets the ULP trip detection for the OPS track, this should be called
+/// before the OPS track output is re-enabled after a trip.
+void clear_ops_trip();
+
+/// Registers a callback to be invoked when the OPS track warning state
+/// changes.
+///
+/// @param callback is the callback to invoke, nullptr to remove.
+void set_ops_warning_callback(ops_warning_callback_t callback);
+
+/// @return true if the OPS track current is above the warning threshold.
+bool is_ops_warning_active();
+
 /// @return the last reading from the PROG track ADC pin. May return 4095 if no
 /// reading is available.
 uint16_t get_last_prog_reading();
 
+/// Calculates statistics for the most recent PROG track ADC readings.
+///
+/// @param stats will receive the statistics.
+/// @param samples is the number of readings to include, this is limited to
+/// @ref ULP_ADC_SAMPLE_RING_SIZE (one reading is taken every ~2.5ms).
+///
+/// @return false if no readings are available.
+bool get_prog_recent_stats(UlpAdcStats *stats, size_t samples = SIZE_MAX);
+
+/// Retrieves the most recent PROG track ADC readings.
+///
+/// @param samples will receive the readings, oldest first.
+/// @param count is the maximum number of readings to retrieve.
+///
+/// @return the number of readings retrieved.
+size_t get_prog_samples(uint16_t *samples, size_t count);
+
 /// @return the last reading from the TEMP SENSOR ADC pin. May return 4095 if
 /// no reading is available.
 uint16_t get_last_tempsensor_reading();
@@ -46,6 +46,7 @@ COPYRIGHT (c) 2017-2021 Mike Dunston
 #if CONFIG_ROSTER_EXPOSE_VMS
 #include <locodb/LocoDatabaseVirtualMemorySpace.hxx>
 #endif
+#include <locodb/LocoPresence.hxx>
 #include <mutex>
 #include <NodeRebootHelper.hxx>
 #include <NvsManager.hxx>
@@ -380,6 +381,7 @@ void app_main()
     esp32cs::StatusDisplay status_display(&wifi_manager,
                                           &wifi_manager, &nvs);
     openlcb::TrainService trainService(stack.iface());
+    locodb::LocoPresence loco_presence;
     esp32cs::Esp32TrainDatabase train_db(&stack, &wifi_manager);
 #if CONFIG_ROSTER_EXPOSE_VMS
     locodb::LocoDatabaseVirtualMemorySpace train_db_vms(&stack);
@@ -29,6 +29,7 @@ COPYRIGHT (c) 2017-2021 Mike Dunston
 #include <esp_ota_ops.h>
 #include <EventBroadcastHelper.hxx>
 #include <executor/Service.hxx>
+#include <algorithm>
 #include <Httpd.h>
 #include <mutex>
 #include <NvsManager.hxx>
@@ -42,6 +43,7 @@ COPYRIGHT (c) 2017-2021 Mike Dunston
 #include <utils/SocketClientParams.hxx>
 #include <utils/StringPrintf.hxx>
 #include <utils/StringUtils.hxx>
+#include <vector>
 
 using locodb::DriveMode;
 using locodb::Function;
@@ -98,6 +100,13 @@ HTTP_STREAM_HANDLER(process_ota);
 HTTP_HANDLER(process_accessories);
 HTTP_HANDLER(process_loco);
 HTTP_HANDLER(process_fs);
+HTTP_HANDLER(process_dcc_stats);
+HTTP_HANDLER(process_dcc_railcom);
+HTTP_HANDLER(process_dcc_pom);
+HTTP_HANDLER(process_dcc_current);
+#if CONFIG_DCC_RMT_TRACE
+HTTP_HANDLER(process_dcc_trace);
+#endif // CONFIG_DCC_RMT_TRACE
 
 extern const uint8_t indexHtmlGz[] asm("_binary_index_html_gz_start");
 extern const size_t indexHtmlGz_size asm("index_html_gz_length");
@@ -134,6 +143,26 @@ static NodeHandle cs_node_handle;
 static NvsManager *nvs;
 static Esp32TrainDatabase *cs_traindb;
 
+/// WebSocket clients which receive track status notifications.
+static std::vector<WebSocketFlow *> ws_clients;
+
+/// Lock protecting @ref ws_clients.
+static std::mutex ws_clients_lock;
+
+/// Sends a track status notification to all connected WebSocket clients.
+///
+/// @param status is the JSON track status document.
+static void send_track_status(const string &status)
+{
+  const std::lock_guard<std::mutex> lock(ws_clients_lock);
+  string message =
+    StringPrintf(R"!^!({"res":"track","status":%s})!^!", status.c_str());
+  for (auto client : ws_clients)
+  {
+    client->send_text(message);
+  }
+}
+
 #ifndef CONFIG_STATUS_LED_DATA_PIN
 #define CONFIG_STATUS_LED_DATA_PIN -1
 #endif
@@ -170,11 +199,37 @@ void init_webserver(Service *service, NvsManager *nvs_mgr, openlcb::Node *node,
   httpd->uri("/locomotive", process_loco);
   httpd->uri("/locomotive/roster", process_loco);
   httpd->uri("/locomotive/estop", process_loco);
+  httpd->uri("/dcc/stats", HttpMethod::GET, process_dcc_stats);
+  httpd->uri("/dcc/railcom", HttpMethod::GET, process_dcc_railcom);
+  httpd->uri("/dcc/pom", HttpMethod::GET, process_dcc_pom);
+  httpd->uri("/dcc/current", HttpMethod::GET, process_dcc_current);
+#if CONFIG_DCC_RMT_TRACE
+  httpd->uri("/dcc/trace", HttpMethod::GET, process_dcc_trace);
+#endif // CONFIG_DCC_RMT_TRACE
+  esp32cs::set_track_status_listener(send_track_status);
 }
 
 WEBSOCKET_STREAM_HANDLER_IMPL(process_ws, socket, event, data, len)
 {
-  if (event == WebSocketEvent::WS_EVENT_TEXT)
+  if (event == WebSocketEvent::WS_EVENT_CONNECT)
+  {
+    {
+      const std::lock_guard<std::mutex> lock(ws_clients_lock);
+      ws_clients.push_back(socket);
+    }
+    // send the current track status so the client does not need to poll.
+    socket->send_text(
+      StringPrintf(R"!^!({"res":"track","status":%s})!^!",
+                   esp32cs::get_track_status_json().c_str()));
+  }
+  else if (event == WebSocketEvent::WS_EVENT_DISCONNECT)
+  {
+    const std::lock_guard<std::mutex> lock(ws_clients_lock);
+    ws_clients.erase(
+      std::remove(ws_clients.begin(), ws_clients.end(), socket),
+      ws_clients.end());
+  }
+  else if (event == WebSocketEvent::WS_EVENT_TEXT)
   {
     string response = R"!^!({"res":"error","error":"Request not understood"})!^!";
     string req = string((char *)data, len);
@@ -561,6 +616,13 @@ WEBSOCKET_STREAM_HANDLER_IMPL(process_ws, socket, event, data, len)
                          req_id->valueint, esp32cs::get_ops_load());
       }
     }
+    else if (!strcmp(req_type->valuestring, "stats"))
+    {
+      LOG(VERBOSE, "[WS:%d] STATS received", req_id->valueint);
+      response =
+          StringPrintf(R"!^!({"res":"stats","id":%d,"districts":%s})!^!",
+                       req_id->valueint, esp32cs::get_dcc_stats_json().c_str());
+    }
     else if (!strcmp(req_type->valuestring, "statusled"))
     {
       cJSON *value = cJSON_GetObjectItem(root, "val");
@@ -682,6 +744,129 @@ HTTP_HANDLER_IMPL(process_fs, request)
   return nullptr;
 }
 
+// GET /dcc/stats - DCC signal generation telemetry for all districts.
+HTTP_HANDLER_IMPL(process_dcc_stats, request)
+{
+  return new StringResponse(
+      StringPrintf(R"!^!({"districts":%s})!^!",
+                   esp32cs::get_dcc_stats_json().c_str()),
+      http::MIME_TYPE_APPLICATION_JSON);
+}
+
+// GET /dcc/railcom - decoded RailCom feedback for all decoders.
+// GET /dcc/railcom?address=<address> - decoded RailCom feedback for a single decoder.
+HTTP_HANDLER_IMPL(process_dcc_railcom, request)
+{
+  return new JsonResponse(
+    esp32cs::get_railcom_feedback_json(request->param("address", 0)));
+}
+
+// GET /dcc/pom?address=<address>&cv=<cv> - read a CV from a decoder on the main track via RailCom.
+// GET /dcc/pom?address=<address>&cv=<cv>&value=<value> - verify a CV of a decoder on the main track via RailCom.
+// GET /dcc/pom?address=<address>&long=<true|false>&cv=<cv> - as above with an explicit address type, the default is long for addresses above 127.
+HTTP_HANDLER_IMPL(process_dcc_pom, request)
+{
+  uint16_t address = request->param("address", 0);
+  uint16_t cv = request->param("cv", 0);
+  bool is_long = request->param("long",
+    address > dcc::DccShortAddress::ADDRESS_MAX);
+  uint16_t max_address = is_long ? dcc::DccLongAddress::ADDRESS_MAX :
+                                   dcc::DccShortAddress::ADDRESS_MAX;
+  if (address < 1 || address > max_address || cv < 1 || cv > 1024)
+  {
+    request->set_status(HttpStatusCode::STATUS_BAD_REQUEST);
+    return nullptr;
+  }
+  uint8_t value = 0;
+  if (!esp32cs::read_pom_cv(address, is_long, cv, &value))
+  {
+    request->set_status(HttpStatusCode::STATUS_NOT_FOUND);
+    return nullptr;
+  }
+  else if (request->has_param("value"))
+  {
+    uint8_t expected = request->param("value", 0);
+    return new JsonResponse(
+      StringPrintf(
+        R"!^!({"address":%u,"long":%s,"cv":%u,"value":%u,"verified":%s})!^!",
+        address, is_long ? "true" : "false", cv, value,
+        value == expected ? "true" : "false"));
+  }
+  return new JsonResponse(
+    StringPrintf(R"!^!({"address":%u,"long":%s,"cv":%u,"value":%u})!^!",
+                 address, is_long ? "true" : "false", cv, value));
+}
+
+/// @return JSON object containing the statistics and readings of an ADC
+/// sample ring.
+///
+/// @param stats are the statistics for the readings.
+/// @param samples are the readings, oldest first.
+/// @param count is the number of readings.
+static string adc_samples_to_json(const esp32cs::UlpAdcStats &stats,
+                                  const uint16_t *samples, size_t count)
+{
+  string res =
+    StringPrintf(R"!^!({"min":%u,"max":%u,"avg":%u,"samples":[)!^!",
+                 stats.min, stats.max, stats.avg);
+  for (size_t idx = 0; idx < count; idx++)
+  {
+    if (idx)
+    {
+      res += ",";
+    }
+    res += StringPrintf("%u", samples[idx]);
+  }
+  res += "]}";
+  return res;
+}
+
+// GET /dcc/current - most recent current sense ADC readings (one every ~2.5ms) for the OPS and PROG tracks.
+HTTP_HANDLER_IMPL(process_dcc_current, request)
+{
+  uint16_t samples[esp32cs::ULP_ADC_SAMPLE_RING_SIZE];
+  esp32cs::UlpAdcStats stats;
+  string res = "{";
+  if (esp32cs::get_ops_recent_stats(&stats))
+  {
+    size_t count = esp32cs::get_ops_samples(samples,
+                                           esp32cs::ULP_ADC_SAMPLE_RING_SIZE);
+    res += StringPrintf(R"!^!("ops":{"mA":%u,"adc":%s})!^!",
+                        esp32cs::get_ops_load(stats.avg),
+                        adc_samples_to_json(stats, samples, count).c_str());
+  }
+  if (esp32cs::get_prog_recent_stats(&stats))
+  {
+    size_t count = esp32cs::get_prog_samples(samples,
+                                            esp32cs::ULP_ADC_SAMPLE_RING_SIZE);
+    if (res.length() > 1)
+    {
+      res += ",";
+    }
+    res += StringPrintf(R"!^!("prog":{"adc":%s})!^!",
+                        adc_samples_to_json(stats, samples, count).c_str());
+  }
+  res += "}";
+  return new JsonResponse(res);
+}
+
+#if CONFIG_DCC_RMT_TRACE
+// GET /dcc/trace - binary trace of the most recent DCC packets sent by district 0.
+// GET /dcc/trace?district=<index> - binary trace of the most recent DCC packets sent by the district.
+//
+// The trace can be decoded with tools/dcc_trace.py.
+HTTP_HANDLER_IMPL(process_dcc_trace, request)
+{
+  string trace = esp32cs::get_dcc_trace(request->param("district", 0));
+  if (trace.empty())
+  {
+    request->set_status(HttpStatusCode::STATUS_NOT_FOUND);
+    return nullptr;
+  }
+  return new StringResponse(trace, "application/octet-stream");
+}
+#endif // CONFIG_DCC_RMT_TRACE
+
 // GET /accessories - full list of accessory decoders, note that accessory state is STRING type for display
 // GET /accessories?readbleStrings=[0,1] - full list of accessory decoders, accessory state will be returned as true/false (boolean) when readableStrings=0.
 // GET /accessories?address=<address> - retrieve accessory decoders by DCC address
@@ -763,13 +948,25 @@ string convert_loco_to_json(openlcb::TrainImpl *t)
     res += StringPrintf(R"!^!({"id":%d,"state":%d})!^!", funcID,
                         t->get_fn(funcID));
   }
-  res += "]}";
+  res += "]";
+  esp32cs::RailComFeedback feedback;
+  if (esp32cs::get_railcom_feedback(
+        t->legacy_address(),
+        t->legacy_address_type() == dcc::TrainAddressType::DCC_LONG_ADDRESS,
+        &feedback) &&
+      feedback.speed_ms)
+  {
+    res += StringPrintf(R"!^!(,"railcom":{"kmh":%u,"ms":%u,"qos":%u})!^!",
+                        feedback.speed, feedback.speed_ms, feedback.qos);
+  }
+  res += "}";
   return res;
 }
 
 // method - url pattern - meaning
 // ANY /locomotive/estop - send emergency stop to all locomotives
 // GET /locomotive/roster - roster
+// GET /locomotive/roster?present=true - roster entries detected on the track via RailCom
 // GET /locomotive/roster?address=<address> - get roster entry
 // PUT / POST /locomotive/roster?address=<address>&name=<name>&desc=<desc>&mode=<mode>&idle=[true|false] - create or update roster entry
 // DELETE /locomotive/roster?address=<address> - delete roster entry
@@ -795,6 +992,10 @@ HTTP_HANDLER_IMPL(process_loco, request)
     if (request->method() == HttpMethod::GET &&
         !request->has_param("address"))
     {
+      if (request->param("present", false))
+      {
+        return new JsonResponse(cs_traindb->present_to_json());
+      }
       return new JsonResponse(cs_traindb->to_json());
     }
     else if (request->has_param("address"))
@@ -0,0 +1,186 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+#ifndef HOST_RAILCOM_HXX_
+#define HOST_RAILCOM_HXX_
+
+#include "DccPacketClass.hxx"
+
+#include <dcc/Packet.hxx>
+#include <dcc/RailCom.hxx>
+#include <dcc/RailcomHub.hxx>
+#include <deque>
+#include <stdint.h>
+#include <string.h>
+
+namespace esp32cs
+{
+
+/// Simulated multi-function decoder which responds in the RailCom cut-out.
+struct HostRailComDecoder
+{
+  /// DCC address of the decoder.
+  uint16_t address;
+
+  /// True if @ref address is a 14-bit (long) address.
+  bool is_long;
+
+  /// True if the decoder is on the track.
+  bool present{true};
+
+  /// True if the decoder sends its address on channel 1.
+  bool broadcast{true};
+
+  /// True if the next channel 1 broadcast is ADR_HIGH.
+  bool adr_high_next{true};
+
+  /// Values of the CVs, indexed by the CV number minus one.
+  uint8_t cv[1024];
+
+  /// Number of POM packets the decoder has responded to.
+  uint32_t pom_responses{0};
+};
+
+/// Responds to DCC packets as the decoders on the track would in the
+/// RailCom cut-out following each packet and delivers the feedback to the
+/// RailCom hub.
+///
+/// Every present decoder with @ref HostRailComDecoder::broadcast set sends
+/// its address on channel 1, alternating between ADR_HIGH and ADR_LOW
+/// (RCN-217), when more than one decoder broadcasts the bytes collide and
+/// the receiver sees the OR of the transmitted bytes. The decoder addressed
+/// by the packet responds on channel 2: a POM packet is answered with the
+/// value of the CV (after writing it for a POM write) and any other packet
+/// with an ACK.
+class HostRailComResponder
+{
+public:
+  /// Constructor.
+  ///
+  /// @param hub is the RailCom hub to deliver the feedback to.
+  HostRailComResponder(dcc::RailcomHubFlow *hub) : hub_(hub)
+  {
+  }
+
+  /// Adds a decoder to the track.
+  ///
+  /// @param address is the DCC address of the decoder.
+  /// @param is_long is true if @param address is a 14-bit (long) address.
+  ///
+  /// @return the decoder, all CVs are zero.
+  HostRailComDecoder *add_decoder(uint16_t address, bool is_long)
+  {
+    decoders_.emplace_back();
+    HostRailComDecoder *decoder = &decoders_.back();
+    memset(decoder->cv, 0, sizeof(decoder->cv));
+    decoder->address = address;
+    decoder->is_long = is_long;
+    return decoder;
+  }
+
+  /// Transmits a packet as the signal generator would, the packet is
+  /// followed by one cut-out per transmission (including the repeats).
+  ///
+  /// @param packet is the packet to transmit.
+  void transmit(const dcc::Packet &packet)
+  {
+    // feedback key selection of RMTTrackDevice::encode_packet.
+    uint32_t key = packet.feedback_key ? packet.feedback_key :
+                   dcc_packet_feedback_key(packet);
+    for (unsigned idx = 0; idx <= packet.packet_header.rept_count; idx++)
+    {
+      respond(packet, key);
+    }
+  }
+
+  /// Simulates the cut-out following a packet.
+  ///
+  /// @param packet is the packet which preceded the cut-out.
+  /// @param feedback_key is the feedback key of the cut-out.
+  void respond(const dcc::Packet &packet, uint32_t feedback_key)
+  {
+    Buffer<dcc::RailcomHubData> *buf = hub_->alloc();
+    buf->data()->reset(feedback_key);
+    uint8_t ch1[2] = {0, 0};
+    bool ch1_sent = false;
+    for (HostRailComDecoder &decoder : decoders_)
+    {
+      if (decoder.present && decoder.broadcast)
+      {
+        uint8_t value = decoder.adr_high_next ? adr_high(decoder) :
+                        (decoder.address & 0xFF);
+        uint8_t id = decoder.adr_high_next ? 1 : 2;
+        ch1[0] |= dcc::railcom_encode[(id << 2) | (value >> 6)];
+        ch1[1] |= dcc::railcom_encode[value & 0x3F];
+        decoder.adr_high_next = !decoder.adr_high_next;
+        ch1_sent = true;
+      }
+    }
+    if (ch1_sent)
+    {
+      buf->data()->add_ch1_data(ch1[0]);
+      buf->data()->add_ch1_data(ch1[1]);
+    }
+    HostRailComDecoder *target = find(dcc_packet_address(packet));
+    if (target && dcc_packet_class(packet) == DccPacketClass::POM)
+    {
+      // instruction and CV number follow the one or two address bytes.
+      uint8_t index = packet.payload[0] >= 192 ? 2 : 1;
+      uint8_t instruction = packet.payload[index];
+      uint16_t cv = ((instruction & 0x03) << 8) | packet.payload[index + 1];
+      if ((instruction & 0x0C) == 0x0C)
+      {
+        target->cv[cv] = packet.payload[index + 2];
+      }
+      // POM response datagram, identifier zero followed by the CV value.
+      buf->data()->add_ch2_data(dcc::railcom_encode[target->cv[cv] >> 6]);
+      buf->data()->add_ch2_data(dcc::railcom_encode[target->cv[cv] & 0x3F]);
+      target->pom_responses++;
+    }
+    else if (target)
+    {
+      buf->data()->add_ch2_data(dcc::RailcomDefs::CODE_ACK);
+    }
+    hub_->send(buf);
+  }
+
+private:
+  /// Hub to deliver the feedback to.
+  dcc::RailcomHubFlow *hub_;
+
+  /// Decoders on the track.
+  std::deque<HostRailComDecoder> decoders_;
+
+  /// @return the ADR_HIGH value of a decoder.
+  ///
+  /// @param decoder is the decoder.
+  static uint8_t adr_high(const HostRailComDecoder &decoder)
+  {
+    return decoder.is_long ? 0x80 | (decoder.address >> 8) : 0;
+  }
+
+  /// @return the present decoder with an address or nullptr.
+  ///
+  /// @param address is the address from dcc_packet_address.
+  HostRailComDecoder *find(uint16_t address)
+  {
+    for (HostRailComDecoder &decoder : decoders_)
+    {
+      if (decoder.present &&
+          dcc_address_key(decoder.address, decoder.is_long) == address)
+      {
+        return &decoder;
+      }
+    }
+    return nullptr;
+  }
+};
+
+} // namespace esp32cs
+
+#endif // HOST_RAILCOM_HXX_
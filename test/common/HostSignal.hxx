@@ -0,0 +1,529 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+#ifndef HOST_SIGNAL_HXX_
+#define HOST_SIGNAL_HXX_
+
+#include "HostTrack.hxx"
+#include "RailComCutout.hxx"
+
+#include <algorithm>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace esp32cs
+{
+
+/// Duration of a single RMT tick in picoseconds, the APB clock is 80MHz and
+/// the REF clock is 1MHz.
+static constexpr uint64_t HOST_RMT_TICK_PSEC = CONFIG_DCC_RMT_CLOCK_DIVIDER *
+  (CONFIG_DCC_RMT_CLOCK_SOURCE == RMT_BASECLK_APB ? 12500ULL : 1000000ULL);
+
+/// Track level of a recorded half-wave.
+enum class HalfWaveLevel : uint8_t
+{
+  /// Signal pin low.
+  LOW,
+
+  /// Signal pin high.
+  HIGH,
+
+  /// Track outputs disabled for the RailCom cut-out.
+  CUTOUT
+};
+
+/// Single recorded half-wave of the track signal.
+struct HalfWave
+{
+  /// Level of the track during the half-wave.
+  HalfWaveLevel level;
+
+  /// Duration of the half-wave in nanoseconds.
+  uint32_t nsec;
+};
+
+/// Records the track signal generated via the simulated RMT channel.
+///
+/// Every transmission started on the RMT channel is appended as a sequence of
+/// half-waves. A RailCom cut-out is recorded as a @ref HalfWaveLevel::CUTOUT
+/// half-wave which replaces the start of the following transmission since
+/// the RMT continues to send the preamble while the track outputs are
+/// disabled.
+class HostSignalRecorder : public HostRailcomDriver
+{
+public:
+  /// Constructor.
+  ///
+  /// @param channel is the RMT channel to record.
+  HostSignalRecorder(rmt_channel_t channel) : channel_(channel)
+  {
+    host_rmt::channel(channel_).on_tx_start = [this]()
+    {
+      record_transmission();
+    };
+  }
+
+  ~HostSignalRecorder()
+  {
+    host_rmt::channel(channel_).on_tx_start = nullptr;
+  }
+
+  /// Runs the cut-out phases to completion, the length of the cut-out is
+  /// the sum of the timer alarms requested by the sequencer.
+  void start_cutout() override
+  {
+    HostRailcomDriver::start_cutout();
+    uint32_t nsec = 0;
+    for (uint32_t usec = cutout_.start(); usec; usec = cutout_.advance())
+    {
+      nsec += usec * 1000;
+    }
+    waves_.push_back({HalfWaveLevel::CUTOUT, nsec});
+    elapsedNsec_ += nsec;
+    pendingCutNsec_ = nsec;
+  }
+
+  /// @return the recorded half-waves.
+  const std::vector<HalfWave> &waves()
+  {
+    return waves_;
+  }
+
+  /// @return the number of recorded half-waves, this can be used to locate
+  /// events in the decoded signal.
+  size_t mark()
+  {
+    return waves_.size();
+  }
+
+  /// @return the length of the recorded signal in nanoseconds.
+  uint64_t elapsed_nsec()
+  {
+    return elapsedNsec_;
+  }
+
+  /// Writes the recorded half-waves to a file, one half-wave per line with
+  /// the level (L, H or C for the cut-out) and the duration in nanoseconds.
+  ///
+  /// @param path is the file to write.
+  ///
+  /// @return true if the file was written.
+  bool write(const char *path)
+  {
+    FILE *fp = fopen(path, "w");
+    if (fp == nullptr)
+    {
+      return false;
+    }
+    static const char LEVELS[] = {'L', 'H', 'C'};
+    for (const HalfWave &wave : waves_)
+    {
+      fprintf(fp, "%c %" PRIu32 "\n", LEVELS[(size_t)wave.level], wave.nsec);
+    }
+    return fclose(fp) == 0;
+  }
+
+  /// Reads half-waves written by @ref write.
+  ///
+  /// @param path is the file to read.
+  /// @param waves receives the half-waves.
+  ///
+  /// @return true if the file was read.
+  static bool read(const char *path, std::vector<HalfWave> *waves)
+  {
+    FILE *fp = fopen(path, "r");
+    if (fp == nullptr)
+    {
+      return false;
+    }
+    char level;
+    uint32_t nsec;
+    bool valid = true;
+    while (valid && fscanf(fp, " %c %" SCNu32, &level, &nsec) == 2)
+    {
+      switch (level)
+      {
+        case 'L':
+          waves->push_back({HalfWaveLevel::LOW, nsec});
+          break;
+        case 'H':
+          waves->push_back({HalfWaveLevel::HIGH, nsec});
+          break;
+        case 'C':
+          waves->push_back({HalfWaveLevel::CUTOUT, nsec});
+          break;
+        default:
+          valid = false;
+      }
+    }
+    valid &= feof(fp) != 0;
+    fclose(fp);
+    return valid;
+  }
+
+private:
+  /// Appends the transmission in the RMT memory to the recording.
+  void record_transmission()
+  {
+    for (const rmt_item32_t &item : host_rmt_transmission(channel_))
+    {
+      if (item.duration0 == 0)
+      {
+        break;
+      }
+      record_half(item.level0, item.duration0);
+      if (item.duration1 == 0)
+      {
+        break;
+      }
+      record_half(item.level1, item.duration1);
+    }
+  }
+
+  /// Appends a single half-wave, the part of the half-wave that overlaps a
+  /// cut-out is dropped.
+  ///
+  /// @param level is the RMT output level.
+  /// @param ticks is the duration in RMT ticks.
+  void record_half(uint32_t level, uint32_t ticks)
+  {
+    uint32_t nsec = (ticks * HOST_RMT_TICK_PSEC) / 1000;
+    if (pendingCutNsec_ >= nsec)
+    {
+      pendingCutNsec_ -= nsec;
+      return;
+    }
+    nsec -= pendingCutNsec_;
+    pendingCutNsec_ = 0;
+    waves_.push_back({level ? HalfWaveLevel::HIGH : HalfWaveLevel::LOW, nsec});
+    elapsedNsec_ += nsec;
+  }
+
+  /// RMT channel being recorded.
+  rmt_channel_t channel_;
+
+  /// Phase sequencing of the cut-out.
+  RailComCutoutSequencer<HostRailComHwDefs, HostTrackBooster, HostOlcbBooster>
+    cutout_;
+
+  /// Remaining part of the cut-out which overlaps the next transmission.
+  uint32_t pendingCutNsec_{0};
+
+  /// Total length of the recorded half-waves.
+  uint64_t elapsedNsec_{0};
+
+  /// Recorded half-waves.
+  std::vector<HalfWave> waves_;
+};
+
+/// Packet decoded from the recorded track signal.
+struct DecodedPacket
+{
+  /// Packet bytes including the checksum.
+  std::vector<uint8_t> payload;
+
+  /// Number of complete preamble bits before the start bit.
+  uint32_t preamble_bits;
+
+  /// True if the preamble followed a RailCom cut-out.
+  bool after_cutout;
+
+  /// Index of the first half-wave of the start bit.
+  size_t start;
+};
+
+/// Result of decoding a recorded track signal.
+struct DecodedSignal
+{
+  /// Packets decoded from the signal.
+  std::vector<DecodedPacket> packets;
+
+  /// Conformance violations found in the signal.
+  std::vector<std::string> errors;
+
+  /// Number of RailCom cut-outs.
+  uint32_t cutouts{0};
+
+  /// Shortest time from the end of a packet end bit to the start of the
+  /// following cut-out, in nanoseconds.
+  uint64_t min_cutout_start_nsec{UINT64_MAX};
+
+  /// Longest time from the end of a packet end bit to the start of the
+  /// following cut-out, in nanoseconds.
+  uint64_t max_cutout_start_nsec{0};
+};
+
+/// Decodes a recorded track signal and checks it against the NMRA limits.
+///
+/// Each bit must meet the S-9.1 command station limits: both halves of a
+/// ONE are 55-61 usec and differ by at most 3 usec, both halves of a ZERO are
+/// 95-9900 usec and the ZERO is at most 12000 usec. Packets must have a valid
+/// checksum and at least the configured number of preamble bits. When a
+/// RailCom cut-out precedes the packet, at least 12 complete preamble bits
+/// must follow the cut-out as S-9.2 allows a decoder to require 12 bits.
+/// Cut-outs must be 454-488 usec (S-9.3.2) and may only follow a complete
+/// packet.
+class HostSignalDecoder
+{
+public:
+  /// Minimum number of complete preamble bits after a cut-out.
+  static constexpr uint32_t MIN_PREAMBLE_AFTER_CUTOUT = 12;
+
+  /// Constructor.
+  ///
+  /// @param first_half is the RMT level of the first half of each bit.
+  /// @param min_preamble is the minimum number of preamble bits for packets
+  /// which do not follow a cut-out.
+  HostSignalDecoder(uint8_t first_half, uint32_t min_preamble)
+    : firstHalf_(first_half ? HalfWaveLevel::HIGH : HalfWaveLevel::LOW),
+      minPreamble_(min_preamble)
+  {
+  }
+
+  /// Decodes a recorded track signal.
+  ///
+  /// @param waves is the recorded signal.
+  ///
+  /// @return the decoded packets and any conformance violations.
+  DecodedSignal decode(const std::vector<HalfWave> &waves)
+  {
+    DecodedSignal result;
+    State state = State::SYNC;
+    uint32_t ones = 0;
+    bool afterCutout = false;
+    bool partial = false;
+    bool realign = false;
+    uint64_t now = 0;
+    uint64_t packetEnd = 0;
+    uint8_t byte = 0;
+    uint8_t bits = 0;
+    DecodedPacket packet;
+    for (size_t idx = 0; idx < waves.size(); idx++)
+    {
+      const HalfWave &first = waves[idx];
+      if (first.level == HalfWaveLevel::CUTOUT)
+      {
+        result.cutouts++;
+        if (first.nsec < 454000 || first.nsec > 488000)
+        {
+          error(&result, idx, "cut-out of %" PRIu32 " nsec, must be "
+                "454-488 usec", first.nsec);
+        }
+        if (state != State::PREAMBLE || packetEnd == 0)
+        {
+          error(&result, idx, "cut-out does not follow a packet end bit");
+        }
+        else
+        {
+          result.min_cutout_start_nsec =
+            std::min(result.min_cutout_start_nsec, now - packetEnd);
+          result.max_cutout_start_nsec =
+            std::max(result.max_cutout_start_nsec, now - packetEnd);
+        }
+        now += first.nsec;
+        state = State::PREAMBLE;
+        ones = 0;
+        afterCutout = true;
+        // the track resumes part way through a half-wave.
+        partial = true;
+        continue;
+      }
+      if (partial)
+      {
+        // the first half-wave after the cut-out is incomplete.
+        now += first.nsec;
+        partial = false;
+        realign = true;
+        continue;
+      }
+      if (realign && first.level != firstHalf_)
+      {
+        // second half of the bit that was interrupted by the cut-out.
+        now += first.nsec;
+        realign = false;
+        continue;
+      }
+      realign = false;
+      if (first.level != firstHalf_ || idx + 1 >= waves.size() ||
+          waves[idx + 1].level == HalfWaveLevel::CUTOUT)
+      {
+        if (idx + 1 < waves.size())
+        {
+          error(&result, idx, "half-wave out of phase");
+        }
+        now += first.nsec;
+        state = State::SYNC;
+        continue;
+      }
+      const HalfWave &second = waves[++idx];
+      now += first.nsec + second.nsec;
+      int bit = classify(first.nsec, second.nsec);
+      if (bit < 0)
+      {
+        error(&result, idx - 1, "bit halves of %" PRIu32 "/%" PRIu32
+              " nsec violate S-9.1", first.nsec, second.nsec);
+        state = State::SYNC;
+        continue;
+      }
+      switch (state)
+      {
+        case State::SYNC:
+          // wait for the next preamble.
+          if (bit)
+          {
+            state = State::PREAMBLE;
+            ones = 1;
+            afterCutout = false;
+            packetEnd = 0;
+          }
+          break;
+        case State::PREAMBLE:
+          if (bit)
+          {
+            ones++;
+            break;
+          }
+          // start bit.
+          packet.payload.clear();
+          packet.preamble_bits = ones;
+          packet.after_cutout = afterCutout;
+          packet.start = idx - 1;
+          state = State::DATA;
+          byte = 0;
+          bits = 0;
+          break;
+        case State::DATA:
+          byte = (byte << 1) | bit;
+          if (++bits == 8)
+          {
+            packet.payload.push_back(byte);
+            state = State::SEPARATOR;
+          }
+          break;
+        case State::SEPARATOR:
+          if (!bit)
+          {
+            state = State::DATA;
+            byte = 0;
+            bits = 0;
+            break;
+          }
+          // packet end bit.
+          finish_packet(&result, packet);
+          state = State::PREAMBLE;
+          ones = 1;
+          afterCutout = false;
+          packetEnd = now;
+          break;
+      }
+    }
+    return result;
+  }
+
+private:
+  /// Decoder state.
+  enum class State
+  {
+    /// Waiting for a ONE bit.
+    SYNC,
+
+    /// Counting preamble bits.
+    PREAMBLE,
+
+    /// Receiving the bits of a packet byte.
+    DATA,
+
+    /// Waiting for the end of byte or end of packet bit.
+    SEPARATOR
+  };
+
+  /// Maximum number of errors that are recorded.
+  static constexpr size_t MAX_ERRORS = 32;
+
+  /// @return 1 for a ONE bit, 0 for a ZERO bit and -1 if the halves do not
+  /// meet the S-9.1 limits.
+  ///
+  /// @param first is the duration of the first half in nanoseconds.
+  /// @param second is the duration of the second half in nanoseconds.
+  static int classify(uint32_t first, uint32_t second)
+  {
+    if (first >= 55000 && first <= 61000 && second >= 55000 &&
+        second <= 61000)
+    {
+      uint32_t delta = first > second ? first - second : second - first;
+      return delta <= 3000 ? 1 : -1;
+    }
+    if (first >= 95000 && first <= 9900000 && second >= 95000 &&
+        second <= 9900000 && first + second <= 12000000)
+    {
+      return 0;
+    }
+    return -1;
+  }
+
+  /// Validates and records a decoded packet.
+  ///
+  /// @param result receives the packet and any violations.
+  /// @param packet is the decoded packet.
+  void finish_packet(DecodedSignal *result, const DecodedPacket &packet)
+  {
+    uint8_t checksum = 0;
+    for (uint8_t value : packet.payload)
+    {
+      checksum ^= value;
+    }
+    if (packet.payload.size() < 3 || checksum)
+    {
+      error(result, packet.start, "packet of %zu bytes with bad checksum",
+            packet.payload.size());
+    }
+    uint32_t required =
+      packet.after_cutout ? MIN_PREAMBLE_AFTER_CUTOUT : minPreamble_;
+    if (packet.preamble_bits < required)
+    {
+      error(result, packet.start, "preamble of %" PRIu32 " bits, required "
+            "%" PRIu32 "%s", packet.preamble_bits, required,
+            packet.after_cutout ? " after the cut-out" : "");
+    }
+    result->packets.push_back(packet);
+  }
+
+  /// Records a conformance violation.
+  ///
+  /// @param result receives the violation.
+  /// @param idx is the index of the half-wave where it was found.
+  /// @param fmt is the printf format of the message.
+  __attribute__((format(printf, 3, 4)))
+  static void error(DecodedSignal *result, size_t idx, const char *fmt, ...)
+  {
+    if (result->errors.size() >= MAX_ERRORS)
+    {
+      return;
+    }
+    char msg[160];
+    int len = snprintf(msg, sizeof(msg), "half-wave %zu: ", idx);
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(msg + len, sizeof(msg) - len, fmt, args);
+    va_end(args);
+    result->errors.push_back(msg);
+  }
+
+  /// Level of the first half of each bit.
+  HalfWaveLevel firstHalf_;
+
+  /// Minimum number of preamble bits without a cut-out.
+  uint32_t minPreamble_;
+};
+
+} // namespace esp32cs
+
+#endif // HOST_SIGNAL_HXX_
@@ -0,0 +1,292 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+#ifndef HOST_TRACK_HXX_
+#define HOST_TRACK_HXX_
+
+#include "sdkconfig.h"
+
+#include <atomic>
+#include <chrono>
+#include <driver/rmt.h>
+#include <freertos_drivers/arduino/RailcomDriver.hxx>
+#include <stdint.h>
+#include <vector>
+
+namespace esp32cs
+{
+
+/// RailCom timing for the host tests, this matches the cut-out timing of
+/// RailComHwDefs.
+struct HostRailComHwDefs
+{
+  /// Number of microseconds to wait after the final packet bit completes
+  /// before disabling the ENABLE pin on the h-bridge.
+  static constexpr uint32_t RAILCOM_START_PHASE1_DELAY_USEC = 1;
+
+  /// Number of microseconds to wait after RAILCOM_PHASE1_DELAY_USEC before
+  /// starting the cut-out period.
+  static constexpr uint32_t RAILCOM_START_PHASE2_DELAY_USEC = 1;
+
+  /// Number of microseconds to wait at the end of the cut-out period.
+  static constexpr uint32_t RAILCOM_STOP_DELAY_USEC = 1;
+
+  /// Number of microseconds to wait for railcom data on channel 1.
+  static constexpr uint32_t RAILCOM_MAX_READ_DELAY_CH_1 =
+    177 - RAILCOM_START_PHASE1_DELAY_USEC - RAILCOM_START_PHASE2_DELAY_USEC;
+
+  /// Number of microseconds to wait for railcom data on channel 2.
+  static constexpr uint32_t RAILCOM_MAX_READ_DELAY_CH_2 =
+    454 - RAILCOM_MAX_READ_DELAY_CH_1 - RAILCOM_STOP_DELAY_USEC;
+};
+
+/// DCC hardware definition for the host tests, this matches
+/// DccHwDefs with the Kconfig defaults.
+struct HostDccHwDefs
+{
+  /// DCC signal output pin.
+  static constexpr int DCC_SIGNAL_PIN_NUM = 0;
+
+  /// The number of preamble bits to send exclusive of end of packet '1' bit
+  /// for DCC packets that are not service mode.
+  static constexpr uint32_t DCC_PREAMBLE_BITS = CONFIG_OPS_DCC_PREAMBLE_BITS;
+
+  /// The number of preamble bits to send exclusive of end of packet '1' bit
+  /// for service mode DCC packets.
+  static constexpr uint32_t DCC_SERVICE_MODE_PREAMBLE_BITS =
+    CONFIG_PROG_DCC_PREAMBLE_BITS;
+
+  /// Number of microseconds of the RailCom cut-out before the channel 1
+  /// window starts.
+  static constexpr uint32_t RAILCOM_CUTOUT_START_USEC =
+    HostRailComHwDefs::RAILCOM_START_PHASE1_DELAY_USEC +
+    HostRailComHwDefs::RAILCOM_START_PHASE2_DELAY_USEC;
+
+  /// Number of RMT ticks for each half of the RMT encoded ZERO bit.
+  static constexpr uint16_t DCC_ZERO_RMT_TICKS =
+    CONFIG_DCC_RMT_TICKS_ZERO_PULSE;
+
+  /// Number of RMT ticks for each half of the RMT encoded ONE bit.
+  static constexpr uint8_t DCC_ONE_RMT_TICKS = CONFIG_DCC_RMT_TICKS_ONE_PULSE;
+
+  /// RMT Channel to use for the DCC Signal output.
+  static const rmt_channel_t RMT_CHANNEL = RMT_CHANNEL_0;
+
+  /// Visual name of the DCC Wave pattern.
+  static constexpr const char * const RMT_WAVE_FMT = "low,high";
+
+  /// Voltage to output on the signal pin for the first half of the DCC signal
+  /// wave pattern.
+  static constexpr uint8_t RMT_DCC_FIRST_HALF = 0;
+
+  /// Voltage to output on the signal pin for the second half of the DCC
+  /// signal wave pattern.
+  static constexpr uint8_t RMT_DCC_SECOND_HALF = 1;
+
+  /// RMT Clock configuration.
+  static constexpr rmt_source_clk_t RMT_CLOCK_SOURCE =
+    (rmt_source_clk_t)CONFIG_DCC_RMT_CLOCK_SOURCE;
+
+  /// Number of outgoing DCC packets to allow in the queue.
+  static const size_t PACKET_Q_SIZE = CONFIG_PACKET_QUEUE_SIZE;
+};
+
+/// Booster output calls recorded by @ref HostBoosterOutput.
+enum class HostBoosterEvent : uint8_t
+{
+  /// start_railcom_cutout_phase1, the output is disabled.
+  OUTPUT_DISABLED,
+
+  /// start_railcom_cutout_phase2, the RailCom detector is enabled.
+  DETECTOR_ENABLED,
+
+  /// stop_railcom_cutout_phase1, the RailCom detector is disabled.
+  DETECTOR_DISABLED,
+
+  /// stop_railcom_cutout_phase2.
+  CUTOUT_STOPPED,
+
+  /// enable_output.
+  OUTPUT_ENABLED
+};
+
+/// Single booster output call recorded by @ref HostBoosterOutput.
+struct HostBoosterRecord
+{
+  /// Booster output which was called.
+  int output;
+
+  /// Call which was made.
+  HostBoosterEvent event;
+};
+
+/// Booster output calls in the order they were made, this is only recorded
+/// while @ref host_booster_recording is set.
+inline std::vector<HostBoosterRecord> host_booster_log;
+
+/// Enables recording of the booster output calls in @ref host_booster_log.
+inline bool host_booster_recording = false;
+
+/// Booster output for the host tests, this records the calls made by the
+/// signal generator and the RailCom cut-out.
+///
+/// The RailCom delays mirror DccOutputHwReal and can be changed by the tests.
+///
+/// @param OUTPUT is used to create distinct types for each output.
+template <int OUTPUT>
+struct HostBoosterOutput
+{
+  /// True if a RailCom cut-out should be generated after each packet.
+  static bool railcom;
+
+  /// Number of calls to @ref enable_output.
+  static uint32_t enables;
+
+  // the track output (zero) uses the RailCom delays and the OpenLCB output
+  // uses no delays, this matches DccHwDefs.
+
+  /// Delay returned by @ref start_railcom_cutout_phase1.
+  static inline uint32_t start_phase1_usec =
+    OUTPUT ? 0 : HostRailComHwDefs::RAILCOM_START_PHASE1_DELAY_USEC;
+
+  /// Delay returned by @ref start_railcom_cutout_phase2.
+  static inline uint32_t start_phase2_usec =
+    OUTPUT ? 0 : HostRailComHwDefs::RAILCOM_START_PHASE2_DELAY_USEC;
+
+  /// Delay returned by @ref stop_railcom_cutout_phase1.
+  static inline uint32_t stop_usec =
+    OUTPUT ? 0 : HostRailComHwDefs::RAILCOM_STOP_DELAY_USEC;
+
+  static bool need_railcom_cutout()
+  {
+    return railcom;
+  }
+
+  static bool should_be_enabled()
+  {
+    return true;
+  }
+
+  static void enable_output()
+  {
+    enables++;
+    record(HostBoosterEvent::OUTPUT_ENABLED);
+  }
+
+  static uint32_t start_railcom_cutout_phase1()
+  {
+    record(HostBoosterEvent::OUTPUT_DISABLED);
+    return start_phase1_usec;
+  }
+
+  static uint32_t start_railcom_cutout_phase2()
+  {
+    record(HostBoosterEvent::DETECTOR_ENABLED);
+    return start_phase2_usec;
+  }
+
+  static uint32_t stop_railcom_cutout_phase1()
+  {
+    record(HostBoosterEvent::DETECTOR_DISABLED);
+    return stop_usec;
+  }
+
+  static void stop_railcom_cutout_phase2()
+  {
+    record(HostBoosterEvent::CUTOUT_STOPPED);
+  }
+
+private:
+  /// Records a call in @ref host_booster_log.
+  ///
+  /// @param event is the call that was made.
+  static void record(HostBoosterEvent event)
+  {
+    if (host_booster_recording)
+    {
+      host_booster_log.push_back({OUTPUT, event});
+    }
+  }
+};
+
+template <int OUTPUT> bool HostBoosterOutput<OUTPUT>::railcom = false;
+template <int OUTPUT> uint32_t HostBoosterOutput<OUTPUT>::enables = 0;
+
+/// Track booster output for the host tests.
+using HostTrackBooster = HostBoosterOutput<0>;
+
+/// OpenLCB booster output for the host tests.
+using HostOlcbBooster = HostBoosterOutput<1>;
+
+/// @ref RailcomDriver which records the calls made by the signal generator.
+class HostRailcomDriver : public RailcomDriver
+{
+public:
+  void feedback_sample() override
+  {
+  }
+
+  void start_cutout() override
+  {
+    cutouts++;
+  }
+
+  void middle_cutout() override
+  {
+  }
+
+  void end_cutout() override
+  {
+  }
+
+  void no_cutout() override
+  {
+  }
+
+  void set_feedback_key(uint32_t key) override
+  {
+    feedbackKey = key;
+  }
+
+  /// Number of calls to @ref start_cutout.
+  uint32_t cutouts{0};
+
+  /// Most recent feedback key.
+  uint32_t feedbackKey{0};
+};
+
+/// @return the RMT items of the most recent transmission on a channel, up to
+/// and including the RMT EOF marker.
+///
+/// @param channel is the RMT channel.
+static inline std::vector<rmt_item32_t> host_rmt_transmission(
+  rmt_channel_t channel)
+{
+  host_rmt::Channel &ch = host_rmt::channel(channel);
+  std::vector<rmt_item32_t> items;
+  for (size_t idx = 0; idx < RMT_MEM_ITEM_NUM * ch.mem_blocks; idx++)
+  {
+    items.push_back(ch.mem[idx]);
+    if (ch.mem[idx].duration0 == 0 || ch.mem[idx].duration1 == 0)
+    {
+      break;
+    }
+  }
+  return items;
+}
+
+/// @return the number of nanoseconds since an arbitrary epoch.
+static inline uint64_t host_nsec()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace esp32cs
+
+#endif // HOST_TRACK_HXX_
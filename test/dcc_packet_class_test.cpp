@@ -0,0 +1,122 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Verifies the DCC packet classification and the supersede / feedback keys,
+// short and long addresses with the same value must never share a key.
+
+#include "HostTrack.hxx"
+#include "RMTTrackDevice.hxx"
+
+#include <stdio.h>
+
+using namespace esp32cs;
+
+using HostTrackDevice =
+  RMTTrackDevice<HostDccHwDefs, HostTrackBooster, HostOlcbBooster>;
+
+namespace
+{
+
+/// Number of failed checks.
+unsigned failures = 0;
+
+/// Records a failed check.
+#define CHECK(x)                                                     \
+  do                                                                 \
+  {                                                                  \
+    if (!(x))                                                        \
+    {                                                                \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,        \
+              __LINE__, #x);                                         \
+      failures++;                                                    \
+    }                                                                \
+  } while (0)
+
+void test_addresses()
+{
+  dcc::Packet pkt;
+  pkt.set_dcc_speed128(dcc::DccShortAddress(3), true, 10);
+  CHECK(dcc_packet_address(pkt) == 3);
+  CHECK(dcc_packet_class(pkt) == DccPacketClass::SPEED);
+  uint32_t shortSpeed = dcc_packet_supersede_key(pkt);
+  uint32_t shortFeedback = dcc_packet_feedback_key(pkt);
+  CHECK(dcc_feedback_key_address(shortFeedback) == 3);
+  CHECK(dcc_feedback_key_is_generated(shortFeedback));
+  // keys set by the packet source are not decoded as an address.
+  CHECK(!dcc_feedback_key_is_generated(0x3FFB1234));
+  CHECK(dcc_feedback_key_address(0x3FFB1234) == DCC_BROADCAST_ADDRESS);
+  CHECK(dcc_feedback_key_address(0x00000300) == DCC_BROADCAST_ADDRESS);
+
+  pkt.set_dcc_speed128(dcc::DccLongAddress(3), true, 10);
+  CHECK(dcc_packet_address(pkt) == dcc_address_key(3, true));
+  CHECK(dcc_address_number(dcc_packet_address(pkt)) == 3);
+  CHECK(dcc_packet_class(pkt) == DccPacketClass::SPEED);
+  CHECK(dcc_packet_supersede_key(pkt) != shortSpeed);
+  CHECK(dcc_packet_feedback_key(pkt) != shortFeedback);
+  CHECK(dcc_feedback_key_address(dcc_packet_feedback_key(pkt)) ==
+        dcc_address_key(3, true));
+
+  pkt.set_dcc_speed128(dcc::DccLongAddress(10239), false, 0);
+  CHECK(dcc_address_number(dcc_packet_address(pkt)) == 10239);
+  CHECK(dcc_packet_address(pkt) != DCC_BROADCAST_ADDRESS);
+
+  pkt.set_dcc_idle();
+  CHECK(dcc_packet_address(pkt) == DCC_BROADCAST_ADDRESS);
+  CHECK(dcc_packet_supersede_key(pkt) == 0);
+
+  pkt.start_dcc_packet();
+  pkt.add_dcc_address(dcc::DccLongAddress(3));
+  pkt.add_dcc_function0_4(0x1F);
+  CHECK(dcc_packet_class(pkt) == DccPacketClass::FUNCTION_F0_F4);
+
+  // POM packets are never superseded and carry their class and tag in the
+  // feedback key.
+  pkt.start_dcc_packet();
+  pkt.add_dcc_address(dcc::DccLongAddress(3));
+  pkt.add_dcc_pom_read1(29);
+  CHECK(dcc_packet_class(pkt) == DccPacketClass::POM);
+  CHECK(dcc_packet_supersede_key(pkt) == 0);
+  uint32_t pomFeedback = dcc_packet_feedback_key(pkt, 7);
+  CHECK(dcc_feedback_key_class(pomFeedback) == DccPacketClass::POM);
+  CHECK(dcc_feedback_key_tag(pomFeedback) == 7);
+  CHECK(dcc_feedback_key_address(pomFeedback) == dcc_address_key(3, true));
+  CHECK(dcc_feedback_key_tag(dcc_packet_feedback_key(pkt)) == 0);
+  CHECK(dcc_feedback_key_class(0x3FFB1234) == DccPacketClass::OTHER);
+  CHECK(dcc_feedback_key_tag(0x3FFB1234) == 0);
+}
+
+void test_no_cross_address_supersede()
+{
+  HostRailcomDriver railcom;
+  HostTrackDevice device(&railcom);
+  device.hw_init();
+
+  dcc::Packet shortPkt;
+  shortPkt.set_dcc_speed128(dcc::DccShortAddress(3), true, 10);
+  dcc::Packet longPkt;
+  longPkt.set_dcc_speed128(dcc::DccLongAddress(3), true, 20);
+  CHECK(device.send(shortPkt));
+  CHECK(device.send(longPkt));
+  CHECK(device.stats().superseded == 0);
+
+  // a newer packet for the short address replaces the queued one.
+  shortPkt.set_dcc_speed128(dcc::DccShortAddress(3), true, 30);
+  CHECK(device.send(shortPkt));
+  CHECK(device.stats().superseded == 1);
+  CHECK(device.stats().ring_high_water == 2);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  test_addresses();
+  test_no_cross_address_supersede();
+  printf("%u failures\n", failures);
+  return failures ? 1 : 0;
+}
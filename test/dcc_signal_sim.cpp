@@ -0,0 +1,415 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// End-to-end simulation of the DCC signal generation.
+//
+// A set of simulated locomotives, accessory and POM packets are scheduled by
+// PrioritizedUpdateLoop and handed to RMTTrackDevice, the RMT ISR is run
+// whenever the packet ring is full. Every RMT transmission is recorded as
+// half-waves (including the RailCom cut-outs) and written to a file which is
+// read back and decoded. The decoded signal is checked against the S-9.1 bit
+// timing, the configured preamble length, the S-9.3.2 cut-out length and
+// the packets that were sent. An emergency stop is issued via
+// RMTTrackDevice::emergency_stop, the EStopPacketSource is part of the VFS
+// layer and is not built on the host.
+//
+// The time from the packet end bit to the cut-out is reported but not checked
+// against S-9.3.2, the on-track length of the sacrificial ONE bit after the
+// packet end bit depends on the RMT end of transmission behaviour which is
+// not modelled.
+//
+// Usage: dcc_signal_sim [half-wave file]
+
+#include "DccPacketClass.hxx"
+#include "HostSignal.hxx"
+#include "HostTrack.hxx"
+#include "PrioritizedUpdateLoop.hxx"
+#include "RMTTrackDevice.hxx"
+
+#include <dcc/PacketSource.hxx>
+#include <esp_timer.h>
+#include <random>
+#include <set>
+
+using namespace esp32cs;
+
+using HostTrackDevice =
+  RMTTrackDevice<HostDccHwDefs, HostTrackBooster, HostOlcbBooster>;
+
+namespace
+{
+
+/// Number of packets generated by the update loop.
+static constexpr size_t SIM_PACKETS = 4000;
+
+/// Number of simulated locomotives.
+static constexpr size_t LOCOMOTIVES = 24;
+
+/// Packet at which the RailCom cut-out is enabled.
+static constexpr size_t RAILCOM_START = 500;
+
+/// Packet at which the emergency stop is requested.
+static constexpr size_t ESTOP_START = 2500;
+
+/// Packet at which the emergency stop is cleared.
+static constexpr size_t ESTOP_END = 2800;
+
+/// Default file for the recorded half-waves.
+static const char * const DEFAULT_PATH = "dcc_halfwaves.txt";
+
+/// Number of failed checks.
+unsigned failures = 0;
+
+/// Records a failed check.
+#define CHECK(x)                                                     \
+  do                                                                 \
+  {                                                                  \
+    if (!(x))                                                        \
+    {                                                                \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,        \
+              __LINE__, #x);                                         \
+      failures++;                                                    \
+    }                                                                \
+  } while (0)
+
+/// Simulated locomotive.
+class SimLocomotive : public dcc::PacketSource
+{
+public:
+  SimLocomotive(unsigned address, bool is_long)
+    : address_(address), isLong_(is_long)
+  {
+  }
+
+  void get_next_packet(unsigned code, dcc::Packet *packet) override
+  {
+    if (isLong_)
+    {
+      build(dcc::DccLongAddress(address_), code, packet);
+    }
+    else
+    {
+      build(dcc::DccShortAddress(address_), code, packet);
+    }
+  }
+
+  /// Speed step of the locomotive.
+  unsigned speed{0};
+
+  /// State of F0-F4.
+  unsigned functions{0};
+
+private:
+  /// Generates the packet for an update code.
+  template <class A> void build(A address, unsigned code, dcc::Packet *packet)
+  {
+    if (code == dcc::DccTrainUpdateCode::FUNCTION0)
+    {
+      packet->start_dcc_packet();
+      packet->add_dcc_address(address);
+      packet->add_dcc_function0_4(functions);
+    }
+    else
+    {
+      packet->set_dcc_speed128(address, true, speed);
+    }
+  }
+
+  /// DCC address of the locomotive.
+  unsigned address_;
+
+  /// True if @ref address_ is a long address.
+  bool isLong_;
+};
+
+/// Track interface which hands the packets to the signal generator, the RMT
+/// ISR is simulated whenever the packet ring is full.
+class SimTrack : public dcc::TrackIf
+{
+public:
+  SimTrack(HostTrackDevice *device) : device_(device)
+  {
+  }
+
+  void send(Buffer<dcc::Packet> *message, unsigned priority) override
+  {
+    const dcc::Packet &packet = *message->data();
+    while (!device_->send(packet))
+    {
+      device_->rmt_transmit_complete();
+    }
+    sent.insert(std::vector<uint8_t>(packet.payload,
+                                     packet.payload + packet.dlc));
+    message->unref();
+  }
+
+  /// Packets accepted by the signal generator.
+  std::set<std::vector<uint8_t>> sent;
+
+private:
+  /// Signal generator to send packets to.
+  HostTrackDevice *device_;
+};
+
+/// @return a pre-built basic accessory packet.
+///
+/// @param address is the accessory address.
+/// @param thrown is the requested output state.
+Buffer<dcc::Packet> *accessory_packet(unsigned address, bool thrown)
+{
+  Buffer<dcc::Packet> *buffer;
+  mainBufferPool->alloc(&buffer);
+  dcc::Packet *packet = buffer->data();
+  packet->start_dcc_packet();
+  packet->payload[packet->dlc++] = 0x80 | (address & 0x3F);
+  packet->payload[packet->dlc++] =
+    0x88 | ((~address >> 2) & 0x70) | (thrown ? 1 : 0);
+  packet->add_dcc_checksum();
+  packet->packet_header.rept_count = 2;
+  return buffer;
+}
+
+/// @return a pre-built POM write packet.
+///
+/// @param address is the long locomotive address.
+/// @param cv is the CV number (zero based).
+/// @param value is the CV value.
+Buffer<dcc::Packet> *pom_packet(unsigned address, unsigned cv, uint8_t value)
+{
+  Buffer<dcc::Packet> *buffer;
+  mainBufferPool->alloc(&buffer);
+  dcc::Packet *packet = buffer->data();
+  packet->start_dcc_packet();
+  packet->add_dcc_address(dcc::DccLongAddress(address));
+  packet->add_dcc_pom_write1(cv, value);
+  packet->packet_header.rept_count = 1;
+  return buffer;
+}
+
+/// @return a decoded packet converted back to a @ref dcc::Packet.
+///
+/// @param decoded is the decoded packet.
+dcc::Packet to_packet(const DecodedPacket &decoded)
+{
+  dcc::Packet packet;
+  for (uint8_t value : decoded.payload)
+  {
+    packet.payload[packet.dlc++] = value;
+  }
+  return packet;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  const char *path = argc > 1 ? argv[1] : DEFAULT_PATH;
+  HostSignalRecorder recorder(HostDccHwDefs::RMT_CHANNEL);
+  HostTrackDevice device(&recorder);
+  device.hw_init();
+  Service service;
+  SimTrack track(&device);
+  PrioritizedUpdateLoop loop(&service, &track);
+  std::mt19937 rng(0xDCC);
+
+  std::vector<SimLocomotive> locos;
+  locos.reserve(LOCOMOTIVES + 1);
+  for (size_t idx = 0; idx < LOCOMOTIVES; idx++)
+  {
+    // alternate short and long addresses.
+    locos.emplace_back(idx & 1 ? 3 + idx : 1000 + idx, !(idx & 1));
+  }
+  // long address with the same number as one of the short addresses.
+  locos.emplace_back(4, true);
+  for (auto &loco : locos)
+  {
+    loop.add_refresh_source(&loco, 0);
+  }
+
+  dcc::Packet estop;
+  estop.set_dcc_speed14(dcc::DccShortAddress(0), true, false,
+                        dcc::Packet::EMERGENCY_STOP);
+  size_t estopMark = 0;
+  size_t clearMark = 0;
+  HostTrackBooster::railcom = false;
+  uint32_t txStart = host_rmt::channel(HostDccHwDefs::RMT_CHANNEL).tx_starts;
+  uint64_t start = host_nsec();
+  for (size_t count = 0; count < SIM_PACKETS; count++)
+  {
+    if (count == RAILCOM_START)
+    {
+      HostTrackBooster::railcom = true;
+    }
+    else if (count == ESTOP_START)
+    {
+      device.emergency_stop();
+      estopMark = recorder.mark();
+    }
+    else if (count == ESTOP_END)
+    {
+      device.clear_emergency_stop();
+      clearMark = recorder.mark();
+    }
+    SimLocomotive &loco = locos[rng() % locos.size()];
+    switch (rng() % 8)
+    {
+      case 0:
+        loco.speed = rng() % 127;
+        loop.notify_update(&loco, dcc::DccTrainUpdateCode::SPEED);
+        break;
+      case 1:
+        loco.functions = rng() & 0x1F;
+        loop.notify_update(&loco, dcc::DccTrainUpdateCode::FUNCTION0);
+        break;
+      case 2:
+        if (rng() % 4 == 0)
+        {
+          loop.send_packet(accessory_packet(rng() % 64, rng() & 1));
+        }
+        break;
+      case 3:
+        if (rng() % 16 == 0)
+        {
+          loop.send_packet(pom_packet(1000 + (rng() % 100), rng() % 1024,
+                                      rng() & 0xFF));
+        }
+        break;
+      default:
+        break;
+    }
+    host_esp_timer::simulated_usec = recorder.elapsed_nsec() / 1000;
+    Buffer<dcc::Packet> *buffer;
+    track.alloc(&buffer);
+    loop.send(buffer);
+  }
+  // drain the packet ring, including the repeats of the queued packets.
+  for (size_t idx = 0; idx < (HostDccHwDefs::PACKET_Q_SIZE + 1) * 4; idx++)
+  {
+    device.rmt_transmit_complete();
+  }
+  uint64_t generateNsec = host_nsec() - start;
+  uint32_t transmissions =
+    host_rmt::channel(HostDccHwDefs::RMT_CHANNEL).tx_starts - txStart;
+  host_esp_timer::simulated_usec = -1;
+
+  if (!recorder.write(path))
+  {
+    fprintf(stderr, "unable to write %s\n", path);
+    return 1;
+  }
+  std::vector<HalfWave> waves;
+  CHECK(HostSignalRecorder::read(path, &waves));
+  CHECK(waves.size() == recorder.waves().size());
+
+  HostSignalDecoder decoder(HostDccHwDefs::RMT_DCC_FIRST_HALF,
+                            HostDccHwDefs::DCC_PREAMBLE_BITS);
+  start = host_nsec();
+  DecodedSignal signal = decoder.decode(waves);
+  uint64_t decodeNsec = host_nsec() - start;
+  for (const std::string &error : signal.errors)
+  {
+    fprintf(stderr, "%s\n", error.c_str());
+  }
+  CHECK(signal.errors.empty());
+  CHECK(signal.cutouts > 0);
+
+  // the decoder must reject a stretched ONE half-wave and a short cut-out.
+  for (HalfWaveLevel level : {HalfWaveLevel::HIGH, HalfWaveLevel::CUTOUT})
+  {
+    std::vector<HalfWave> broken = waves;
+    auto wave = std::find_if(broken.begin() + broken.size() / 2, broken.end(),
+                             [level](const HalfWave &wave)
+                             {
+                               return wave.level == level;
+                             });
+    CHECK(wave != broken.end());
+    if (wave != broken.end())
+    {
+      wave->nsec = level == HalfWaveLevel::CUTOUT ? 400000 : 70000;
+      CHECK(!decoder.decode(broken).errors.empty());
+    }
+  }
+
+  // every transmission is decoded and every packet is either an idle or
+  // e-stop packet generated by the signal generator or a packet that was
+  // sent.
+  const dcc::Packet idle = dcc::Packet::DCC_IDLE();
+  track.sent.emplace(idle.payload, idle.payload + idle.dlc);
+  const std::vector<uint8_t> estopPayload(estop.payload,
+                                          estop.payload + estop.dlc);
+  track.sent.insert(estopPayload);
+  CHECK(signal.packets.size() == transmissions);
+  unsigned unknown = 0;
+  uint32_t minPreamble = UINT32_MAX;
+  uint32_t minCutoutPreamble = UINT32_MAX;
+  for (const DecodedPacket &packet : signal.packets)
+  {
+    if (!track.sent.count(packet.payload) && ++unknown <= 5)
+    {
+      fprintf(stderr, "decoded packet %s was not sent\n",
+              dcc::packet_to_string(to_packet(packet)).c_str());
+    }
+    uint32_t &minimum =
+      packet.after_cutout ? minCutoutPreamble : minPreamble;
+    minimum = std::min(minimum, packet.preamble_bits);
+  }
+  CHECK(unknown == 0);
+
+  // the cut-out overlaps the next preamble, the extended preamble must leave
+  // at least as many bits as a 454 usec cut-out at the start of the
+  // configured preamble.
+  const uint64_t oneBitNsec =
+    (2 * HostDccHwDefs::DCC_ONE_RMT_TICKS * HOST_RMT_TICK_PSEC) / 1000;
+  CHECK(minCutoutPreamble >= HostDccHwDefs::DCC_PREAMBLE_BITS -
+        (454000 + oneBitNsec - 1) / oneBitNsec);
+
+  // the first packet after the e-stop request is the broadcast e-stop and
+  // no locomotive speed packets are sent until the e-stop is cleared.
+  bool first = true;
+  unsigned estops = 0;
+  unsigned latchedSpeed = 0;
+  for (const DecodedPacket &packet : signal.packets)
+  {
+    if (packet.start < estopMark)
+    {
+      continue;
+    }
+    if (first)
+    {
+      CHECK(packet.payload == estopPayload);
+      first = false;
+    }
+    estops += packet.payload == estopPayload;
+    dcc::Packet decoded = to_packet(packet);
+    if (packet.start < clearMark &&
+        dcc_packet_class(decoded) == DccPacketClass::SPEED &&
+        dcc_packet_address(decoded) != DCC_BROADCAST_ADDRESS)
+    {
+      latchedSpeed++;
+    }
+  }
+  CHECK(!first);
+  CHECK(latchedSpeed == 0);
+
+  double trackSec = recorder.elapsed_nsec() / 1e9;
+  printf("%zu half-waves written to %s\n", waves.size(), path);
+  printf("decoded packets: %zu (%u transmissions, %u cut-outs, %u e-stop)\n",
+         signal.packets.size(), transmissions, signal.cutouts, estops);
+  printf("minimum preamble: %" PRIu32 " bits, %" PRIu32 " bits after a "
+         "cut-out\n", minPreamble, minCutoutPreamble);
+  printf("packet end bit to cut-out: %.1f-%.1f usec\n",
+         signal.min_cutout_start_nsec / 1000.0,
+         signal.max_cutout_start_nsec / 1000.0);
+  printf("track time: %.3f sec (%.1f packets/sec on the track)\n", trackSec,
+         transmissions / trackSec);
+  printf("generate: %.0f packets/sec, decode: %.0f packets/sec\n",
+         transmissions / (generateNsec / 1e9),
+         signal.packets.size() / (decodeNsec / 1e9));
+  printf("%u failures\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,248 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Simulation of the RailCom cut-out phase sequencing.
+//
+// RailComCutoutSequencer is driven by a simulated timer which fires each
+// alarm after the requested delay, as the hardware timer of
+// Esp32RailComDriver does. The booster calls are recorded with the simulated
+// time and checked against the expected phase order and the S-9.3.2 timing:
+// the channel 1 window ends 177 usec after the start of the cut-out and the
+// outputs are re-enabled 454-488 usec after the start of the cut-out.
+//
+// The sequencing is run with the booster delays of DccHwDefs, with no
+// booster delays (each alarm is rounded up to one microsecond) and with the
+// cut-out ended early via RailcomDriver::end_cutout.
+
+#include "HostTrack.hxx"
+#include "RailComCutout.hxx"
+
+#include <stdio.h>
+
+using namespace esp32cs;
+
+using Sequencer =
+  RailComCutoutSequencer<HostRailComHwDefs, HostTrackBooster, HostOlcbBooster>;
+using RailComPhase = Sequencer::RailComPhase;
+
+namespace
+{
+
+/// Number of failed checks.
+unsigned failures = 0;
+
+#define CHECK(x)                                                     \
+  do                                                                 \
+  {                                                                  \
+    if (!(x))                                                        \
+    {                                                                \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,        \
+              __LINE__, #x);                                         \
+      failures++;                                                    \
+    }                                                                \
+  } while (0)
+
+/// Booster call with the simulated time it was made at.
+struct TimedEvent
+{
+  /// Booster output which was called.
+  int output;
+
+  /// Call which was made.
+  HostBoosterEvent event;
+
+  /// Microseconds since the start of the cut-out.
+  uint32_t usec;
+};
+
+/// Result of a simulated cut-out.
+struct SimCutout
+{
+  /// Simulated time at which each phase was entered, indexed by phase.
+  uint32_t phase_usec[RailComPhase::STOP_PHASE + 1];
+
+  /// Booster calls in the order they were made.
+  std::vector<TimedEvent> events;
+
+  /// Shortest alarm requested by the sequencer.
+  uint32_t min_alarm{UINT32_MAX};
+
+  /// Simulated time at which the cut-out completed.
+  uint32_t end_usec{0};
+};
+
+/// Moves the recorded booster calls into the simulated cut-out.
+///
+/// @param sim is the simulated cut-out.
+/// @param usec is the current simulated time.
+void collect(SimCutout *sim, uint32_t usec)
+{
+  for (const HostBoosterRecord &record : host_booster_log)
+  {
+    sim->events.push_back({record.output, record.event, usec});
+  }
+  host_booster_log.clear();
+}
+
+/// Runs a cut-out to completion with a simulated timer.
+///
+/// @return the simulated cut-out.
+SimCutout run_cutout()
+{
+  Sequencer sequencer;
+  SimCutout sim{};
+  uint32_t now = 0;
+  host_booster_log.clear();
+  host_booster_recording = true;
+  uint32_t alarm = sequencer.start();
+  collect(&sim, now);
+  sim.phase_usec[sequencer.phase()] = now;
+  while (alarm)
+  {
+    sim.min_alarm = std::min(sim.min_alarm, alarm);
+    now += alarm;
+    alarm = sequencer.advance();
+    collect(&sim, now);
+    sim.phase_usec[sequencer.phase()] = now;
+  }
+  sim.end_usec = now;
+  host_booster_recording = false;
+  CHECK(sequencer.phase() == RailComPhase::PRE_CUTOUT);
+  CHECK(sequencer.advance() == 0);
+  return sim;
+}
+
+/// @return the simulated time of a booster call, UINT32_MAX if the call was
+/// not made.
+///
+/// @param sim is the simulated cut-out.
+/// @param output is the booster output.
+/// @param event is the booster call.
+uint32_t event_usec(const SimCutout &sim, int output, HostBoosterEvent event)
+{
+  for (const TimedEvent &timed : sim.events)
+  {
+    if (timed.output == output && timed.event == event)
+    {
+      return timed.usec;
+    }
+  }
+  return UINT32_MAX;
+}
+
+/// Checks the phase order and timing of a simulated cut-out.
+///
+/// @param name is the name of the configuration.
+/// @param sim is the simulated cut-out.
+void check_cutout(const char *name, const SimCutout &sim)
+{
+  static constexpr HostBoosterEvent ORDER[] =
+  {
+    HostBoosterEvent::OUTPUT_DISABLED,
+    HostBoosterEvent::DETECTOR_ENABLED,
+    HostBoosterEvent::DETECTOR_DISABLED,
+    HostBoosterEvent::CUTOUT_STOPPED,
+    HostBoosterEvent::OUTPUT_ENABLED
+  };
+  const uint32_t *phase = sim.phase_usec;
+  printf("%s: detector %u usec, channel 1 %u-%u usec, channel 2 %u-%u usec, "
+         "outputs enabled %u usec\n", name,
+         phase[RailComPhase::START_PHASE2], phase[RailComPhase::CUTOUT_PHASE1],
+         phase[RailComPhase::CUTOUT_PHASE2], phase[RailComPhase::CUTOUT_PHASE2],
+         phase[RailComPhase::STOP_PHASE], sim.end_usec);
+
+  // both outputs see every call in order and at non-decreasing times.
+  for (int output : {0, 1})
+  {
+    uint32_t previous = 0;
+    for (HostBoosterEvent event : ORDER)
+    {
+      uint32_t usec = event_usec(sim, output, event);
+      CHECK(usec != UINT32_MAX);
+      CHECK(usec >= previous);
+      previous = usec;
+    }
+  }
+  CHECK(sim.events.size() == 2 * (sizeof(ORDER) / sizeof(ORDER[0])));
+
+  // the phases are entered in order and no alarm is zero.
+  CHECK(sim.min_alarm >= 1);
+  CHECK(phase[RailComPhase::START_PHASE1] == 0);
+  CHECK(phase[RailComPhase::START_PHASE1] < phase[RailComPhase::START_PHASE2]);
+  CHECK(phase[RailComPhase::START_PHASE2] < phase[RailComPhase::CUTOUT_PHASE1]);
+  CHECK(phase[RailComPhase::CUTOUT_PHASE1] < phase[RailComPhase::CUTOUT_PHASE2]);
+  CHECK(phase[RailComPhase::CUTOUT_PHASE2] < phase[RailComPhase::STOP_PHASE]);
+  CHECK(phase[RailComPhase::STOP_PHASE] < sim.end_usec);
+
+  // the outputs are disabled at the start and the detector is enabled once
+  // the phase 1 delay has elapsed.
+  CHECK(event_usec(sim, 0, HostBoosterEvent::OUTPUT_DISABLED) == 0);
+  CHECK(event_usec(sim, 0, HostBoosterEvent::DETECTOR_ENABLED) ==
+        phase[RailComPhase::START_PHASE2]);
+  CHECK(event_usec(sim, 0, HostBoosterEvent::DETECTOR_DISABLED) ==
+        phase[RailComPhase::STOP_PHASE]);
+  CHECK(event_usec(sim, 0, HostBoosterEvent::OUTPUT_ENABLED) ==
+        sim.end_usec);
+
+  // S-9.3.2 channel 1 ends 177 usec and the cut-out 454-488 usec after the
+  // start of the cut-out.
+  CHECK(phase[RailComPhase::CUTOUT_PHASE2] <= 177);
+  CHECK(sim.end_usec >= 454 && sim.end_usec <= 488);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  // booster delays of DccHwDefs, the cut-out must match the length used by
+  // the signal generator.
+  SimCutout sim = run_cutout();
+  check_cutout("booster delays", sim);
+  CHECK(sim.end_usec == Sequencer::CUTOUT_USEC);
+  CHECK(sim.phase_usec[RailComPhase::CUTOUT_PHASE1] == Sequencer::START_USEC);
+
+  // no booster delays, each alarm is rounded up so the timer fires.
+  HostTrackBooster::start_phase1_usec = 0;
+  HostTrackBooster::start_phase2_usec = 0;
+  HostTrackBooster::stop_usec = 0;
+  check_cutout("no booster delays", run_cutout());
+  HostTrackBooster::start_phase1_usec =
+    HostRailComHwDefs::RAILCOM_START_PHASE1_DELAY_USEC;
+  HostTrackBooster::start_phase2_usec =
+    HostRailComHwDefs::RAILCOM_START_PHASE2_DELAY_USEC;
+  HostTrackBooster::stop_usec = HostRailComHwDefs::RAILCOM_STOP_DELAY_USEC;
+
+  // cut-out ended during the channel 1 window, the detector is disabled and
+  // the outputs re-enabled without waiting for the remaining phases.
+  Sequencer sequencer;
+  host_booster_log.clear();
+  host_booster_recording = true;
+  sequencer.start();
+  sequencer.advance();
+  sequencer.advance();
+  CHECK(sequencer.phase() == RailComPhase::CUTOUT_PHASE1);
+  host_booster_log.clear();
+  sequencer.stop_detector();
+  sequencer.stop();
+  host_booster_recording = false;
+  CHECK(sequencer.phase() == RailComPhase::PRE_CUTOUT);
+  CHECK(sequencer.advance() == 0);
+  CHECK(host_booster_log.size() == 6);
+  if (host_booster_log.size() == 6)
+  {
+    CHECK(host_booster_log[0].event == HostBoosterEvent::DETECTOR_DISABLED);
+    CHECK(host_booster_log[1].event == HostBoosterEvent::DETECTOR_DISABLED);
+    CHECK(host_booster_log[2].event == HostBoosterEvent::CUTOUT_STOPPED);
+    CHECK(host_booster_log[3].event == HostBoosterEvent::CUTOUT_STOPPED);
+    CHECK(host_booster_log[4].event == HostBoosterEvent::OUTPUT_ENABLED);
+    CHECK(host_booster_log[5].event == HostBoosterEvent::OUTPUT_ENABLED);
+  }
+
+  printf("%u failures\n", failures);
+  return failures ? 1 : 0;
+}
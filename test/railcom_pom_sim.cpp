@@ -0,0 +1,366 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Simulation of the RailCom POM read-back and channel 1 presence detection.
+//
+// RailComPomEngine sends its POM packets to a simulated track, the packets
+// are answered by HostRailComResponder and the feedback is decoded by
+// RailComFeedbackCache which forwards the POM responses to the engine. The
+// engine timeouts run on the simulated esp_timer clock.
+//
+// The POM checks cover short and long addresses with the same number,
+// responses to the packets of an earlier request or of another packet source
+// which arrive before the packet of the current request and responses with a
+// feedback key of another packet class. The channel 1 checks cover the
+// pairing of ADR_HIGH and ADR_LOW from adjacent cut-outs only and the
+// presence table keyed by address and address type.
+
+#include "HostRailCom.hxx"
+#include "RailComFeedbackCache.hxx"
+#include "RailComPomEngine.hxx"
+
+#include <deque>
+#include <locodb/LocoPresence.hxx>
+#include <openlcb/Defs.hxx>
+#include <stdio.h>
+
+using namespace esp32cs;
+
+namespace
+{
+
+/// Number of failed checks.
+unsigned failures = 0;
+
+#define CHECK(x)                                                     \
+  do                                                                 \
+  {                                                                  \
+    if (!(x))                                                        \
+    {                                                                \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,        \
+              __LINE__, #x);                                         \
+      failures++;                                                    \
+    }                                                                \
+  } while (0)
+
+/// Simulated time per packet and cut-out, in microseconds.
+static constexpr int64_t PACKET_USEC = 10000;
+
+/// Track which holds the packets sent by the engine until they are
+/// transmitted by the test.
+class HostPomTrack : public dcc::TrackIf
+{
+public:
+  void send(Buffer<dcc::Packet> *message, unsigned priority) override
+  {
+    packets.push_back(*message->data());
+    message->unref();
+  }
+
+  /// Packets waiting to be transmitted.
+  std::deque<dcc::Packet> packets;
+};
+
+/// RailCom hub, feedback cache, POM engine and decoders on the track.
+struct PomSim
+{
+  PomSim()
+  {
+    host_esp_timer::simulated_usec = 1000;
+    cache.set_pom_engine(&engine);
+  }
+
+  ~PomSim()
+  {
+    host_esp_timer::simulated_usec = -1;
+  }
+
+  /// Queues a request with the engine.
+  ///
+  /// @return the request, the caller holds a reference to it.
+  template <typename... Args> Buffer<RailComPomRequest> *start(Args... args)
+  {
+    Buffer<RailComPomRequest> *b;
+    engine.alloc(&b);
+    b->data()->reset(args...);
+    b->ref();
+    engine.send(b);
+    return b;
+  }
+
+  /// Transmits the packets waiting on the track.
+  void transmit()
+  {
+    while (!track.packets.empty())
+    {
+      responder.transmit(track.packets.front());
+      track.packets.pop_front();
+      host_esp_timer::simulated_usec += PACKET_USEC;
+    }
+  }
+
+  /// Runs the track and the engine until a request completes.
+  ///
+  /// @param b is the request.
+  /// @param transmit is false to leave the packets of the engine on the
+  /// track, the decoders then never respond.
+  ///
+  /// @return the result of the request.
+  int finish(Buffer<RailComPomRequest> *b, bool transmit = true)
+  {
+    for (unsigned idx = 0;
+         idx < 1000 &&
+         b->data()->resultCode == CallableFlowRequestBase::OPERATION_PENDING;
+         idx++)
+    {
+      if (transmit)
+      {
+        this->transmit();
+      }
+      host_esp_timer::simulated_usec += PACKET_USEC;
+      host_run_timers();
+    }
+    return b->data()->resultCode;
+  }
+
+  /// Reads a CV and releases the request.
+  ///
+  /// @param value receives the CV value.
+  ///
+  /// @return the result of the request.
+  int read(uint16_t address, bool is_long, uint16_t cv, uint8_t *value)
+  {
+    Buffer<RailComPomRequest> *b =
+      start(RailComPomRequest::READ, address, is_long, cv);
+    int result = finish(b);
+    *value = b->data()->value;
+    b->unref();
+    return result;
+  }
+
+  Service service;
+  dcc::RailcomHubFlow hub{&service};
+  RailComFeedbackCache cache{&hub};
+  locodb::LocoPresence presence;
+  HostPomTrack track;
+  RailComPomEngine engine{&service, &track};
+  HostRailComResponder responder{&hub};
+};
+
+/// @return an idle packet.
+dcc::Packet idle_packet()
+{
+  dcc::Packet pkt;
+  pkt.set_dcc_idle();
+  return pkt;
+}
+
+/// Short and long addresses with the same number are different decoders.
+void test_address_types()
+{
+  PomSim sim;
+  HostRailComDecoder *short3 = sim.responder.add_decoder(3, false);
+  HostRailComDecoder *long3 = sim.responder.add_decoder(3, true);
+  HostRailComDecoder *long100 = sim.responder.add_decoder(100, true);
+  short3->broadcast = long3->broadcast = long100->broadcast = false;
+  short3->cv[7] = 145;
+  long3->cv[7] = 99;
+  long100->cv[0] = 100;
+
+  uint8_t value = 0;
+  CHECK(sim.read(3, false, 8, &value) == 0);
+  CHECK(value == 145);
+  CHECK(sim.read(3, true, 8, &value) == 0);
+  CHECK(value == 99);
+  // long addresses below 128 are sent as long addresses.
+  CHECK(sim.read(100, true, 1, &value) == 0);
+  CHECK(value == 100);
+  CHECK(long100->pom_responses == 2);
+  CHECK(sim.read(128, false, 1, &value) ==
+        openlcb::Defs::ERROR_INVALID_ARGS);
+  CHECK(sim.read(10240, true, 1, &value) ==
+        openlcb::Defs::ERROR_INVALID_ARGS);
+  CHECK(sim.read(3, false, 1025, &value) ==
+        openlcb::Defs::ERROR_INVALID_ARGS);
+}
+
+/// The engine packets carry a tagged POM feedback key and are not
+/// superseded.
+void test_packet_keys()
+{
+  PomSim sim;
+  Buffer<RailComPomRequest> *first =
+    sim.start(RailComPomRequest::READ, 3, false, 1);
+  CHECK(sim.track.packets.size() == 1);
+  dcc::Packet pkt = sim.track.packets.front();
+  CHECK(dcc_packet_class(pkt) == DccPacketClass::POM);
+  CHECK(dcc_packet_supersede_key(pkt) == 0);
+  CHECK(pkt.packet_header.rept_count == 1);
+  CHECK(dcc_feedback_key_class(pkt.feedback_key) == DccPacketClass::POM);
+  CHECK(dcc_feedback_key_address(pkt.feedback_key) == 3);
+  uint8_t tag = dcc_feedback_key_tag(pkt.feedback_key);
+  CHECK(tag != 0);
+  CHECK(sim.finish(first, false) == RailComPomRequest::ERROR_NO_RESPONSE);
+  CHECK(first->data()->attempts == 3);
+  first->unref();
+
+  // every attempt of a request uses the same tag, the next request another.
+  CHECK(sim.track.packets.size() == 3);
+  for (const dcc::Packet &sent : sim.track.packets)
+  {
+    CHECK(sent.feedback_key == pkt.feedback_key);
+  }
+  sim.track.packets.clear();
+  Buffer<RailComPomRequest> *second =
+    sim.start(RailComPomRequest::READ, 3, false, 1);
+  CHECK(sim.track.packets.size() == 1);
+  CHECK(dcc_feedback_key_tag(sim.track.packets.front().feedback_key) != tag);
+  CHECK(dcc_feedback_key_tag(sim.track.packets.front().feedback_key) != 0);
+  CHECK(sim.finish(second, false) == RailComPomRequest::ERROR_NO_RESPONSE);
+  second->unref();
+}
+
+/// Responses which arrive before the packet of the current request has been
+/// transmitted are ignored.
+void test_stale_responses()
+{
+  PomSim sim;
+  HostRailComDecoder *decoder = sim.responder.add_decoder(7, false);
+  decoder->broadcast = false;
+  decoder->cv[0] = 11;
+  decoder->cv[1] = 22;
+  decoder->cv[2] = 33;
+
+  // the packets of a request which timed out are still waiting on the track
+  // when the next request for the same decoder starts, the responses to
+  // them must not complete the new request.
+  uint8_t value = 0;
+  Buffer<RailComPomRequest> *b =
+    sim.start(RailComPomRequest::READ, 7, false, 1);
+  CHECK(sim.finish(b, false) == RailComPomRequest::ERROR_NO_RESPONSE);
+  b->unref();
+  CHECK(sim.track.packets.size() == 3);
+  CHECK(sim.read(7, false, 2, &value) == 0);
+  CHECK(value == 22);
+  CHECK(decoder->pom_responses == 8);
+
+  // a POM write from another packet source reaches the decoder first.
+  b = sim.start(RailComPomRequest::READ, 7, false, 3);
+  dcc::Packet write;
+  write.start_dcc_packet();
+  write.add_dcc_address(dcc::DccShortAddress(7));
+  write.add_dcc_pom_write1(4, 55);
+  sim.responder.transmit(write);
+  CHECK(decoder->cv[4] == 55);
+  host_run_timers();
+  CHECK(b->data()->resultCode == CallableFlowRequestBase::OPERATION_PENDING);
+
+  // a response with the address and tag of the request but the feedback key
+  // of another packet class.
+  uint32_t key = sim.track.packets.front().feedback_key;
+  uint32_t speed_key = (key & ~DCC_FEEDBACK_KEY_CLASS_MASK) |
+                       (uint8_t)DccPacketClass::SPEED;
+  sim.responder.respond(sim.track.packets.front(), speed_key);
+  host_run_timers();
+  CHECK(b->data()->resultCode == CallableFlowRequestBase::OPERATION_PENDING);
+
+  CHECK(sim.finish(b) == 0);
+  CHECK(b->data()->value == 33);
+  CHECK(b->data()->attempts == 1);
+  b->unref();
+
+  // verify reports the value read on a mismatch.
+  b = sim.start(RailComPomRequest::VERIFY, 7, false, 3, 34);
+  CHECK(sim.finish(b) == RailComPomRequest::ERROR_VERIFY_FAILED);
+  CHECK(b->data()->value == 33);
+  b->unref();
+  b = sim.start(RailComPomRequest::VERIFY, 7, false, 3, 33);
+  CHECK(sim.finish(b) == 0);
+  b->unref();
+
+  // the cache attributes the responses to the short address only.
+  RailComFeedback fb;
+  CHECK(sim.cache.get(7, false, &fb));
+  CHECK(fb.cv_value == 33);
+  CHECK(!sim.cache.get(7, true, &fb));
+}
+
+/// Channel 1 ADR_HIGH and ADR_LOW are only combined from adjacent cut-outs.
+void test_channel1_pairing()
+{
+  using dcc::TrainAddressType;
+  PomSim sim;
+  dcc::Packet idle = idle_packet();
+  HostRailComDecoder *long_decoder = sim.responder.add_decoder(0x1234, true);
+  HostRailComDecoder *short_decoder = sim.responder.add_decoder(5, false);
+
+  // ADR_HIGH of the long address, then the decoder leaves the track.
+  short_decoder->present = false;
+  sim.responder.transmit(idle);
+  long_decoder->present = false;
+  sim.responder.transmit(idle);
+
+  // the next decoder starts with ADR_LOW, this must not be combined with
+  // the ADR_HIGH received two cut-outs earlier.
+  short_decoder->present = true;
+  short_decoder->adr_high_next = false;
+  sim.responder.transmit(idle);
+  CHECK(sim.presence.present().empty());
+  sim.responder.transmit(idle);
+  sim.responder.transmit(idle);
+  CHECK(sim.presence.is_present(5, TrainAddressType::DCC_SHORT_ADDRESS));
+  CHECK(!sim.presence.is_present(5, TrainAddressType::DCC_LONG_ADDRESS));
+  CHECK(sim.presence.is_present(5, TrainAddressType::UNSPECIFIED));
+  CHECK(!sim.presence.is_present(0x1205, TrainAddressType::DCC_LONG_ADDRESS));
+  CHECK(sim.presence.present().size() == 1);
+
+  // long address, both halves in adjacent cut-outs.
+  short_decoder->present = false;
+  long_decoder->present = true;
+  long_decoder->adr_high_next = true;
+  sim.responder.transmit(idle);
+  sim.responder.transmit(idle);
+  CHECK(sim.presence.is_present(0x1234, TrainAddressType::DCC_LONG_ADDRESS));
+  CHECK(!sim.presence.is_present(0x1234,
+                                 TrainAddressType::DCC_SHORT_ADDRESS));
+
+  // two decoders broadcasting at the same time collide, nothing is
+  // reported and the pairing starts again afterwards.
+  HostRailComDecoder *other = sim.responder.add_decoder(9, false);
+  long_decoder->adr_high_next = true;
+  for (unsigned idx = 0; idx < 4; idx++)
+  {
+    sim.responder.transmit(idle);
+  }
+  CHECK(!sim.presence.is_present(9, TrainAddressType::UNSPECIFIED));
+  CHECK(sim.presence.present().size() == 2);
+  long_decoder->present = false;
+  other->adr_high_next = false;
+  sim.responder.transmit(idle);
+  CHECK(!sim.presence.is_present(9, TrainAddressType::UNSPECIFIED));
+  sim.responder.transmit(idle);
+  sim.responder.transmit(idle);
+  CHECK(sim.presence.is_present(9, TrainAddressType::DCC_SHORT_ADDRESS));
+
+  // presence expires after the timeout.
+  host_esp_timer::simulated_usec +=
+    MSEC_TO_USEC(locodb::config_loco_presence_timeout_ms() + 1);
+  CHECK(!sim.presence.is_present(5, TrainAddressType::DCC_SHORT_ADDRESS));
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  test_address_types();
+  test_packet_keys();
+  test_stale_responses();
+  test_channel1_pairing();
+  printf("%u failures\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,255 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Compares the per-bit DCC encoder which used to run in the RMT ISR with the
+// table driven encoder of RMTTrackDevice.
+//
+// The per-bit encoder is a copy of the encoder prior to the symbol tables,
+// both encoders must generate identical RMT items when EMC spreading is
+// disabled. The table driven encoder runs from send() in the task context so
+// the remaining RMT ISR cost (rmt_transmit_complete) is reported separately.
+
+#include "HostTrack.hxx"
+#include "RMTTrackDevice.hxx"
+
+#include <inttypes.h>
+#include <random>
+#include <stdio.h>
+
+using namespace esp32cs;
+
+using HostTrackDevice =
+  RMTTrackDevice<HostDccHwDefs, HostTrackBooster, HostOlcbBooster>;
+
+namespace
+{
+
+/// Number of packets to encode with each encoder.
+static constexpr size_t BENCH_PACKETS = 200000;
+
+/// Maximum number of RMT items for a single packet, 17 preamble bits and
+/// six payload bytes need 74 items.
+static constexpr size_t MAX_PACKET_ITEMS = 128;
+
+/// Number of microseconds per DCC ONE bit, the host RMT clock has one tick
+/// per microsecond.
+static constexpr uint32_t ONE_BIT_USEC = 2 * HostDccHwDefs::DCC_ONE_RMT_TICKS;
+
+/// Number of preamble bits of OPS packets, the encoder extends the configured
+/// preamble to cover the start of the RailCom cut-out.
+static constexpr uint32_t OPS_PREAMBLE_BITS = HostDccHwDefs::DCC_PREAMBLE_BITS +
+  (HostDccHwDefs::RAILCOM_CUTOUT_START_USEC + ONE_BIT_USEC - 1) / ONE_BIT_USEC;
+
+/// Per-bit DCC encoder, this is the encoder which ran in the RMT ISR prior to
+/// the pre-encoded symbol tables.
+///
+/// @param packet is the DCC packet to encode.
+/// @param items is the buffer to receive the RMT items.
+///
+/// @return the number of RMT items generated, including the EOF marker.
+__attribute__((noinline))
+uint32_t legacy_encode(const dcc::Packet &packet, rmt_item32_t *items)
+{
+  static const rmt_item32_t DCC_RMT_ONE_BIT =
+  {{{
+    HostDccHwDefs::DCC_ONE_RMT_TICKS, HostDccHwDefs::RMT_DCC_FIRST_HALF,
+    HostDccHwDefs::DCC_ONE_RMT_TICKS, HostDccHwDefs::RMT_DCC_SECOND_HALF
+  }}};
+  static const rmt_item32_t DCC_RMT_ZERO_BIT =
+  {{{
+    HostDccHwDefs::DCC_ZERO_RMT_TICKS, HostDccHwDefs::RMT_DCC_FIRST_HALF,
+    HostDccHwDefs::DCC_ZERO_RMT_TICKS, HostDccHwDefs::RMT_DCC_SECOND_HALF
+  }}};
+  const uint8_t PACKET_BIT_MASK[] =
+  {
+    0x80, 0x40, 0x20, 0x10, //
+    0x08, 0x04, 0x02, 0x01  //
+  };
+  uint32_t pktLength;
+  uint32_t preableBitCount = OPS_PREAMBLE_BITS;
+  for (pktLength = 0; pktLength < preableBitCount; pktLength++)
+  {
+    items[pktLength].val = DCC_RMT_ONE_BIT.val;
+  }
+  items[pktLength++].val = DCC_RMT_ZERO_BIT.val;
+  for (uint8_t dlc = 0; dlc < packet.dlc; dlc++)
+  {
+    for(uint8_t bit = 0; bit < 8; bit++)
+    {
+      items[pktLength++].val =
+        packet.payload[dlc] & PACKET_BIT_MASK[bit] ?
+          DCC_RMT_ONE_BIT.val : DCC_RMT_ZERO_BIT.val;
+    }
+    items[pktLength++].val = DCC_RMT_ZERO_BIT.val;
+  }
+  items[pktLength - 1].val = DCC_RMT_ONE_BIT.val;
+  items[pktLength++].val = DCC_RMT_ONE_BIT.val;
+  items[pktLength++].val = 0;
+  return pktLength;
+}
+
+/// @return a set of packets covering all payload lengths and packet classes.
+std::vector<dcc::Packet> generate_packets()
+{
+  std::vector<dcc::Packet> packets;
+  std::mt19937 rng(0x5EED);
+  dcc::Packet pkt;
+  pkt.set_dcc_idle();
+  packets.push_back(pkt);
+  pkt.set_dcc_reset_all_decoders();
+  packets.push_back(pkt);
+  for (unsigned address = 1; address < 10000; address += 37)
+  {
+    if (address <= dcc::DccShortAddress::ADDRESS_MAX)
+    {
+      pkt.set_dcc_speed128(dcc::DccShortAddress(address), address & 1,
+                           rng() % 126);
+      packets.push_back(pkt);
+      pkt.start_dcc_packet();
+      pkt.add_dcc_address(dcc::DccShortAddress(address));
+      pkt.add_dcc_function0_4(rng() & 0x1F);
+      packets.push_back(pkt);
+    }
+    pkt.set_dcc_speed128(dcc::DccLongAddress(address), address & 1,
+                         rng() % 126);
+    packets.push_back(pkt);
+    pkt.start_dcc_packet();
+    pkt.add_dcc_address(dcc::DccLongAddress(address));
+    pkt.add_dcc_pom_write1(rng() % 1024, rng() & 0xFF);
+    // POM packets carry the feedback key of the flow waiting for the
+    // response, this must reach the RailCom driver unchanged.
+    pkt.feedback_key = 0x3FFB0000 + address;
+    packets.push_back(pkt);
+  }
+  // random payloads of every supported length.
+  for (unsigned count = 0; count < 256; count++)
+  {
+    pkt.start_dcc_packet();
+    unsigned dlc = 2 + (count % 4);
+    for (unsigned idx = 0; idx < dlc; idx++)
+    {
+      pkt.payload[pkt.dlc++] = rng() & 0xFF;
+    }
+    pkt.add_dcc_checksum();
+    packets.push_back(pkt);
+  }
+  return packets;
+}
+
+/// Verifies that the table driven encoder generates the same RMT items as the
+/// per-bit encoder and that the RailCom driver receives the feedback key of
+/// each packet.
+///
+/// @param device is the signal generator to test.
+/// @param railcom is the RailCom driver of @param device.
+/// @param packets is the set of packets to verify.
+///
+/// @return the number of mismatched packets.
+unsigned verify_encoders(HostTrackDevice &device, HostRailcomDriver &railcom,
+                         const std::vector<dcc::Packet> &packets)
+{
+  unsigned failures = 0;
+  rmt_item32_t expected[MAX_PACKET_ITEMS];
+  for (const dcc::Packet &pkt : packets)
+  {
+    uint32_t length = legacy_encode(pkt, expected);
+    if (!device.send(pkt))
+    {
+      fprintf(stderr, "send() rejected a packet with an empty ring\n");
+      return failures + 1;
+    }
+    // the first transmission completion selects the new packet, the second
+    // releases it back to the ring.
+    device.rmt_transmit_complete();
+    std::vector<rmt_item32_t> actual =
+      host_rmt_transmission(HostDccHwDefs::RMT_CHANNEL);
+    uint32_t feedbackKey = railcom.feedbackKey;
+    device.rmt_transmit_complete();
+    bool match = actual.size() == length;
+    for (size_t idx = 0; match && idx < length; idx++)
+    {
+      match = actual[idx].val == expected[idx].val;
+    }
+    if (!match)
+    {
+      fprintf(stderr, "encoder mismatch for %s (%zu vs %u items)\n",
+              dcc::packet_to_string(pkt).c_str(), actual.size(), length);
+      failures++;
+    }
+    uint32_t expectedKey = pkt.feedback_key ? pkt.feedback_key :
+                           dcc_packet_feedback_key(pkt);
+    if (feedbackKey != expectedKey)
+    {
+      fprintf(stderr, "feedback key mismatch for %s (%08x vs %08x)\n",
+              dcc::packet_to_string(pkt).c_str(), feedbackKey, expectedKey);
+      failures++;
+    }
+  }
+  return failures;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  HostRailcomDriver railcom;
+  HostTrackDevice device(&railcom);
+  device.hw_init();
+
+  std::vector<dcc::Packet> packets = generate_packets();
+  unsigned failures = verify_encoders(device, railcom, packets);
+  printf("encoder equivalence: %zu packets, %u mismatches\n", packets.size(),
+         failures);
+
+  // per-bit encoder, this cost used to be paid in the RMT ISR for every new
+  // packet.
+  rmt_item32_t items[MAX_PACKET_ITEMS];
+  uint32_t checksum = 0;
+  uint64_t start = host_nsec();
+  for (size_t idx = 0; idx < BENCH_PACKETS; idx++)
+  {
+    checksum += legacy_encode(packets[idx % packets.size()], items);
+    checksum += items[checksum % 16].val;
+  }
+  uint64_t legacyNsec = host_nsec() - start;
+
+  // table driven encoder, the ring is filled via send() from the task
+  // context and drained by the RMT ISR path.
+  uint32_t txStarts = host_rmt::channel(HostDccHwDefs::RMT_CHANNEL).tx_starts;
+  uint64_t sendNsec = 0;
+  uint64_t isrNsec = 0;
+  size_t sent = 0;
+  while (sent < BENCH_PACKETS)
+  {
+    start = host_nsec();
+    while (sent < BENCH_PACKETS &&
+           device.send(packets[sent % packets.size()]))
+    {
+      sent++;
+    }
+    uint64_t now = host_nsec();
+    sendNsec += now - start;
+    for (size_t idx = 0; idx <= HostDccHwDefs::PACKET_Q_SIZE; idx++)
+    {
+      device.rmt_transmit_complete();
+    }
+    isrNsec += host_nsec() - now;
+  }
+  uint64_t isrCalls =
+    host_rmt::channel(HostDccHwDefs::RMT_CHANNEL).tx_starts - txStarts;
+
+  printf("%-28s %12s\n", "encoder", "nsec/packet");
+  printf("%-28s %12.1f\n", "per-bit (RMT ISR)",
+         (double)legacyNsec / BENCH_PACKETS);
+  printf("%-28s %12.1f\n", "table (send)", (double)sendNsec / BENCH_PACKETS);
+  printf("%-28s %12.1f\n", "table (RMT ISR, per call)",
+         (double)isrNsec / (isrCalls ? isrCalls : 1));
+  printf("(checksum %" PRIu32 ")\n", checksum);
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,59 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the OpenMRN spinlock.
+
+#ifndef SPINLOCK_HXX_
+#define SPINLOCK_HXX_
+
+#include <atomic>
+
+namespace esp32cs
+{
+
+/// Busy-waiting lock.
+class Spinlock
+{
+public:
+  void lock()
+  {
+    while (flag_.test_and_set(std::memory_order_acquire))
+    {
+    }
+  }
+
+  void unlock()
+  {
+    flag_.clear(std::memory_order_release);
+  }
+
+private:
+  std::atomic_flag flag_ = ATOMIC_FLAG_INIT;
+};
+
+/// Scoped lock for a @ref Spinlock.
+class SpinlockHolder
+{
+public:
+  SpinlockHolder(Spinlock *lock) : lock_(lock)
+  {
+    lock_->lock();
+  }
+
+  ~SpinlockHolder()
+  {
+    lock_->unlock();
+  }
+
+private:
+  Spinlock *lock_;
+};
+
+} // namespace esp32cs
+
+#endif // SPINLOCK_HXX_
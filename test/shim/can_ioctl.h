@@ -0,0 +1,21 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the OpenMRN CAN ioctl definitions.
+
+#ifndef CAN_IOCTL_H_
+#define CAN_IOCTL_H_
+
+#define IOC_TYPE(cmd) (((cmd) >> 8) & 0xFF)
+#define IOC_SIZE(cmd) (((cmd) >> 16) & 0xFFFF)
+#define CAN_IOC_MAGIC ('c')
+#define NOTIFIABLE_TYPE 13
+#define CAN_IOC_WRITE_ACTIVE \
+  ((NOTIFIABLE_TYPE << 16) | (CAN_IOC_MAGIC << 8) | 2)
+
+#endif // CAN_IOCTL_H_
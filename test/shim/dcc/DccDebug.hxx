@@ -0,0 +1,40 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the OpenMRN DCC packet debug helpers.
+
+#ifndef DCC_DCCDEBUG_HXX_
+#define DCC_DCCDEBUG_HXX_
+
+#include <dcc/Packet.hxx>
+#include <stdio.h>
+#include <string>
+
+namespace dcc
+{
+
+/// @return a printable representation of the packet payload.
+///
+/// @param pkt is the packet to print.
+/// @param bin_payload is ignored, the payload is always printed in hex.
+static inline std::string packet_to_string(const DCCPacket &pkt,
+                                           bool bin_payload = false)
+{
+  std::string result = "[dcc]";
+  char buf[8];
+  for (unsigned idx = 0; idx < pkt.dlc; idx++)
+  {
+    snprintf(buf, sizeof(buf), " %02x", pkt.payload[idx]);
+    result += buf;
+  }
+  return result;
+}
+
+} // namespace dcc
+
+#endif // DCC_DCCDEBUG_HXX_
@@ -0,0 +1,41 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the OpenMRN DCC definitions.
+
+#ifndef DCC_DEFS_HXX_
+#define DCC_DEFS_HXX_
+
+namespace dcc
+{
+
+/// Address types of the trains on the track.
+enum class TrainAddressType
+{
+  /// DCC address with an unspecified type.
+  DCC_DEFAULT = 1,
+
+  /// 7-bit DCC address.
+  DCC_SHORT_ADDRESS,
+
+  /// 14-bit DCC address.
+  DCC_LONG_ADDRESS,
+
+  /// Marklin-Motorola address.
+  MM,
+
+  /// Unsupported address type.
+  UNSUPPORTED = 255,
+
+  /// Address type was not specified.
+  UNSPECIFIED = 254,
+};
+
+} // namespace dcc
+
+#endif // DCC_DEFS_HXX_
@@ -0,0 +1,199 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the subset of the OpenMRN DCC packet API which is used by
+// the DCC signal generation code, the encoding matches OpenMRN.
+
+#ifndef DCC_PACKET_HXX_
+#define DCC_PACKET_HXX_
+
+#include <stdint.h>
+#include <string.h>
+
+namespace dcc
+{
+
+/// Maximum number of payload bytes in a DCC packet.
+static constexpr unsigned DCC_PACKET_MAX_PAYLOAD = 6;
+
+/// Raw DCC packet as passed to the track interface.
+struct DCCPacket
+{
+  struct
+  {
+    uint8_t is_pkt : 1;
+    uint8_t is_marklin : 1;
+    uint8_t skip_ec : 1;
+    uint8_t send_long_preamble : 1;
+    uint8_t sense_ack : 1;
+    uint8_t rept_count : 2;
+    uint8_t reserved : 1;
+  } packet_header;
+  uint8_t dlc;
+  uint8_t payload[DCC_PACKET_MAX_PAYLOAD];
+  uintptr_t feedback_key;
+};
+
+/// Short (7-bit) multi-function decoder address.
+struct DccShortAddress
+{
+  explicit DccShortAddress(uint8_t v) : value(v)
+  {
+  }
+  uint8_t value;
+  static constexpr uint8_t ADDRESS_MAX = 127;
+};
+
+/// Long (14-bit) multi-function decoder address.
+struct DccLongAddress
+{
+  explicit DccLongAddress(uint16_t v) : value(v)
+  {
+  }
+  uint16_t value;
+  static constexpr uint16_t ADDRESS_MAX = 10239;
+};
+
+/// DCC packet with helpers for building packets.
+struct Packet : public DCCPacket
+{
+  /// Speed value that generates an emergency stop instruction.
+  static constexpr unsigned EMERGENCY_STOP = 0xFFFF;
+
+  Packet()
+  {
+    clear();
+  }
+
+  /// @return an idle packet.
+  static Packet DCC_IDLE()
+  {
+    Packet p;
+    p.set_dcc_idle();
+    return p;
+  }
+
+  void clear()
+  {
+    memset(static_cast<DCCPacket *>(this), 0, sizeof(DCCPacket));
+  }
+
+  void start_dcc_packet()
+  {
+    clear();
+    packet_header.is_pkt = 0;
+  }
+
+  void set_dcc_idle()
+  {
+    start_dcc_packet();
+    payload[dlc++] = 0xFF;
+    payload[dlc++] = 0;
+    add_dcc_checksum();
+  }
+
+  void set_dcc_reset_all_decoders()
+  {
+    start_dcc_packet();
+    payload[dlc++] = 0;
+    payload[dlc++] = 0;
+    add_dcc_checksum();
+  }
+
+  void add_dcc_address(DccShortAddress address)
+  {
+    payload[dlc++] = address.value & 0x7F;
+  }
+
+  void add_dcc_address(DccLongAddress address)
+  {
+    payload[dlc++] = 0xC0 | ((address.value >> 8) & 0x3F);
+    payload[dlc++] = address.value & 0xFF;
+  }
+
+  template <class A>
+  void set_dcc_speed14(A address, bool is_fwd, bool light, unsigned speed)
+  {
+    start_dcc_packet();
+    add_dcc_address(address);
+    uint8_t value = 0x40 | (is_fwd ? 0x20 : 0) | (light ? 0x10 : 0);
+    if (speed == EMERGENCY_STOP)
+    {
+      value |= 1;
+    }
+    else if (speed)
+    {
+      value |= (speed + 1) & 0xF;
+    }
+    payload[dlc++] = value;
+    add_dcc_checksum();
+  }
+
+  template <class A>
+  void set_dcc_speed128(A address, bool is_fwd, unsigned speed)
+  {
+    start_dcc_packet();
+    add_dcc_address(address);
+    payload[dlc++] = 0x3F;
+    uint8_t value = is_fwd ? 0x80 : 0;
+    if (speed == EMERGENCY_STOP)
+    {
+      value |= 1;
+    }
+    else if (speed)
+    {
+      value |= (speed + 1) & 0x7F;
+    }
+    payload[dlc++] = value;
+    add_dcc_checksum();
+  }
+
+  void add_dcc_function0_4(unsigned values)
+  {
+    payload[dlc++] = 0x80 | ((values & 1) << 4) | ((values >> 1) & 0xF);
+    add_dcc_checksum();
+  }
+
+  void add_dcc_function5_8(unsigned values)
+  {
+    payload[dlc++] = 0xB0 | (values & 0xF);
+    add_dcc_checksum();
+  }
+
+  void add_dcc_pom_read1(unsigned cv_number)
+  {
+    add_dcc_prog_command(0xE4, cv_number, 0);
+  }
+
+  void add_dcc_pom_write1(unsigned cv_number, uint8_t value)
+  {
+    add_dcc_prog_command(0xEC, cv_number, value);
+  }
+
+  void add_dcc_prog_command(uint8_t cmd, unsigned cv_number, uint8_t value)
+  {
+    payload[dlc++] = cmd | ((cv_number >> 8) & 3);
+    payload[dlc++] = cv_number & 0xFF;
+    payload[dlc++] = value;
+    add_dcc_checksum();
+  }
+
+  void add_dcc_checksum()
+  {
+    uint8_t checksum = 0;
+    for (unsigned idx = 0; idx < dlc; idx++)
+    {
+      checksum ^= payload[idx];
+    }
+    payload[dlc++] = checksum;
+  }
+};
+
+} // namespace dcc
+
+#endif // DCC_PACKET_HXX_
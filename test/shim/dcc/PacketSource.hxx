@@ -0,0 +1,40 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the OpenMRN DCC packet source interface.
+
+#ifndef DCC_PACKETSOURCE_HXX_
+#define DCC_PACKETSOURCE_HXX_
+
+#include <dcc/Packet.hxx>
+
+namespace dcc
+{
+
+/// Generator of DCC packets for a locomotive or other device.
+class PacketSource
+{
+public:
+  virtual ~PacketSource()
+  {
+  }
+
+  /// Generates the next packet for the track.
+  ///
+  /// @param code is the @ref DccTrainUpdateCode of the update or zero for a
+  /// background refresh.
+  /// @param packet receives the generated packet.
+  virtual void get_next_packet(unsigned code, Packet *packet) = 0;
+};
+
+/// Packet source which is not a train.
+typedef PacketSource NonTrainPacketSource;
+
+} // namespace dcc
+
+#endif // DCC_PACKETSOURCE_HXX_
@@ -0,0 +1,117 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the OpenMRN RailCom definitions, the 4-of-8 code table
+// follows RCN-217.
+
+#ifndef DCC_RAILCOM_HXX_
+#define DCC_RAILCOM_HXX_
+
+#include <array>
+#include <stdint.h>
+
+namespace dcc
+{
+
+/// RailCom special symbols and codes.
+struct RailcomDefs
+{
+  /// Decoded values of the symbols which do not carry data.
+  enum
+  {
+    INV = 0xff,
+    ACK = 0xfe,
+    NACK = 0xfd,
+    BUSY = 0xfc,
+  };
+
+  /// Codes of the symbols which do not carry data.
+  enum
+  {
+    CODE_ACK = 0xf0,
+    CODE_ACK2 = 0x0f,
+    CODE_NACK = 0x3c,
+    CODE_BUSY = 0xe1,
+  };
+};
+
+/// 4-of-8 code of each 6-bit data value.
+inline constexpr uint8_t railcom_encode[64] =
+{
+  0xac, 0xaa, 0xa9, 0xa5, 0xa3, 0xa6, 0x9c, 0x9a,
+  0x99, 0x95, 0x93, 0x96, 0x8e, 0x8d, 0x8b, 0xb1,
+  0xb2, 0xb4, 0xb8, 0x74, 0x72, 0x6c, 0x6a, 0x69,
+  0x65, 0x63, 0x66, 0x5c, 0x5a, 0x59, 0x55, 0x53,
+  0x56, 0x4e, 0x4d, 0x4b, 0x47, 0x71, 0xe8, 0xe4,
+  0xe2, 0xd1, 0xc9, 0xc5, 0xd8, 0xd4, 0xd2, 0xca,
+  0xc6, 0xcc, 0x78, 0x17, 0x1b, 0x1d, 0x1e, 0x2e,
+  0x36, 0x3a, 0x27, 0x2b, 0x2d, 0x35, 0x39, 0x33,
+};
+
+/// @return the decode table, the inverse of @ref railcom_encode.
+inline std::array<uint8_t, 256> railcom_decode_table()
+{
+  std::array<uint8_t, 256> table;
+  table.fill(RailcomDefs::INV);
+  for (uint8_t value = 0; value < 64; value++)
+  {
+    table[railcom_encode[value]] = value;
+  }
+  table[RailcomDefs::CODE_ACK] = RailcomDefs::ACK;
+  table[RailcomDefs::CODE_ACK2] = RailcomDefs::ACK;
+  table[RailcomDefs::CODE_NACK] = RailcomDefs::NACK;
+  table[RailcomDefs::CODE_BUSY] = RailcomDefs::BUSY;
+  return table;
+}
+
+/// Decoded value of each received byte.
+inline const std::array<uint8_t, 256> railcom_decode = railcom_decode_table();
+
+/// RailCom data received in a single cut-out.
+struct Feedback
+{
+  /// Clears the data and sets the feedback key.
+  ///
+  /// @param key is the feedback key of the packet preceding the cut-out.
+  void reset(uintptr_t key)
+  {
+    ch1Size = 0;
+    ch2Size = 0;
+    channel = 0;
+    feedbackKey = key;
+  }
+
+  /// Adds a byte received in the channel 1 window.
+  void add_ch1_data(uint8_t data)
+  {
+    if (ch1Size < sizeof(ch1Data))
+    {
+      ch1Data[ch1Size++] = data;
+    }
+  }
+
+  /// Adds a byte received in the channel 2 window.
+  void add_ch2_data(uint8_t data)
+  {
+    if (ch2Size < sizeof(ch2Data))
+    {
+      ch2Data[ch2Size++] = data;
+    }
+  }
+
+  uint8_t ch1Size{0};
+  uint8_t ch1Data[2];
+  uint8_t ch2Size{0};
+  uint8_t ch2Data[6];
+  uint8_t channel{0};
+  uintptr_t feedbackKey{0};
+};
+
+} // namespace dcc
+
+#endif // DCC_RAILCOM_HXX_
@@ -0,0 +1,76 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the OpenMRN RailCom hub, each feedback is delivered
+// synchronously to all registered ports.
+
+#ifndef DCC_RAILCOMHUB_HXX_
+#define DCC_RAILCOMHUB_HXX_
+
+#include <algorithm>
+#include <dcc/RailCom.hxx>
+#include <executor/StateFlow.hxx>
+#include <vector>
+
+namespace dcc
+{
+
+/// Message carried by the RailCom hub.
+typedef Feedback RailcomHubData;
+
+/// Listener of the RailCom hub.
+typedef FlowInterface<Buffer<RailcomHubData>> RailcomHubPortInterface;
+
+/// Distributes the RailCom feedback to the registered ports.
+class RailcomHubFlow : public FlowInterface<Buffer<RailcomHubData>>
+{
+public:
+  RailcomHubFlow(Service *service)
+  {
+  }
+
+  /// Adds a listener.
+  void register_port(RailcomHubPortInterface *port)
+  {
+    ports_.push_back(port);
+  }
+
+  /// Removes a listener.
+  void unregister_port(RailcomHubPortInterface *port)
+  {
+    ports_.erase(std::find(ports_.begin(), ports_.end(), port));
+  }
+
+  /// @return a new feedback buffer.
+  Buffer<RailcomHubData> *alloc()
+  {
+    Buffer<RailcomHubData> *buffer;
+    FlowInterface<Buffer<RailcomHubData>>::alloc(&buffer);
+    return buffer;
+  }
+
+  /// Delivers the feedback to all listeners.
+  void send(Buffer<RailcomHubData> *message,
+            unsigned priority = UINT_MAX) override
+  {
+    for (RailcomHubPortInterface *port : ports_)
+    {
+      message->ref();
+      port->send(message, priority);
+    }
+    message->unref();
+  }
+
+private:
+  /// Registered listeners.
+  std::vector<RailcomHubPortInterface *> ports_;
+};
+
+} // namespace dcc
+
+#endif // DCC_RAILCOMHUB_HXX_
@@ -0,0 +1,25 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the OpenMRN DCC track interface.
+
+#ifndef DCC_TRACKIF_HXX_
+#define DCC_TRACKIF_HXX_
+
+#include <dcc/Packet.hxx>
+#include <executor/StateFlow.hxx>
+
+namespace dcc
+{
+
+/// Interface which receives the DCC packets to send to the track.
+typedef FlowInterface<Buffer<dcc::Packet>> TrackIf;
+
+} // namespace dcc
+
+#endif // DCC_TRACKIF_HXX_
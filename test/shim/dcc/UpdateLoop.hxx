@@ -0,0 +1,67 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the OpenMRN DCC update loop interface.
+
+#ifndef DCC_UPDATELOOP_HXX_
+#define DCC_UPDATELOOP_HXX_
+
+namespace dcc
+{
+
+class PacketSource;
+
+/// Update codes passed to UpdateLoopBase::notify_update.
+enum DccTrainUpdateCode
+{
+  REFRESH = 0,
+  SPEED = 1,
+  FUNCTION0 = 2,
+  FUNCTION5 = 3,
+  FUNCTION9 = 4,
+  FUNCTION13 = 5,
+  FUNCTION21 = 6,
+  MIN_REFRESH = SPEED,
+  MAX_REFRESH = FUNCTION9,
+  ESTOP = 16,
+};
+
+/// Interface of the packet scheduler.
+class UpdateLoopBase
+{
+public:
+  virtual ~UpdateLoopBase()
+  {
+  }
+
+  /// Notifies the update loop that a packet source has an update to send.
+  virtual void notify_update(PacketSource *source, unsigned code) = 0;
+
+  /// Registers a packet source for background refresh.
+  virtual bool add_refresh_source(PacketSource *source,
+                                  unsigned priority = DEFAULT_PRIORITY) = 0;
+
+  /// Removes a packet source from background refresh.
+  virtual void remove_refresh_source(PacketSource *source) = 0;
+
+  enum
+  {
+    /// Priority of normal trains.
+    DEFAULT_PRIORITY = 0x800000,
+    /// Packet sources above this priority suppress all other sources.
+    EXCLUSIVE_MIN_PRIORITY = 0x1000000,
+    /// Priority of the programming track.
+    PROGRAMMING_PRIORITY = 0x2000000,
+    /// Priority of the e-stop packet source.
+    ESTOP_PRIORITY = 0x4000000,
+  };
+};
+
+} // namespace dcc
+
+#endif // DCC_UPDATELOOP_HXX_
@@ -0,0 +1,179 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the ESP-IDF v4.4 RMT driver.
+//
+// The RMT memory of each channel is modelled as a plain array of items,
+// rmt_fill_tx_items writes into it and rmt_tx_start counts the number of
+// transmissions and invokes the optional per-channel hook. The host tests read
+// the items back from @ref host_rmt to reconstruct the generated signal.
+
+#ifndef DRIVER_RMT_H_
+#define DRIVER_RMT_H_
+
+#include <esp_err.h>
+#include <esp_heap_caps.h>
+#include <esp_intr_alloc.h>
+#include <functional>
+#include <soc/soc_caps.h>
+#include <stdint.h>
+#include <string.h>
+
+#define RMT_MEM_ITEM_NUM SOC_RMT_MEM_WORDS_PER_CHANNEL
+
+typedef enum
+{
+  RMT_CHANNEL_0,
+  RMT_CHANNEL_1,
+  RMT_CHANNEL_2,
+  RMT_CHANNEL_3,
+  RMT_CHANNEL_4,
+  RMT_CHANNEL_5,
+  RMT_CHANNEL_6,
+  RMT_CHANNEL_7,
+  RMT_CHANNEL_MAX
+} rmt_channel_t;
+
+typedef enum
+{
+  RMT_BASECLK_REF = 0,
+  RMT_BASECLK_APB = 1,
+  RMT_BASECLK_MAX
+} rmt_source_clk_t;
+
+typedef enum
+{
+  RMT_MODE_TX = 0,
+  RMT_MODE_RX,
+  RMT_MODE_MAX
+} rmt_mode_t;
+
+typedef struct
+{
+  union
+  {
+    struct
+    {
+      uint32_t duration0 : 15;
+      uint32_t level0 : 1;
+      uint32_t duration1 : 15;
+      uint32_t level1 : 1;
+    };
+    uint32_t val;
+  };
+} rmt_item32_t;
+
+typedef struct
+{
+  rmt_mode_t rmt_mode;
+  rmt_channel_t channel;
+  int gpio_num;
+  uint8_t clk_div;
+  uint8_t mem_block_num;
+  uint32_t flags;
+} rmt_config_t;
+
+namespace host_rmt
+{
+
+/// Simulated state of a single RMT channel.
+struct Channel
+{
+  /// RMT memory of the channel, sized for all memory blocks.
+  rmt_item32_t mem[RMT_MEM_ITEM_NUM * SOC_RMT_CHANNELS_PER_GROUP];
+
+  /// Number of memory blocks configured via rmt_config.
+  uint8_t mem_blocks;
+
+  /// Number of calls to rmt_tx_start.
+  uint32_t tx_starts;
+
+  /// True while the driver is installed.
+  bool installed;
+
+  /// Called from rmt_tx_start after the transmission count is updated, the
+  /// RMT memory holds the items of the transmission being started.
+  std::function<void()> on_tx_start;
+};
+
+/// @return the simulated state of an RMT channel.
+///
+/// @param channel is the RMT channel.
+static inline Channel &channel(rmt_channel_t channel)
+{
+  static Channel channels[RMT_CHANNEL_MAX];
+  return channels[channel];
+}
+
+} // namespace host_rmt
+
+static inline esp_err_t rmt_config(const rmt_config_t *config)
+{
+  host_rmt::channel(config->channel).mem_blocks = config->mem_block_num;
+  return ESP_OK;
+}
+
+static inline esp_err_t rmt_driver_install(rmt_channel_t channel,
+                                           size_t rx_buf_size, int flags)
+{
+  host_rmt::channel(channel).installed = true;
+  return ESP_OK;
+}
+
+static inline esp_err_t rmt_driver_uninstall(rmt_channel_t channel)
+{
+  host_rmt::channel(channel).installed = false;
+  return ESP_OK;
+}
+
+static inline esp_err_t rmt_set_source_clk(rmt_channel_t channel,
+                                           rmt_source_clk_t base_clk)
+{
+  return ESP_OK;
+}
+
+static inline esp_err_t rmt_set_tx_thr_intr_en(rmt_channel_t channel,
+                                               bool en, uint16_t evt_thresh)
+{
+  return ESP_OK;
+}
+
+static inline esp_err_t rmt_fill_tx_items(rmt_channel_t channel,
+                                          const rmt_item32_t *item,
+                                          uint16_t item_num,
+                                          uint16_t mem_offset)
+{
+  host_rmt::Channel &ch = host_rmt::channel(channel);
+  if (mem_offset + item_num > RMT_MEM_ITEM_NUM * ch.mem_blocks)
+  {
+    return ESP_FAIL;
+  }
+  memcpy(ch.mem + mem_offset, item, item_num * sizeof(rmt_item32_t));
+  return ESP_OK;
+}
+
+static inline esp_err_t rmt_tx_start(rmt_channel_t channel, bool tx_idx_rst)
+{
+  host_rmt::Channel &ch = host_rmt::channel(channel);
+  ch.tx_starts++;
+  if (ch.on_tx_start)
+  {
+    ch.on_tx_start();
+  }
+  return ESP_OK;
+}
+
+static inline esp_err_t rmt_write_items(rmt_channel_t channel,
+                                        const rmt_item32_t *rmt_item,
+                                        int item_num, bool wait_tx_done)
+{
+  ESP_ERROR_CHECK(rmt_fill_tx_items(channel, rmt_item, item_num, 0));
+  return rmt_tx_start(channel, true);
+}
+
+#endif // DRIVER_RMT_H_
@@ -0,0 +1,34 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the ESP-IDF error codes.
+
+#ifndef ESP_ERR_H_
+#define ESP_ERR_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+#define ESP_ERROR_CHECK(x)                                        \
+  do                                                              \
+  {                                                               \
+    esp_err_t err_rc_ = (x);                                      \
+    if (err_rc_ != ESP_OK)                                        \
+    {                                                             \
+      fprintf(stderr, "%s:%d: %s failed: %d\n", __FILE__,        \
+              __LINE__, #x, err_rc_);                             \
+      abort();                                                    \
+    }                                                             \
+  } while (0)
+
+#endif // ESP_ERR_H_
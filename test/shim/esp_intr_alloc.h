@@ -0,0 +1,17 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the ESP-IDF interrupt allocator.
+
+#ifndef ESP_INTR_ALLOC_H_
+#define ESP_INTR_ALLOC_H_
+
+#define ESP_INTR_FLAG_LOWMED 0x0E
+#define ESP_INTR_FLAG_SHARED (1 << 8)
+
+#endif // ESP_INTR_ALLOC_H_
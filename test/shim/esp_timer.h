@@ -0,0 +1,43 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the ESP-IDF high resolution timer.
+
+#ifndef ESP_TIMER_H_
+#define ESP_TIMER_H_
+
+#include <chrono>
+#include <sdkconfig.h>
+#include <stdint.h>
+
+namespace host_esp_timer
+{
+
+/// Simulated time in microseconds, the host clock is used when this is
+/// negative.
+inline int64_t simulated_usec = -1;
+
+} // namespace host_esp_timer
+
+/// @return the simulated time or the number of microseconds since the first
+/// call.
+///
+/// NOTE: this is a weak definition rather than an inline function so that
+/// PrioritizedUpdateLoop can alias its clock to it as it does on the ESP32.
+extern "C" __attribute__((weak)) int64_t esp_timer_get_time()
+{
+  if (host_esp_timer::simulated_usec >= 0)
+  {
+    return host_esp_timer::simulated_usec;
+  }
+  static const auto start = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - start).count();
+}
+
+#endif // ESP_TIMER_H_
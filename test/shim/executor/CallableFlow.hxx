@@ -0,0 +1,105 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the OpenMRN callable flows.
+//
+// Requests are queued and processed one at a time, the caller must keep a
+// reference to the request buffer and poll resultCode for completion since
+// there is no executor to block on.
+
+#ifndef EXECUTOR_CALLABLEFLOW_HXX_
+#define EXECUTOR_CALLABLEFLOW_HXX_
+
+#include <deque>
+#include <executor/StateFlow.hxx>
+
+/// Base of the requests sent to a @ref CallableFlow.
+struct CallableFlowRequestBase
+{
+  /// Value of @ref resultCode until the request has completed.
+  static constexpr int OPERATION_PENDING = 0x20000;
+
+  /// Prepares the request for sending.
+  void reset_base()
+  {
+    resultCode = OPERATION_PENDING;
+  }
+
+  /// Result of the request, zero on success.
+  int resultCode{OPERATION_PENDING};
+};
+
+/// Flow which processes requests of type RequestType one at a time.
+template <class RequestType>
+class CallableFlow : public StateFlowBase,
+                     public FlowInterface<Buffer<RequestType>>
+{
+public:
+  CallableFlow(Service *service)
+  {
+  }
+
+  /// Queues a request, it is started immediately when the flow is idle.
+  void send(Buffer<RequestType> *message,
+            unsigned priority = UINT_MAX) override
+  {
+    queue_.push_back(message);
+    if (!current_)
+    {
+      run(STATE(next_request));
+    }
+  }
+
+  /// Entry point of the flow for each request.
+  virtual Action entry() = 0;
+
+protected:
+  /// @return the request being processed.
+  RequestType *request()
+  {
+    return current_->data();
+  }
+
+  /// Completes the request successfully.
+  Action return_ok()
+  {
+    return return_with_error(0);
+  }
+
+  /// Completes the request.
+  ///
+  /// @param error is the result of the request.
+  Action return_with_error(int error)
+  {
+    request()->resultCode = error;
+    current_->unref();
+    current_ = nullptr;
+    return call_immediately(STATE(next_request));
+  }
+
+private:
+  /// Starts the next queued request.
+  Action next_request()
+  {
+    if (queue_.empty())
+    {
+      return exit();
+    }
+    current_ = queue_.front();
+    queue_.pop_front();
+    return call_immediately(STATE(entry));
+  }
+
+  /// Requests waiting to be processed.
+  std::deque<Buffer<RequestType> *> queue_;
+
+  /// Request being processed.
+  Buffer<RequestType> *current_{nullptr};
+};
+
+#endif // EXECUTOR_CALLABLEFLOW_HXX_
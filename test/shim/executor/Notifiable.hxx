@@ -0,0 +1,32 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the OpenMRN Notifiable interface.
+
+#ifndef EXECUTOR_NOTIFIABLE_HXX_
+#define EXECUTOR_NOTIFIABLE_HXX_
+
+/// An object that can be notified of an event.
+class Notifiable
+{
+public:
+  virtual ~Notifiable()
+  {
+  }
+
+  /// Generic callback.
+  virtual void notify() = 0;
+
+  /// Callback from an interrupt context.
+  virtual void notify_from_isr()
+  {
+    notify();
+  }
+};
+
+#endif // EXECUTOR_NOTIFIABLE_HXX_
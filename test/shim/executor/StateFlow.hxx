@@ -0,0 +1,441 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the OpenMRN state flows and buffers.
+//
+// There is no executor, a StateFlow runs its entry() synchronously for each
+// message sent to it and the flow must exit from entry(). Flows which wait on
+// a StateFlowTimer are resumed by host_run_timers() once the simulated time
+// (see esp_timer_get_time) reaches the timer deadline. Buffers are heap
+// allocated and released by their last unref().
+
+#ifndef EXECUTOR_STATEFLOW_HXX_
+#define EXECUTOR_STATEFLOW_HXX_
+
+#include <algorithm>
+#include <climits>
+#include <deque>
+#include <executor/Notifiable.hxx>
+#include <memory>
+#include <os/os.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+#include <utils/macros.h>
+#include <vector>
+
+/// Owner of the flows, unused on the host.
+class Service
+{
+};
+
+/// Entry in a @ref QList.
+class QMember
+{
+public:
+  virtual ~QMember()
+  {
+  }
+};
+
+/// Reference counted buffer.
+class BufferBase : public QMember
+{
+public:
+  /// Releases a reference to the buffer, the buffer is freed when the last
+  /// reference is released.
+  void unref()
+  {
+    HASSERT(count_ > 0);
+    if (--count_ == 0)
+    {
+      delete this;
+    }
+  }
+
+  /// Adds a reference to the buffer.
+  void ref()
+  {
+    count_++;
+  }
+
+private:
+  /// Number of references to the buffer.
+  unsigned count_{1};
+};
+
+/// Buffer holding a message of type T.
+template <class T> class Buffer : public BufferBase
+{
+public:
+  /// @return the message stored in the buffer.
+  T *data()
+  {
+    return &data_;
+  }
+
+private:
+  T data_;
+};
+
+/// Deleter which releases a reference to a buffer.
+template <class T> struct BufferDelete
+{
+  void operator()(Buffer<T> *buffer)
+  {
+    buffer->unref();
+  }
+};
+
+/// Releases the reference to a buffer when it goes out of scope.
+template <class T>
+using AutoReleaseBuffer = std::unique_ptr<Buffer<T>, BufferDelete<T>>;
+
+/// Allocator for buffers.
+class Pool
+{
+public:
+  virtual ~Pool()
+  {
+  }
+
+  /// Allocates a new buffer.
+  ///
+  /// @param result receives the buffer.
+  /// @param flow is unused, allocation never blocks on the host.
+  template <class BufferType>
+  void alloc(BufferType **result, Notifiable *flow = nullptr)
+  {
+    *result = new BufferType();
+  }
+};
+
+/// Default buffer pool.
+inline Pool *mainBufferPool = new Pool();
+
+/// Queue of @ref QMember with a fixed number of priority bands.
+///
+/// @param ITEMS is the number of priority bands.
+template <unsigned ITEMS> class QList
+{
+public:
+  /// Result of @ref next.
+  struct Result
+  {
+    /// Item removed from the queue or nullptr.
+    QMember *item;
+
+    /// Priority band the item was removed from.
+    unsigned index;
+  };
+
+  /// Adds an item to the queue.
+  ///
+  /// @param item is the item to add.
+  /// @param index is the priority band, lower values are returned first.
+  void insert(QMember *item, unsigned index = 0)
+  {
+    queues_[index >= ITEMS ? ITEMS - 1 : index].push_back(item);
+  }
+
+  /// @return the first item in the highest priority band, or nullptr.
+  Result next()
+  {
+    for (unsigned index = 0; index < ITEMS; index++)
+    {
+      if (!queues_[index].empty())
+      {
+        QMember *item = queues_[index].front();
+        queues_[index].pop_front();
+        return {item, index};
+      }
+    }
+    return {nullptr, 0};
+  }
+
+  /// @return the number of items in the queue.
+  size_t pending()
+  {
+    size_t count = 0;
+    for (unsigned index = 0; index < ITEMS; index++)
+    {
+      count += queues_[index].size();
+    }
+    return count;
+  }
+
+  /// @return true if the queue has no items.
+  bool empty()
+  {
+    return pending() == 0;
+  }
+
+private:
+  std::deque<QMember *> queues_[ITEMS];
+};
+
+/// Interface of a flow which receives messages.
+template <class MessageType> class FlowInterface
+{
+public:
+  /// Type of the messages received by the flow.
+  typedef MessageType message_type;
+
+  virtual ~FlowInterface()
+  {
+  }
+
+  /// Sends a message to the flow, ownership is transferred to the flow.
+  ///
+  /// @param message is the message to send.
+  /// @param priority is the priority of the message.
+  virtual void send(MessageType *message, unsigned priority = UINT_MAX) = 0;
+
+  /// @return the pool to allocate messages for this flow from.
+  virtual Pool *pool()
+  {
+    return mainBufferPool;
+  }
+
+  /// Allocates a message for this flow.
+  ///
+  /// @param result receives the message.
+  void alloc(MessageType **result)
+  {
+    pool()->alloc(result);
+  }
+};
+
+class StateFlowTimer;
+
+/// Base of all state flows.
+class StateFlowBase
+{
+public:
+  class Action;
+
+  /// State of a flow.
+  typedef Action (StateFlowBase::*Callback)();
+
+  /// Result of a state of the flow.
+  class Action
+  {
+  public:
+    /// Constructor.
+    ///
+    /// @param next is the state to run next, nullptr when the flow is
+    /// waiting or has exited.
+    Action(Callback next = nullptr) : next_(next)
+    {
+    }
+
+    /// @return the state to run next.
+    Callback next() const
+    {
+      return next_;
+    }
+
+  private:
+    /// State to run next.
+    Callback next_;
+  };
+
+  virtual ~StateFlowBase()
+  {
+  }
+
+  /// Runs states of the flow until one of them waits or exits.
+  ///
+  /// @param state is the first state to run.
+  void run(Callback state)
+  {
+    while (state)
+    {
+      state = (this->*state)().next();
+    }
+  }
+
+protected:
+  /// Terminates the processing of the current message.
+  Action exit()
+  {
+    return Action();
+  }
+
+  /// Continues with another state.
+  ///
+  /// @param state is the state to run.
+  Action call_immediately(Callback state)
+  {
+    return Action(state);
+  }
+
+  /// Waits for a timer to expire (or be triggered).
+  ///
+  /// @param timer is the timer to start.
+  /// @param nsec is the timeout in nanoseconds.
+  /// @param state is the state to run when the timer expires.
+  inline Action sleep_and_call(StateFlowTimer *timer, long long nsec,
+                               Callback state);
+};
+
+/// Converts a member function of a flow to a @ref StateFlowBase::Callback.
+#define STATE(_fn)                                                   \
+  (StateFlowBase::Callback)(                                         \
+    &std::remove_reference<decltype(*this)>::type::_fn)
+
+/// Timer which resumes a flow, see host_run_timers.
+class StateFlowTimer
+{
+public:
+  /// Constructor.
+  ///
+  /// @param parent is the flow to resume.
+  StateFlowTimer(StateFlowBase *parent) : parent_(parent)
+  {
+    timers().push_back(this);
+  }
+
+  ~StateFlowTimer()
+  {
+    timers().erase(std::find(timers().begin(), timers().end(), this));
+  }
+
+  /// Starts the timer.
+  ///
+  /// @param nsec is the timeout in nanoseconds.
+  /// @param state is the state of the parent flow to run on expiry.
+  void start(long long nsec, StateFlowBase::Callback state)
+  {
+    deadline_ = os_get_time_monotonic() + nsec;
+    state_ = state;
+  }
+
+  /// Expires the timer at the next call to host_run_timers.
+  void trigger()
+  {
+    if (state_)
+    {
+      deadline_ = 0;
+    }
+  }
+
+  /// Resumes the parent flow if the timer has expired.
+  ///
+  /// @return true if the timer expired.
+  bool run_if_expired()
+  {
+    if (!state_ || deadline_ > os_get_time_monotonic())
+    {
+      return false;
+    }
+    StateFlowBase::Callback state = state_;
+    state_ = nullptr;
+    parent_->run(state);
+    return true;
+  }
+
+  /// @return all timers.
+  static std::vector<StateFlowTimer *> &timers()
+  {
+    static std::vector<StateFlowTimer *> timers;
+    return timers;
+  }
+
+private:
+  /// Flow to resume.
+  StateFlowBase *parent_;
+
+  /// State to resume the flow with, nullptr when the timer is not running.
+  StateFlowBase::Callback state_{nullptr};
+
+  /// Monotonic time at which the timer expires.
+  long long deadline_{0};
+};
+
+StateFlowBase::Action StateFlowBase::sleep_and_call(StateFlowTimer *timer,
+                                                    long long nsec,
+                                                    Callback state)
+{
+  timer->start(nsec, state);
+  return Action();
+}
+
+/// Resumes the flows of all expired timers, a resumed flow may start its
+/// timer again.
+inline void host_run_timers()
+{
+  bool expired = true;
+  while (expired)
+  {
+    expired = false;
+    for (size_t idx = 0; idx < StateFlowTimer::timers().size(); idx++)
+    {
+      expired |= StateFlowTimer::timers()[idx]->run_if_expired();
+    }
+  }
+}
+
+/// State flow which processes messages of type MessageType one at a time.
+template <class MessageType, class QueueType>
+class StateFlow : public StateFlowBase, public FlowInterface<MessageType>
+{
+public:
+  StateFlow(Service *service)
+  {
+  }
+
+  /// Processes the message synchronously, the message is released after
+  /// @ref entry unless it was transferred.
+  void send(MessageType *message, unsigned priority = UINT_MAX) override
+  {
+    HASSERT(!current_);
+    current_ = message;
+    run(entry().next());
+    if (current_)
+    {
+      current_->unref();
+      current_ = nullptr;
+    }
+  }
+
+  /// Entry point of the flow for each message.
+  virtual Action entry() = 0;
+
+protected:
+  /// @return the message being processed.
+  MessageType *message()
+  {
+    return current_;
+  }
+
+  /// @return the message being processed, the flow no longer owns it.
+  MessageType *transfer_message()
+  {
+    MessageType *message = current_;
+    current_ = nullptr;
+    return message;
+  }
+
+  /// Releases the current message and terminates processing.
+  Action release_and_exit()
+  {
+    if (current_)
+    {
+      current_->unref();
+      current_ = nullptr;
+    }
+    return exit();
+  }
+
+private:
+  /// Message being processed.
+  MessageType *current_{nullptr};
+};
+
+#endif // EXECUTOR_STATEFLOW_HXX_
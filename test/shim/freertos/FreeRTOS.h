@@ -0,0 +1,23 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the FreeRTOS kernel header, the host tests use threads
+// from the C++ standard library instead of FreeRTOS tasks.
+
+#ifndef FREERTOS_H_
+#define FREERTOS_H_
+
+#include <esp_heap_caps.h>
+#include <stdint.h>
+
+typedef int BaseType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+
+#endif // FREERTOS_H_
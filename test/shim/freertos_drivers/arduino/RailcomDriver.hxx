@@ -0,0 +1,43 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the OpenMRN RailCom driver interface.
+
+#ifndef FREERTOS_DRIVERS_ARDUINO_RAILCOMDRIVER_HXX_
+#define FREERTOS_DRIVERS_ARDUINO_RAILCOMDRIVER_HXX_
+
+#include <stdint.h>
+
+/// Abstract base class for RailCom drivers.
+class RailcomDriver
+{
+public:
+  virtual ~RailcomDriver()
+  {
+  }
+
+  /// Instructs the driver to take a feedback sample.
+  virtual void feedback_sample() = 0;
+
+  /// Instructs the driver to start the RailCom cut-out.
+  virtual void start_cutout() = 0;
+
+  /// Called between the channel 1 and channel 2 windows.
+  virtual void middle_cutout() = 0;
+
+  /// Instructs the driver to end the RailCom cut-out.
+  virtual void end_cutout() = 0;
+
+  /// Called instead of start/middle/end when no cut-out is generated.
+  virtual void no_cutout() = 0;
+
+  /// Specifies the feedback key for the next cut-out.
+  virtual void set_feedback_key(uint32_t key) = 0;
+};
+
+#endif // FREERTOS_DRIVERS_ARDUINO_RAILCOMDRIVER_HXX_
@@ -0,0 +1,29 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the OpenLCB error codes.
+
+#ifndef OPENLCB_DEFS_HXX_
+#define OPENLCB_DEFS_HXX_
+
+namespace openlcb
+{
+
+struct Defs
+{
+  /// Error codes of the OpenLCB requests.
+  enum ErrorCodes
+  {
+    /// Invalid arguments.
+    ERROR_INVALID_ARGS = 0x1080,
+  };
+};
+
+} // namespace openlcb
+
+#endif // OPENLCB_DEFS_HXX_
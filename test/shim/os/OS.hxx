@@ -0,0 +1,64 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the OpenMRN OS abstraction, backed by the C++ standard
+// library.
+
+#ifndef OS_OS_HXX_
+#define OS_OS_HXX_
+
+// the OpenMRN header pulls in most of the C and C++ runtime headers, the DCC
+// code relies on these being available.
+#include <algorithm>
+#include <errno.h>
+#include <mutex>
+#include <stdarg.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/// Mutual exclusion lock.
+class OSMutex
+{
+public:
+  OSMutex(bool recursive = false)
+  {
+  }
+
+  void lock()
+  {
+    mutex_.lock();
+  }
+
+  void unlock()
+  {
+    mutex_.unlock();
+  }
+
+private:
+  std::recursive_mutex mutex_;
+};
+
+/// Scoped lock for an @ref OSMutex.
+class OSMutexLock
+{
+public:
+  OSMutexLock(OSMutex *mutex) : mutex_(mutex)
+  {
+    mutex_->lock();
+  }
+
+  ~OSMutexLock()
+  {
+    mutex_->unlock();
+  }
+
+private:
+  OSMutex *mutex_;
+};
+
+#endif // OS_OS_HXX_
@@ -0,0 +1,31 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the OpenMRN OS time functions and conversion macros.
+
+#ifndef OS_OS_H_
+#define OS_OS_H_
+
+#include <esp_timer.h>
+
+#define SEC_TO_NSEC(_sec) (((long long)_sec) * 1000000000LL)
+#define SEC_TO_USEC(_sec) (((long long)_sec) * 1000000LL)
+#define SEC_TO_MSEC(_sec) (((long long)_sec) * 1000LL)
+#define MSEC_TO_NSEC(_msec) (((long long)_msec) * 1000000LL)
+#define MSEC_TO_USEC(_msec) (((long long)_msec) * 1000LL)
+#define USEC_TO_NSEC(_usec) (((long long)_usec) * 1000LL)
+#define NSEC_TO_MSEC(_nsec) (((long long)_nsec) / 1000000LL)
+
+/// @return the monotonic time in nanoseconds, this follows the simulated
+/// time of esp_timer_get_time.
+static inline long long os_get_time_monotonic()
+{
+  return USEC_TO_NSEC(esp_timer_get_time());
+}
+
+#endif // OS_OS_H_
@@ -0,0 +1,26 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host build configuration, this mirrors the Kconfig defaults for an OPS
+// track with RailCom enabled.
+
+#ifndef SDKCONFIG_H_
+#define SDKCONFIG_H_
+
+#define CONFIG_IDF_TARGET_ESP32 1
+#define CONFIG_OPS_TRACK_ENABLED 1
+#define CONFIG_RAILCOM_CUT_OUT_ENABLED 1
+#define CONFIG_OPS_DCC_PREAMBLE_BITS 16
+#define CONFIG_PROG_DCC_PREAMBLE_BITS 22
+#define CONFIG_PACKET_QUEUE_SIZE 5
+#define CONFIG_DCC_RMT_TICKS_ZERO_PULSE 100
+#define CONFIG_DCC_RMT_TICKS_ONE_PULSE 58
+#define CONFIG_DCC_RMT_CLOCK_SOURCE 1
+#define CONFIG_DCC_RMT_CLOCK_DIVIDER 80
+
+#endif // SDKCONFIG_H_
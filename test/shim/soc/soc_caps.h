@@ -0,0 +1,17 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the ESP-IDF SoC capabilities.
+
+#ifndef SOC_SOC_CAPS_H_
+#define SOC_SOC_CAPS_H_
+
+#define SOC_RMT_CHANNELS_PER_GROUP 8
+#define SOC_RMT_MEM_WORDS_PER_CHANNEL 64
+
+#endif // SOC_SOC_CAPS_H_
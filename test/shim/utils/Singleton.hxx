@@ -0,0 +1,49 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the OpenMRN singleton helper.
+
+#ifndef UTILS_SINGLETON_HXX_
+#define UTILS_SINGLETON_HXX_
+
+#include <utils/macros.h>
+
+/// Registers the single instance of class T while it exists.
+template <class T> class Singleton
+{
+public:
+  Singleton()
+  {
+    HASSERT(!instance_);
+    instance_ = static_cast<T *>(this);
+  }
+
+  ~Singleton()
+  {
+    instance_ = nullptr;
+  }
+
+  /// @return the instance of T.
+  static T *instance()
+  {
+    HASSERT(instance_);
+    return instance_;
+  }
+
+  /// @return true if the instance of T exists.
+  static bool exists()
+  {
+    return instance_ != nullptr;
+  }
+
+private:
+  /// Instance of T.
+  static inline T *instance_ = nullptr;
+};
+
+#endif // UTILS_SINGLETON_HXX_
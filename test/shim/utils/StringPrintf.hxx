@@ -0,0 +1,34 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the OpenMRN printf style string formatting.
+
+#ifndef UTILS_STRINGPRINTF_HXX_
+#define UTILS_STRINGPRINTF_HXX_
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string>
+
+/// @return the formatted string.
+///
+/// @param format is the printf style format.
+inline std::string StringPrintf(const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(nullptr, 0, format, args);
+  va_end(args);
+  std::string result(length, '\0');
+  va_start(args, format);
+  vsnprintf(&result[0], length + 1, format, args);
+  va_end(args);
+  return result;
+}
+
+#endif // UTILS_STRINGPRINTF_HXX_
@@ -0,0 +1,27 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the OpenMRN link-time constants, the values are plain
+// integer constants instead of linker symbols. As with OpenMRN the symbols
+// have C linkage so the namespace of the declaration does not matter.
+
+#ifndef UTILS_CONSTANTS_HXX_
+#define UTILS_CONSTANTS_HXX_
+
+#define DECLARE_CONST(name)                                          \
+  extern "C" const int _sym_##name;                                  \
+  static inline int config_##name(void)                              \
+  {                                                                  \
+    return _sym_##name;                                              \
+  }
+
+#define DEFAULT_CONST(name, value)                                   \
+  extern "C" const int _sym_##name;                                  \
+  const int _sym_##name = value
+
+#endif // UTILS_CONSTANTS_HXX_
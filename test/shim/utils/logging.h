@@ -0,0 +1,39 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the OpenMRN logging macros, messages below WARNING are
+// suppressed to keep the test output readable.
+
+#ifndef UTILS_LOGGING_H_
+#define UTILS_LOGGING_H_
+
+#include <stdio.h>
+
+#define FATAL 0
+#define LEVEL_ERROR 1
+#define WARNING 2
+#define INFO 3
+#define VERBOSE 4
+
+#ifndef LOGLEVEL
+#define LOGLEVEL WARNING
+#endif
+
+#define LOG(level, message...)          \
+  do                                    \
+  {                                     \
+    if ((level) <= LOGLEVEL)            \
+    {                                   \
+      fprintf(stderr, message);         \
+      fprintf(stderr, "\n");            \
+    }                                   \
+  } while (0)
+
+#define LOG_ERROR(message...) LOG(LEVEL_ERROR, message)
+
+#endif // UTILS_LOGGING_H_
@@ -0,0 +1,41 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Host stand-in for the OpenMRN utility macros.
+
+#ifndef UTILS_MACROS_H_
+#define UTILS_MACROS_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define HASSERT(x)                                                   \
+  do                                                                 \
+  {                                                                  \
+    if (!(x))                                                        \
+    {                                                                \
+      fprintf(stderr, "%s:%d: assertion failed: %s\n", __FILE__,    \
+              __LINE__, #x);                                         \
+      abort();                                                       \
+    }                                                                \
+  } while (0)
+
+#define DIE(MSG)                                                     \
+  do                                                                 \
+  {                                                                  \
+    fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, MSG);        \
+    abort();                                                         \
+  } while (0)
+
+#define ARRAYSIZE(a) (sizeof(a) / sizeof(a[0]))
+
+#define DISALLOW_COPY_AND_ASSIGN(TypeName) \
+  TypeName(const TypeName &) = delete;     \
+  void operator=(const TypeName &) = delete
+
+#endif // UTILS_MACROS_H_
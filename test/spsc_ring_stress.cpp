@@ -0,0 +1,281 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Stress test for SpscRing with a producer thread and a simulated RMT ISR
+// thread.
+//
+// The producer and consumer follow the same protocol as RMTTrackDevice: the
+// producer waits for space by stashing a Notifiable (and re-checking the ring
+// afterwards) and the consumer keeps the active slot until it selects the
+// next one, waking the producer once the ring has drained to the low
+// watermark. Each slot carries a sequence number and a payload derived from
+// it so that torn or reused slots are detected by the consumer.
+//
+// Reports the packets/sec through the ring and the worst observed latency
+// between the consumer waking the producer and the producer resuming.
+
+#include "SpscRing.hxx"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <executor/Notifiable.hxx>
+#include <inttypes.h>
+#include <mutex>
+#include <stdio.h>
+#include <thread>
+
+using namespace esp32cs;
+
+namespace
+{
+
+/// Number of slots in the ring, this matches PACKET_Q_SIZE + 1.
+static constexpr size_t RING_SIZE = 6;
+
+/// Number of pending slots at or below which the producer is woken.
+static constexpr size_t LOW_WATERMARK = RING_SIZE / 2;
+
+/// Number of packets to pass through the ring.
+static constexpr uint32_t TEST_PACKETS = 1000000;
+
+/// Maximum time to wait for a wake-up before it is considered lost.
+static constexpr auto WAKE_TIMEOUT = std::chrono::seconds(2);
+
+/// Number of payload words in each slot.
+static constexpr size_t PAYLOAD_WORDS = 16;
+
+using Clock = std::chrono::steady_clock;
+
+/// Slot passed through the ring.
+struct Slot
+{
+  /// Sequence number of the slot.
+  uint32_t seq;
+
+  /// Payload derived from @ref seq.
+  uint32_t payload[PAYLOAD_WORDS];
+};
+
+/// @return the expected payload word for a sequence number.
+///
+/// @param seq is the sequence number of the slot.
+/// @param idx is the index of the payload word.
+uint32_t payload_word(uint32_t seq, size_t idx)
+{
+  return (seq * 2654435761u) ^ (idx * 0x9E3779B9u);
+}
+
+/// Notifiable that blocks the producer thread until it is notified.
+class WakeEvent : public Notifiable
+{
+public:
+  void notify() override
+  {
+    {
+      std::lock_guard<std::mutex> l(lock_);
+      notified_ = true;
+      notifiedAt_ = Clock::now();
+    }
+    cond_.notify_one();
+  }
+
+  /// Waits for @ref notify to be called.
+  ///
+  /// @param latency receives the time from the notification until this
+  /// thread resumed.
+  ///
+  /// @return false if no notification arrived within @ref WAKE_TIMEOUT.
+  bool wait(Clock::duration *latency)
+  {
+    std::unique_lock<std::mutex> l(lock_);
+    if (!cond_.wait_for(l, WAKE_TIMEOUT, [this]() { return notified_; }))
+    {
+      return false;
+    }
+    *latency = Clock::now() - notifiedAt_;
+    notified_ = false;
+    return true;
+  }
+
+private:
+  std::mutex lock_;
+  std::condition_variable cond_;
+  bool notified_{false};
+  Clock::time_point notifiedAt_;
+};
+
+/// Producer and simulated ISR sharing a ring.
+class RingStress
+{
+public:
+  RingStress()
+  {
+    ring_.init(slots_);
+  }
+
+  /// Producer thread body.
+  void producer()
+  {
+    WakeEvent event;
+    for (uint32_t seq = 0; seq < TEST_PACKETS && !failed_.load(); seq++)
+    {
+      Slot *slot;
+      while ((slot = ring_.write_slot()) == nullptr)
+      {
+        waits_++;
+        wait_for_space(&event);
+        Clock::duration latency;
+        if (!event.wait(&latency))
+        {
+          fprintf(stderr, "lost wake-up at seq %" PRIu32 " (pending %zu)\n",
+                  seq, ring_.pending());
+          failed_ = true;
+          return;
+        }
+        if (latency > worstLatency_)
+        {
+          worstLatency_ = latency;
+        }
+        totalLatency_ += latency;
+      }
+      slot->seq = seq;
+      for (size_t idx = 0; idx < PAYLOAD_WORDS; idx++)
+      {
+        slot->payload[idx] = payload_word(seq, idx);
+      }
+      ring_.commit();
+    }
+  }
+
+  /// Simulated RMT ISR thread body, the active slot is kept until the next
+  /// slot is selected as the RMT ISR does while repeating a packet.
+  void consumer()
+  {
+    uint32_t expected = 0;
+    Slot *active = nullptr;
+    while (expected < TEST_PACKETS && !failed_.load())
+    {
+      if (active)
+      {
+        ring_.release();
+        if (ring_.pending() <= LOW_WATERMARK &&
+            notifiable_.load(std::memory_order_relaxed))
+        {
+          Notifiable *n = notifiable_.exchange(nullptr);
+          if (n)
+          {
+            n->notify_from_isr();
+          }
+        }
+      }
+      active = ring_.peek();
+      if (active == nullptr)
+      {
+        // idle packet.
+        idles_++;
+        std::this_thread::yield();
+        continue;
+      }
+      if (active->seq != expected)
+      {
+        fprintf(stderr, "out of order slot: %" PRIu32 " expected %" PRIu32
+                "\n", active->seq, expected);
+        failed_ = true;
+        return;
+      }
+      for (size_t idx = 0; idx < PAYLOAD_WORDS; idx++)
+      {
+        if (active->payload[idx] != payload_word(expected, idx))
+        {
+          fprintf(stderr, "corrupt slot %" PRIu32 " word %zu\n", expected,
+                  idx);
+          failed_ = true;
+          return;
+        }
+      }
+      expected++;
+    }
+    if (active)
+    {
+      ring_.release();
+    }
+    received_ = expected;
+  }
+
+  /// Runs the producer and consumer until all packets have been passed
+  /// through the ring.
+  ///
+  /// @return true if all packets were received intact.
+  bool run()
+  {
+    Clock::time_point start = Clock::now();
+    std::thread isr(&RingStress::consumer, this);
+    std::thread writer(&RingStress::producer, this);
+    writer.join();
+    isr.join();
+    double elapsed =
+      std::chrono::duration<double>(Clock::now() - start).count();
+
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    printf("packets: %" PRIu32 " in %.3f sec (%.0f packets/sec)\n",
+           received_, elapsed, received_ / elapsed);
+    printf("producer waits: %" PRIu32 ", consumer idles: %" PRIu32 "\n",
+           waits_, idles_);
+    printf("wake latency: worst %" PRId64 " usec, mean %.2f usec\n",
+           (int64_t)duration_cast<microseconds>(worstLatency_).count(),
+           waits_ ? std::chrono::duration<double, std::micro>(
+                      totalLatency_).count() / waits_ : 0.0);
+    return !failed_ && received_ == TEST_PACKETS && ring_.pending() == 0;
+  }
+
+private:
+  /// Requests a notification when there is space available in the ring, this
+  /// mirrors RMTTrackDevice::wait_for_space.
+  ///
+  /// @param n is the @ref Notifiable to invoke.
+  void wait_for_space(Notifiable *n)
+  {
+    if (!ring_.available())
+    {
+      n = notifiable_.exchange(n);
+      if (n)
+      {
+        n->notify();
+      }
+      if (ring_.pending() > LOW_WATERMARK)
+      {
+        return;
+      }
+      n = notifiable_.exchange(nullptr);
+    }
+    if (n)
+    {
+      n->notify();
+    }
+  }
+
+  SpscRing<Slot, RING_SIZE> ring_;
+  Slot slots_[RING_SIZE];
+  std::atomic<Notifiable *> notifiable_{nullptr};
+  std::atomic<bool> failed_{false};
+  uint32_t received_{0};
+  uint32_t waits_{0};
+  uint32_t idles_{0};
+  Clock::duration worstLatency_{0};
+  Clock::duration totalLatency_{0};
+};
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  RingStress stress;
+  return stress.run() ? 0 : 1;
+}
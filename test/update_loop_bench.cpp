@@ -0,0 +1,260 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Measures the cost of the PrioritizedUpdateLoop operations as the number of
+// registered packet sources grows from 10 to 2000.
+//
+// The update queues and the source lookup are expected to be O(1) while the
+// background refresh uses a binary heap and is O(log n), the table reports
+// the cost of each operation relative to the smallest source count so the
+// growth can be compared against these bounds. Removing a source only scans
+// the source table when the exclusive source is removed. Time is simulated with one
+// packet every PACKET_USEC so that the refresh of every source is always
+// overdue and each entry() call does real work.
+//
+// The refresh fairness is verified for each source count, timings are only
+// reported.
+
+#include "HostTrack.hxx"
+#include "PrioritizedUpdateLoop.hxx"
+
+#include <dcc/PacketSource.hxx>
+#include <esp_timer.h>
+#include <random>
+#include <stdio.h>
+
+using namespace esp32cs;
+
+namespace
+{
+
+/// Number of registered packet sources to measure.
+static constexpr size_t SOURCE_COUNTS[] = {10, 50, 100, 500, 1000, 2000};
+
+/// Number of operations to time for each measurement.
+static constexpr size_t BENCH_OPS = 200000;
+
+/// Number of remove and add operations to time.
+static constexpr size_t REGISTER_OPS = 20000;
+
+/// Simulated duration of a single DCC packet on the track.
+static constexpr int64_t PACKET_USEC = 5000;
+
+/// Packet source generating a speed packet for a long address.
+class BenchSource : public dcc::PacketSource
+{
+public:
+  BenchSource(unsigned address) : address_(address)
+  {
+  }
+
+  void get_next_packet(unsigned code, dcc::Packet *packet) override
+  {
+    packets++;
+    packet->set_dcc_speed128(dcc::DccLongAddress(address_), true, code);
+  }
+
+  /// Number of packets generated by this source.
+  uint32_t packets{0};
+
+private:
+  /// DCC address of the source.
+  unsigned address_;
+};
+
+/// Track interface which keeps the packets for reuse by the benchmark so
+/// that buffer allocation is not part of the measurements.
+class BenchTrack : public dcc::TrackIf
+{
+public:
+  ~BenchTrack()
+  {
+    for (auto *buffer : free_)
+    {
+      buffer->unref();
+    }
+  }
+
+  void send(Buffer<dcc::Packet> *message, unsigned priority) override
+  {
+    if (message->data()->dlc == 3 && message->data()->payload[0] == 0xFF)
+    {
+      idles++;
+    }
+    free_.push_back(message);
+  }
+
+  /// @return a buffer to pass to the update loop.
+  Buffer<dcc::Packet> *buffer()
+  {
+    if (free_.empty())
+    {
+      return new Buffer<dcc::Packet>();
+    }
+    Buffer<dcc::Packet> *buffer = free_.back();
+    free_.pop_back();
+    return buffer;
+  }
+
+  /// Number of idle packets received.
+  uint32_t idles{0};
+
+private:
+  /// Buffers available for reuse.
+  std::vector<Buffer<dcc::Packet> *> free_;
+};
+
+/// Measured cost of the update loop operations, in nanoseconds per call.
+struct BenchResult
+{
+  double add;
+  double notify;
+  double update;
+  double refresh;
+};
+
+/// Runs the update loop with a number of packet sources.
+///
+/// @param count is the number of packet sources to register.
+/// @param result receives the measurements.
+///
+/// @return true if every packet source was refreshed evenly.
+bool run(size_t count, BenchResult *result)
+{
+  Service service;
+  BenchTrack track;
+  PrioritizedUpdateLoop loop(&service, &track);
+  std::vector<BenchSource> sources;
+  std::mt19937 rng(count);
+  sources.reserve(count);
+  for (size_t idx = 0; idx < count; idx++)
+  {
+    sources.emplace_back(idx + 1);
+  }
+  host_esp_timer::simulated_usec = 1000000;
+
+  for (auto &source : sources)
+  {
+    loop.add_refresh_source(&source, 0);
+  }
+
+  // re-registration of random sources, this leaves the sources in a
+  // different order in the refresh heap.
+  uint64_t start = host_nsec();
+  for (size_t idx = 0; idx < REGISTER_OPS; idx++)
+  {
+    BenchSource *source = &sources[rng() % count];
+    loop.remove_refresh_source(source);
+    loop.add_refresh_source(source, 0);
+  }
+  result->add = (double)(host_nsec() - start) / REGISTER_OPS;
+  for (auto &source : sources)
+  {
+    source.packets = 0;
+  }
+
+  // background refresh only, every source must be refreshed once per round.
+  uint64_t elapsed = 0;
+  size_t rounds = 0;
+  bool fair = true;
+  while (rounds * count < BENCH_OPS || rounds < 2)
+  {
+    start = host_nsec();
+    for (size_t idx = 0; idx < count; idx++)
+    {
+      host_esp_timer::simulated_usec += PACKET_USEC;
+      loop.send(track.buffer());
+    }
+    elapsed += host_nsec() - start;
+    rounds++;
+    for (auto &source : sources)
+    {
+      fair &= source.packets == rounds;
+    }
+  }
+  result->refresh = (double)elapsed / (rounds * count);
+  fair &= track.idles == 0;
+  if (!fair)
+  {
+    fprintf(stderr, "%zu sources: uneven refresh after %zu rounds (%u idle)\n",
+            count, rounds, track.idles);
+  }
+
+  // speed and function updates for random sources, the notifications and
+  // the packets sent for them are timed separately.
+  const size_t BATCH = 64;
+  uint64_t notifyNsec = 0;
+  uint64_t updateNsec = 0;
+  dcc::PacketSource *batch[BATCH];
+  for (size_t done = 0; done < BENCH_OPS; done += BATCH)
+  {
+    for (size_t idx = 0; idx < BATCH; idx++)
+    {
+      batch[idx] = &sources[rng() % count];
+    }
+    start = host_nsec();
+    for (size_t idx = 0; idx < BATCH; idx++)
+    {
+      loop.notify_update(batch[idx],
+                         idx & 1 ? dcc::DccTrainUpdateCode::SPEED
+                                 : dcc::DccTrainUpdateCode::FUNCTION0);
+    }
+    uint64_t now = host_nsec();
+    notifyNsec += now - start;
+    for (size_t idx = 0; idx < BATCH; idx++)
+    {
+      host_esp_timer::simulated_usec += PACKET_USEC;
+      loop.send(track.buffer());
+    }
+    updateNsec += host_nsec() - now;
+  }
+  result->notify = (double)notifyNsec / BENCH_OPS;
+  result->update = (double)updateNsec / BENCH_OPS;
+
+  PrioritizedUpdateLoop::Stats stats;
+  loop.get_stats(&stats);
+  fair &= stats.sources == count;
+
+  for (auto &source : sources)
+  {
+    loop.remove_refresh_source(&source);
+  }
+  host_esp_timer::simulated_usec = -1;
+  return fair;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  BenchResult base{};
+  unsigned failures = 0;
+  // warm up the allocator so the first measurement is not skewed.
+  run(SOURCE_COUNTS[0], &base);
+  printf("%8s %14s %14s %14s %14s\n", "sources", "remove+add", "notify_update",
+         "entry(update)", "entry(refresh)");
+  for (size_t count : SOURCE_COUNTS)
+  {
+    BenchResult result;
+    if (!run(count, &result))
+    {
+      failures++;
+    }
+    if (count == SOURCE_COUNTS[0])
+    {
+      base = result;
+    }
+    printf("%8zu %8.1f %5.2fx %8.1f %5.2fx %8.1f %5.2fx %8.1f %5.2fx\n",
+           count, result.add, result.add / base.add, result.notify,
+           result.notify / base.notify, result.update,
+           result.update / base.update, result.refresh,
+           result.refresh / base.refresh);
+  }
+  printf("(nsec per call and relative to %zu sources)\n", SOURCE_COUNTS[0]);
+  return failures ? 1 : 0;
+}
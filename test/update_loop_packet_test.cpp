@@ -0,0 +1,189 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This file is part of ESP32 Command Station.
+ */
+
+// Verifies that pre-built packets queued with
+// PrioritizedUpdateLoop::send_packet reach the track interface for every
+// traffic class, including speed and function packets which share their
+// class with the packet source updates.
+
+#include "DccPacketClass.hxx"
+#include "HostTrack.hxx"
+#include "PrioritizedUpdateLoop.hxx"
+
+#include <dcc/PacketSource.hxx>
+#include <esp_timer.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+using namespace esp32cs;
+
+namespace
+{
+
+/// Number of failed checks.
+unsigned failures = 0;
+
+/// Records a failed check.
+#define CHECK(x)                                                     \
+  do                                                                 \
+  {                                                                  \
+    if (!(x))                                                        \
+    {                                                                \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,        \
+              __LINE__, #x);                                         \
+      failures++;                                                    \
+    }                                                                \
+  } while (0)
+
+/// Simulated duration of a single DCC packet on the track.
+static constexpr int64_t PACKET_USEC = 5000;
+
+/// Packet source generating a speed packet for a short address.
+class TestSource : public dcc::PacketSource
+{
+public:
+  TestSource(unsigned address) : address_(address)
+  {
+  }
+
+  void get_next_packet(unsigned code, dcc::Packet *packet) override
+  {
+    packet->set_dcc_speed128(dcc::DccShortAddress(address_), true, 1);
+  }
+
+private:
+  /// DCC address of the source.
+  unsigned address_;
+};
+
+/// Track interface which records the packets it receives.
+class TestTrack : public dcc::TrackIf
+{
+public:
+  void send(Buffer<dcc::Packet> *message, unsigned priority) override
+  {
+    packets.push_back(*message->data());
+    message->unref();
+  }
+
+  /// @return the number of received packets matching a packet.
+  ///
+  /// @param packet is the packet to look for.
+  size_t count(const dcc::Packet &packet)
+  {
+    size_t matches = 0;
+    for (auto &sent : packets)
+    {
+      if (sent.dlc == packet.dlc &&
+          !memcmp(sent.payload, packet.payload, packet.dlc))
+      {
+        matches++;
+      }
+    }
+    return matches;
+  }
+
+  /// Packets received from the update loop.
+  std::vector<dcc::Packet> packets;
+};
+
+/// Queues a copy of a packet with the update loop.
+///
+/// @param loop is the update loop.
+/// @param packet is the packet to queue.
+void send_packet(PrioritizedUpdateLoop *loop, const dcc::Packet &packet)
+{
+  Buffer<dcc::Packet> *buffer = new Buffer<dcc::Packet>();
+  *buffer->data() = packet;
+  loop->send_packet(buffer);
+}
+
+/// Runs the update loop for a number of packets.
+///
+/// @param loop is the update loop.
+/// @param count is the number of packets to generate.
+void run(PrioritizedUpdateLoop *loop, size_t count)
+{
+  for (size_t idx = 0; idx < count; idx++)
+  {
+    host_esp_timer::simulated_usec += PACKET_USEC;
+    loop->send(new Buffer<dcc::Packet>());
+  }
+}
+
+void test_prebuilt_packets()
+{
+  Service service;
+  TestTrack track;
+  PrioritizedUpdateLoop loop(&service, &track);
+  host_esp_timer::simulated_usec = 1000000;
+
+  dcc::Packet speed;
+  speed.set_dcc_speed128(dcc::DccShortAddress(3), true, 10);
+  dcc::Packet function;
+  function.start_dcc_packet();
+  function.add_dcc_address(dcc::DccLongAddress(1234));
+  function.add_dcc_function0_4(0x1F);
+  dcc::Packet pom;
+  pom.start_dcc_packet();
+  pom.add_dcc_address(dcc::DccLongAddress(1234));
+  pom.add_dcc_pom_write1(29, 6);
+
+  // without any packet sources the pre-built packets are the only traffic.
+  send_packet(&loop, speed);
+  send_packet(&loop, function);
+  send_packet(&loop, pom);
+  run(&loop, 3);
+  CHECK(track.count(speed) == 1);
+  CHECK(track.count(function) == 1);
+  CHECK(track.count(pom) == 1);
+
+  // the queues are drained, only idle packets follow.
+  track.packets.clear();
+  run(&loop, 3);
+  CHECK(track.count(speed) == 0);
+  CHECK(track.count(function) == 0);
+  CHECK(track.packets.size() == 3);
+
+  // with pending packet source updates in the same traffic classes.
+  TestSource source(5);
+  loop.add_refresh_source(&source, 0);
+  track.packets.clear();
+  loop.notify_update(&source, dcc::DccTrainUpdateCode::SPEED);
+  loop.notify_update(&source, dcc::DccTrainUpdateCode::FUNCTION0);
+  send_packet(&loop, speed);
+  send_packet(&loop, function);
+  run(&loop, 16);
+  CHECK(track.count(speed) == 1);
+  CHECK(track.count(function) == 1);
+
+  // every queued packet was sent, the depth returns to zero between sends.
+  PrioritizedUpdateLoop::Stats stats;
+  loop.get_stats(&stats);
+  CHECK(stats.packet_queue_high_water == 3);
+  for (size_t idx = 0; idx < 8; idx++)
+  {
+    send_packet(&loop, speed);
+    run(&loop, 2);
+  }
+  loop.get_stats(&stats);
+  CHECK(stats.packet_queue_high_water == 3);
+
+  loop.remove_refresh_source(&source);
+  host_esp_timer::simulated_usec = -1;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  test_prebuilt_packets();
+  printf("%u failures\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+#
+# SPDX-FileCopyrightText: 2022 Mike Dunston (atanisoft)
+#
+# SPDX-License-Identifier: GPL-3.0
+#
+# This file is part of ESP32 Command Station.
+#
+# Decodes the DCC packet trace downloaded from the /dcc/trace URI of the
+# command station web server.
+#
+# Usage:
+#   dcc_trace.py trace.bin
+#   dcc_trace.py http://192.168.4.1/dcc/trace?district=0
+#   dcc_trace.py trace.bin --address 3 --class speed
+#   dcc_trace.py trace.bin --address L3
+#
+# Long (14-bit) decoder addresses are shown with an "L" prefix, short address
+# 3 and long address 3 are different decoders.
+
+import argparse
+import struct
+import sys
+import urllib.request
+
+HEADER = struct.Struct('<4sBBBBI')
+RECORD = struct.Struct('<II6sBBBBBB')
+MAGIC = b'DCCT'
+FORMAT_VERSION = 1
+FLAG_SUPERSEDED = 0x01
+
+# matches esp32cs::DCC_LONG_ADDRESS_FLAG
+LONG_ADDRESS_FLAG = 0x8000
+
+# matches esp32cs::DccPacketClass
+PACKET_CLASSES = ['other', 'speed', 'f0-f4', 'f5-f8', 'f9-f12', 'f13-f20',
+                  'f21-f28']
+
+
+def packet_address(payload, dlc):
+    """Returns the multi-function decoder address of the packet or None.
+
+    Long addresses have LONG_ADDRESS_FLAG set, matching the address used in
+    the feedback key (esp32cs::dcc_packet_address).
+    """
+    if dlc < 2:
+        return None
+    if 1 <= payload[0] <= 127:
+        return payload[0]
+    if 192 <= payload[0] <= 231:
+        return LONG_ADDRESS_FLAG | ((payload[0] & 0x3F) << 8) | payload[1]
+    return None
+
+
+def format_address(address):
+    """Returns the printable form of an address from packet_address()."""
+    if address is None:
+        return '-'
+    if address & LONG_ADDRESS_FLAG:
+        return 'L%d' % (address & ~LONG_ADDRESS_FLAG)
+    return str(address)
+
+
+def parse_address(value):
+    """Parses an --address argument, "L<n>" selects long address n and
+    addresses above 127 are always long."""
+    is_long = value[:1] in ('L', 'l')
+    try:
+        address = int(value[1:] if is_long else value)
+    except ValueError:
+        raise argparse.ArgumentTypeError('invalid address: %s' % value)
+    if is_long or address > 127:
+        return LONG_ADDRESS_FLAG | address
+    return address
+
+
+def load(source):
+    """Loads the raw trace from a file or URL."""
+    if source.startswith('http://') or source.startswith('https://'):
+        with urllib.request.urlopen(source) as response:
+            return response.read()
+    with open(source, 'rb') as trace:
+        return trace.read()
+
+
+def decode(data):
+    """Yields (district, record dict) for each record in the trace."""
+    if len(data) < HEADER.size:
+        raise ValueError('trace is too short')
+    magic, version, record_size, district, _, count = \
+        HEADER.unpack_from(data, 0)
+    if magic != MAGIC:
+        raise ValueError('not a DCC trace (bad magic)')
+    if version != FORMAT_VERSION or record_size != RECORD.size:
+        raise ValueError('unsupported trace format v%d (%d byte records)'
+                         % (version, record_size))
+    if len(data) < HEADER.size + count * RECORD.size:
+        raise ValueError('trace is truncated')
+    for idx in range(count):
+        (timestamp, feedback_key, payload, dlc, repeat, preamble, pkt_class,
+         flags, _) = RECORD.unpack_from(data, HEADER.size + idx * RECORD.size)
+        yield district, {
+            'timestamp': timestamp,
+            'feedback_key': feedback_key,
+            'payload': payload[:min(dlc, len(payload))],
+            'dlc': dlc,
+            'repeat': repeat,
+            'preamble': preamble,
+            'class': PACKET_CLASSES[pkt_class]
+                     if pkt_class < len(PACKET_CLASSES) else str(pkt_class),
+            'superseded': bool(flags & FLAG_SUPERSEDED),
+            'address': packet_address(payload, dlc),
+        }
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode a DCC packet trace.')
+    parser.add_argument('source', help='trace file or /dcc/trace URL')
+    parser.add_argument('--address', type=parse_address,
+                        help='only show packets for this decoder address, '
+                             'use L<n> for long address n')
+    parser.add_argument('--class', dest='pkt_class', choices=PACKET_CLASSES,
+                        help='only show packets of this class')
+    args = parser.parse_args()
+
+    try:
+        records = list(decode(load(args.source)))
+    except (OSError, ValueError) as err:
+        print('error: %s' % err, file=sys.stderr)
+        return 1
+
+    previous = None
+    for district, record in records:
+        if args.address is not None and record['address'] != args.address:
+            continue
+        if args.pkt_class and record['class'] != args.pkt_class:
+            continue
+        # timestamps are 32-bit microsecond counters and will wrap.
+        delta = 0 if previous is None else \
+            (record['timestamp'] - previous) & 0xFFFFFFFF
+        previous = record['timestamp']
+        payload = ' '.join('%02X' % b for b in record['payload'])
+        if record['dlc'] > len(record['payload']):
+            payload += ' ...'
+        address = format_address(record['address'])
+        print('%d %10u +%8uus addr:%-5s %-7s rpt:%d pre:%d key:%08X%s  %s'
+              % (district, record['timestamp'], delta, address,
+                 record['class'], record['repeat'], record['preamble'],
+                 record['feedback_key'],
+                 ' (superseded)' if record['superseded'] else '', payload))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())